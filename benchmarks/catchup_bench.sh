@@ -0,0 +1,222 @@
+define(){ IFS='\n' read -r -d '' ${1} || true; }
+declare -A pids
+declare -A rounds
+redirection=( "> out" "2> err" "< /dev/null" )
+
+define HELP <<'EOF'
+Script for checking that a paused follower catches up from stable storage
+usage  : $0 [options]
+options: --app                # app to run
+         --pause              # time the follower is paused (seconds)
+EOF
+
+usage () {
+    echo -e "$HELP"
+}
+
+timer_start () {
+	echo "$1"
+	t1=$(date +%s%N)
+}
+
+timer_stop () {
+	t2=$(date +%s%N)
+	echo "done ($(expr $t2 - $t1) nanoseconds)"
+}
+
+ErrorAndExit () {
+  echo "ERROR: $1"
+  exit 1
+}
+
+ForceAbsolutePath () {
+  case "$2" in
+    /* )
+      ;;
+    *)
+      ErrorAndExit "Expected an absolute path for $1"
+      ;;
+  esac
+}
+
+StartDare() {
+    for ((i=0; i<${group_size}; ++i)); do
+        srv=${servers[$i]}
+        config_dare=( "server_type=start" "server_idx=$i" "group_size=$group_size" "config_path=${DAREDIR}/target/nodes.local.cfg" "dare_log_file=$PWD/srv${i}_1.log" "mgid=$DGID" "LD_PRELOAD=${DAREDIR}/target/interpose.so" )
+        cmd=( "ssh" "$USER@${servers[$i]}" "${config_dare[@]}" "nohup" "${run_dare}" "${redirection[@]}" "&" "echo \$!" )
+        pids[$srv]=$("${cmd[@]}")
+        rounds[$srv]=2
+        #echo "StartDare COMMAND: "${cmd[@]}
+        echo -e "\tp$i ($srv) -- pid=${pids[$srv]}"
+        #echo -e enable interpretation of backslash escapes
+    done
+    #echo -e "\n\tinitial servers: ${!servers[]}${!pids[@]}"
+    #echo -e "\t...and their PIDs: ${pids[@]}"
+}
+
+StopDare() {
+    for srv in "${!pids[@]}"; do 
+        #${!pids[@]}: expand to the list of array indices (keys) assigned in pids
+        cmd=( "ssh" "$USER@$srv" "kill -2" "${pids[$srv]}" )
+        echo "Executing: ${cmd[@]}"
+        $("${cmd[@]}")
+    done
+}
+
+FindLeader() {
+    leader=""
+    max_idx=-1
+    max_term=""
+ 
+    for ((i=0; i<${group_size}; ++i)); do
+        srv=${servers[$i]}
+        # look for the latest [T<term>] LEADER 
+        cmd=( "ssh" "$USER@$srv" "grep -r \"] LEADER\"" "$PWD/srv${i}_$((rounds[$srv]-1)).log" )
+        #echo ${cmd[@]}
+        grep_out=$("${cmd[@]}")
+        if [[ -z $grep_out ]]; then
+            continue
+        fi
+        terms=($(echo $grep_out | awk '{print $2}'))
+        for j in "${terms[@]}"; do
+           term=`echo $j | awk -F'T' '{print $2}' | awk -F']' '{print $1}'`
+           if [[ $term -gt $max_term ]]; then 
+                max_term=$term
+                leader=$srv
+                leader_idx=$i
+           fi
+        done
+    done
+    echo "Leader: p${leader_idx} ($leader)"
+}
+
+# Pause (SIGSTOP) a server that is not the leader
+PauseServer() {
+    FindLeader
+    for ((i=0; i<${group_size}; ++i)); do
+        srv=${servers[$i]}
+        if [[ "x$srv" == "x$leader" ]]; then
+            continue
+        fi
+        cmd=( "ssh" "$USER@$srv" "kill -STOP" "${pids[$srv]}" )
+        $("${cmd[@]}")
+        paused=$srv
+        paused_idx=$i
+        echo -e "\tpaused p$i ($srv) -- p$leader_idx is the leader"
+        break
+    done
+}
+
+ResumeServer() {
+    cmd=( "ssh" "$USER@$paused" "kill -CONT" "${pids[$paused]}" )
+    $("${cmd[@]}")
+    echo -e "\tresumed p$paused_idx ($paused)"
+}
+
+# The paused server must catch up without leaving the group
+CheckCatchup() {
+    cmd=( "ssh" "$USER@$paused" "grep -c \"CATCH-UP DONE\"" "$PWD/srv${paused_idx}_1.log" )
+    done_count=$("${cmd[@]}")
+    cmd=( "ssh" "$USER@$leader" "grep -c \"REMOVE SERVER\"" "$PWD/srv${leader_idx}_1.log" )
+    rm_count=$("${cmd[@]}")
+    if [[ -z $done_count || $done_count -eq 0 ]]; then
+        StopDare
+        ErrorAndExit "p$paused_idx did not catch up"
+    fi
+    if [[ -n $rm_count && $rm_count -ne 0 ]]; then
+        StopDare
+        ErrorAndExit "p$paused_idx was removed from the group"
+    fi
+    echo -e "\tp$paused_idx caught up ($done_count times) without a CONFIG change"
+}
+
+port=8888
+StartBenchmark() {
+    if [[ "$APP" == "ssdb" ]]; then
+        run_loop=( "${DAREDIR}/apps/ssdb/ssdb-master/tools/ssdb-bench" "$leader" "$port" "$request_count" "$client_count")
+    elif [[ "$APP" == "redis" ]]; then
+        run_loop=( "${DAREDIR}/apps/redis/install/bin/redis-benchmark" "-t set,get" "-h $leader" "-p $port" "-n $request_count" "-c $client_count")
+    fi
+    rounds[$client]=$((rounds[$client] + 1))
+    cmd=( "ssh" "$USER@${client}" "${run_loop[@]}" ">" "clt_${rounds[$client]}.log")
+    $("${cmd[@]}")
+}
+
+DAREDIR=$PWD/..
+APP=""
+client_count=1
+request_count=1000000
+pause_time=30
+for arg in "$@"
+do
+    case ${arg} in
+    --help|-help|-h)
+        usage
+        exit 1
+        ;;
+    --op=*)
+        OPCODE=`echo $arg | sed -e 's/--op=//'`
+        OPCODE=`eval echo ${OPCODE}`    # tilde and variable expansion
+        ;;
+    --pause=*)
+        pause_time=`echo $arg | sed -e 's/--pause=//'`
+        ;;
+    --app=*)
+        APP=`echo $arg | sed -e 's/--app=//'`
+        APP=`eval echo ${APP}`    # tilde and variable expansion
+        ;;
+    esac
+done
+
+if [[ "x$APP" == "x" ]]; then
+    ErrorAndExit "No app defined: --app"
+elif [[ "$APP" == "ssdb" ]]; then
+    run_dare="${DAREDIR}/apps/ssdb/ssdb-master/ssdb-server ${DAREDIR}/apps/ssdb/ssdb-master/ssdb.conf"
+elif [[ "$APP" == "redis" ]]; then
+    run_dare="${DAREDIR}/apps/redis/install/bin/redis-server --port $port"
+fi
+
+# list of allocated nodes, e.g., nodes=(n112002 n112001 n111902)
+nodes=(10.22.1.3 10.22.1.4 10.22.1.5 10.22.1.6 10.22.1.7 10.22.1.8 10.22.1.9 202.45.128.159)
+node_count=${#nodes[@]}
+
+echo "Allocated ${node_count} nodes:" > nodes
+for ((i=0; i<${node_count}; ++i)); do
+    echo "$i:${nodes[$i]}" >> nodes
+done
+group_size=5
+
+client=${nodes[-2]}
+echo ">>> client: ${client}"
+
+for ((i=0; i<$node_count; ++i)); do
+    servers[${i}]=${nodes[$i]}
+done
+echo ">>> $(($node_count)) servers: ${servers[@]}"
+
+DGID="ff0e::ffff:e101:101"
+
+rm -f *.log
+
+########################################################################
+
+echo -e "Starting $group_size servers..."
+StartDare
+echo "done"
+sleep 2.5
+FindLeader
+
+# Keep the log under load while a follower is paused
+StartBenchmark &
+bench_pid=$!
+sleep 1
+
+echo -e "Pausing a server (non-leader) for ${pause_time}s..."
+PauseServer
+sleep $pause_time
+ResumeServer
+wait $bench_pid
+
+sleep 2
+CheckCatchup
+StopDare
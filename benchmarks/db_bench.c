@@ -0,0 +1,213 @@
+/*
+ * Stable storage benchmark: runs the same workload against every
+ * backend (mem, file, file with compressed segments, bdb), so that 
+ * the numbers are comparable.
+ *
+ * The "set" workload stores Redis SET commands (RESP) with record_size
+ * byte values, as the proxy does for a Redis server.
+ *
+ * build: gcc -O2 -std=gnu99 -o db_bench db_bench.c ../src/db/db-*.c ../src/util/crc32c.c ../src/util/lz.c -ldb -lpthread
+ * usage: db_bench [records] [record_size] [sync] [dir] [fixed|set] [segment_MB]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include "../src/include/db/db-interface.h"
+
+#define CHUNK_SIZE (128*4096)
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* backend, const char* op, uint64_t records,
+                   uint64_t bytes, double t)
+{
+    printf("%-7s %-12s %10.0lf records/s %10.2lf MB/s\n", backend, op,
+           records / t, bytes / t / 1e6);
+}
+
+/* A Redis SET command; the values are words from a small vocabulary,
+so that they compress about as well as text */
+static uint32_t make_set(uint8_t* rec, uint32_t value_size, uint64_t i)
+{
+    static const char* words[] = {"user", "session", "42", "cart",
+        "item", "price", "ok", "null", "true", "id", "2016", "name"};
+    char value[value_size + 16];
+    uint32_t len = 0, n;
+    uint64_t x = i * 0x9E3779B97F4A7C15ULL;
+    while (len < value_size) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        n = snprintf(value + len, sizeof(value) - len, "%s:",
+                     words[x % (sizeof(words)/sizeof(words[0]))]);
+        len += n;
+    }
+    return sprintf((char*)rec, "*3\r\n$3\r\nSET\r\n$16\r\nkey:%012"PRIu64"\r\n$%"PRIu32"\r\n%.*s\r\n",
+                   i % 1000000, value_size, (int)value_size, value);
+}
+
+/* Size of the files of the backend */
+static uint64_t disk_usage(const char* name)
+{
+    char pattern[300];
+    struct stat st;
+    glob_t g;
+    uint64_t total = 0;
+    size_t i;
+    snprintf(pattern, sizeof(pattern), "%s*", name);
+    if (glob(pattern, 0, NULL, &g) != 0) {
+        return 0;
+    }
+    for (i = 0; i < g.gl_pathc; i++) {
+        if (stat(g.gl_pathv[i], &st) == 0) {
+            total += st.st_size;
+        }
+    }
+    globfree(&g);
+    return total;
+}
+
+int main(int argc, char** argv)
+{
+    const char* backends[] = {"mem", "file", "file+lz", "bdb"};
+    uint64_t records = 100000;
+    uint32_t record_size = 64;
+    const char* dir = "/tmp";
+    const char* workload = "fixed";
+    uint64_t segment_size = 16 * 1024 * 1024;
+    uint64_t disk;
+    db_config cfg;
+    char name[256], path[600];
+    void **batch;
+    uint32_t *sizes, rec_cap;
+    uint64_t i, last_idx, from_idx, count;
+    uint32_t len;
+    uint8_t *rec, *recs, *buf;
+    double t;
+    db* db_p;
+    int b;
+
+    db_config_default(&cfg);
+    if (argc > 1) records = strtoull(argv[1], NULL, 10);
+    if (argc > 2) record_size = strtoul(argv[2], NULL, 10);
+    if (argc > 3) cfg.sync = atoi(argv[3]);
+    if (argc > 4) dir = argv[4];
+    if (argc > 5) workload = argv[5];
+    if (argc > 6) segment_size = strtoull(argv[6], NULL, 10) * 1024 * 1024;
+    /* Room for the RESP framing of the set workload */
+    rec_cap = record_size + 64;
+    /* Large enough for both runs, so that nothing is dropped */
+    cfg.mem_size = 4 * records * (rec_cap + 64);
+
+    rec = malloc(rec_cap);
+    recs = malloc(records * rec_cap);
+    buf = malloc(cfg.mem_size > CHUNK_SIZE ? cfg.mem_size : CHUNK_SIZE);
+    batch = malloc(records * sizeof(void*));
+    sizes = malloc(records * sizeof(uint32_t));
+    if (!rec || !recs || !buf || !batch || !sizes) {
+        fprintf(stderr, "Cannot allocate buffers\n");
+        return 1;
+    }
+    memset(rec, 0xAB, record_size);
+    for (i = 0; i < records; i++) {
+        batch[i] = recs + i * rec_cap;
+        if (0 == strcmp(workload, "set")) {
+            sizes[i] = make_set(batch[i], record_size, records + i);
+        } else {
+            memset(batch[i], 0xAB, record_size);
+            sizes[i] = record_size;
+        }
+    }
+
+    printf("%"PRIu64" records of %"PRIu32" bytes (%s); sync=%d\n",
+           records, record_size, workload, cfg.sync);
+    for (b = 0; b < sizeof(backends)/sizeof(backends[0]); b++) {
+        if (0 == strcmp(backends[b], "file+lz")) {
+            strcpy(cfg.backend, "file");
+            cfg.segment_size = segment_size;
+        } else {
+            strcpy(cfg.backend, backends[b]);
+            cfg.segment_size = 0;
+        }
+        snprintf(name, sizeof(name), "%s/db_bench_%s", dir, backends[b]);
+        snprintf(path, sizeof(path), "rm -f %s %s.*", name, name);
+        if (system(path) != 0) {
+            printf("%-7s cannot remove the old files\n", backends[b]);
+        }
+
+        db_p = initialize_db(name, &cfg, 0);
+        if (NULL == db_p) {
+            printf("%-7s cannot open\n", backends[b]);
+            continue;
+        }
+
+        /* One record at a time, indexed by log idx */
+        t = now_sec();
+        count = 0;
+        for (i = 1; i <= records; i++) {
+            if (0 == strcmp(workload, "set")) {
+                len = make_set(rec, record_size, i);
+            } else {
+                rec[0] = (uint8_t)i;
+                len = record_size;
+            }
+            store_record(db_p, i, len, rec);
+            count += len;
+        }
+        report(backends[b], "store", records, count, now_sec() - t);
+
+        /* One batch */
+        t = now_sec();
+        store_records(db_p, records, batch, sizes, NULL);
+        report(backends[b], "store batch", records, get_records_len(db_p) - count, now_sec() - t);
+
+        /* Wait for the sealed segments to be compressed */
+        t = now_sec();
+        if (0 == compact_db(db_p)) {
+            report(backends[b], "compact", get_records_count(db_p),
+                   get_records_len(db_p), now_sec() - t);
+        }
+        disk = disk_usage(name);
+        if (disk) {
+            printf("%-7s %-12s %10"PRIu64" bytes    %10.2lf x\n", backends[b], "on disk",
+                   disk, (double)get_records_len(db_p) / disk);
+        }
+
+        /* Snapshot */
+        t = now_sec();
+        dump_records(db_p, buf);
+        report(backends[b], "dump", get_records_count(db_p),
+               get_records_len(db_p), now_sec() - t);
+
+        /* Catch-up chunks */
+        t = now_sec();
+        count = 0;
+        for (from_idx = 1; from_idx <= records; from_idx = last_idx + 1) {
+            len = dump_records_from(db_p, from_idx, records + 1, buf,
+                                    CHUNK_SIZE, &last_idx);
+            if (0 == last_idx || (0 == len && last_idx < from_idx)) {
+                printf("%-7s cannot read from idx=%"PRIu64"\n", backends[b], from_idx);
+                break;
+            }
+            count += len;
+        }
+        report(backends[b], "dump from", records, count, now_sec() - t);
+
+        close_db(db_p, 0);
+    }
+    free(rec);
+    free(recs);
+    free(buf);
+    free(batch);
+    free(sizes);
+    return 0;
+}
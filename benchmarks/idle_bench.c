@@ -0,0 +1,176 @@
+/*
+ * Idle mode microbenchmark: a server thread waits for requests as the
+ * DARE thread does, either busy-polling all the time or in idle mode,
+ * i.e., busy-polling until it has no activity for idle_timeout and then
+ * sleeping in epoll (the backend of the EV loop) until either the client
+ * kicks an eventfd (as the proxy threads, see dare_kick) or a periodic
+ * timer expires (as a follower, which sees the leader's one-sided writes
+ * only by checking its log every idle_poll_period). It reports the CPU
+ * usage of the server thread during one second without requests and the latency of the
+ * first request after an idle period.
+ *
+ * build: gcc -O2 -std=gnu99 -o idle_bench idle_bench.c -lpthread
+ * usage: idle_bench [idle_timeout_ms] [idle_poll_period_us] [rounds]
+ *        idle_bench 10 1000 20
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define MODE_BUSY   0   /* always busy-poll */
+#define MODE_KICK   1   /* idle mode, woken up by the eventfd */
+#define MODE_TICK   2   /* idle mode, woken up by the timer only */
+
+static volatile uint64_t req;       /* last request (client) */
+static volatile uint64_t ack;       /* last request seen (server) */
+static volatile int sleeping;
+static volatile int stop;
+static int mode;
+static int kick_fd, ep_fd;
+static double idle_timeout = 0.01;
+static int poll_period_us = 1000;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* CPU time of a thread */
+static double thread_cpu(pthread_t thread)
+{
+    struct timespec ts;
+    clockid_t cid;
+
+    if (pthread_getcpuclockid(thread, &cid)) return 0;
+    clock_gettime(cid, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* server(void *arg)
+{
+    struct epoll_event ev;
+    double active_ts = now_sec();
+    uint64_t count;
+    int timeout;
+
+    while (!stop) {
+        if (req != ack) {
+            ack = req;
+            active_ts = now_sec();
+            continue;
+        }
+        if ( (MODE_BUSY == mode) || (now_sec() - active_ts < idle_timeout) ) {
+            continue;
+        }
+        /* Sleep; the client either sees the flag or the check sees
+        the request (see enter_idle_mode) */
+        sleeping = 1;
+        __sync_synchronize();
+        while ( (req == ack) && !stop ) {
+            /* epoll_wait has a millisecond granularity, as ev_io */
+            timeout = (poll_period_us + 999) / 1000;
+            if (epoll_wait(ep_fd, &ev, 1, timeout) > 0) {
+                if (read(kick_fd, &count, sizeof(count))) {}
+            }
+        }
+        sleeping = 0;
+    }
+    return NULL;
+}
+
+static void kick()
+{
+    uint64_t one = 1;
+
+    __sync_synchronize();
+    if ( (MODE_KICK != mode) || !sleeping ) return;
+    if (write(kick_fd, &one, sizeof(one))) {}
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv)
+{
+    const char *names[3] = {"busy-poll", "idle (kick)", "idle (timer)"};
+    struct epoll_event ev;
+    pthread_t thread;
+    double idle_sec, t, cpu, *lat;
+    int rounds = 20, i;
+
+    if (argc > 1) idle_timeout = atof(argv[1]) / 1e3;
+    if (argc > 2) poll_period_us = atoi(argv[2]);
+    if (argc > 3) rounds = atoi(argv[3]);
+    if (rounds < 1) rounds = 1;
+    idle_sec = 1;
+
+    kick_fd = eventfd(0, EFD_NONBLOCK);
+    ep_fd = epoll_create1(0);
+    if ( (kick_fd < 0) || (ep_fd < 0) ) {
+        fprintf(stderr, "Cannot create eventfd / epoll\n");
+        return 1;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, kick_fd, &ev)) {
+        fprintf(stderr, "Cannot add eventfd to epoll\n");
+        return 1;
+    }
+    lat = malloc(rounds * sizeof(double));
+    if (NULL == lat) {
+        fprintf(stderr, "Cannot allocate latencies\n");
+        return 1;
+    }
+    printf("idle_timeout %.1lf ms; idle_poll_period %d us; %d rounds\n",
+           idle_timeout * 1e3, poll_period_us, rounds);
+
+    for (mode = MODE_BUSY; mode <= MODE_TICK; mode++) {
+        stop = 0;
+        req = ack = 0;
+        if (pthread_create(&thread, NULL, server, NULL)) {
+            fprintf(stderr, "Cannot create server thread\n");
+            return 1;
+        }
+        /* Idle CPU: no requests at all */
+        usleep(2 * idle_timeout * 1e6);
+        cpu = thread_cpu(thread);
+        t = now_sec();
+        usleep(idle_sec * 1e6);
+        cpu = (thread_cpu(thread) - cpu) / (now_sec() - t);
+        /* Wake-up latency: one request after each idle period */
+        for (i = 0; i < rounds; i++) {
+            usleep((2 * idle_timeout + 0.001 * (i % 7)) * 1e6);
+            t = now_sec();
+            req = i + 1;
+            kick();
+            /* Yield, in case the server thread shares the core */
+            while (ack != (uint64_t)(i + 1)) sched_yield();
+            lat[i] = (now_sec() - t) * 1e6;
+        }
+        stop = 1;
+        pthread_join(thread, NULL);
+        qsort(lat, rounds, sizeof(double), cmp_double);
+        printf("%-14s CPU %6.1lf%%   first request %10.1lf usec "
+               "(min %.1lf, max %.1lf)\n", names[mode],
+               100 * cpu,
+               lat[rounds / 2], lat[0], lat[rounds - 1]);
+    }
+    free(lat);
+    close(ep_fd);
+    close(kick_fd);
+    return 0;
+}
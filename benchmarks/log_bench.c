@@ -0,0 +1,579 @@
+/*
+ * Log microbenchmark: appends 1M entries to a log that wraps around
+ * several times and measures the tail, idx and offset lookups, with the
+ * side ring and by walking the log (the ring is emptied), checking that
+ * both give the same results. Then, it reports the bytes per entry and 
+ * the cycles per entry of the apply loop (check and read the committed 
+ * entries) and of the commit loop (count the acks of the entries), 
+ * alone and while another thread writes acks, as the NIC does for the 
+ * followers' replies. Then, it computes the commit offset of the not 
+ * committed entries by walking them and counting the acks of each one, 
+ * and from the majority idx of the acks (see update_remote_logs). 
+ * Then, it appends the entries again, once with the 
+ * staging copy of the proxy (tailq) and once through reservations, 
+ * checking that both logs are the same. Last, a follower appends the
+ * entries up to the end offset and in-band, also across a wrap marker.
+ *
+ * build: gcc -O2 -std=gnu99 -I../src/include/dare -o log_bench log_bench.c ../src/util/crc32c.c -lpthread
+ * usage: log_bench [entries] [cmd_len] [window]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../src/include/dare/dare_log.h"
+#include "../src/include/dare/timer.h"
+
+FILE *log_fp;
+int prev_log_entry_head = 0;
+log_ring_t log_ring;
+log_rsv_t log_rsv;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* op, uint64_t count, double t)
+{
+    printf("%-28s %12.1lf ns/op\n", op, t * 1e9 / count);
+}
+
+/* Offsets of the entries, as the leader would compute them */
+static uint64_t *offsets;
+
+/* Acks (the idx of the last persisted entry of each server, see 
+ack_idx in ctrl_data_t) written by a second thread for the entries 
+[first, last], as the followers' replies are written by the NIC */
+static volatile uint64_t ack_idx[3];
+
+struct acker_t {
+    uint64_t first, last;
+    volatile int stop;
+};
+
+static void* acker(void *arg)
+{
+    struct acker_t *a = (struct acker_t*)arg;
+    uint64_t idx;
+    uint8_t i;
+    while (!a->stop) {
+        for (idx = a->first; idx <= a->last && !a->stop; idx++) {
+            for (i = 1; i < 3; i++) {
+                ack_idx[i] = idx;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* The apply loop of the servers (see apply_committed_entries) */
+static uint64_t apply_loop(dare_log_t *log, uint64_t from, uint64_t to,
+                           uint64_t *sum)
+{
+    dare_log_entry_t *entry;
+    uint64_t offset = from, count = 0;
+    while (offset != to) {
+        entry = log_get_entry(log, &offset);
+        if (!log_fit_entry(log, offset, entry)) {
+            offset = 0;
+            continue;
+        }
+        if (entry->crc != log_entry_crc(entry)) {
+            fprintf(stderr, "Corrupted log entry (idx=%"PRIu64")\n", entry->idx);
+            exit(1);
+        }
+        if (CSM == entry->type) {
+            *sum += entry->data.cmd.cmd[0];
+        }
+        offset += log_entry_len(entry);
+        count++;
+    }
+    return count;
+}
+
+/* The commit loop: walk the entries and count the acks of each one */
+static uint64_t commit_loop(dare_log_t *log, uint64_t from, uint64_t to,
+                            uint64_t *sum)
+{
+    dare_log_entry_t *entry;
+    uint64_t offset = from, count = 0;
+    uint8_t i;
+    while (offset != to) {
+        entry = log_get_entry(log, &offset);
+        if (!log_fit_entry(log, offset, entry)) {
+            offset = 0;
+            continue;
+        }
+        for (i = 0; i < 3; i++) {
+            if ((0 == i) || (ack_idx[i] >= entry->idx)) {
+                (*sum)++;
+            }
+        }
+        offset += log_entry_len(entry);
+        count++;
+    }
+    return count;
+}
+
+static void report_cycles(const char* op, uint64_t count, uint64_t ticks)
+{
+    printf("%-28s %12.1lf cycles/entry\n", op, (double)ticks / count);
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t entries = 1000000;
+    uint32_t cmd_len = 64;
+    uint64_t window = 1000;
+    dare_log_t *log;
+    dare_nc_buf_t *nc_ring, *nc_walk;
+    uint8_t cmd_buf[sizeof(sm_cmd_t) + 4096];
+    sm_cmd_t *cmd = (sm_cmd_t*)cmd_buf;
+    dare_log_entry_t *entry, sample;
+    uint64_t len, i, idx, offset, tail = 0, end = 0, count, checksum;
+    uint64_t saved_first, saved_last;
+    double t;
+
+    log_fp = stderr;
+    if (argc > 1) entries = strtoull(argv[1], NULL, 10);
+    if (argc > 2) cmd_len = strtoul(argv[2], NULL, 10);
+    if (argc > 3) window = strtoull(argv[3], NULL, 10);
+    if (cmd_len > 4096) cmd_len = 4096;
+
+    /* Room for a quarter of the entries, so that the log wraps around */
+    sample.type = CSM;
+    sample.data.cmd.len = cmd_len;
+    len = (entries / 4 + window) * log_entry_len(&sample);
+    log = calloc(1, sizeof(dare_log_t) + len);
+    offsets = malloc((entries + 1) * sizeof(uint64_t));
+    nc_ring = malloc(sizeof(dare_nc_buf_t) + window * sizeof(dare_log_entry_det_t));
+    nc_walk = malloc(sizeof(dare_nc_buf_t) + window * sizeof(dare_log_entry_det_t));
+    if (!log || !offsets || !nc_ring || !nc_walk) {
+        fprintf(stderr, "Cannot allocate the log\n");
+        return 1;
+    }
+    log_init(log, len);
+    if (log_ring_init(log)) {
+        fprintf(stderr, "Cannot allocate the ring\n");
+        return 1;
+    }
+    nc_ring->cap = nc_walk->cap = window;
+    printf("%"PRIu64" entries of %"PRIu32" bytes; log of %"PRIu64" MB; "
+           "ring of %"PRIu64" entries; %"PRIu64" not committed\n",
+           entries, cmd_len, len >> 20, log_ring.mask + 1, window);
+
+    /* Append; the apply and commit offsets trail the end, so that only 
+    the last window entries are not committed, and the head offset 
+    trails the commit offset by an eighth of the entries */
+    memset(cmd->cmd, 'x', cmd_len);
+    cmd->len = cmd_len;
+    t = now_sec();
+    for (i = 1; i <= entries; i++) {
+        idx = log_append_entry(log, 1, i, 0, CSM, cmd);
+        if (idx != i) {
+            fprintf(stderr, "Cannot append entry %"PRIu64"\n", i);
+            return 1;
+        }
+        offsets[i] = log->tail;
+        if (i > window) {
+            log->commit = log->apply = offsets[i - window + 1];
+        }
+        if (i > window + entries / 8) {
+            log->head = offsets[i - window - entries / 8 + 1];
+        }
+    }
+    report("append", entries, now_sec() - t);
+
+    /* Tail lookup (after a change of leadership, log->tail is reset) */
+    count = entries / 10;
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        log->tail = log->len;
+        tail = log_get_tail(log);
+    }
+    report("tail (ring)", count, now_sec() - t);
+    if (tail != offsets[entries]) {
+        fprintf(stderr, "Wrong tail: %"PRIu64" != %"PRIu64"\n", tail, offsets[entries]);
+        return 1;
+    }
+    count = 1000;
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        log->tail = log->len;
+        log_ring_reset();
+        tail = log_get_tail(log);
+    }
+    report("tail (walk)", count, now_sec() - t);
+    if (tail != offsets[entries]) {
+        fprintf(stderr, "Wrong tail: %"PRIu64" != %"PRIu64"\n", tail, offsets[entries]);
+        return 1;
+    }
+
+    /* The walk above rebuilt the ring from the commit offset only;
+    append again, so that it covers up to the head offset */
+    log_ring_reset();
+    for (i = entries - entries / 8 + 1; i <= entries; i++) {
+        log_ring_push(i, 1, offsets[i]);
+    }
+
+    /* idx -> entry for the entries after the head offset */
+    count = entries / 10;
+    checksum = 0;
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        idx = entries - (i * 7919) % (entries / 8);
+        entry = log_get_entry_by_idx(log, idx, &offset);
+        if (NULL == entry || offset != offsets[idx]) {
+            fprintf(stderr, "Wrong entry for idx %"PRIu64"\n", idx);
+            return 1;
+        }
+        checksum += offset;
+    }
+    report("idx lookup (ring)", count, now_sec() - t);
+    saved_first = log_ring.first;
+    saved_last = log_ring.last;
+    count = 100;
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        idx = entries - (i * 7919) % (entries / 8);
+        log_ring.last = 0;
+        entry = log_get_entry_by_idx(log, idx, &offset);
+        if (NULL == entry || offset != offsets[idx]) {
+            fprintf(stderr, "Wrong entry for idx %"PRIu64"\n", idx);
+            return 1;
+        }
+    }
+    report("idx lookup (walk)", count, now_sec() - t);
+    log_ring.first = saved_first;
+    log_ring.last = saved_last;
+
+    /* Not committed entries -> NC-Buffer */
+    count = (window > 10000) ? 10 : 10000;
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        log_entries_to_nc_buf(log, nc_ring);
+    }
+    report("nc buffer (ring)", count, now_sec() - t);
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        log_ring.last = 0;
+        log_entries_to_nc_buf(log, nc_walk);
+    }
+    report("nc buffer (walk)", count, now_sec() - t);
+    log_ring.first = saved_first;
+    log_ring.last = saved_last;
+    if ( (nc_ring->len != window) || (nc_walk->len != window) ||
+        memcmp(nc_ring->entries, nc_walk->entries,
+               window * sizeof(dare_log_entry_det_t)) )
+    {
+        fprintf(stderr, "Wrong NC-Buffer: %"PRIu64" / %"PRIu64" entries\n",
+                nc_ring->len, nc_walk->len);
+        return 1;
+    }
+
+    /* Remote end offset for a remote log that diverges halfway
+    through the not committed entries */
+    nc_ring->entries[window / 2].term = 2;
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        end = log_find_remote_end_offset(log, nc_ring);
+    }
+    report("remote end (ring)", count, now_sec() - t);
+    if (end != offsets[entries - window + 1 + window / 2]) {
+        fprintf(stderr, "Wrong remote end offset\n");
+        return 1;
+    }
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        log_ring.last = 0;
+        end = log_find_remote_end_offset(log, nc_ring);
+    }
+    report("remote end (walk)", count, now_sec() - t);
+    if (end != offsets[entries - window + 1 + window / 2]) {
+        fprintf(stderr, "Wrong remote end offset\n");
+        return 1;
+    }
+    log_ring.first = saved_first;
+    log_ring.last = saved_last;
+    /* The same, in chunks, as the leader reads them (see log_adjustment) */
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        for (idx = 0; idx < window; idx += NC_CHUNK_ENTRIES) {
+            len = (window - idx < NC_CHUNK_ENTRIES) ? 
+                    window - idx : NC_CHUNK_ENTRIES;
+            if (!log_match_nc_chunk(log, nc_ring->entries + idx, len, 
+                                    idx + len == window, &end)) {
+                break;
+            }
+        }
+    }
+    report("remote end (chunks)", count, now_sec() - t);
+    if (end != offsets[entries - window + 1 + window / 2]) {
+        fprintf(stderr, "Wrong remote end offset\n");
+        return 1;
+    }
+
+    /* Bytes per entry, apply and commit loops over the entries between 
+    the head and the commit offsets */
+    {
+        dare_log_entry_t noop;
+        struct acker_t a;
+        pthread_t thread;
+        HRT_TIMESTAMP_T t1, t2;
+        uint64_t ticks, round;
+        uint64_t (*loops[2])(dare_log_t*, uint64_t, uint64_t, uint64_t*) = 
+                {apply_loop, commit_loop};
+        const char *names[4] = {"apply loop", "commit loop", 
+                            "apply loop (acks)", "commit loop (acks)"};
+
+        noop.type = NOOP;
+        offset = offsets[entries];
+        entry = log_get_entry(log, &offset);
+        printf("%-28s %12"PRIu32" bytes (NOOP: %"PRIu32")\n", "entry", 
+               log_entry_len(entry), log_entry_len(&noop));
+
+        a.first = entries - window - entries / 8 + 1;
+        a.last = entries - window;
+        for (round = 0; round < 4; round++) {
+            if (2 == round) {
+                a.stop = 0;
+                pthread_create(&thread, NULL, acker, &a);
+            }
+            count = 0;
+            HRT_GET_TIMESTAMP(t1);
+            for (i = 0; i < 20; i++) {
+                count += loops[round % 2](log, log->head, log->commit, &checksum);
+            }
+            HRT_GET_TIMESTAMP(t2);
+            HRT_GET_ELAPSED_TICKS(t1, t2, &ticks);
+            report_cycles(names[round], count, ticks);
+        }
+        a.stop = 1;
+        pthread_join(thread, NULL);
+    }
+
+    /* Commit offset of the not committed entries, once a majority acked 
+    them: walk the entries (offsets relative to the end) against the 
+    majority idx of the acks (plain integer compares) and the ring */
+    {
+        uint64_t acks[3], walk_end = 0, idx_end = 0, commit_idx;
+        HRT_TIMESTAMP_T t1, t2;
+        uint64_t ticks;
+        uint8_t k, replies;
+
+        ack_idx[1] = ack_idx[2] = entries;
+        count = (window > 10000) ? 10 : 10000;
+        HRT_GET_TIMESTAMP(t1);
+        for (i = 0; i < count; i++) {
+            offset = log->commit;
+            while (log_offset_end_distance(log, offset)) {
+                entry = log_get_entry(log, &offset);
+                if (!log_fit_entry(log, offset, entry)) {
+                    offset = 0;
+                    continue;
+                }
+                for (k = 0, replies = 0; k < 3; k++) {
+                    if ((0 == k) || (ack_idx[k] >= entry->idx)) {
+                        replies++;
+                    }
+                }
+                if (replies < 2) break;
+                offset += log_entry_len(entry);
+            }
+            walk_end = offset;
+        }
+        HRT_GET_TIMESTAMP(t2);
+        HRT_GET_ELAPSED_TICKS(t1, t2, &ticks);
+        printf("%-28s %12.1lf cycles/commit\n", "commit offset (walk)", 
+               (double)ticks / count);
+        HRT_GET_TIMESTAMP(t1);
+        for (i = 0; i < count; i++) {
+            acks[0] = entries;
+            acks[1] = ack_idx[1];
+            acks[2] = ack_idx[2];
+            commit_idx = log_majority_idx(acks, 3);
+            idx_end = log_commit_offset(log, commit_idx);
+        }
+        HRT_GET_TIMESTAMP(t2);
+        HRT_GET_ELAPSED_TICKS(t1, t2, &ticks);
+        printf("%-28s %12.1lf cycles/commit\n", "commit offset (idx)", 
+               (double)ticks / count);
+        if ( (walk_end != log->end) || (idx_end != log->end) ) {
+            fprintf(stderr, "Wrong commit offset\n");
+            return 1;
+        }
+    }
+
+    /* Append with a staging copy (as the tailq of the proxy) and through 
+    reservations, i.e., in place (the DARE thread adopts the published 
+    entries every 16 entries) */
+    {
+        dare_log_t *rlog = calloc(1, sizeof(dare_log_t) + log->len);
+        sm_cmd_t *staged;
+        uint64_t prev_end;
+        int round;
+        const char *names[2] = {"append (staging copy)", "append (reserve)"};
+
+        if (!rlog) {
+            fprintf(stderr, "Cannot allocate the log\n");
+            return 1;
+        }
+        log_rsv_init();
+        for (round = 0; round < 2; round++) {
+            log_init(rlog, log->len);
+            rlog->head = 0;
+            log_ring_reset();
+            if (round) log_rsv_start(rlog, 1);
+            t = now_sec();
+            for (i = 1; i <= entries; i++) {
+                if (round) {
+                    entry = log_reserve_entry(rlog, i, 0, CSM, cmd_len, &prev_end);
+                    if (NULL == entry) {
+                        fprintf(stderr, "Cannot reserve entry %"PRIu64"\n", i);
+                        return 1;
+                    }
+                    memcpy(entry->data.cmd.cmd, cmd->cmd, cmd_len);
+                    log_publish_entry(rlog, entry, prev_end);
+                    if ( (i & 15) && (i != entries) ) continue;
+                    log_adopt_entries(rlog);
+                }
+                else {
+                    staged = malloc(sizeof(sm_cmd_t) + cmd_len);
+                    staged->len = cmd_len;
+                    memcpy(staged->cmd, cmd->cmd, cmd_len);
+                    idx = log_append_entry(rlog, 1, i, 0, CSM, staged);
+                    free(staged);
+                    if (idx != i) {
+                        fprintf(stderr, "Cannot append entry %"PRIu64"\n", i);
+                        return 1;
+                    }
+                }
+                if (rlog->tail != offsets[i]) {
+                    fprintf(stderr, "Wrong offset for entry %"PRIu64"\n", i);
+                    return 1;
+                }
+                if (i > window + entries / 8) {
+                    rlog->head = offsets[i - window - entries / 8 + 1];
+                }
+            }
+            report(names[round], entries, now_sec() - t);
+            if (memcmp(log->entries, rlog->entries, log->len)) {
+                fprintf(stderr, "Wrong log (%s)\n", names[round]);
+                return 1;
+            }
+            log_rsv_stop();
+        }
+        free(rlog);
+    }
+
+    /* Follower: append the entries after the head offset, up to the end 
+    offset written by the leader (a walk over the entries) and in-band, 
+    i.e., without the end offset (idx, term and CRC checks) */
+    {
+        dare_log_t *flog = malloc(sizeof(dare_log_t) + log->len);
+        HRT_TIMESTAMP_T t1, t2;
+        uint64_t ticks, scan_ticks, walk_end = 0, n;
+        
+        if (!flog) {
+            fprintf(stderr, "Cannot allocate the log\n");
+            return 1;
+        }
+        memcpy(flog, log, sizeof(dare_log_t) + log->len);
+        idx = entries - window - entries / 8 + 1;
+        n = entries - idx + 1;
+        count = (n > 100000) ? 1 : 10;
+        HRT_GET_TIMESTAMP(t1);
+        for (i = 0; i < count; i++) {
+            offset = log->head;
+            while (log_offset_end_distance(log, offset)) {
+                entry = log_get_entry(log, &offset);
+                if (!log_fit_entry(log, offset, entry)) {
+                    offset = 0;
+                    continue;
+                }
+                offset += log_entry_len(entry);
+            }
+            walk_end = offset;
+        }
+        HRT_GET_TIMESTAMP(t2);
+        HRT_GET_ELAPSED_TICKS(t1, t2, &ticks);
+        printf("%-28s %12.1lf cycles/entry\n", "follower (end offset)", 
+               (double)ticks / count / n);
+        ticks = 0;
+        for (i = 0; i < count; i++) {
+            uint64_t next = idx;
+            flog->end = flog->head;
+            HRT_GET_TIMESTAMP(t1);
+            log_scan_entries(flog, &next, 1);
+            HRT_GET_TIMESTAMP(t2);
+            HRT_GET_ELAPSED_TICKS(t1, t2, &scan_ticks);
+            ticks += scan_ticks;
+            if (next != entries + 1) break;
+        }
+        printf("%-28s %12.1lf cycles/entry\n", "follower (in-band)", 
+               (double)ticks / count / n);
+        if ( (walk_end != log->end) || (flog->end != log->end) ) {
+            fprintf(stderr, "Wrong follower end offset\n");
+            return 1;
+        }
+        free(flog);
+    }
+
+    /* Follower: in-band across a wrap marker; in a log of 1000 bytes, 
+    an entry does not fit at the end, so the leader leaves a marker 
+    header there and writes the entry from the beginning */
+    {
+        uint64_t mlen = 1000, next = 3;
+        dare_log_t *mlog = calloc(1, sizeof(dare_log_t) + mlen);
+        dare_log_t *flog = calloc(1, sizeof(dare_log_t) + mlen);
+        int wrapped = 0;
+
+        if (!mlog || !flog) {
+            fprintf(stderr, "Cannot allocate the log\n");
+            return 1;
+        }
+        log_init(mlog, mlen);
+        log_init(flog, mlen);
+        mlog->head = flog->head = 0;
+        log_ring_reset();
+        for (i = 1; !wrapped || (mlog->tail == 0); i++) {
+            idx = log_append_entry(mlog, 1, i, 0, CSM, cmd);
+            if (idx != i) {
+                fprintf(stderr, "Cannot append entry %"PRIu64"\n", i);
+                return 1;
+            }
+            if (3 == i) {
+                /* Room to wrap around; the follower starts from 3 */
+                mlog->head = flog->head = mlog->tail;
+            }
+            if ( (i > 1) && (0 == mlog->tail) ) wrapped = 1;
+        }
+        /* As written by the leader */
+        memcpy(flog->entries, mlog->entries, mlen);
+        flog->end = flog->head;
+        log_scan_entries(flog, &next, 1);
+        if ( !wrapped || (next != i) || (flog->end != mlog->end) ) {
+            fprintf(stderr, "Follower stuck at the wrap marker (offset "
+                    "%"PRIu64", idx %"PRIu64")\n", flog->end, next);
+            return 1;
+        }
+        printf("%-28s %12"PRIu64" entries\n", "follower (wrap marker)", 
+               next - 3);
+        free(mlog);
+        free(flog);
+    }
+
+    printf("ok (%"PRIu64")\n", checksum);
+    log_ring_free();
+    free(log);
+    free(offsets);
+    free(nc_ring);
+    free(nc_walk);
+    return 0;
+}
@@ -0,0 +1,183 @@
+define(){ IFS='\n' read -r -d '' ${1} || true; }
+declare -A pids
+declare -A rounds
+redirection=( "> out" "2> err" "< /dev/null" )
+
+define HELP <<'EOF'
+Script for comparing log sizes: for every size, starts the group with
+log_size_mb set, runs the benchmark against the leader and reports the
+leader's log write latency (median, 2nd and 98th percentiles, from the
+first RDMA write to commit) and the number of forced log prunings.
+Needs a DEBUG build (make DEBUGOPT=1) and reserved hugepages, e.g.,
+  echo 5 > /sys/kernel/mm/hugepages/hugepages-1048576kB/nr_hugepages
+usage  : $0 [options]
+options: --app                # app to run
+         --sizes=<MB,...>     # log sizes (default 64,4096)
+EOF
+
+usage () {
+    echo -e "$HELP"
+}
+
+timer_start () {
+	echo "$1"
+	t1=$(date +%s%N)
+}
+
+timer_stop () {
+	t2=$(date +%s%N)
+	echo "done ($(expr $t2 - $t1) nanoseconds)"
+}
+
+ErrorAndExit () {
+  echo "ERROR: $1"
+  exit 1
+}
+
+ForceAbsolutePath () {
+  case "$2" in
+    /* )
+      ;;
+    *)
+      ErrorAndExit "Expected an absolute path for $1"
+      ;;
+  esac
+}
+
+StartDare() {
+    for ((i=0; i<${group_size}; ++i)); do
+        srv=${servers[$i]}
+        config_dare=( "server_type=start" "server_idx=$i" "group_size=$group_size" "config_path=$PWD/log_${size}.cfg" "dare_log_file=$PWD/srv${i}_1.log" "mgid=$DGID" "LD_PRELOAD=${DAREDIR}/target/interpose.so" )
+        cmd=( "ssh" "$USER@${servers[$i]}" "${config_dare[@]}" "nohup" "${run_dare}" "${redirection[@]}" "&" "echo \$!" )
+        pids[$srv]=$("${cmd[@]}")
+        rounds[$srv]=2
+        echo -e "\tp$i ($srv) -- pid=${pids[$srv]}"
+    done
+}
+
+StopDare() {
+    for srv in "${!pids[@]}"; do 
+        cmd=( "ssh" "$USER@$srv" "kill -2" "${pids[$srv]}" )
+        echo "Executing: ${cmd[@]}"
+        $("${cmd[@]}")
+    done
+}
+
+FindLeader() {
+    leader=""
+    max_idx=-1
+    max_term=""
+ 
+    for ((i=0; i<${group_size}; ++i)); do
+        srv=${servers[$i]}
+        # look for the latest [T<term>] LEADER 
+        cmd=( "ssh" "$USER@$srv" "grep -r \"] LEADER\"" "$PWD/srv${i}_$((rounds[$srv]-1)).log" )
+        #echo ${cmd[@]}
+        grep_out=$("${cmd[@]}")
+        if [[ -z $grep_out ]]; then
+            continue
+        fi
+        terms=($(echo $grep_out | awk '{print $2}'))
+        for j in "${terms[@]}"; do
+           term=`echo $j | awk -F'T' '{print $2}' | awk -F']' '{print $1}'`
+           if [[ $term -gt $max_term ]]; then 
+                max_term=$term
+                leader=$srv
+                leader_idx=$i
+           fi
+        done
+    done
+    echo "Leader: p${leader_idx} ($leader)"
+}
+
+# Report the leader's log pages, write latency and forced prunings
+CheckLeader() {
+    log="$PWD/srv${leader_idx}_1.log"
+    cmd=( "ssh" "$USER@$leader" "grep \"Log of\"" "$log" )
+    echo -e "\t$("${cmd[@]}")"
+    cmd=( "ssh" "$USER@$leader" "grep \"LOG WRITE:\"" "$log" "|" "tail -n 1" )
+    echo -e "\t$("${cmd[@]}")"
+    cmd=( "ssh" "$USER@$leader" "grep -c \"FORCED LOG PRUNING\"" "$log" )
+    echo -e "\tforced prunings: $("${cmd[@]}")"
+}
+
+port=8888
+StartBenchmark() {
+    if [[ "$APP" == "ssdb" ]]; then
+        run_loop=( "${DAREDIR}/apps/ssdb/ssdb-master/tools/ssdb-bench" "$leader" "$port" "$request_count" "$client_count")
+    elif [[ "$APP" == "redis" ]]; then
+        run_loop=( "${DAREDIR}/apps/redis/install/bin/redis-benchmark" "-t set,get" "-h $leader" "-p $port" "-n $request_count" "-c $client_count")
+    fi
+    rounds[$client]=$((rounds[$client] + 1))
+    cmd=( "ssh" "$USER@${client}" "${run_loop[@]}" ">" "clt_${rounds[$client]}.log")
+    $("${cmd[@]}")
+}
+
+DAREDIR=$PWD/..
+APP=""
+client_count=1
+request_count=1000000
+sizes="64,4096"
+for arg in "$@"
+do
+    case ${arg} in
+    --help|-help|-h)
+        usage
+        exit 1
+        ;;
+    --sizes=*)
+        sizes=`echo $arg | sed -e 's/--sizes=//'`
+        ;;
+    --app=*)
+        APP=`echo $arg | sed -e 's/--app=//'`
+        APP=`eval echo ${APP}`    # tilde and variable expansion
+        ;;
+    esac
+done
+
+if [[ "x$APP" == "x" ]]; then
+    ErrorAndExit "No app defined: --app"
+elif [[ "$APP" == "ssdb" ]]; then
+    run_dare="${DAREDIR}/apps/ssdb/ssdb-master/ssdb-server ${DAREDIR}/apps/ssdb/ssdb-master/ssdb.conf"
+elif [[ "$APP" == "redis" ]]; then
+    run_dare="${DAREDIR}/apps/redis/install/bin/redis-server --port $port"
+fi
+
+# list of allocated nodes, e.g., nodes=(n112002 n112001 n111902)
+nodes=(10.22.1.3 10.22.1.4 10.22.1.5 10.22.1.6 10.22.1.7 10.22.1.8 10.22.1.9 202.45.128.159)
+node_count=${#nodes[@]}
+
+echo "Allocated ${node_count} nodes:" > nodes
+for ((i=0; i<${node_count}; ++i)); do
+    echo "$i:${nodes[$i]}" >> nodes
+done
+group_size=5
+
+client=${nodes[-2]}
+echo ">>> client: ${client}"
+
+for ((i=0; i<$node_count; ++i)); do
+    servers[${i}]=${nodes[$i]}
+done
+echo ">>> $(($node_count)) servers: ${servers[@]}"
+
+DGID="ff0e::ffff:e101:101"
+
+########################################################################
+
+for size in ${sizes//,/ }; do
+    rm -f *.log
+    sed -e "s/log_size_mb = .*;/log_size_mb = ${size}L;/" \
+        ${DAREDIR}/target/nodes.local.cfg > log_${size}.cfg
+    echo -e "Log of $size MB: starting $group_size servers..."
+    StartDare
+    echo "done"
+    sleep 2.5
+    FindLeader
+    timer_start "Running the benchmark..."
+    StartBenchmark
+    timer_stop
+    CheckLeader
+    StopDare
+    sleep 2
+done
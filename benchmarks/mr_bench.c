@@ -0,0 +1,294 @@
+/*
+ * Snapshot transfer microbenchmark: a joiner reads a snapshot of
+ * size MB in chunks of CHUNK_SIZE bytes over a loopback RC connection
+ * (as rc_recover_sm), and it reports the time-to-first-byte (from the
+ * start of the transfer, including the allocation and registration of
+ * the snapshot buffer, until the first chunk is in the buffer) and the
+ * throughput of the whole transfer. The snapshot buffer is either
+ *  - copy: not registered; every chunk is read into a registered chunk
+ *    buffer and copied into the snapshot;
+ *  - pin: registered (and pinned) at once; the chunks are read directly
+ *    into the snapshot (header and data scattered, as rc_recover_sm);
+ *  - odp: registered with on-demand paging, i.e., without pinning it;
+ *    the HCA faults the pages in while reading the chunks;
+ *  - odp (cached): a second transfer that reuses the buffer and its
+ *    registration (the pages were returned with MADV_DONTNEED).
+ * The odp rows need an HCA with on-demand paging for RC reads.
+ *
+ * build: gcc -O2 -std=gnu99 -o mr_bench mr_bench.c -libverbs
+ * usage: mr_bench [device] [gid_index] [size_MB]
+ *        mr_bench mlx5_0 -1 1024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <infiniband/verbs.h>
+
+#define PAGE_SIZE   4096
+#define CHUNK_SIZE  (128 * PAGE_SIZE)   /* as SM_CHUNK_SIZE */
+#define HDR_SIZE    64                  /* room for the chunk header */
+
+#define MODE_COPY   0
+#define MODE_PIN    1
+#define MODE_ODP    2
+
+static struct ibv_context *ctx;
+static struct ibv_pd *pd;
+static struct ibv_cq *cq;
+static struct ibv_qp *qp[2];
+static uint8_t port = 1;
+static int gid_index = -1;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct ibv_qp* create_qp()
+{
+    struct ibv_qp_init_attr init;
+    struct ibv_qp_attr attr;
+    struct ibv_qp *q;
+
+    memset(&init, 0, sizeof(init));
+    init.send_cq = init.recv_cq = cq;
+    init.qp_type = IBV_QPT_RC;
+    init.cap.max_send_wr = 16;
+    init.cap.max_recv_wr = 1;
+    init.cap.max_send_sge = 2;
+    init.cap.max_recv_sge = 1;
+    q = ibv_create_qp(pd, &init);
+    if (NULL == q) return NULL;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_INIT;
+    attr.port_num = port;
+    attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ |
+                           IBV_ACCESS_LOCAL_WRITE;
+    if (ibv_modify_qp(q, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+                      IBV_QP_PORT | IBV_QP_ACCESS_FLAGS))
+    {
+        return NULL;
+    }
+    return q;
+}
+
+static int connect_qp(struct ibv_qp *q, uint32_t dest_qpn,
+                      struct ibv_port_attr *pattr)
+{
+    struct ibv_qp_attr attr;
+    union ibv_gid gid;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTR;
+    attr.path_mtu = pattr->active_mtu;
+    attr.dest_qp_num = dest_qpn;
+    attr.rq_psn = 55;
+    attr.max_dest_rd_atomic = 1;
+    attr.min_rnr_timer = 12;
+    attr.ah_attr.dlid = pattr->lid;
+    attr.ah_attr.port_num = port;
+    if (gid_index >= 0) {
+        if (ibv_query_gid(ctx, port, gid_index, &gid)) return 1;
+        attr.ah_attr.is_global = 1;
+        attr.ah_attr.grh.dgid = gid;
+        attr.ah_attr.grh.sgid_index = gid_index;
+        attr.ah_attr.grh.hop_limit = 1;
+    }
+    if (ibv_modify_qp(q, &attr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
+                      IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+                      IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER))
+    {
+        return 1;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTS;
+    attr.timeout = 14;
+    attr.retry_cnt = 7;
+    attr.rnr_retry = 7;
+    attr.sq_psn = 55;
+    attr.max_rd_atomic = 1;
+    return ibv_modify_qp(q, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT |
+                         IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY |
+                         IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC);
+}
+
+/* Read one chunk (header and data) from the donor into the given SGEs */
+static int read_chunk(struct ibv_sge *sg, int num_sge, uint64_t raddr,
+                      uint32_t rkey)
+{
+    struct ibv_send_wr wr, *bad_wr;
+    struct ibv_wc wc;
+    int n;
+
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = sg;
+    wr.num_sge = num_sge;
+    wr.opcode = IBV_WR_RDMA_READ;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = raddr;
+    wr.wr.rdma.rkey = rkey;
+    if (ibv_post_send(qp[0], &wr, &bad_wr)) return 1;
+    while (0 == (n = ibv_poll_cq(cq, 1, &wc)));
+    return (n < 0) || (IBV_WC_SUCCESS != wc.status);
+}
+
+/* Transfer a snapshot of size bytes; the snapshot buffer (and its
+ * registration, if any) is kept in *snapshot (*smr) when not NULL;
+ * @return the total time or a negative value on error */
+static double transfer(int mode, uint64_t size, uint8_t *donor,
+                       struct ibv_mr *dmr, uint8_t *chunk,
+                       struct ibv_mr *cmr, uint8_t **snapshot,
+                       struct ibv_mr **smr, double *ttfb)
+{
+    struct ibv_sge sg[2];
+    uint64_t offset, len;
+    double start = now_sec();
+    int access = IBV_ACCESS_LOCAL_WRITE;
+
+    if (NULL == *snapshot) {
+        if (posix_memalign((void**)snapshot, PAGE_SIZE, size)) return -1;
+    }
+    if ( (MODE_COPY != mode) && (NULL == *smr) ) {
+        if (MODE_ODP == mode) access |= IBV_ACCESS_ON_DEMAND;
+        *smr = ibv_reg_mr(pd, *snapshot, size, access);
+        if (NULL == *smr) return -1;
+    }
+    for (offset = 0; offset < size; offset += len) {
+        len = (size - offset < CHUNK_SIZE) ? size - offset : CHUNK_SIZE;
+        sg[0].addr = (uint64_t)chunk;
+        sg[0].lkey = cmr->lkey;
+        if (MODE_COPY == mode) {
+            sg[0].length = HDR_SIZE + len;
+        }
+        else {
+            sg[0].length = HDR_SIZE;
+            sg[1].addr = (uint64_t)(*snapshot + offset);
+            sg[1].length = len;
+            sg[1].lkey = (*smr)->lkey;
+        }
+        if (read_chunk(sg, (MODE_COPY == mode) ? 1 : 2, (uint64_t)donor,
+                       dmr->rkey))
+        {
+            return -1;
+        }
+        if (MODE_COPY == mode) {
+            memcpy(*snapshot + offset, chunk + HDR_SIZE, len);
+        }
+        if (0 == offset) *ttfb = now_sec() - start;
+    }
+    return now_sec() - start;
+}
+
+int main(int argc, char** argv)
+{
+    struct ibv_device **list;
+    struct ibv_port_attr pattr;
+    struct ibv_device_attr_ex attr_ex;
+    const char *name = NULL;
+    const char *names[4] = {"copy", "pin", "odp", "odp (cached)"};
+    uint64_t size = 1024;
+    uint8_t *donor, *chunk, *snapshot;
+    struct ibv_mr *dmr, *cmr, *smr;
+    double t, ttfb;
+    int i, num, mode, odp = 0;
+
+    if (argc > 1) name = argv[1];
+    if (argc > 2) gid_index = atoi(argv[2]);
+    if (argc > 3) size = strtoull(argv[3], NULL, 10);
+    size <<= 20;
+
+    list = ibv_get_device_list(&num);
+    if (NULL == list || 0 == num) {
+        fprintf(stderr, "No RDMA device found\n");
+        return 1;
+    }
+    for (i = 0; i < num; i++) {
+        if (!name || !strcmp(name, ibv_get_device_name(list[i]))) break;
+    }
+    if (i == num) {
+        fprintf(stderr, "Cannot find device %s\n", name);
+        return 1;
+    }
+    ctx = ibv_open_device(list[i]);
+    if (NULL == ctx || ibv_query_port(ctx, port, &pattr)) {
+        fprintf(stderr, "Cannot open device %s\n", ibv_get_device_name(list[i]));
+        return 1;
+    }
+    memset(&attr_ex, 0, sizeof(attr_ex));
+    if ( (0 == ibv_query_device_ex(ctx, NULL, &attr_ex)) &&
+        (attr_ex.odp_caps.general_caps & IBV_ODP_SUPPORT) &&
+        (attr_ex.odp_caps.per_transport_caps.rc_odp_caps & IBV_ODP_SUPPORT_READ) )
+    {
+        odp = 1;
+    }
+    pd = ibv_alloc_pd(ctx);
+    cq = ibv_create_cq(ctx, 32, NULL, NULL, 0);
+    donor = calloc(1, HDR_SIZE + CHUNK_SIZE);
+    chunk = calloc(1, HDR_SIZE + CHUNK_SIZE);
+    if (!pd || !cq || !donor || !chunk) {
+        fprintf(stderr, "Cannot allocate resources\n");
+        return 1;
+    }
+    dmr = ibv_reg_mr(pd, donor, HDR_SIZE + CHUNK_SIZE,
+                     IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ);
+    cmr = ibv_reg_mr(pd, chunk, HDR_SIZE + CHUNK_SIZE, IBV_ACCESS_LOCAL_WRITE);
+    qp[0] = create_qp();
+    qp[1] = create_qp();
+    if (!dmr || !cmr || !qp[0] || !qp[1] ||
+        connect_qp(qp[0], qp[1]->qp_num, &pattr) ||
+        connect_qp(qp[1], qp[0]->qp_num, &pattr))
+    {
+        fprintf(stderr, "Cannot set up the loopback connection\n");
+        return 1;
+    }
+    printf("%s: snapshot of %"PRIu64" MB in chunks of %d KB; "
+           "on-demand paging %s\n", ibv_get_device_name(list[i]),
+           size >> 20, CHUNK_SIZE >> 10, odp ? "supported" : "not supported");
+
+    for (mode = MODE_COPY; mode <= MODE_ODP; mode++) {
+        if ( (MODE_ODP == mode) && !odp ) break;
+        snapshot = NULL;
+        smr = NULL;
+        t = transfer(mode, size, donor, dmr, chunk, cmr, &snapshot, &smr,
+                     &ttfb);
+        if (t < 0) {
+            fprintf(stderr, "Transfer failed (%s)\n", names[mode]);
+            return 1;
+        }
+        printf("%-14s first byte %10.1lf usec   %8.1lf MB/s\n", names[mode],
+               ttfb * 1e6, size / t / 1e6);
+        if (MODE_ODP == mode) {
+            /* Next recovery: keep the buffer and its registration */
+            madvise(snapshot, size & ~((uint64_t)PAGE_SIZE - 1), MADV_DONTNEED);
+            t = transfer(mode, size, donor, dmr, chunk, cmr, &snapshot, &smr,
+                         &ttfb);
+            if (t < 0) {
+                fprintf(stderr, "Transfer failed (%s)\n", names[mode + 1]);
+                return 1;
+            }
+            printf("%-14s first byte %10.1lf usec   %8.1lf MB/s\n",
+                   names[mode + 1], ttfb * 1e6, size / t / 1e6);
+        }
+        if (smr) ibv_dereg_mr(smr);
+        free(snapshot);
+    }
+
+    ibv_destroy_qp(qp[0]);
+    ibv_destroy_qp(qp[1]);
+    ibv_dereg_mr(dmr);
+    ibv_dereg_mr(cmr);
+    ibv_destroy_cq(cq);
+    ibv_dealloc_pd(pd);
+    ibv_close_device(ctx);
+    ibv_free_device_list(list);
+    free(donor);
+    free(chunk);
+    return 0;
+}
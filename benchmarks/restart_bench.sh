@@ -0,0 +1,217 @@
+define(){ IFS='\n' read -r -d '' ${1} || true; }
+declare -A pids
+declare -A rounds
+redirection=( "> out" "2> err" "< /dev/null" )
+
+define HELP <<'EOF'
+Script for measuring the restart-to-serving time of a follower that is
+killed and restarted; with --region, every server keeps its log region
+in a file and the restarted server recovers from its own log
+usage  : $0 [options]
+options: --app                # app to run
+         --region             # back the log region by a file
+EOF
+
+usage () {
+    echo -e "$HELP"
+}
+
+timer_start () {
+	echo "$1"
+	t1=$(date +%s%N)
+}
+
+timer_stop () {
+	t2=$(date +%s%N)
+	echo "done ($(expr $t2 - $t1) nanoseconds)"
+}
+
+ErrorAndExit () {
+  echo "ERROR: $1"
+  exit 1
+}
+
+ForceAbsolutePath () {
+  case "$2" in
+    /* )
+      ;;
+    *)
+      ErrorAndExit "Expected an absolute path for $1"
+      ;;
+  esac
+}
+
+StartDare() {
+    for ((i=0; i<${group_size}; ++i)); do
+        srv=${servers[$i]}
+        config_dare=( "server_type=start" "server_idx=$i" "group_size=$group_size" "config_path=${DAREDIR}/target/nodes.local.cfg" "dare_log_file=$PWD/srv${i}_1.log" "mgid=$DGID" "LD_PRELOAD=${DAREDIR}/target/interpose.so" )
+        if [[ $region -eq 1 ]]; then
+            config_dare+=( "dare_log_region=$PWD/srv${i}.region" )
+        fi
+        cmd=( "ssh" "$USER@${servers[$i]}" "${config_dare[@]}" "nohup" "${run_dare}" "${redirection[@]}" "&" "echo \$!" )
+        pids[$srv]=$("${cmd[@]}")
+        rounds[$srv]=2
+        echo -e "\tp$i ($srv) -- pid=${pids[$srv]}"
+    done
+}
+
+StopDare() {
+    for srv in "${!pids[@]}"; do 
+        cmd=( "ssh" "$USER@$srv" "kill -2" "${pids[$srv]}" )
+        echo "Executing: ${cmd[@]}"
+        $("${cmd[@]}")
+    done
+}
+
+FindLeader() {
+    leader=""
+    max_idx=-1
+    max_term=""
+ 
+    for ((i=0; i<${group_size}; ++i)); do
+        srv=${servers[$i]}
+        # look for the latest [T<term>] LEADER 
+        cmd=( "ssh" "$USER@$srv" "grep -r \"] LEADER\"" "$PWD/srv${i}_$((rounds[$srv]-1)).log" )
+        #echo ${cmd[@]}
+        grep_out=$("${cmd[@]}")
+        if [[ -z $grep_out ]]; then
+            continue
+        fi
+        terms=($(echo $grep_out | awk '{print $2}'))
+        for j in "${terms[@]}"; do
+           term=`echo $j | awk -F'T' '{print $2}' | awk -F']' '{print $1}'`
+           if [[ $term -gt $max_term ]]; then 
+                max_term=$term
+                leader=$srv
+                leader_idx=$i
+           fi
+        done
+    done
+    echo "Leader: p${leader_idx} ($leader)"
+}
+
+# Kill (SIGKILL) a server that is not the leader
+KillServer() {
+    FindLeader
+    for ((i=0; i<${group_size}; ++i)); do
+        srv=${servers[$i]}
+        if [[ "x$srv" == "x$leader" ]]; then
+            continue
+        fi
+        cmd=( "ssh" "$USER@$srv" "kill -9" "${pids[$srv]}" )
+        $("${cmd[@]}")
+        killed=$srv
+        killed_idx=$i
+        echo -e "\tkilled p$i ($srv) -- p$leader_idx is the leader"
+        break
+    done
+}
+
+RestartServer() {
+    config_dare=( "server_type=join" "group_size=$group_size" "config_path=${DAREDIR}/target/nodes.local.cfg" "dare_log_file=$PWD/srv${killed_idx}_2.log" "mgid=$DGID" "LD_PRELOAD=${DAREDIR}/target/interpose.so" )
+    if [[ $region -eq 1 ]]; then
+        config_dare+=( "dare_log_region=$PWD/srv${killed_idx}.region" )
+    fi
+    cmd=( "ssh" "$USER@$killed" "${config_dare[@]}" "nohup" "${run_dare}" "${redirection[@]}" "&" "echo \$!" )
+    pids[$killed]=$("${cmd[@]}")
+    echo -e "\trestarted p$killed_idx ($killed) -- pid=${pids[$killed]}"
+}
+
+# Wait until the restarted server recovered and report the time
+CheckRestart() {
+    for ((t=0; t<600; ++t)); do
+        cmd=( "ssh" "$USER@$killed" "grep \"Server recovered in\"" "$PWD/srv${killed_idx}_2.log" )
+        grep_out=$("${cmd[@]}")
+        if [[ -n $grep_out ]]; then
+            timer_stop
+            echo -e "\t$grep_out"
+            return
+        fi
+        sleep 0.1
+    done
+    StopDare
+    ErrorAndExit "p$killed_idx did not recover"
+}
+
+port=8888
+StartBenchmark() {
+    if [[ "$APP" == "ssdb" ]]; then
+        run_loop=( "${DAREDIR}/apps/ssdb/ssdb-master/tools/ssdb-bench" "$leader" "$port" "$request_count" "$client_count")
+    elif [[ "$APP" == "redis" ]]; then
+        run_loop=( "${DAREDIR}/apps/redis/install/bin/redis-benchmark" "-t set,get" "-h $leader" "-p $port" "-n $request_count" "-c $client_count")
+    fi
+    rounds[$client]=$((rounds[$client] + 1))
+    cmd=( "ssh" "$USER@${client}" "${run_loop[@]}" ">" "clt_${rounds[$client]}.log")
+    $("${cmd[@]}")
+}
+
+DAREDIR=$PWD/..
+APP=""
+client_count=1
+request_count=1000000
+region=0
+for arg in "$@"
+do
+    case ${arg} in
+    --help|-help|-h)
+        usage
+        exit 1
+        ;;
+    --region)
+        region=1
+        ;;
+    --app=*)
+        APP=`echo $arg | sed -e 's/--app=//'`
+        APP=`eval echo ${APP}`    # tilde and variable expansion
+        ;;
+    esac
+done
+
+if [[ "x$APP" == "x" ]]; then
+    ErrorAndExit "No app defined: --app"
+elif [[ "$APP" == "ssdb" ]]; then
+    run_dare="${DAREDIR}/apps/ssdb/ssdb-master/ssdb-server ${DAREDIR}/apps/ssdb/ssdb-master/ssdb.conf"
+elif [[ "$APP" == "redis" ]]; then
+    run_dare="${DAREDIR}/apps/redis/install/bin/redis-server --port $port"
+fi
+
+# list of allocated nodes, e.g., nodes=(n112002 n112001 n111902)
+nodes=(10.22.1.3 10.22.1.4 10.22.1.5 10.22.1.6 10.22.1.7 10.22.1.8 10.22.1.9 202.45.128.159)
+node_count=${#nodes[@]}
+
+echo "Allocated ${node_count} nodes:" > nodes
+for ((i=0; i<${node_count}; ++i)); do
+    echo "$i:${nodes[$i]}" >> nodes
+done
+group_size=5
+
+client=${nodes[-2]}
+echo ">>> client: ${client}"
+
+for ((i=0; i<$node_count; ++i)); do
+    servers[${i}]=${nodes[$i]}
+done
+echo ">>> $(($node_count)) servers: ${servers[@]}"
+
+DGID="ff0e::ffff:e101:101"
+
+rm -f *.log *.region
+
+########################################################################
+
+echo -e "Starting $group_size servers..."
+StartDare
+echo "done"
+sleep 2.5
+FindLeader
+
+# Fill the log and the stable storage
+StartBenchmark
+
+echo -e "Killing a server (non-leader)..."
+KillServer
+sleep 1
+timer_start "Restarting p$killed_idx..."
+RestartServer
+CheckRestart
+StopDare
@@ -0,0 +1,409 @@
+/*
+ * Shared-memory transport microbenchmark: two processes on one host,
+ * connected over the emulated fabric (src/dare/dare_tp_shm.c) as two
+ * servers are: an RC connection and a UD QP each. It reports the
+ * latency of RDMA writes, reads and CAS (one signaled WR at a time),
+ * the rate of writes posted in batches of 64 (the last one signaled)
+ * and the UD round trip (ping-pong, as the control messages); then,
+ * it checks that a write fails with a retry-exceeded error once the
+ * responder resets its QP, as a revoked log access.
+ * The injected one-way latency (usec) models a network; with 0, the
+ * numbers are the cost of the emulation.
+ *
+ * build: gcc -O2 -std=gnu99 -I../src/include/dare -o shm_bench shm_bench.c ../src/dare/dare_tp.c ../src/dare/dare_tp_shm.c -libverbs -lpthread
+ * usage: shm_bench [latency_us] [size] [count]
+ *        shm_bench 2 64 100000
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "dare_tp.h"
+
+FILE *log_fp;
+
+#define BUF_SIZE (1 << 20)
+#define BATCH    64
+#define UD_BUFS  64
+#define UD_SIZE  4096
+#define GRH      40
+
+/* Exchanged between the two processes */
+struct peer_t {
+    volatile int ready;
+    volatile int connected;
+    uint16_t lid;
+    uint32_t rc_qpn;
+    uint32_t ud_qpn;
+    uint32_t rkey;
+    uint64_t addr;
+};
+struct xchg_t {
+    struct peer_t p[2];
+    volatile int revoke;        // the responder resets its QP
+    volatile int revoked;
+    volatile int stop;
+};
+
+static struct xchg_t *xchg;
+static double latency = 0;
+static uint32_t size = 64;
+static uint64_t count = 100000;
+
+static const dare_tp_ops_t *tp = &dare_tp_shm_ops;
+static struct ibv_context *ctx;
+static struct ibv_pd *pd;
+static struct ibv_cq *rc_cq, *ud_cq;
+static struct ibv_qp *rc_qp, *ud_qp;
+static struct ibv_mr *mr, *ud_mr;
+static char *buf, *ud_buf;
+static struct ibv_ah *ah;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    fprintf(stderr, "%d: %s failed\n", (int)getpid(), what);
+    exit(1);
+}
+
+static void post_ud_recv(uint64_t i)
+{
+    struct ibv_sge sge = {(uint64_t)(ud_buf + i * UD_SIZE), UD_SIZE,
+                          ud_mr->lkey};
+    struct ibv_recv_wr wr, *bad;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = i;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    if (tp->post_recv(ud_qp, &wr, &bad)) die("post_recv");
+}
+
+static void setup(int me)
+{
+    struct ibv_device **list = tp->get_device_list(NULL);
+    struct ibv_port_attr port;
+    struct ibv_qp_init_attr init;
+    struct ibv_qp_attr attr;
+    struct ibv_ah_attr ah_attr;
+    struct peer_t *peer;
+    uint64_t i;
+
+    ctx = tp->open_device(list[0]);
+    if (NULL == ctx) die("open_device");
+    tp->query_port(ctx, 1, &port);
+    pd = tp->alloc_pd(ctx);
+    rc_cq = tp->create_cq(ctx, 4 * BATCH, NULL, NULL, 0);
+    ud_cq = tp->create_cq(ctx, 2 * UD_BUFS, NULL, NULL, 0);
+    /* Remote access: from the transport, so that the peer maps it */
+    buf = (char*)tp->alloc_buf(BUF_SIZE);
+    if (NULL == buf) die("alloc_buf");
+    ud_buf = malloc(UD_BUFS * UD_SIZE);
+    mr = tp->reg_mr(pd, buf, BUF_SIZE, IBV_ACCESS_LOCAL_WRITE |
+            IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ |
+            IBV_ACCESS_REMOTE_ATOMIC);
+    ud_mr = tp->reg_mr(pd, ud_buf, UD_BUFS * UD_SIZE, IBV_ACCESS_LOCAL_WRITE);
+    if ( (NULL == mr) || (NULL == ud_mr) ) die("reg_mr");
+
+    memset(&init, 0, sizeof(init));
+    init.send_cq = init.recv_cq = rc_cq;
+    init.qp_type = IBV_QPT_RC;
+    init.cap.max_send_wr = 4 * BATCH;
+    init.cap.max_recv_wr = 1;
+    init.cap.max_send_sge = init.cap.max_recv_sge = 1;
+    init.cap.max_inline_data = 256;
+    rc_qp = tp->create_qp(pd, &init);
+    init.send_cq = init.recv_cq = ud_cq;
+    init.qp_type = IBV_QPT_UD;
+    init.cap.max_send_wr = UD_BUFS;
+    init.cap.max_recv_wr = UD_BUFS;
+    ud_qp = tp->create_qp(pd, &init);
+    if ( (NULL == rc_qp) || (NULL == ud_qp) ) die("create_qp");
+
+    /* UD: INIT, RTR, RTS */
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_INIT;
+    attr.port_num = 1;
+    attr.qkey = 0x11111111;
+    if (tp->modify_qp(ud_qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+                      IBV_QP_PORT | IBV_QP_QKEY)) die("modify_qp");
+    attr.qp_state = IBV_QPS_RTR;
+    if (tp->modify_qp(ud_qp, &attr, IBV_QP_STATE)) die("modify_qp");
+    attr.qp_state = IBV_QPS_RTS;
+    if (tp->modify_qp(ud_qp, &attr, IBV_QP_STATE | IBV_QP_SQ_PSN))
+        die("modify_qp");
+    for (i = 0; i < UD_BUFS; i++) post_ud_recv(i);
+
+    /* Publish and wait for the peer */
+    xchg->p[me].lid = port.lid;
+    xchg->p[me].rc_qpn = rc_qp->qp_num;
+    xchg->p[me].ud_qpn = ud_qp->qp_num;
+    xchg->p[me].rkey = mr->rkey;
+    xchg->p[me].addr = (uint64_t)buf;
+    __sync_synchronize();
+    xchg->p[me].ready = 1;
+    while (!xchg->p[1 - me].ready) sched_yield();
+    peer = &xchg->p[1 - me];
+
+    memset(&ah_attr, 0, sizeof(ah_attr));
+    ah_attr.dlid = peer->lid;
+    ah_attr.port_num = 1;
+    ah = tp->create_ah(pd, &ah_attr);
+
+    /* RC: connect to the peer */
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_INIT;
+    attr.port_num = 1;
+    attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ |
+                           IBV_ACCESS_REMOTE_ATOMIC;
+    if (tp->modify_qp(rc_qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+                      IBV_QP_PORT | IBV_QP_ACCESS_FLAGS)) die("modify_qp");
+    attr.qp_state = IBV_QPS_RTR;
+    attr.path_mtu = IBV_MTU_4096;
+    attr.dest_qp_num = peer->rc_qpn;
+    attr.rq_psn = 13;
+    attr.max_dest_rd_atomic = 16;
+    attr.min_rnr_timer = 12;
+    attr.ah_attr.dlid = peer->lid;
+    attr.ah_attr.port_num = 1;
+    if (tp->modify_qp(rc_qp, &attr, IBV_QP_STATE | IBV_QP_AV |
+                      IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+                      IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER))
+        die("modify_qp");
+    attr.qp_state = IBV_QPS_RTS;
+    attr.sq_psn = 13;
+    attr.timeout = 1;
+    attr.retry_cnt = 0;
+    attr.rnr_retry = 7;
+    attr.max_rd_atomic = 16;
+    if (tp->modify_qp(rc_qp, &attr, IBV_QP_STATE | IBV_QP_SQ_PSN |
+                      IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY |
+                      IBV_QP_MAX_QP_RD_ATOMIC)) die("modify_qp");
+
+    /* The peer must be connected to answer */
+    xchg->p[me].connected = 1;
+    while (!xchg->p[1 - me].connected) sched_yield();
+}
+
+/* Wait for the completion of a signaled WR */
+static enum ibv_wc_status rc_wait()
+{
+    struct ibv_wc wc;
+    int n;
+    while (0 == (n = tp->poll_cq(rc_cq, 1, &wc)));
+    if (n < 0) die("poll_cq");
+    return wc.status;
+}
+
+/* Post a WR on [off, off + len) of the remote buffer, from the same
+range of the local one (or into it) */
+static int rc_post(enum ibv_wr_opcode opcode, uint64_t off, uint32_t len,
+                   int signaled, uint64_t compare, uint64_t swap)
+{
+    struct peer_t *peer = &xchg->p[1];
+    struct ibv_sge sge = {(uint64_t)buf + off, len, mr->lkey};
+    struct ibv_send_wr wr, *bad;
+
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = opcode;
+    wr.send_flags = signaled ? IBV_SEND_SIGNALED : 0;
+    if ( (IBV_WR_RDMA_WRITE == opcode) && (len <= 256) ) {
+        wr.send_flags |= IBV_SEND_INLINE;
+    }
+    if (IBV_WR_ATOMIC_CMP_AND_SWP == opcode) {
+        wr.wr.atomic.remote_addr = peer->addr + off;
+        wr.wr.atomic.rkey = peer->rkey;
+        wr.wr.atomic.compare_add = compare;
+        wr.wr.atomic.swap = swap;
+    }
+    else {
+        wr.wr.rdma.remote_addr = peer->addr + off;
+        wr.wr.rdma.rkey = peer->rkey;
+    }
+    return tp->post_send(rc_qp, &wr, &bad);
+}
+
+static void ud_send(uint32_t remote_qpn, uint32_t len)
+{
+    struct ibv_sge sge = {(uint64_t)buf, len, mr->lkey};
+    struct ibv_send_wr wr, *bad;
+    struct ibv_wc wc;
+
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_SEND;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.ud.ah = ah;
+    wr.wr.ud.remote_qpn = remote_qpn;
+    wr.wr.ud.remote_qkey = 0x11111111;
+    if (tp->post_send(ud_qp, &wr, &bad)) die("post_send");
+    while (0 == tp->poll_cq(ud_cq, 1, &wc));
+    if (IBV_WC_SUCCESS != wc.status) die("UD send");
+}
+
+/* Receive a UD message (not a send completion) */
+static int ud_recv(int stop_on_revoke)
+{
+    struct ibv_wc wc;
+    while (1) {
+        if (stop_on_revoke && (xchg->revoke || xchg->stop)) return 0;
+        if (0 == tp->poll_cq(ud_cq, 1, &wc)) {
+            sched_yield();
+            continue;
+        }
+        if (IBV_WC_RECV != wc.opcode) continue;
+        if (IBV_WC_SUCCESS != wc.status) die("UD recv");
+        post_ud_recv(wc.wr_id);
+        return 1;
+    }
+}
+
+static void report(const char *name, double t, uint64_t n)
+{
+    printf("%-22s %9.2f us %12.0f ops/s\n", name, t / n * 1e6, n / t);
+}
+
+/* The responder: echoes the UD messages and resets its QP on request */
+static void responder()
+{
+    struct ibv_qp_attr attr;
+
+    while (ud_recv(1)) {
+        ud_send(xchg->p[0].ud_qpn, size);
+    }
+    if (xchg->revoke) {
+        memset(&attr, 0, sizeof(attr));
+        attr.qp_state = IBV_QPS_RESET;
+        if (tp->modify_qp(rc_qp, &attr, IBV_QP_STATE)) die("modify_qp");
+        xchg->revoked = 1;
+    }
+    while (!xchg->stop) sched_yield();
+}
+
+static void requester()
+{
+    uint64_t i, j;
+    double t;
+    uint64_t *word = (uint64_t*)(buf + BUF_SIZE - 8);
+    enum ibv_wc_status status;
+
+    /* Write latency; the data is read back */
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        buf[0] = (char)i;
+        if (rc_post(IBV_WR_RDMA_WRITE, 0, size, 1, 0, 0)) die("post_send");
+        if (IBV_WC_SUCCESS != rc_wait()) die("write");
+    }
+    report("RDMA write latency", now_sec() - t, count);
+
+    /* Read latency */
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        if (rc_post(IBV_WR_RDMA_READ, size, size, 1, 0, 0)) die("post_send");
+        if (IBV_WC_SUCCESS != rc_wait()) die("read");
+    }
+    report("RDMA read latency", now_sec() - t, count);
+    buf[0] = 0;
+    if (rc_post(IBV_WR_RDMA_READ, 0, size, 1, 0, 0)) die("post_send");
+    if (IBV_WC_SUCCESS != rc_wait()) die("read");
+    if (buf[0] != (char)(count - 1)) die("check of the written data");
+
+    /* CAS latency: each one succeeds */
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        if (rc_post(IBV_WR_ATOMIC_CMP_AND_SWP, BUF_SIZE - 8, 8, 1, i, i + 1))
+            die("post_send");
+        if (IBV_WC_SUCCESS != rc_wait()) die("CAS");
+        if (*word != i) die("check of the CAS");
+    }
+    report("CAS latency", now_sec() - t, count);
+
+    /* Write rate */
+    t = now_sec();
+    for (i = 0; i < count; i += BATCH) {
+        for (j = 0; j < BATCH; j++) {
+            if (rc_post(IBV_WR_RDMA_WRITE, (j * size) % (BUF_SIZE / 2), size,
+                        BATCH - 1 == j, 0, 0)) die("post_send");
+        }
+        if (IBV_WC_SUCCESS != rc_wait()) die("write");
+    }
+    report("RDMA write rate", now_sec() - t, i);
+
+    /* UD round trip */
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        ud_send(xchg->p[1].ud_qpn, size);
+        ud_recv(0);
+    }
+    report("UD round trip", now_sec() - t, count);
+
+    /* Revoked access */
+    xchg->revoke = 1;
+    while (!xchg->revoked) sched_yield();
+    if (rc_post(IBV_WR_RDMA_WRITE, 0, size, 1, 0, 0)) die("post_send");
+    status = rc_wait();
+    printf("write after the reset: %s\n", ibv_wc_status_str(status));
+    if (IBV_WC_RETRY_EXC_ERR != status) die("check of the revoked access");
+    if (rc_post(IBV_WR_RDMA_WRITE, 0, size, 1, 0, 0)) die("post_send");
+    status = rc_wait();
+    printf("next write: %s\n", ibv_wc_status_str(status));
+    if (IBV_WC_WR_FLUSH_ERR != status) die("check of the QP in error");
+}
+
+int main(int argc, char **argv)
+{
+    char fabric[64];
+    pid_t pid;
+    int me, st;
+
+    log_fp = stderr;
+    if (argc > 1) latency = atof(argv[1]);
+    if (argc > 2) size = atoi(argv[2]);
+    if (argc > 3) count = strtoull(argv[3], NULL, 10);
+    if (size < 8) size = 8;
+    if (size > UD_SIZE - GRH) size = UD_SIZE - GRH;
+    count = (count + BATCH - 1) / BATCH * BATCH;
+
+    xchg = mmap(NULL, sizeof(struct xchg_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == xchg) die("mmap");
+    memset(xchg, 0, sizeof(struct xchg_t));
+    snprintf(fabric, sizeof(fabric), "shm_bench_%d", (int)getpid());
+    dare_tp_shm_config(fabric, latency);
+    printf("%"PRIu64" ops of %u bytes; injected latency %.1f us\n",
+           count, size, latency);
+
+    fflush(stdout);
+    pid = fork();
+    me = (0 == pid) ? 1 : 0;
+    setup(me);
+    if (me) {
+        responder();
+        tp->close_device(ctx);
+        return 0;
+    }
+    requester();
+    xchg->stop = 1;
+    waitpid(pid, &st, 0);
+    tp->close_device(ctx);
+
+    snprintf(fabric, sizeof(fabric), "/dev/shm/shm_bench_%d", (int)getpid());
+    unlink(fabric);
+    return (WIFEXITED(st) && (0 == WEXITSTATUS(st))) ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+/*
+ * Pipeline microbenchmark: the DARE thread ingests entries (copies the
+ * command into a log and computes a checksum, as a follower that
+ * appends the entries), stores them (write to a file, with an optional
+ * fdatasync every batch, as the stable storage) and replays them (write
+ * to a socket read by another thread, as the application). With one
+ * thread the three steps run in sequence, as in polling(); with the
+ * stages, the DARE thread only ingests and queues the entries to the
+ * persist and apply stages (src/dare/dare_stage.c), replaying only the
+ * stored ones. It reports the throughput and the longest iteration of
+ * the DARE thread, i.e., how late a HB could be sent.
+ *
+ * build: gcc -O2 -std=gnu99 -I../src/include/dare -o stage_bench stage_bench.c ../src/dare/dare_stage.c -lpthread
+ * usage: stage_bench [entries] [cmd_len] [batch] [sync] [dir] [cpu_dare,cpu_persist,cpu_apply]
+ *        stage_bench 1000000 64 64 0 /tmp 0,1,2
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "dare_stage.h"
+
+FILE *log_fp;
+
+static uint64_t entries = 1000000;
+static uint32_t cmd_len = 64;
+static uint64_t batch = 64;
+static int do_sync = 0;
+static const char *dir = "/tmp";
+static int cpu[3] = {-1, -1, -1};
+
+static int store_fd;
+static int app_fd[2];
+static volatile int app_stop;
+static char *log_buf;
+static uint64_t log_len = 64 << 20;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The application: reads the replayed commands */
+static void* app_thread(void *arg)
+{
+    char buf[65536];
+    while (!app_stop) {
+        if (read(app_fd[1], buf, sizeof(buf)) <= 0) break;
+    }
+    return NULL;
+}
+
+/* Ingest: copy the command into the log and checksum it */
+static char* ingest(uint64_t idx, uint64_t *offset)
+{
+    char *entry;
+    uint64_t i, sum = 0;
+
+    if (*offset + cmd_len > log_len) *offset = 0;
+    entry = log_buf + *offset;
+    memset(entry, (int)idx, cmd_len);
+    for (i = 0; i < cmd_len; i += 8) sum += *(uint64_t*)(entry + i);
+    *(uint64_t*)entry = sum ^ idx;
+    *offset += cmd_len;
+    return entry;
+}
+
+static void store(uint64_t idx, void *cmd, uint32_t len)
+{
+    if (write(store_fd, &idx, sizeof(idx)) < 0) {}
+    if (write(store_fd, cmd, len) < 0) {}
+}
+
+static void replay(void *cmd, uint32_t len)
+{
+    if (write(app_fd[0], cmd, len) < 0) {}
+}
+
+static void persist_cb(stage_rec_t *rec, void *arg)
+{
+    store(rec->idx, rec->data, rec->len);
+    if (do_sync && (rec->idx % batch == 0)) fdatasync(store_fd);
+}
+
+static void apply_cb(stage_rec_t *rec, void *arg)
+{
+    replay(rec->data, rec->len);
+}
+
+static void report(const char *name, double t, double max_gap)
+{
+    printf("%-14s %10.0f entries/s %8.1f MB/s   longest iteration %8.1f us\n",
+           name, entries / t, entries * cmd_len / t / 1e6, max_gap * 1e6);
+}
+
+static void run_single()
+{
+    uint64_t idx = 1, i, offset = 0;
+    double start, last, now, max_gap = 0;
+    char *cmd[4096];
+
+    start = last = now_sec();
+    while (idx <= entries) {
+        /* One loop iteration: ingest, persist and apply a batch */
+        for (i = 0; (i < batch) && (idx + i <= entries); i++) {
+            cmd[i] = ingest(idx + i, &offset);
+        }
+        for (i = 0; (i < batch) && (idx + i <= entries); i++) {
+            store(idx + i, cmd[i], cmd_len);
+        }
+        if (do_sync) fdatasync(store_fd);
+        for (i = 0; (i < batch) && (idx + i <= entries); i++) {
+            replay(cmd[i], cmd_len);
+        }
+        idx += i;
+        now = now_sec();
+        if (now - last > max_gap) max_gap = now - last;
+        last = now;
+    }
+    report("single thread", now_sec() - start, max_gap);
+}
+
+static void run_staged()
+{
+    stage_t persist, apply;
+    uint64_t idx = 1, applied = 0, i, offset = 0, stored;
+    double start, last, now, max_gap = 0;
+    char *cmd;
+    /* Ingested, not yet applied commands (the log keeps them) */
+    char **pending = calloc(entries + 1, sizeof(char*));
+
+    stage_start(&persist, "persist", cpu[1], persist_cb, NULL);
+    stage_start(&apply, "apply", cpu[2], apply_cb, NULL);
+
+    start = last = now_sec();
+    while (applied < entries) {
+        /* Ingest a batch and queue it to the persist stage */
+        for (i = 0; (i < batch) && (idx <= entries); i++) {
+            cmd = ingest(idx, &offset);
+            if (0 != stage_push(&persist, idx, 0, 0, 0, cmd, cmd_len)) break;
+            pending[idx++] = cmd;
+        }
+        /* Replay the stored entries */
+        stored = stage_empty(&persist) ? idx - 1 : stage_done(&persist);
+        while (applied < stored) {
+            if (0 != stage_push(&apply, applied + 1, 0, 0, 0,
+                                pending[applied + 1], cmd_len)) break;
+            applied++;
+        }
+        now = now_sec();
+        if (now - last > max_gap) max_gap = now - last;
+        last = now;
+    }
+    stage_drain(&apply);
+    report("stages", now_sec() - start, max_gap);
+
+    stage_stop(&persist);
+    stage_stop(&apply);
+    free(pending);
+}
+
+int main(int argc, char **argv)
+{
+    char path[256];
+    pthread_t app;
+
+    log_fp = stderr;
+    if (argc > 1) entries = strtoull(argv[1], NULL, 10);
+    if (argc > 2) cmd_len = atoi(argv[2]);
+    if (argc > 3) batch = strtoull(argv[3], NULL, 10);
+    if (argc > 4) do_sync = atoi(argv[4]);
+    if (argc > 5) dir = argv[5];
+    if (argc > 6) sscanf(argv[6], "%d,%d,%d", &cpu[0], &cpu[1], &cpu[2]);
+    if (cmd_len < 8) cmd_len = 8;
+    cmd_len = (cmd_len + 7) & ~7;
+    if (batch < 1) batch = 1;
+    if (batch > 4096) batch = 4096;
+
+    log_buf = malloc(log_len);
+    snprintf(path, sizeof(path), "%s/stage_bench.dat", dir);
+    if ( (NULL == log_buf) ||
+        (socketpair(AF_UNIX, SOCK_STREAM, 0, app_fd) != 0) )
+    {
+        perror("setup");
+        return 1;
+    }
+    pthread_create(&app, NULL, app_thread, NULL);
+
+    printf("%"PRIu64" entries of %u bytes; batch %"PRIu64"; sync %d; "
+           "CPUs %d,%d,%d\n", entries, cmd_len, batch, do_sync,
+           cpu[0], cpu[1], cpu[2]);
+
+    stage_pin(pthread_self(), cpu[0]);
+    store_fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    run_single();
+    close(store_fd);
+
+    store_fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    run_staged();
+    close(store_fd);
+    unlink(path);
+
+    app_stop = 1;
+    shutdown(app_fd[0], SHUT_RDWR);
+    pthread_join(app, NULL);
+    return 0;
+}
@@ -0,0 +1,577 @@
+/*
+ * WR rate microbenchmark: RDMA writes over a loopback RC connection
+ * (two QPs on the same port), posted one per doorbell and polling the
+ * CQ after every post (as post_send), and chained in batches, i.e., one
+ * doorbell and one CQ poll per batch (as queue_send / flush_all_sends).
+ * Every 32nd WR is signaled, as the leader does to avoid overflowing the
+ * send queue. Then, it writes log ranges with a window of K = 1..32
+ * outstanding ranges (as update_remote_logs); every range is signaled
+ * and, once it completes, the end offset is written, chained with the
+ * next range. Last, it measures the latency of a replication round at
+ * small payloads: the log write followed by the end offset write (two
+ * dependent round trips) and the log write alone (in-band entries).
+ * Then, the leader throughput of groups of 3, 7, 15 and 31 servers: 
+ * every range is written to each follower over its own loopback 
+ * connection, with a window of LOG_WINDOW ranges per follower; as all 
+ * connections use the same port, the port carries the leader's 
+ * traffic (and the followers', which doubles it on the wire).
+ * Last, the latency of a client read on the leader of groups of 3 and 5
+ * servers: with leases off, every read first reads the SID of each 
+ * follower and waits for a majority (as rc_verify_leadership); with 
+ * leases on, the leader sends a signaled HB to each follower every 
+ * HB_PERIOD and answers the read locally while a majority of HBs 
+ * completed within the last LEASE (as rc_lease_valid).
+ * It runs on real HCAs and on soft-RoCE (rxe); for RoCE, give a GID
+ * index.
+ *
+ * build: gcc -O2 -std=gnu99 -o wr_bench wr_bench.c -libverbs
+ * usage: wr_bench [device] [gid_index] [size] [count]
+ *        wr_bench rxe0 1 64 1000000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <infiniband/verbs.h>
+
+#define SQ_DEPTH    256
+#define SIGNAL_MOD  32
+#define MAX_BATCH   SIGNAL_MOD
+#define END_WR_ID   UINT64_MAX
+#define MAX_FANOUT  30
+#define LOG_WINDOW  8
+#define HB_PERIOD   0.001   /* seconds */
+#define LEASE       0.01    /* seconds, shortened by a drift of 0.1% */
+#define HB_WR_ID    (1ULL << 32)
+
+static struct ibv_context *ctx;
+static struct ibv_pd *pd;
+static struct ibv_cq *cq;
+static struct ibv_qp *qp[2];
+static struct ibv_qp *fqp[2 * MAX_FANOUT];  /* a loopback pair per follower */
+static struct ibv_mr *mr;
+static uint8_t port = 1;
+static int gid_index = -1;
+static uint32_t max_inline;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct ibv_qp* create_qp()
+{
+    struct ibv_qp_init_attr init;
+    struct ibv_qp_attr attr;
+    struct ibv_qp *q;
+
+    memset(&init, 0, sizeof(init));
+    init.send_cq = init.recv_cq = cq;
+    init.qp_type = IBV_QPT_RC;
+    init.cap.max_send_wr = SQ_DEPTH;
+    init.cap.max_recv_wr = 1;
+    init.cap.max_send_sge = init.cap.max_recv_sge = 1;
+    init.cap.max_inline_data = 256;
+    q = ibv_create_qp(pd, &init);
+    if (NULL == q) {
+        init.cap.max_inline_data = 0;
+        q = ibv_create_qp(pd, &init);
+        if (NULL == q) return NULL;
+    }
+    max_inline = init.cap.max_inline_data;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_INIT;
+    attr.port_num = port;
+    attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ |
+                           IBV_ACCESS_LOCAL_WRITE;
+    if (ibv_modify_qp(q, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+                      IBV_QP_PORT | IBV_QP_ACCESS_FLAGS))
+    {
+        return NULL;
+    }
+    return q;
+}
+
+static int connect_qp(struct ibv_qp *q, uint32_t dest_qpn,
+                      struct ibv_port_attr *pattr)
+{
+    struct ibv_qp_attr attr;
+    union ibv_gid gid;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTR;
+    attr.path_mtu = pattr->active_mtu;
+    attr.dest_qp_num = dest_qpn;
+    attr.rq_psn = 55;
+    attr.max_dest_rd_atomic = 1;
+    attr.min_rnr_timer = 12;
+    attr.ah_attr.dlid = pattr->lid;
+    attr.ah_attr.port_num = port;
+    if (gid_index >= 0) {
+        if (ibv_query_gid(ctx, port, gid_index, &gid)) return 1;
+        attr.ah_attr.is_global = 1;
+        attr.ah_attr.grh.dgid = gid;
+        attr.ah_attr.grh.sgid_index = gid_index;
+        attr.ah_attr.grh.hop_limit = 1;
+    }
+    if (ibv_modify_qp(q, &attr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
+                      IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+                      IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER))
+    {
+        return 1;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTS;
+    attr.timeout = 14;
+    attr.retry_cnt = 7;
+    attr.rnr_retry = 7;
+    attr.sq_psn = 55;
+    attr.max_rd_atomic = 1;
+    return ibv_modify_qp(q, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT |
+                         IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY |
+                         IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC);
+}
+
+/* Post count writes of size bytes, batch WRs per post;
+ * @return the elapsed time or a negative value on error */
+static double run(uint8_t *buf, uint32_t size, uint64_t count, int batch)
+{
+    struct ibv_send_wr wr[MAX_BATCH], *bad_wr;
+    struct ibv_sge sg[MAX_BATCH];
+    struct ibv_wc wc[16];
+    uint64_t posted = 0, acked = 0;
+    int i, n, ne;
+    double t;
+
+    t = now_sec();
+    while (posted < count) {
+        n = (count - posted < (uint64_t)batch) ? (int)(count - posted) : batch;
+        while (posted + n - acked > SQ_DEPTH - SIGNAL_MOD) {
+            /* The send queue is full; wait for a signaled WR */
+            ne = ibv_poll_cq(cq, 16, wc);
+            for (i = 0; i < ne; i++) {
+                if (wc[i].status != IBV_WC_SUCCESS) return -1;
+                acked += SIGNAL_MOD;
+            }
+        }
+        for (i = 0; i < n; i++) {
+            memset(&sg[i], 0, sizeof(sg[i]));
+            sg[i].addr = (uint64_t)buf;
+            sg[i].length = size;
+            sg[i].lkey = mr->lkey;
+            memset(&wr[i], 0, sizeof(wr[i]));
+            wr[i].wr_id = posted + i;
+            wr[i].sg_list = &sg[i];
+            wr[i].num_sge = 1;
+            wr[i].opcode = IBV_WR_RDMA_WRITE;
+            if (0 == (posted + i + 1) % SIGNAL_MOD) {
+                wr[i].send_flags |= IBV_SEND_SIGNALED;
+            }
+            if (size <= max_inline) {
+                wr[i].send_flags |= IBV_SEND_INLINE;
+            }
+            wr[i].wr.rdma.remote_addr = (uint64_t)buf + size;
+            wr[i].wr.rdma.rkey = mr->rkey;
+            wr[i].next = (i + 1 < n) ? &wr[i + 1] : NULL;
+        }
+        if (ibv_post_send(qp[0], wr, &bad_wr)) return -1;
+        posted += n;
+        /* Poll the CQ once per post */
+        ne = ibv_poll_cq(cq, 16, wc);
+        for (i = 0; i < ne; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) return -1;
+            acked += SIGNAL_MOD;
+        }
+    }
+    /* Wait for the last signaled WR */
+    while (acked < count - count % SIGNAL_MOD) {
+        ne = ibv_poll_cq(cq, 16, wc);
+        for (i = 0; i < ne; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) return -1;
+            acked += SIGNAL_MOD;
+        }
+    }
+    return now_sec() - t;
+}
+
+static void set_write(struct ibv_send_wr *wr, struct ibv_sge *sg,
+                      uint8_t *buf, uint32_t size, uint64_t wr_id)
+{
+    memset(sg, 0, sizeof(*sg));
+    sg->addr = (uint64_t)buf;
+    sg->length = size;
+    sg->lkey = mr->lkey;
+    memset(wr, 0, sizeof(*wr));
+    wr->wr_id = wr_id;
+    wr->sg_list = sg;
+    wr->num_sge = 1;
+    wr->opcode = IBV_WR_RDMA_WRITE;
+    wr->send_flags = IBV_SEND_SIGNALED;
+    if (size <= max_inline) {
+        wr->send_flags |= IBV_SEND_INLINE;
+    }
+    wr->wr.rdma.remote_addr = (uint64_t)buf + size;
+    wr->wr.rdma.rkey = mr->rkey;
+}
+
+/* Write count ranges of size bytes with up to window ranges outstanding;
+ * the end offset write of the completed ranges is posted before the 
+ * next range, one at a time;
+ * @return the elapsed time or a negative value on error */
+static double run_window(uint8_t *buf, uint32_t size, uint64_t count,
+                         int window)
+{
+    struct ibv_send_wr wr[2], *bad_wr;
+    struct ibv_sge sg[2];
+    struct ibv_wc wc[16];
+    uint64_t posted = 0, acked = 0, end = 0;
+    int i, n, ne, end_posted = 0;
+    double t;
+
+    t = now_sec();
+    while (end < count) {
+        n = 0;
+        if (!end_posted && (end != acked)) {
+            /* The end offset covers the ranges completed so far */
+            set_write(&wr[n], &sg[n], buf, sizeof(uint64_t), END_WR_ID);
+            *(uint64_t*)buf = acked;
+            end_posted = 1;
+            n++;
+        }
+        if ((posted < count) && (posted - acked < (uint64_t)window)) {
+            set_write(&wr[n], &sg[n], buf, size, posted);
+            posted++;
+            n++;
+        }
+        if (n) {
+            wr[0].next = (n > 1) ? &wr[1] : NULL;
+            wr[n - 1].next = NULL;
+            if (ibv_post_send(qp[0], wr, &bad_wr)) return -1;
+        }
+        ne = ibv_poll_cq(cq, 16, wc);
+        for (i = 0; i < ne; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) return -1;
+            if (END_WR_ID == wc[i].wr_id) {
+                end = *(uint64_t*)buf;
+                end_posted = 0;
+            }
+            else {
+                acked++;
+            }
+        }
+    }
+    return now_sec() - t;
+}
+
+/* Wait for the completion of one signaled WR; 0 on success */
+static int wait_one()
+{
+    struct ibv_wc wc;
+    int ne;
+
+    while (0 == (ne = ibv_poll_cq(cq, 1, &wc)));
+    return (ne < 0 || wc.status != IBV_WC_SUCCESS);
+}
+
+/* Replicate count entries of size bytes, one round at a time: the log
+ * write and, once it completes, the end offset write, or only the log
+ * write (the follower appends the entry in-band);
+ * @return the average latency per round (usec) or a negative value on error */
+static double run_round(uint8_t *buf, uint32_t size, uint64_t count,
+                        int end_write)
+{
+    struct ibv_send_wr wr, *bad_wr;
+    struct ibv_sge sg;
+    uint64_t i;
+    double t;
+
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        set_write(&wr, &sg, buf, size, i);
+        if (ibv_post_send(qp[0], &wr, &bad_wr) || wait_one()) return -1;
+        if (!end_write) continue;
+        set_write(&wr, &sg, buf, sizeof(uint64_t), END_WR_ID);
+        if (ibv_post_send(qp[0], &wr, &bad_wr) || wait_one()) return -1;
+    }
+    return (now_sec() - t) * 1e6 / count;
+}
+
+/* Replicate count ranges of size bytes to followers servers, each with 
+ * up to window outstanding ranges (as update_remote_logs); 
+ * @return the elapsed time or a negative value on error */
+static double run_fanout(uint8_t *buf, uint32_t size, uint64_t count,
+                         int followers, int window)
+{
+    struct ibv_send_wr wr, *bad_wr;
+    struct ibv_sge sg;
+    struct ibv_wc wc[16];
+    uint64_t posted[MAX_FANOUT], acked[MAX_FANOUT];
+    int i, ne, done = 0;
+    double t;
+
+    memset(posted, 0, sizeof(posted));
+    memset(acked, 0, sizeof(acked));
+    t = now_sec();
+    while (done < followers) {
+        for (i = 0; i < followers; i++) {
+            if ( (posted[i] < count) && 
+                 (posted[i] - acked[i] < (uint64_t)window) )
+            {
+                set_write(&wr, &sg, buf, size, i);
+                if (ibv_post_send(fqp[2 * i], &wr, &bad_wr)) return -1;
+                posted[i]++;
+            }
+        }
+        ne = ibv_poll_cq(cq, 16, wc);
+        for (i = 0; i < ne; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) return -1;
+            if (++acked[wc[i].wr_id] == count) done++;
+        }
+    }
+    return now_sec() - t;
+}
+
+/* Serve count reads on the leader of a group of followers + 1 servers,
+ * verifying the leadership with a read of each follower's SID (waiting 
+ * for a majority) or, with lease set, locally while a majority of 
+ * servers received an HB within the lease; 
+ * @return the average latency per read (usec) or a negative value on 
+ * error; local is set to the fraction of reads served locally */
+static double run_reads(uint8_t *buf, uint64_t count, int followers,
+                        int lease, double *local)
+{
+    struct ibv_send_wr wr, *bad_wr;
+    struct ibv_sge sg;
+    struct ibv_wc wc[16];
+    double hb_ts[MAX_FANOUT], lease_ts[MAX_FANOUT];
+    double t, total = 0, last_hb = 0;
+    uint64_t i, served = 0, hb_pending = 0;
+    int j, k, ne, ok, pending, quorum = (followers + 1) / 2 + 1;
+
+    memset(lease_ts, 0, sizeof(lease_ts));
+    for (i = 0; i < count; i++) {
+        if (lease && (now_sec() - last_hb > HB_PERIOD)) {
+            /* One HB in flight per follower; not part of the latency */
+            last_hb = now_sec();
+            for (j = 0; j < followers; j++) {
+                if (hb_pending & (1ULL << j)) continue;
+                set_write(&wr, &sg, buf, sizeof(uint64_t), HB_WR_ID | j);
+                if (ibv_post_send(fqp[2 * j], &wr, &bad_wr)) return -1;
+                hb_ts[j] = last_hb;
+                hb_pending |= 1ULL << j;
+            }
+        }
+        t = now_sec();
+        ok = 1;
+        pending = 0;
+        if (lease) {
+            for (j = 0; j < followers; j++) {
+                ok += (t < lease_ts[j] + LEASE * (1 - 0.001));
+            }
+        }
+        if (ok >= quorum) {
+            served++;
+            total += now_sec() - t;
+        }
+        else {
+            /* Read the SID of every follower */
+            ok = 1;
+            for (j = 0; j < followers; j++) {
+                memset(&sg, 0, sizeof(sg));
+                sg.addr = (uint64_t)buf + 128;
+                sg.length = sizeof(uint64_t);
+                sg.lkey = mr->lkey;
+                memset(&wr, 0, sizeof(wr));
+                wr.wr_id = j;
+                wr.sg_list = &sg;
+                wr.num_sge = 1;
+                wr.opcode = IBV_WR_RDMA_READ;
+                wr.send_flags = IBV_SEND_SIGNALED;
+                wr.wr.rdma.remote_addr = (uint64_t)buf;
+                wr.wr.rdma.rkey = mr->rkey;
+                if (ibv_post_send(fqp[2 * j], &wr, &bad_wr)) return -1;
+            }
+            pending = followers;
+        }
+        /* Wait for a majority of SIDs; the other reads complete after 
+        the read is answered; delivered HBs renew the lease */
+        do {
+            ne = ibv_poll_cq(cq, 16, wc);
+            for (k = 0; k < ne; k++) {
+                if (wc[k].status != IBV_WC_SUCCESS) return -1;
+                j = wc[k].wr_id & 0xFF;
+                if (wc[k].wr_id & HB_WR_ID) {
+                    lease_ts[j] = hb_ts[j];
+                    hb_pending &= ~(1ULL << j);
+                    continue;
+                }
+                pending--;
+                if (++ok == quorum) {
+                    total += now_sec() - t;
+                }
+            }
+        } while (pending > 0);
+    }
+    /* Wait for the last HBs */
+    while (hb_pending) {
+        ne = ibv_poll_cq(cq, 16, wc);
+        for (k = 0; k < ne; k++) {
+            if (wc[k].status != IBV_WC_SUCCESS) return -1;
+            hb_pending &= ~(1ULL << (wc[k].wr_id & 0xFF));
+        }
+    }
+    *local = (double)served / count;
+    return total * 1e6 / count;
+}
+
+int main(int argc, char** argv)
+{
+    struct ibv_device **list;
+    struct ibv_port_attr pattr;
+    const char *name = NULL;
+    uint32_t size = 64;
+    uint64_t count = 1000000;
+    int batches[] = {1, 2, 4, 8, 32};
+    int windows[] = {1, 2, 4, 8, 16, 32};
+    uint32_t payloads[] = {8, 64, 256};
+    int groups[] = {3, 7, 15, 31};
+    int read_groups[] = {3, 5};
+    double local;
+    int j, k;
+    int i, num;
+    uint8_t *buf;
+    char label[40];
+    double t;
+
+    if (argc > 1) name = argv[1];
+    if (argc > 2) gid_index = atoi(argv[2]);
+    if (argc > 3) size = strtoul(argv[3], NULL, 10);
+    if (argc > 4) count = strtoull(argv[4], NULL, 10);
+
+    list = ibv_get_device_list(&num);
+    if (NULL == list || 0 == num) {
+        fprintf(stderr, "No RDMA device found\n");
+        return 1;
+    }
+    for (i = 0; i < num; i++) {
+        if (!name || !strcmp(name, ibv_get_device_name(list[i]))) break;
+    }
+    if (i == num) {
+        fprintf(stderr, "Cannot find device %s\n", name);
+        return 1;
+    }
+    ctx = ibv_open_device(list[i]);
+    if (NULL == ctx || ibv_query_port(ctx, port, &pattr)) {
+        fprintf(stderr, "Cannot open device %s\n", ibv_get_device_name(list[i]));
+        return 1;
+    }
+    pd = ibv_alloc_pd(ctx);
+    cq = ibv_create_cq(ctx, 2 * SQ_DEPTH, NULL, NULL, 0);
+    buf = calloc(2, (size > 256) ? size : 256);
+    if (!pd || !cq || !buf) {
+        fprintf(stderr, "Cannot allocate resources\n");
+        return 1;
+    }
+    mr = ibv_reg_mr(pd, buf, 2 * ((size > 256) ? size : 256),
+                    IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
+                    IBV_ACCESS_REMOTE_READ);
+    qp[0] = create_qp();
+    qp[1] = create_qp();
+    if (!mr || !qp[0] || !qp[1] ||
+        connect_qp(qp[0], qp[1]->qp_num, &pattr) ||
+        connect_qp(qp[1], qp[0]->qp_num, &pattr))
+    {
+        fprintf(stderr, "Cannot set up the loopback connection\n");
+        return 1;
+    }
+    printf("%s: %"PRIu64" writes of %"PRIu32" bytes (max inline %"PRIu32")\n",
+           ibv_get_device_name(list[i]), count, size, max_inline);
+
+    for (i = 0; i < (int)(sizeof(batches) / sizeof(int)); i++) {
+        t = run(buf, size, count, batches[i]);
+        if (t < 0) {
+            fprintf(stderr, "Work request failed\n");
+            return 1;
+        }
+        snprintf(label, sizeof(label), "%d WR(s) per doorbell", batches[i]);
+        printf("%-28s %12.2lf Mwr/s\n", label, count / t / 1e6);
+    }
+    for (i = 0; i < (int)(sizeof(windows) / sizeof(int)); i++) {
+        t = run_window(buf, size, count, windows[i]);
+        if (t < 0) {
+            fprintf(stderr, "Work request failed\n");
+            return 1;
+        }
+        snprintf(label, sizeof(label), "window of %d range(s)", windows[i]);
+        printf("%-28s %12.2lf Mrange/s %10.2lf MB/s\n", label,
+               count / t / 1e6, count * (double)size / t / 1e6);
+    }
+    for (i = 0; i < (int)(sizeof(payloads) / sizeof(uint32_t)); i++) {
+        for (j = 1; j >= 0; j--) {
+            t = run_round(buf, payloads[i], count / 10 + 1, j);
+            if (t < 0) {
+                fprintf(stderr, "Work request failed\n");
+                return 1;
+            }
+            snprintf(label, sizeof(label), "round of %"PRIu32" B (%s)",
+                     payloads[i], j ? "log+end" : "in-band");
+            printf("%-28s %12.2lf usec\n", label, t);
+        }
+    }
+    for (i = 0; i < 2 * MAX_FANOUT; i++) {
+        fqp[i] = create_qp();
+        if (NULL == fqp[i]) break;
+        if ( (i & 1) && 
+             (connect_qp(fqp[i - 1], fqp[i]->qp_num, &pattr) ||
+              connect_qp(fqp[i], fqp[i - 1]->qp_num, &pattr)) )
+        {
+            break;
+        }
+    }
+    for (j = 0; j < (int)(sizeof(groups) / sizeof(int)); j++) {
+        if (2 * (groups[j] - 1) > i) {
+            fprintf(stderr, "Cannot connect %d followers\n", groups[j] - 1);
+            break;
+        }
+        t = run_fanout(buf, size, count / 10 + 1, groups[j] - 1, LOG_WINDOW);
+        if (t < 0) {
+            fprintf(stderr, "Work request failed\n");
+            return 1;
+        }
+        snprintf(label, sizeof(label), "group of %d", groups[j]);
+        printf("%-28s %12.2lf Mrange/s %10.2lf MB/s\n", label,
+               (count / 10 + 1) / t / 1e6, 
+               (count / 10 + 1) * (double)size * (groups[j] - 1) / t / 1e6);
+    }
+    for (j = 0; j < (int)(sizeof(read_groups) / sizeof(int)); j++) {
+        for (k = 0; k < 2; k++) {
+            if (2 * (read_groups[j] - 1) > i) break;
+            t = run_reads(buf, count / 10 + 1, read_groups[j] - 1, k, &local);
+            if (t < 0) {
+                fprintf(stderr, "Work request failed\n");
+                return 1;
+            }
+            snprintf(label, sizeof(label), "read, group of %d (%s)",
+                     read_groups[j], k ? "lease" : "verify");
+            printf("%-28s %12.2lf usec %9.1lf%% local\n", label, t, 100 * local);
+        }
+    }
+    for (i = 0; i < 2 * MAX_FANOUT; i++) {
+        if (fqp[i]) ibv_destroy_qp(fqp[i]);
+    }
+
+    ibv_destroy_qp(qp[0]);
+    ibv_destroy_qp(qp[1]);
+    ibv_dereg_mr(mr);
+    ibv_destroy_cq(cq);
+    ibv_dealloc_pd(pd);
+    ibv_close_device(ctx);
+    ibv_free_device_list(list);
+    free(buf);
+    return 0;
+}
@@ -8,6 +8,24 @@ uint64_t elec_timeout_high;
 double rc_info_period;
 double retransmit_period;
 double log_pruning_period;
+double catchup_rate;
+uint64_t log_size_mb;
+int log_hugepages = 1;
+int log_window = 8;
+double idle_timeout = 0.;
+double idle_poll_period = 0.001;
+int loggp_tune = 0;
+char loggp_profile[128] = "";
+double tune_latency_target = 0.;
+double lease_period = 0.;
+double lease_drift = 0.001;
+int pipeline_stages = 0;
+int cpu_dare = -1;
+int cpu_persist = -1;
+int cpu_apply = -1;
+char transport[16] = "ib";
+char shm_fabric[64] = "dare";
+double shm_latency = 0.;
 
 int dare_read_config(const char* config_path){
     config_t config_file;
@@ -34,6 +52,59 @@ int dare_read_config(const char* config_path){
         if(config_setting_lookup_float(dare_global_config,"log_pruning_period",&temp_float)){
             log_pruning_period = temp_float;
         }
+        if(config_setting_lookup_float(dare_global_config,"catchup_rate",&temp_float)){
+            catchup_rate = temp_float;
+        }
+        if(config_setting_lookup_float(dare_global_config,"idle_timeout",&temp_float)){
+            idle_timeout = temp_float;
+        }
+        if(config_setting_lookup_float(dare_global_config,"idle_poll_period",&temp_float)){
+            idle_poll_period = temp_float;
+        }
+        int temp_int;
+        if(config_setting_lookup_int(dare_global_config,"log_hugepages",&temp_int)){
+            log_hugepages = temp_int;
+        }
+        if(config_setting_lookup_int(dare_global_config,"log_window",&temp_int)){
+            log_window = temp_int;
+        }
+        if(config_setting_lookup_int(dare_global_config,"loggp_tune",&temp_int)){
+            loggp_tune = temp_int;
+        }
+        if(config_setting_lookup_float(dare_global_config,"tune_latency_target",&temp_float)){
+            tune_latency_target = temp_float;
+        }
+        if(config_setting_lookup_float(dare_global_config,"lease_period",&temp_float)){
+            lease_period = temp_float;
+        }
+        if(config_setting_lookup_float(dare_global_config,"lease_drift",&temp_float)){
+            lease_drift = temp_float;
+        }
+        if(config_setting_lookup_float(dare_global_config,"shm_latency",&temp_float)){
+            shm_latency = temp_float;
+        }
+        if(config_setting_lookup_int(dare_global_config,"pipeline_stages",&temp_int)){
+            pipeline_stages = temp_int;
+        }
+        if(config_setting_lookup_int(dare_global_config,"cpu_dare",&temp_int)){
+            cpu_dare = temp_int;
+        }
+        if(config_setting_lookup_int(dare_global_config,"cpu_persist",&temp_int)){
+            cpu_persist = temp_int;
+        }
+        if(config_setting_lookup_int(dare_global_config,"cpu_apply",&temp_int)){
+            cpu_apply = temp_int;
+        }
+        const char *temp_str;
+        if(config_setting_lookup_string(dare_global_config,"loggp_profile",&temp_str)){
+            strncpy(loggp_profile, temp_str, sizeof(loggp_profile) - 1);
+        }
+        if(config_setting_lookup_string(dare_global_config,"transport",&temp_str)){
+            strncpy(transport, temp_str, sizeof(transport) - 1);
+        }
+        if(config_setting_lookup_string(dare_global_config,"shm_fabric",&temp_str)){
+            strncpy(shm_fabric, temp_str, sizeof(shm_fabric) - 1);
+        }
         long long temp_int64;
         if(config_setting_lookup_int64(dare_global_config,"elec_timeout_low",&temp_int64)){
             elec_timeout_low = temp_int64;
@@ -41,6 +112,9 @@ int dare_read_config(const char* config_path){
         if(config_setting_lookup_int64(dare_global_config,"elec_timeout_high",&temp_int64)){
             elec_timeout_high = temp_int64;
         }
+        if(config_setting_lookup_int64(dare_global_config,"log_size_mb",&temp_int64)){
+            log_size_mb = temp_int64;
+        }
     }
 
     config_destroy(&config_file);
@@ -13,6 +13,9 @@ int proxy_read_config(struct proxy_node_t* cur_node,const char* config_path){
 
     config_lookup_int(&config_file,"req_log",&cur_node->req_log);
 
+    cur_node->recovery_threads = 4;
+    config_lookup_int(&config_file,"recovery_threads",&cur_node->recovery_threads);
+
     const char* db_name;
     if(!config_lookup_string(&config_file,"db_name",&db_name)){
         goto goto_config_error;
@@ -28,6 +31,27 @@ int proxy_read_config(struct proxy_node_t* cur_node,const char* config_path){
     }
     cur_node->db_name[db_name_len] = '\0';
 
+    db_config_default(&cur_node->db_cfg);
+    const char* db_backend;
+    if(config_lookup_string(&config_file,"db_backend",&db_backend)){
+        strncpy(cur_node->db_cfg.backend,db_backend,sizeof(cur_node->db_cfg.backend)-1);
+    }
+    int temp_int;
+    if(config_lookup_int(&config_file,"db_page_size",&temp_int)){
+        cur_node->db_cfg.page_size = temp_int;
+    }
+    if(config_lookup_int(&config_file,"db_cache_size",&temp_int)){
+        cur_node->db_cfg.cache_size = temp_int;
+    }
+    long long temp_int64;
+    if(config_lookup_int64(&config_file,"db_mem_size",&temp_int64)){
+        cur_node->db_cfg.mem_size = temp_int64;
+    }
+    if(config_lookup_int64(&config_file,"db_segment_size",&temp_int64)){
+        cur_node->db_cfg.segment_size = temp_int64;
+    }
+    config_lookup_int(&config_file,"db_sync",&cur_node->db_cfg.sync);
+
 
     const char* peer_ipaddr=NULL;
     int peer_port=-1;
@@ -142,10 +142,16 @@ void ep_dp_reply_read_req( struct rb_root *root, uint64_t idx )
         ep = rb_entry(node, dare_ep_t, node);
         if (!ep->wait_for_idx) continue;
         if (!verify_leadership) {
-            /* Verify leadership */
-            rc = rc_verify_leadership(&leader);
-            if (0 != rc) {
-                error(log_fp, "Cannot verify leadership\n");
+            /* Verify leadership; no need while a majority of servers 
+            promised not to vote for another candidate */
+            if (rc_lease_valid()) {
+                leader = 1;
+            }
+            else {
+                rc = rc_verify_leadership(&leader);
+                if (0 != rc) {
+                    error(log_fp, "Cannot verify leadership\n");
+                }
             }
             if (0 == leader) {
                 /* No longer the leader; reset the wait idx */
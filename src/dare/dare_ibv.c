@@ -20,6 +20,7 @@
 #include <inttypes.h>
 #include <netinet/in.h>
 #include <time.h>
+#include <fcntl.h>
  
 #include "../include/dare/dare.h"
 #include "../include/dare/dare_ibv.h"
@@ -50,6 +51,19 @@ test_qp_support_rc( struct ibv_context *device_context );
 /* Init and cleaning up */
 #if 1
 
+/**
+ * Select the transport (see dare_tp.h); servers do it before 
+ * allocating the memory that the peers access (see alloc_buf)
+ */
+int dare_ib_select_transport()
+{
+    if (0 != dare_tp_select(transport)) {
+        error_return(1, log_fp, "Unknown transport %s\n", transport);
+    }
+    dare_tp_shm_config(shm_fabric, shm_latency);
+    return 0;
+}
+
 /** 
  * Initialize the IB device 
  *  - ibv_device; ibv_context & ud_init()
@@ -61,8 +75,12 @@ int dare_init_ib_device( uint32_t receive_count )
     int num_devs;
     struct ibv_device **ib_devs = NULL;
     
+    if (0 != dare_ib_select_transport()) {
+        return 1;
+    }
+    
     /* Get list of devices (HCAs) */ 
-    ib_devs = ibv_get_device_list(&num_devs);
+    ib_devs = dare_tp->get_device_list(&num_devs);
     if (0 == num_devs) {
         error_return(1, log_fp, "No HCAs available\n");
     }
@@ -81,13 +99,25 @@ int dare_init_ib_device( uint32_t receive_count )
     }
     
     /* Free device list */
-    ibv_free_device_list(ib_devs);
+    dare_tp->free_device_list(ib_devs);
     
     if (NULL == IBDEV) {
         /* Cannot find device */
         return 1;
     }
     
+    /* Create the completion channel of the CQs; the events are 
+    requested only before the server goes to sleep (idle mode) */
+    IBDEV->cq_channel = dare_tp->create_comp_channel(IBDEV->ib_dev_context);
+    if (NULL == IBDEV->cq_channel) {
+        error_return(1, log_fp, "Cannot create completion channel\n");
+    }
+    i = fcntl(IBDEV->cq_channel->fd, F_GETFL);
+    if (fcntl(IBDEV->cq_channel->fd, F_SETFL, i | O_NONBLOCK) < 0) {
+        error_return(1, log_fp, "Cannot set completion channel "
+                     "non-blocking\n");
+    }
+    
     /* Initialize IB UD connection */
     ud_init(receive_count);
 
@@ -134,9 +164,10 @@ init_one_device( struct ibv_device* ib_dev )
     int i;
     dare_ib_device_t *device = NULL;
     struct ibv_context *dev_context = NULL;
+    struct ibv_device_attr_ex attr_ex;
     
     /* Open up the device */
-    dev_context = ibv_open_device(ib_dev);
+    dev_context = dare_tp->open_device(ib_dev);
     if (NULL == dev_context) {
         goto error;
     }
@@ -159,48 +190,61 @@ init_one_device( struct ibv_device* ib_dev )
     device->request_id = 1;
     
     /* Get device's attributes */
-    if(ibv_query_device(device->ib_dev_context, &device->ib_dev_attr)){
+    if(dare_tp->query_device(device->ib_dev_context, &device->ib_dev_attr)){
         goto error;
     }
     
     if (IBV_ATOMIC_NONE == device->ib_dev_attr.atomic_cap) {
         info(log_fp, "# HCA %s does not support atomic operations\n", 
-             ibv_get_device_name(device->ib_dev));
+             dare_tp->get_device_name(device->ib_dev));
     }
     else {
         info(log_fp, "# HCA %s supports atomic operations\n", 
-             ibv_get_device_name(device->ib_dev));
+             dare_tp->get_device_name(device->ib_dev));
     }
     info(log_fp, "# max_qp_wr=%d\n", device->ib_dev_attr.max_qp_wr);
     info(log_fp, "# max_qp_rd_atom=%d\n", device->ib_dev_attr.max_qp_rd_atom);
     
     if (0 == device->ib_dev_attr.max_srq) {
         info(log_fp, "# HCA %s does not support Shared Receive Queues.\n", 
-             ibv_get_device_name(device->ib_dev));
+             dare_tp->get_device_name(device->ib_dev));
     }
     else {
         info(log_fp, "# HCA %s supports Shared Receive Queues.\n",
-             ibv_get_device_name(device->ib_dev));
+             dare_tp->get_device_name(device->ib_dev));
     }
     
     if (0 == device->ib_dev_attr.max_mcast_grp) {
         info(log_fp, "# HCA %s does not support multicast groups.\n", 
-             ibv_get_device_name(device->ib_dev));
+             dare_tp->get_device_name(device->ib_dev));
     }
     else {
         info(log_fp, "# HCA %s supports multicast groups.\n",
-             ibv_get_device_name(device->ib_dev));
+             dare_tp->get_device_name(device->ib_dev));
     }
     
     info(log_fp, "# HCA %s supports maximum %d WRs.\n", 
-             ibv_get_device_name(device->ib_dev), device->ib_dev_attr.max_qp_wr);
+             dare_tp->get_device_name(device->ib_dev), device->ib_dev_attr.max_qp_wr);
+    
+    /* On-demand paging: the snapshot is read directly into its buffer,
+    which is registered without pinning it (see rc_recover_sm) */
+    memset(&attr_ex, 0, sizeof(attr_ex));
+    if ( (0 == dare_tp->query_device_ex(device->ib_dev_context, NULL, &attr_ex)) &&
+        (attr_ex.odp_caps.general_caps & IBV_ODP_SUPPORT) &&
+        (attr_ex.odp_caps.per_transport_caps.rc_odp_caps & IBV_ODP_SUPPORT_READ) )
+    {
+        device->odp = 1;
+    }
+    info(log_fp, "# HCA %s %s on-demand paging for RC reads.\n",
+             dare_tp->get_device_name(device->ib_dev),
+             device->odp ? "supports" : "does not support");
     
 
     /* Find port */
     device->port_num = 0;
     for (i = 1; i <= device->ib_dev_attr.phys_port_cnt; i++) {
         struct ibv_port_attr ib_port_attr;
-        if (ibv_query_port(device->ib_dev_context, i, &ib_port_attr)) {
+        if (dare_tp->query_port(device->ib_dev_context, i, &ib_port_attr)) {
             goto error;
         }
         if (IBV_PORT_ACTIVE != ib_port_attr.state) {
@@ -210,7 +254,7 @@ init_one_device( struct ibv_device* ib_dev )
         /* find index of pkey 0xFFFF */
         uint16_t pkey, j;
         for (j = 0; j < device->ib_dev_attr.max_pkeys; j++) {
-            if (ibv_query_pkey(device->ib_dev_context, i, j, &pkey)) {
+            if (dare_tp->query_pkey(device->ib_dev_context, i, j, &pkey)) {
                 goto error;
             }
             pkey = ntohs(pkey);// & IB_PKEY_MASK;
@@ -240,7 +284,7 @@ init_one_device( struct ibv_device* ib_dev )
         device->gid_index = 0;
 
         union ibv_gid temp_gid;
-        if (ibv_query_gid(device->ib_dev_context, device->port_num, device->gid_index, &temp_gid)) {
+        if (dare_tp->query_gid(device->ib_dev_context, device->port_num, device->gid_index, &temp_gid)) {
             goto error;
         }
         memcpy(device->gid.raw, temp_gid.raw ,16);
@@ -260,7 +304,7 @@ error:
     }
     /* Free the device context */
     if (NULL != dev_context) {
-        ibv_close_device(dev_context);
+        dare_tp->close_device(dev_context);
     }
     return NULL;      
 }
@@ -311,9 +355,13 @@ free_ib_device()
 {        
     if (NULL != IBDEV) {
         ud_shutdown();
+        
+        if (NULL != IBDEV->cq_channel) {
+            dare_tp->destroy_comp_channel(IBDEV->cq_channel);
+        }
     
         if (NULL != IBDEV->ib_dev_context) {
-            ibv_close_device(IBDEV->ib_dev_context);
+            dare_tp->close_device(IBDEV->ib_dev_context);
         }
     
         free(IBDEV);
@@ -365,9 +413,15 @@ int dare_ib_send_sm_request()
     return rc_send_sm_request();
 }
 
-int dare_ib_send_sm_reply( uint8_t idx, void *s, int reg_mem )
+int dare_ib_send_sm_reply( uint8_t idx, void *s, uint64_t offset, 
+                           uint64_t total, int last, uint64_t seq )
 {
-    return rc_send_sm_reply(idx, s, reg_mem);
+    return rc_send_sm_reply(idx, s, offset, total, last, seq);
+}
+
+int dare_ib_send_sm_ack( uint8_t idx, uint64_t seq )
+{
+    return rc_send_sm_ack(idx, seq);
 }
 
 int dare_ib_recover_sm( uint8_t idx )
@@ -401,6 +455,19 @@ int dare_ib_send_hb_reply( uint8_t idx )
     return rc_send_hb_reply(idx);
 }
 
+/**
+ * Send my status record (apply offset) to the leader
+ */
+int dare_ib_send_status( uint8_t idx )
+{
+    return rc_send_status(idx);
+}
+
+void dare_ib_report_wr_rate()
+{
+    rc_report_wr_rate();
+}
+
 #endif 
 
 /* ================================================================== */
@@ -452,9 +519,12 @@ int dare_ib_write_remote_logs( int wait_for_commit )
     return rc_write_remote_logs(wait_for_commit);
 }
 
-int dare_ib_send_entries_reply( uint8_t idx )
+/**
+ * Acknowledge the entries persisted up to entry_idx
+ */
+int dare_ib_send_entries_reply( uint8_t idx, uint64_t entry_idx )
 {
-    return rc_send_entries_reply(idx);
+    return rc_send_entries_reply(idx, entry_idx);
 }
 
 /**
@@ -465,6 +535,29 @@ int dare_ib_get_remote_apply_offsets()
     return rc_get_remote_apply_offsets();
 }
 
+/**
+ * Catch-up from stable storage (lagging followers)
+ */
+int dare_ib_send_catchup_notice( uint8_t idx )
+{
+    return rc_send_catchup_notice(idx);
+}
+
+int dare_ib_send_catchup_request( uint8_t idx )
+{
+    return rc_send_catchup_request(idx);
+}
+
+int dare_ib_send_catchup_reply( uint8_t idx )
+{
+    return rc_send_catchup_reply(idx);
+}
+
+int dare_ib_recv_catchup_chunk( uint8_t idx )
+{
+    return rc_recv_catchup_chunk(idx);
+}
+
 #endif 
 
 /* ================================================================== */
@@ -508,6 +601,80 @@ int dare_ib_restore_log_access()
     return rc_restore_log_access();
 }
 
+/**
+ * Get the remote key of the NC-Buffers
+ */
+uint32_t dare_ib_nc_rkey()
+{
+    return IBDEV->nc_mr->rkey;
+}
+
+#endif 
+
+/* ================================================================== */
+/* Auto-tuning */
+#if 1
+
+/**
+ * Pick the RC parameters (inline cutoff, signaling interval, log 
+ * window) from a profile file or from LogGP measurements
+ */
+int dare_ib_tune( const char *profile_path, double latency_target )
+{
+    return rc_tune(profile_path, latency_target);
+}
+
+#endif 
+
+/* ================================================================== */
+/* Idle mode */
+#if 1
+
+/**
+ * Request an event for the next completion on the CQs that can 
+ * wake up a sleeping server: UD receive (client requests, votes...) 
+ * and RC (own writes and reads)
+ * Note: one-sided writes of the other servers do not create 
+ * completions; the log is checked periodically (see idle_poll_period)
+ */
+int dare_ib_arm_cqs()
+{
+    int i;
+    
+    if (dare_tp->req_notify_cq(IBDEV->ud_rcq, 0)) {
+        error_return(1, log_fp, "Cannot arm UD Receive CQ\n");
+    }
+    for (i = 0; i < 2; i++) {
+        if (NULL == IBDEV->rc_cq[i]) continue;
+        if (dare_tp->req_notify_cq(IBDEV->rc_cq[i], 0)) {
+            error_return(1, log_fp, "Cannot arm RC CQ\n");
+        }
+    }
+    return 0;
+}
+
+/**
+ * Get and acknowledge the pending completion events; the completions 
+ * themselves are polled as usual
+ */
+void dare_ib_get_cq_events()
+{
+    struct ibv_cq *cq;
+    void *cq_context;
+    
+    while (0 == dare_tp->get_cq_event(IBDEV->cq_channel, &cq, &cq_context)) {
+        dare_tp->ack_cq_events(cq, 1);
+    }
+}
+
+/**
+ * File descriptor of the completion channel (readable on events)
+ */
+int dare_ib_cq_fd()
+{
+    return IBDEV->cq_channel->fd;
+}
+
 #endif 
 
 /* ================================================================== */
@@ -571,7 +738,7 @@ int dare_ib_print_ud_qp()
     int rc;
     struct ibv_qp_attr attr;
     struct ibv_qp_init_attr init_attr;
-    rc = ibv_query_qp(IBDEV->ud_qp, &attr, IBV_QP_STATE, &init_attr);
+    rc = dare_tp->query_qp(IBDEV->ud_qp, &attr, IBV_QP_STATE, &init_attr);
     if (0 != rc) {
         error_return(1, log_fp, "ibv_query_qp failed because %s\n",
                              strerror(rc));
@@ -615,12 +782,12 @@ test_qp_support_rc( struct ibv_context *device_context )
     struct ibv_qp *qp = NULL;
     
     /* Try to make both the PD and CQ */
-    pd = ibv_alloc_pd(device_context);
+    pd = dare_tp->alloc_pd(device_context);
     if (NULL == pd) {
         return 1;
     }
     
-    cq = ibv_create_cq(device_context, 2, NULL, NULL, 0);
+    cq = dare_tp->create_cq(device_context, 2, NULL, NULL, 0);
     if (NULL == cq) {
         rc = 1;
         goto out;
@@ -640,22 +807,22 @@ test_qp_support_rc( struct ibv_context *device_context )
     qpia.qp_type = IBV_QPT_RC;
     qpia.sq_sig_all = 0;
     
-    qp = ibv_create_qp(pd, &qpia);
+    qp = dare_tp->create_qp(pd, &qpia);
     if (NULL == qp) {
         rc = 1;
         goto out;
     }
     
-    ibv_destroy_qp(qp);
+    dare_tp->destroy_qp(qp);
     rc = 0;
  
 out:
     /* Free the PD and/or CQ */
     if (NULL != pd) {
-        ibv_dealloc_pd(pd);
+        dare_tp->dealloc_pd(pd);
     }
     if (NULL != cq) {
-        ibv_destroy_cq(cq);
+        dare_tp->destroy_cq(cq);
     }
 
     return rc;   
@@ -682,7 +849,7 @@ int find_max_inline( struct ibv_context *context,
     *max_inline_arg = 0;
 
     /* Make a dummy CQ */
-    cq = ibv_create_cq(context, 1, NULL, NULL, 0);
+    cq = dare_tp->create_cq(context, 1, NULL, NULL, 0);
     if (NULL == cq) {
         return 1;
     }
@@ -702,10 +869,10 @@ int find_max_inline( struct ibv_context *context,
     init_attr.cap.max_inline_data = max_inline_data = 1 << 20;
     rc = 1;
     while (max_inline_data > 0) {
-        qp = ibv_create_qp(pd, &init_attr);
+        qp = dare_tp->create_qp(pd, &init_attr);
         if (NULL != qp) {
             *max_inline_arg = max_inline_data;
-            ibv_destroy_qp(qp);
+            dare_tp->destroy_qp(qp);
             rc = 0;
             break;
         }
@@ -715,7 +882,7 @@ int find_max_inline( struct ibv_context *context,
     
     /* Destroy the temp CQ */
     if (NULL != cq) {
-        ibv_destroy_cq(cq);
+        dare_tp->destroy_cq(cq);
     }
 
     return rc;
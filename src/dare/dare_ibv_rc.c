@@ -14,6 +14,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <stddef.h>
+#include <sys/mman.h>
 
 
 #include "../include/dare/dare_ibv_rc.h"
@@ -28,6 +29,9 @@
 #define RC_SUCCESS    0
 #define RC_INSUCCESS  -1
 
+/* Period (seconds) of the WR rate reports (see rc_report_wr_rate) */
+#define WR_REPORT_PERIOD 10
+
 /* Return code for handling WCs */
 #define WC_SUCCESS      0
 #define WC_ERROR        1
@@ -42,6 +46,8 @@ extern dare_ib_device_t *dare_ib_device;
 #define SRV_DATA ((dare_server_data_t*)dare_ib_device->udata)
 #define CLT_DATA ((dare_client_data_t*)dare_ib_device->udata)
 
+extern dare_log_entry_det_t last_applied_entry;
+
 uint64_t ssn;   // Send Sequence Number
 int wa_flag;
 
@@ -53,6 +59,8 @@ static int
 rc_memory_reg();
 static void
 rc_memory_dereg();
+static void
+free_snapshot();
 static int 
 rc_qp_create( dare_ib_ep_t* ep );
 static void 
@@ -79,6 +87,38 @@ post_send( uint8_t server_id,
            int signaled,
            rem_mem_t rm,
            int *posted_sends );
+static int 
+queue_send( uint8_t server_id, 
+            int qp_id,
+            void *buf,
+            uint32_t len,
+            struct ibv_mr *mr,
+            enum ibv_wr_opcode opcode,
+            int signaled,
+            rem_mem_t rm,
+            int *posted_sends );
+static int 
+post_send_sg( uint8_t server_id, 
+              int qp_id,
+              struct ibv_sge *sges,
+              int num_sge,
+              enum ibv_wr_opcode opcode,
+              int signaled,
+              rem_mem_t rm,
+              int *posted_sends );
+static int 
+queue_send_sg( uint8_t server_id, 
+               int qp_id,
+               struct ibv_sge *sges,
+               int num_sge,
+               enum ibv_wr_opcode opcode,
+               int signaled,
+               rem_mem_t rm,
+               int *posted_sends );
+static int
+flush_sends( uint8_t server_id, int qp_id );
+static int
+flush_all_sends( int qp_id );
 static int
 empty_completion_queue( uint8_t server_id, 
                         int qp_id,
@@ -106,12 +146,35 @@ handle_work_completion( struct ibv_wc *wc, int qp_id );
 
 static int
 log_adjustment();
+static void
+lr_check_nc_chunk( server_t *server, dare_log_entry_det_t *chunk, 
+                   uint64_t len, uint64_t total );
+static void
+lr_window_init( server_t *server, uint64_t end );
+static void
+lr_window_drop( server_t *server );
+static void
+lr_window_completion( server_t *server, uint64_t wr_id, int wc_rc );
+static int
+lr_inband( uint64_t offset );
 static int
 update_remote_logs();
-static int 
-cmpfunc_offset( const void *a, const void *b );
+static int
+send_status( uint8_t idx, int qp_id, int signaled );
+static uint64_t
+status_ack_idx( uint8_t idx );
+static void
+lease_check_acks();
+static void
+lease_work_completion( struct ibv_wc *wc, int qp_id );
 static int 
 cmpfunc_uint64( const void *a, const void *b );
+static double 
+now_usec();
+static void
+tune_observe( double usec );
+static int
+tune_unstash( int qp_id );
 
 
 /* ================================================================== */
@@ -165,13 +228,16 @@ void rc_free()
         IBDEV->rc_wc_array = NULL;
     }
     if (NULL != IBDEV->rc_cq[LOG_QP]) {
-        ibv_destroy_cq(IBDEV->rc_cq[LOG_QP]);
+        dare_tp->destroy_cq(IBDEV->rc_cq[LOG_QP]);
     }
     if (NULL != IBDEV->rc_cq[CTRL_QP]) {
-        ibv_destroy_cq(IBDEV->rc_cq[CTRL_QP]);
+        dare_tp->destroy_cq(IBDEV->rc_cq[CTRL_QP]);
     }
+    /* Drop the cached registrations; the buffers are freed 
+    afterwards (see free_server_data) */
+    mr_cache_free(&IBDEV->mr_cache);
     if (NULL != IBDEV->rc_pd) {
-        ibv_dealloc_pd(IBDEV->rc_pd);
+        dare_tp->dealloc_pd(IBDEV->rc_pd);
     }
     rc_memory_dereg();
 }
@@ -203,19 +269,19 @@ rc_prerequisite()
     info(log_fp, "# IBDEV->rc_cqe = %d\n", IBDEV->rc_cqe);
     
     /* Allocate a RC protection domain */
-    IBDEV->rc_pd = ibv_alloc_pd(IBDEV->ib_dev_context);
+    IBDEV->rc_pd = dare_tp->alloc_pd(IBDEV->ib_dev_context);
     if (NULL == IBDEV->rc_pd) {
         error_return(1, log_fp, "Cannot create PD\n");
     }
 
     /* Create a RC completion queue */
-    IBDEV->rc_cq[LOG_QP] = ibv_create_cq(IBDEV->ib_dev_context, 
-                                   IBDEV->rc_cqe, NULL, NULL, 0);
+    IBDEV->rc_cq[LOG_QP] = dare_tp->create_cq(IBDEV->ib_dev_context, 
+                                   IBDEV->rc_cqe, NULL, IBDEV->cq_channel, 0);
     if (NULL == IBDEV->rc_cq[LOG_QP]) {
         error_return(1, log_fp, "Cannot create LOG CQ\n");
     }
-    IBDEV->rc_cq[CTRL_QP] = ibv_create_cq(IBDEV->ib_dev_context, 
-                                   IBDEV->rc_cqe, NULL, NULL, 0);
+    IBDEV->rc_cq[CTRL_QP] = dare_tp->create_cq(IBDEV->ib_dev_context, 
+                                   IBDEV->rc_cqe, NULL, IBDEV->cq_channel, 0);
     if (NULL == IBDEV->rc_cq[CTRL_QP]) {
         error_return(1, log_fp, "Cannot create CTRL CQ\n");
     }
@@ -228,6 +294,13 @@ rc_prerequisite()
     }
     info(log_fp, "# MAX_INLINE_DATA = %"PRIu32"\n", IBDEV->rc_max_inline_data);
     
+    /* Defaults; rc_tune may change them once connected */
+    IBDEV->rc_inline_cutoff = IBDEV->rc_max_inline_data;
+    IBDEV->rc_signal_interval = IBDEV->rc_max_send_wr >> 2;
+    if (0 == IBDEV->rc_signal_interval) {
+        IBDEV->rc_signal_interval = 1;
+    }
+    
     /* Allocate array for work completion */
     IBDEV->rc_wc_array = (struct ibv_wc*)
             malloc(IBDEV->rc_cqe * sizeof(struct ibv_wc));
@@ -240,9 +313,11 @@ rc_prerequisite()
 static int
 rc_memory_reg()
 {
+    int i;
+    
     /* Register memory for control data: state & private data */
     //debug(log_fp, "CTRL mem addr %"PRIu64"\n", (uint64_t)SRV_DATA->ctrl_data);
-    IBDEV->lcl_mr[CTRL_QP] = ibv_reg_mr(IBDEV->rc_pd,
+    IBDEV->lcl_mr[CTRL_QP] = dare_tp->reg_mr(IBDEV->rc_pd,
             SRV_DATA->ctrl_data, sizeof(ctrl_data_t), 
             IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC | 
             IBV_ACCESS_REMOTE_READ | IBV_ACCESS_LOCAL_WRITE);
@@ -252,7 +327,7 @@ rc_memory_reg()
     }
    
     /* Register memory for local log */    
-    IBDEV->lcl_mr[LOG_QP] = ibv_reg_mr(IBDEV->rc_pd,
+    IBDEV->lcl_mr[LOG_QP] = dare_tp->reg_mr(IBDEV->rc_pd,
             SRV_DATA->log, sizeof(dare_log_t) + SRV_DATA->log->len, 
             IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC | 
             IBV_ACCESS_REMOTE_READ | IBV_ACCESS_LOCAL_WRITE);
@@ -262,12 +337,31 @@ rc_memory_reg()
     }
         
         
-    /* Register memory for the preregister snapshot */
-    IBDEV->prereg_snapshot_mr = ibv_reg_mr(IBDEV->rc_pd, SRV_DATA->prereg_snapshot, 
-            sizeof(snapshot_t) + PREREG_SNAPSHOT_SIZE, 
-            IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC | 
+    /* Register memory for the snapshot chunks */
+    for (i = 0; i < 2; i++) {
+        IBDEV->sm_chunk_mr[i] = dare_tp->reg_mr(IBDEV->rc_pd, SRV_DATA->sm_chunk[i], 
+                sizeof(snapshot_t) + SM_CHUNK_SIZE, 
+                IBV_ACCESS_REMOTE_READ | IBV_ACCESS_LOCAL_WRITE);
+        if (NULL == IBDEV->sm_chunk_mr[i]) {
+            error_return(1, log_fp, "Cannot register memory because %s\n", 
+                        strerror(errno));
+        }
+    }
+    
+    /* Register memory for the catch-up chunk */
+    IBDEV->cu_buf_mr = dare_tp->reg_mr(IBDEV->rc_pd, SRV_DATA->cu_buf, 
+            CATCHUP_BUF_SIZE, 
+            IBV_ACCESS_REMOTE_READ | IBV_ACCESS_LOCAL_WRITE);
+    if (NULL == IBDEV->cu_buf_mr) {
+        error_return(1, log_fp, "Cannot register memory because %s\n", 
+                    strerror(errno));
+    }
+    
+    /* Register memory for the NC-Buffers */
+    IBDEV->nc_mr = dare_tp->reg_mr(IBDEV->rc_pd, SRV_DATA->nc_buf, 
+            SRV_DATA->nc_len, 
             IBV_ACCESS_REMOTE_READ | IBV_ACCESS_LOCAL_WRITE);
-    if (NULL == IBDEV->prereg_snapshot_mr) {
+    if (NULL == IBDEV->nc_mr) {
         error_return(1, log_fp, "Cannot register memory because %s\n", 
                     strerror(errno));
     }
@@ -278,35 +372,44 @@ rc_memory_reg()
 static void
 rc_memory_dereg()
 {
-    int rc;
+    int rc, i;
     
     if (NULL != IBDEV->lcl_mr[LOG_QP]) {
-        rc = ibv_dereg_mr(IBDEV->lcl_mr[LOG_QP]);
+        rc = dare_tp->dereg_mr(IBDEV->lcl_mr[LOG_QP]);
         if (0 != rc) {
             error(log_fp, "Cannot deregister memory");
         }
         IBDEV->lcl_mr[LOG_QP] = NULL;
     }
     if (NULL != IBDEV->lcl_mr[CTRL_QP]) {
-        rc = ibv_dereg_mr(IBDEV->lcl_mr[CTRL_QP]);
+        rc = dare_tp->dereg_mr(IBDEV->lcl_mr[CTRL_QP]);
         if (0 != rc) {
             error(log_fp, "Cannot deregister memory");
         }
         IBDEV->lcl_mr[CTRL_QP] = NULL;
     }
-    if (NULL != IBDEV->prereg_snapshot_mr) {
-        rc = ibv_dereg_mr(IBDEV->prereg_snapshot_mr);
+    for (i = 0; i < 2; i++) {
+        if (NULL != IBDEV->sm_chunk_mr[i]) {
+            rc = dare_tp->dereg_mr(IBDEV->sm_chunk_mr[i]);
+            if (0 != rc) {
+                error(log_fp, "Cannot deregister memory");
+            }
+            IBDEV->sm_chunk_mr[i] = NULL;
+        }
+    }
+    if (NULL != IBDEV->cu_buf_mr) {
+        rc = dare_tp->dereg_mr(IBDEV->cu_buf_mr);
         if (0 != rc) {
             error(log_fp, "Cannot deregister memory");
         }
-        IBDEV->prereg_snapshot_mr = NULL;
+        IBDEV->cu_buf_mr = NULL;
     }
-    if (NULL != IBDEV->snapshot_mr) {
-        rc = ibv_dereg_mr(IBDEV->snapshot_mr);
+    if (NULL != IBDEV->nc_mr) {
+        rc = dare_tp->dereg_mr(IBDEV->nc_mr);
         if (0 != rc) {
             error(log_fp, "Cannot deregister memory");
         }
-        IBDEV->snapshot_mr = NULL;
+        IBDEV->nc_mr = NULL;
     }
 }
 
@@ -325,11 +428,11 @@ rc_qp_create( dare_ib_ep_t* ep )
         qp_init_attr.send_cq = IBDEV->rc_cq[i];
         qp_init_attr.recv_cq = IBDEV->rc_cq[i];
         qp_init_attr.cap.max_inline_data = IBDEV->rc_max_inline_data;
-        qp_init_attr.cap.max_send_sge = 1;  
+        qp_init_attr.cap.max_send_sge = RC_MAX_SGE;  
         qp_init_attr.cap.max_recv_sge = 1;
         qp_init_attr.cap.max_recv_wr = 1;
         qp_init_attr.cap.max_send_wr = IBDEV->rc_max_send_wr;
-        ep->rc_ep.rc_qp[i].qp = ibv_create_qp(IBDEV->rc_pd, &qp_init_attr);
+        ep->rc_ep.rc_qp[i].qp = dare_tp->create_qp(IBDEV->rc_pd, &qp_init_attr);
         if (NULL == ep->rc_ep.rc_qp[i].qp) {
             error_return(1, log_fp, "Cannot create QP\n");
         }
@@ -358,21 +461,21 @@ rc_qp_destroy( dare_ib_ep_t* ep )
     for (i = 0; i < 2; i++) {
         if (NULL == ep->rc_ep.rc_qp[i].qp) continue;
 #if 1        
-        ibv_query_qp(ep->rc_ep.rc_qp[i].qp, &attr, IBV_QP_STATE, &init_attr);
+        dare_tp->query_qp(ep->rc_ep.rc_qp[i].qp, &attr, IBV_QP_STATE, &init_attr);
         if (attr.qp_state != IBV_QPS_RESET) {
             /* Move QP into the ERR state to cancel all outstanding WR */
             memset(&attr, 0, sizeof(attr));
             attr.qp_state = IBV_QPS_ERR;
-            rc = ibv_modify_qp(ep->rc_ep.rc_qp[i].qp, &attr, IBV_QP_STATE);
+            rc = dare_tp->modify_qp(ep->rc_ep.rc_qp[i].qp, &attr, IBV_QP_STATE);
             if (0 != rc) {
                 error(log_fp, "ibv_modify_qp failed because %s\n", strerror(rc));
                 continue;
             }
             /* Empty the corresponding CQ */
-            while (ibv_poll_cq(IBDEV->rc_cq[i], 1, &wc) > 0);// info(log_fp, "while...\n");
+            while (dare_tp->poll_cq(IBDEV->rc_cq[i], 1, &wc) > 0);// info(log_fp, "while...\n");
         }
 #endif        
-        rc = ibv_destroy_qp(ep->rc_ep.rc_qp[i].qp);
+        rc = dare_tp->destroy_qp(ep->rc_ep.rc_qp[i].qp);
         if (0 != rc) {
             error(log_fp, "ibv_destroy_qp failed because %s\n", strerror(rc));
         }
@@ -519,43 +622,28 @@ int rc_send_sm_request()
 }
 
 /**
- * Server recovery: Send SM reply
+ * Server recovery: Send SM reply; publish a chunk of the snapshot
+ * Note: the chunk must be ready, i.e., s is one of the registered 
+ * chunks filled by the snapshot thread (see poll_sm_requests)
  */
-int rc_send_sm_reply( uint8_t target, void *s, int reg_mem )
+int rc_send_sm_reply( uint8_t target, void *s, uint64_t offset, 
+                      uint64_t total, int last, uint64_t seq )
 {
     int rc;
     dare_ib_ep_t *ep;
     rem_mem_t rm;
-    uint32_t offset;
+    uint32_t offs;
     struct ibv_mr *lcl_mr;
     snapshot_t *snapshot = (snapshot_t*)s;
     
     TIMER_INIT;
 
-    /* Set register memory */
-    if (reg_mem) {
-        /* Register memory for the snapshot */
-        if (NULL != IBDEV->snapshot_mr) {
-            /* For some reason the snapshot_mr is already registered */
-            rc = ibv_dereg_mr(IBDEV->snapshot_mr);
-            if (0 != rc) {
-                error(log_fp, "Cannot deregister memory");
-            }
-        }
-        IBDEV->snapshot_mr = ibv_reg_mr(IBDEV->rc_pd, snapshot, 
-                sizeof(snapshot_t) + snapshot->len, 
-                IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC | 
-                IBV_ACCESS_REMOTE_READ | IBV_ACCESS_LOCAL_WRITE);
-        if (NULL == IBDEV->snapshot_mr) {
-            error_return(1, log_fp, "Cannot register memory");
-        }
-    }
     /* Set the local MR */
-    if (snapshot == SRV_DATA->prereg_snapshot) {
-        lcl_mr = IBDEV->prereg_snapshot_mr;
+    if (snapshot == SRV_DATA->sm_chunk[0]) {
+        lcl_mr = IBDEV->sm_chunk_mr[0];
     }
     else {
-        lcl_mr = IBDEV->snapshot_mr;
+        lcl_mr = IBDEV->sm_chunk_mr[1];
     }
     
     /* Send SM reply */
@@ -564,8 +652,12 @@ int rc_send_sm_reply( uint8_t target, void *s, int reg_mem )
     reply->raddr = (uint64_t)snapshot;
     reply->rkey = lcl_mr->rkey;
     reply->len = sizeof(snapshot_t) + snapshot->len;
+    reply->offset = offset;
+    reply->total = total;
+    reply->last = last;
+    reply->seq = seq;
     
-    offset = (uint32_t) (offsetof(ctrl_data_t, sm_rep) 
+    offs = (uint32_t) (offsetof(ctrl_data_t, sm_rep) 
             + sizeof(sm_rep_t) * SRV_DATA->config.idx);
             
     ep = (dare_ib_ep_t*)SRV_DATA->config.servers[target].ep;
@@ -576,7 +668,7 @@ int rc_send_sm_reply( uint8_t target, void *s, int reg_mem )
     TIMER_START(log_fp, "Send SM reply (%"PRIu64")\n", ssn); 
     text(log_fp, "   (p%"PRIu8")\n", target);
         
-    rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + offset;
+    rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + offs;
     rm.rkey = ep->rc_ep.rmt_mr[CTRL_QP].rkey;
     
     /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
@@ -592,58 +684,127 @@ int rc_send_sm_reply( uint8_t target, void *s, int reg_mem )
     return 0;
 }
 
+/**
+ * Server recovery: Acknowledge a chunk of the snapshot; the donor can 
+ * reuse the chunk buffer and publish the next chunk
+ */
+int rc_send_sm_ack( uint8_t target, uint64_t seq )
+{
+    int rc;
+    dare_ib_ep_t *ep;
+    rem_mem_t rm;
+    uint32_t offset;
+    
+    uint64_t *ack = &SRV_DATA->ctrl_data->sm_ack[SRV_DATA->config.idx];
+    *ack = seq;
+    offset = (uint32_t) (offsetof(ctrl_data_t, sm_ack) 
+            + sizeof(uint64_t) * SRV_DATA->config.idx);
+    
+    ep = (dare_ib_ep_t*)SRV_DATA->config.servers[target].ep;
+    if (0 == ep->rc_connected) {
+        return 0;
+    }
+    rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + offset;
+    rm.rkey = ep->rc_ep.rmt_mr[CTRL_QP].rkey;
+    /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
+    rc = post_send(target, CTRL_QP, ack, sizeof(uint64_t), 
+                IBDEV->lcl_mr[CTRL_QP], IBV_WR_RDMA_WRITE, 
+                NOTSIGNALED, rm, NULL);
+    if (0 != rc) {
+        /* This should never happen */
+        error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
+    }
+    
+    return 0;
+}
+
 /**
  * Server recovery: Get the SM of a random picked server referred to 
- * as the target. For this, the target must dump it's SM in a contiguous 
- * buffer that is accessible through RDMA. The SM contains the offset of 
- * the last applied entry; thus, lcl.apply = SM.apply
+ * as the target. The target dumps it's SM in chunks that are accessible 
+ * through RDMA; every chunk is read into a local chunk buffer and then 
+ * copied into the snapshot. With on-demand paging, the chunk data is 
+ * read directly into the snapshot, whose registration does not pin it 
+ * and is cached across recoveries (only the header goes to the chunk 
+ * buffer). The SM contains the offset of the last applied entry; thus, 
+ * after the last chunk, lcl.apply = SM.apply
+ * @return 0 if the chunk was received; -1 to try again later
  * 
  * !!! Note: to avoid connecting the LOG QPs, we use the CTRL QP
  */
 int rc_recover_sm( uint8_t target )
 {
-    int rc;
+    int rc, num_sge = 1;
     rem_mem_t rm;
     uint8_t i, size = get_group_size(SRV_DATA->config);
     int posted_sends[MAX_SERVER_COUNT];
-    TIMER_INIT;
-       
-    /* Set local memory where to store the SM snapshot */
+    sm_rep_t *reply = &SRV_DATA->ctrl_data->sm_rep[target];
+    snapshot_t *chunk = SRV_DATA->sm_chunk[0];
     snapshot_t *snapshot;
-    struct ibv_mr *lcl_mr;
-    if (SRV_DATA->ctrl_data->sm_rep[target].len <= PREREG_SNAPSHOT_SIZE) {
-        info(log_fp, "   # pre-register snapshot\n");
-        snapshot = SRV_DATA->prereg_snapshot;
-        lcl_mr = IBDEV->prereg_snapshot_mr;
+    struct ibv_sge sges[RC_MAX_SGE];
+    struct ibv_mr *mr = NULL;
+    char *data, *src;
+    uint64_t snapshot_size;
+    double ts;
+    TIMER_INIT;
+    
+    if ( (reply->len > sizeof(snapshot_t) + SM_CHUNK_SIZE) || 
+        (reply->offset + reply->len - sizeof(snapshot_t) > reply->total) )
+    {
+        error(log_fp, "Invalid SM reply\n");
+        return -1;
     }
-    else {
-        /* Allocate memory for the snapshot */
-        snapshot = SRV_DATA->snapshot;
-        if (snapshot != NULL) {
-            /* For some reason the snapshot is already allocated */
-            free(snapshot);
-        }
-        rc = posix_memalign((void**)&snapshot, sizeof(uint64_t), 
-            sizeof(snapshot_t) + SRV_DATA->ctrl_data->sm_rep[target].len);
-        if (0 != rc) {
-            error_return(1, log_fp, "Cannot allocate snapshot\n");
-        }
-        /* Register memory for the snapshot */
-        if (NULL != IBDEV->snapshot_mr) {
-            /* For some reason the snapshot_mr is already registered */
-            rc = ibv_dereg_mr(IBDEV->snapshot_mr);
+       
+    /* Allocate memory for the snapshot */
+    if (1 == reply->seq) {
+        ts = now_usec();
+        snapshot_size = sizeof(snapshot_t) + reply->total;
+        if (SRV_DATA->snapshot_size < snapshot_size) {
+            /* Left from a previous transfer, but too small */
+            free_snapshot();
+            rc = posix_memalign((void**)&SRV_DATA->snapshot, PAGE_SIZE, 
+                snapshot_size);
             if (0 != rc) {
-                error(log_fp, "Cannot deregister memory");
+                SRV_DATA->snapshot = NULL;
+                error_return(1, log_fp, "Cannot allocate snapshot\n");
             }
+            SRV_DATA->snapshot_size = snapshot_size;
         }
-        IBDEV->snapshot_mr = ibv_reg_mr(IBDEV->rc_pd, snapshot, 
-            sizeof(snapshot_t) + SRV_DATA->ctrl_data->sm_rep[target].len, 
-            IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC | 
-            IBV_ACCESS_REMOTE_READ | IBV_ACCESS_LOCAL_WRITE);
-        if (NULL == IBDEV->snapshot_mr) {
-            error_return(1, log_fp, "Cannot register memory");
+        SRV_DATA->snapshot->len = 0;
+        if (IBDEV->odp) {
+            /* Register the whole buffer now (or find it in the cache); 
+            without pinning, the time does not depend on its size */
+            mr = mr_cache_get(&IBDEV->mr_cache, IBDEV->rc_pd, 
+                    SRV_DATA->snapshot, SRV_DATA->snapshot_size, 
+                    IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_ON_DEMAND);
+            mr_cache_put(&IBDEV->mr_cache, mr);
+            mr = NULL;
         }
-        lcl_mr = IBDEV->snapshot_mr;
+        info(log_fp, "   # snapshot buffer (%"PRIu64" bytes%s) ready "
+            "in %.1lf usec\n", SRV_DATA->snapshot_size, 
+            IBDEV->odp ? "; on-demand paging" : "", now_usec() - ts);
+    }
+    snapshot = SRV_DATA->snapshot;
+    if (NULL == snapshot) {
+        return -1;
+    }
+    data = snapshot->data + reply->offset;
+    
+    /* The whole chunk goes into the chunk buffer, unless the 
+    snapshot buffer is registered */
+    sges[0].addr = (uint64_t)chunk;
+    sges[0].length = reply->len;
+    sges[0].lkey = IBDEV->sm_chunk_mr[0]->lkey;
+    if ( IBDEV->odp && (reply->len > sizeof(snapshot_t)) ) {
+        mr = mr_cache_get(&IBDEV->mr_cache, IBDEV->rc_pd, 
+                snapshot, SRV_DATA->snapshot_size, 
+                IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_ON_DEMAND);
+    }
+    if (NULL != mr) {
+        sges[0].length = sizeof(snapshot_t);
+        sges[1].addr = (uint64_t)data;
+        sges[1].length = reply->len - sizeof(snapshot_t);
+        sges[1].lkey = mr->lkey;
+        num_sge = 2;
     }
     
     /* Post send op only for the target */
@@ -654,23 +815,22 @@ int rc_recover_sm( uint8_t target )
     TIMER_START(log_fp, "Recover SM (%"PRIu64")\n", ssn); 
     text(log_fp, "   (p%"PRIu8")\n", target);    
     
-    info(log_fp, "   # recover snapshot from p%"PRIu8"\n", target);    
-    
-    rm.raddr = SRV_DATA->ctrl_data->sm_rep[target].raddr;
-    rm.rkey = SRV_DATA->ctrl_data->sm_rep[target].rkey;
+    rm.raddr = reply->raddr;
+    rm.rkey = reply->rkey;
     posted_sends[target] = 1;
-    /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
-    rc = post_send(target, CTRL_QP, snapshot,
-                    SRV_DATA->ctrl_data->sm_rep[target].len, 
-                    lcl_mr, IBV_WR_RDMA_READ, SIGNALED, rm, posted_sends);
+    /* server_id, qp_id, sges, num_sge, opcode, signaled, rm, posted_sends */ 
+    rc = post_send_sg(target, CTRL_QP, sges, num_sge, 
+                    IBV_WR_RDMA_READ, SIGNALED, rm, posted_sends);
     if (0 != rc) {
         /* This should never happen */
         error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
     }
     TIMER_STOP(log_fp);
-    info(log_fp, "   # waiting for snapshot\n");
     
     rc = wait_for_one(posted_sends, CTRL_QP);
+    if (NULL != mr) {
+        mr_cache_put(&IBDEV->mr_cache, mr);
+    }
     if (RC_ERROR == rc) {
         /* This should never happen */
         error_return(1, log_fp, "Cannot get log entries\n");
@@ -679,36 +839,69 @@ int rc_recover_sm( uint8_t target )
         /* Operation failed; try again later */
         return -1;
     }
-    info(log_fp, "   # snapshot recovered; apply it\n");
+    src = (NULL != mr) ? data : chunk->data;
+    if ( (sizeof(snapshot_t) + chunk->len != reply->len) || 
+        (chunk->crc != crc32c(src, chunk->len)) )
+    {
+        /* Corrupted chunk; try again later */
+        error(log_fp, "Corrupted snapshot chunk %"PRIu64"\n", reply->seq);
+        return -1;
+    }
+    if (src != data) {
+        memcpy(data, src, chunk->len);
+    }
+    snapshot->len = reply->offset + chunk->len;
+    if (!reply->last) {
+        return 0;
+    }
+    info(log_fp, "   # snapshot recovered (%"PRIu64" chunks); apply it\n", 
+        reply->seq);
     
     /* Successfully recovered the snapshot - apply it */
+    snapshot->last_entry = chunk->last_entry;
     rc = SRV_DATA->sm->proxy_apply_db_snapshot(snapshot->data, snapshot->len, SRV_DATA->sm->up_para);
     if (0 != rc) {
         error_return(1, log_fp, "Cannot apply SM snapshot\n");
     }
     SRV_DATA->log->apply = snapshot->last_entry.offset;
+    /* The stable storage has no records before the snapshot; thus, 
+    this server cannot help lagging followers catch up from earlier */
+    last_applied_entry = snapshot->last_entry;
+    SRV_DATA->cu_min_idx = snapshot->last_entry.idx + 1;
     
     info(log_fp, "   # snapshot applied; apply = %"PRIu64"\n", SRV_DATA->log->apply);
     
-    /* Free allocated memory if needed */
-    if (SRV_DATA->ctrl_data->sm_rep[target].len > PREREG_SNAPSHOT_SIZE) {
-        if (NULL != IBDEV->snapshot_mr) {
-            rc = ibv_dereg_mr(IBDEV->snapshot_mr);
-            if (0 != rc) {
-                error(log_fp, "Cannot deregister memory");
-            }
-            IBDEV->snapshot_mr = NULL;
-        }
-        if (NULL != SRV_DATA->snapshot) {
-            free(SRV_DATA->snapshot);
-            SRV_DATA->snapshot = NULL;
-        }
+    /* Free allocated memory; with on-demand paging, the buffer and its 
+    registration are kept for the next recovery, only the pages are 
+    returned (the HCA faults them in again) */
+    if (IBDEV->odp) {
+        madvise(SRV_DATA->snapshot, 
+            SRV_DATA->snapshot_size & ~((uint64_t)PAGE_SIZE - 1), 
+            MADV_DONTNEED);
+    }
+    else {
+        free_snapshot();
     }
     info(log_fp, "   # snapshot recovered\n");
     
     return 0;
 }
 
+/**
+ * Free hook of the snapshot buffer: drop its cached registrations 
+ * before the memory is freed
+ */
+static void
+free_snapshot()
+{
+    if (NULL == SRV_DATA->snapshot) return;
+    mr_cache_invalidate(&IBDEV->mr_cache, SRV_DATA->snapshot, 
+                        SRV_DATA->snapshot_size);
+    free(SRV_DATA->snapshot);
+    SRV_DATA->snapshot = NULL;
+    SRV_DATA->snapshot_size = 0;
+}
+
 /**
  * Server recovery:
  *  - Get the commit and the end offsets from a server; 
@@ -720,6 +913,8 @@ int rc_recover_sm( uint8_t target )
  *    the end offsets.
  *  - Set end offset to the commit offset: lcl.end = lcl.commit
  * Note: lcl.head was set when the server receives a reply for the JOIN req
+ * Note: if the log was restored locally, only the entries after the 
+ * restored ones are fetched
  * 
  * !!! Note: to avoid connecting the LOG QPs, we use the CTRL QP
  */
@@ -729,6 +924,7 @@ int rc_recover_log()
     dare_ib_ep_t *ep;
     rem_mem_t rm;
     uint32_t offset, len;
+    uint64_t from;
     uint8_t i, size = get_group_size(SRV_DATA->config);
     uint8_t target;
     int posted_sends[MAX_SERVER_COUNT];
@@ -814,11 +1010,34 @@ int rc_recover_log()
     SRV_DATA->log->end = rmt_offsets->end;
     SRV_DATA->log->commit = rmt_offsets->commit;
     
-    /* Get the log entries between the head and the end offsets */
-    offset = (uint32_t)(offsetof(dare_log_t, entries) 
-            + SRV_DATA->log->head);
-    len = log_offset_end_distance(SRV_DATA->log, SRV_DATA->log->head);
+    from = SRV_DATA->log->head;
+    if (SRV_DATA->rst_end != SRV_DATA->log->len) {
+        /* The entries up to rst_end were restored locally */
+        if (log_offset_end_distance(SRV_DATA->log, SRV_DATA->rst_end) > 
+            log_offset_end_distance(SRV_DATA->log, SRV_DATA->log->head))
+        {
+            /* The target is behind; keep the restored entries, 
+            the leader will handle the rest (log update) */
+            SRV_DATA->log->end = SRV_DATA->rst_end;
+            SRV_DATA->log->commit = SRV_DATA->rst_end;
+            return 0;
+        }
+        if (log_is_offset_larger(SRV_DATA->log, 
+                SRV_DATA->rst_end, SRV_DATA->log->commit))
+        {
+            SRV_DATA->log->commit = SRV_DATA->rst_end;
+        }
+        from = SRV_DATA->rst_end;
+    }
+    
+    /* Get the log entries between the head (or the last restored 
+    entry) and the end offsets */
+    offset = (uint32_t)(offsetof(dare_log_t, entries) + from);
+    len = log_offset_end_distance(SRV_DATA->log, from);
     info(log_fp, "Recovering log entries (len = %"PRIu32" bytes)\n", len);
+    if (0 == len) {
+        return 0;
+    }
     
     /* Post send just for the target */
     for (i = 0; i < size; i++) {
@@ -833,7 +1052,7 @@ int rc_recover_log()
     rm.rkey = ep->rc_ep.rmt_mr[LOG_QP].rkey;
     posted_sends[target] = 1;
     /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
-    rc = post_send(target, CTRL_QP, SRV_DATA->log->entries + SRV_DATA->log->head,
+    rc = post_send(target, CTRL_QP, SRV_DATA->log->entries + from,
                     len, IBDEV->lcl_mr[LOG_QP],
                     IBV_WR_RDMA_READ, SIGNALED, rm, posted_sends);
     if (0 != rc) {
@@ -862,23 +1081,34 @@ int rc_recover_log()
 #if 1
 
 /**
- * Send HB over RDMA (HB = cached SID)
+ * Send HB over RDMA (HB = status record with the cached SID)
  * Only leaders and candidates do this
+ * Note: a follower that acknowledged entries since the previous HB 
+ * sees them as HBs (see persist_new_entries); thus, while the log is 
+ * replicated, the HBs are piggybacked on the log updates
  */
 int rc_send_hb()
 {
-    int rc;
+    int rc, signaled;
     dare_ib_ep_t *ep;
+    server_t *server;
     uint8_t i, size;
+    uint64_t ack_idx;
+    double now = 0;
     
     TIMER_INIT;
     
     /* No need to send HBs to servers in the extended config */
     size = get_group_size(SRV_DATA->config);
     
-    /* Set offset accordingly */
-    uint32_t offset = (uint32_t) (offsetof(ctrl_data_t, hb) 
-                    + sizeof(uint64_t) * SRV_DATA->config.idx);
+    if ( (lease_period > 0) && SID_GET_L(SRV_DATA->ctrl_data->sid) ) {
+        /* Find out which HBs were delivered (see lease_work_completion) */
+        rc = empty_completion_queue(SRV_DATA->config.idx, CTRL_QP, 0, NULL);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot empty completion queue\n");
+        }
+        now = now_usec();
+    }
     
     /* Issue RDMA Write operations */
     ssn++;
@@ -893,14 +1123,36 @@ int rc_send_hb()
             continue;
         }
         //text(log_fp, "   (p%"PRIu8")\n", i);
+        server = &SRV_DATA->config.servers[i];
         
-        rem_mem_t rm;
-        rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + offset;
-        rm.rkey = ep->rc_ep.rmt_mr[CTRL_QP].rkey;
-        /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
-        rc = post_send(i, CTRL_QP, &SRV_DATA->ctrl_data->sid,
-                        sizeof(uint64_t), IBDEV->lcl_mr[CTRL_QP],
-                        IBV_WR_RDMA_WRITE, NOTSIGNALED, rm, NULL);
+        if (SID_GET_L(SRV_DATA->ctrl_data->sid)) {
+            ack_idx = status_ack_idx(i);
+            if (ack_idx != server->hb_ack_idx) {
+                /* New entries acknowledged; the HB was piggybacked 
+                (the acks renew the lease as well, see lease_check_acks) */
+                server->hb_ack_idx = ack_idx;
+                continue;
+            }
+        }
+        
+        /* A leader signals one HB per server at a time; once delivered, 
+        it renews the lease of the server (HBs lost on a QP restart 
+        are given up after a lease period) */
+        signaled = NOTSIGNALED;
+        if (now > 0) {
+            if ( (server->lease_ssn) && 
+                (now - server->lease_hb_ts > lease_period * 1e6) ) 
+            {
+                server->lease_ssn = 0;
+            }
+            if (0 == server->lease_ssn) {
+                signaled = SIGNALED;
+                server->lease_ssn = ssn;
+                server->lease_hb_ts = now;
+            }
+        }
+        
+        rc = send_status(i, CTRL_QP, signaled);
         if (0 != rc) {
             /* This should never happen */
             error_return(1, log_fp, "Cannot post send operation\n");
@@ -912,7 +1164,7 @@ int rc_send_hb()
 }
 
 /**
- * Send HB Reply over RDMA (HB = cached SID)
+ * Send HB Reply over RDMA (HB = status record with the cached SID)
  * Done when receiving an outdated HB
  */
 int rc_send_hb_reply( uint8_t idx )
@@ -923,10 +1175,6 @@ int rc_send_hb_reply( uint8_t idx )
     if (idx >= get_group_size(SRV_DATA->config)) 
         error_return(1, log_fp, "Index out of bound\n");
     
-    /* Set offset accordingly */
-    uint32_t offset = (uint32_t) (offsetof(ctrl_data_t, hb) 
-                    + sizeof(uint64_t) * SRV_DATA->config.idx);
-    
     /* Issue RDMA Write operations */
     ssn++;
     TIMER_START(log_fp, "Sending HB reply (%"PRIu64")\n", ssn);
@@ -939,15 +1187,8 @@ int rc_send_hb_reply( uint8_t idx )
         return 0;
     }
     text(log_fp, "   (p%"PRIu8")\n", idx);
-        
-    rem_mem_t rm;
-    rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + offset;
-    rm.rkey = ep->rc_ep.rmt_mr[CTRL_QP].rkey;
     
-    /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
-    rc = post_send(idx, CTRL_QP, &SRV_DATA->ctrl_data->sid,
-                    sizeof(uint64_t), IBDEV->lcl_mr[CTRL_QP],
-                    IBV_WR_RDMA_WRITE, NOTSIGNALED, rm, NULL);
+    rc = send_status(idx, CTRL_QP, NOTSIGNALED);
     if (0 != rc) {
         /* This should never happen */
         error_return(1, log_fp, "Cannot post send operation\n");
@@ -957,6 +1198,111 @@ int rc_send_hb_reply( uint8_t idx )
     return 0;
 }
 
+/**
+ * Send my status record to the leader if it changed since the last 
+ * one, i.e., the apply offset advanced after the last ack or the 
+ * leader changed; the leader does not need to read the apply offsets 
+ * (see rc_get_remote_apply_offsets)
+ */
+int rc_send_status( uint8_t idx )
+{
+    int rc;
+    status_t *status = &SRV_DATA->ctrl_data->status[SRV_DATA->config.idx];
+    
+    if ( (status->apply == SRV_DATA->log->apply) && 
+        (status->sid == SRV_DATA->ctrl_data->sid) ) 
+    {
+        return 0;
+    }
+    dare_ib_ep_t *ep = (dare_ib_ep_t*)SRV_DATA->config.servers[idx].ep;
+    if (0 == ep->rc_connected) {
+        return 0;
+    }
+    /* Through the LOG QP, as the acks */
+    rc = send_status(idx, LOG_QP, NOTSIGNALED);
+    if (0 != rc) {
+        /* This should never happen */
+        error_return(1, log_fp, "Cannot post send operation\n");
+    }
+    
+    return 0;
+}
+
+/**
+ * Write my status record into status[my idx] of a server, in one 
+ * RDMA write
+ * Note: the writes on the CTRL QP and on the LOG QP are not ordered; 
+ * thus, the HBs (CTRL QP) carry only the SID and the HB counter, and 
+ * the acks and the apply offset go only through the LOG QP, so that 
+ * an older HB cannot move them backwards
+ */
+static int
+send_status( uint8_t idx, int qp_id, int signaled )
+{
+    dare_ib_ep_t *ep = (dare_ib_ep_t*)SRV_DATA->config.servers[idx].ep;
+    status_t *status = &SRV_DATA->ctrl_data->status[SRV_DATA->config.idx];
+    uint32_t offset = (uint32_t) (offsetof(ctrl_data_t, status) 
+                    + sizeof(status_t) * SRV_DATA->config.idx);
+    uint32_t len = sizeof(status_t);
+    rem_mem_t rm;
+    
+    status->sid = SRV_DATA->ctrl_data->sid;
+    status->hb++;
+    if (CTRL_QP == qp_id) {
+        len = offsetof(status_t, ack_idx);
+    }
+    else {
+        status->apply = SRV_DATA->log->apply;
+    }
+    
+    rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + offset;
+    rm.rkey = ep->rc_ep.rmt_mr[CTRL_QP].rkey;
+    /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
+    return post_send(idx, qp_id, status, len, 
+                     IBDEV->lcl_mr[CTRL_QP], IBV_WR_RDMA_WRITE, 
+                     signaled, rm, NULL);
+}
+
+/**
+ * Last entry persisted by a server in my term; the acks from 
+ * a previous term may be for entries that were removed (the SID of 
+ * the record does not tell, as it is newer than the ack)
+ */
+static uint64_t
+status_ack_idx( uint8_t idx )
+{
+    status_t *status = &SRV_DATA->ctrl_data->status[idx];
+    
+    if (status->ack_term != SID_GET_TERM(SRV_DATA->ctrl_data->sid)) {
+        return 0;
+    }
+    return status->ack_idx;
+}
+
+/**
+ * Report the rate of the control WRs (HBs, acks, votes, ...) and 
+ * of the log WRs, every WR_REPORT_PERIOD
+ */
+void rc_report_wr_rate()
+{
+    static double last_ts = 0;
+    static uint64_t last_ctrl = 0, last_log = 0;
+    double now = now_usec(), elapsed;
+    
+    if (0 == last_ts) {
+        last_ts = now;
+        return;
+    }
+    elapsed = (now - last_ts) / 1e6;
+    if (elapsed < WR_REPORT_PERIOD) return;
+    info_wtime(log_fp, "WRs/s: control %.1lf; log %.1lf\n", 
+        (IBDEV->ctrl_wr_count - last_ctrl) / elapsed, 
+        (IBDEV->log_wr_count - last_log) / elapsed);
+    last_ts = now;
+    last_ctrl = IBDEV->ctrl_wr_count;
+    last_log = IBDEV->log_wr_count;
+}
+
 #endif
 
 /* ================================================================== */
@@ -1280,60 +1626,160 @@ int rc_verify_leadership( int *leader )
 }
 
 /**
- * Log adjustment phase
- *  - read the remote commit offset (note that if the remote server has 
- * no not committed entries, we need to set the end offset to the 
- * remote commit offset)
- *  - read the number of not committed entries
- *  - read the not committed entries
- *  - find offset of first non-matching entry and update remote end offset
- * Note: only the leader calls this function
+ * Check if a majority of servers promised not to vote for another 
+ * candidate, i.e., the leader can answer reads without verifying its 
+ * leadership; the servers measure the lease on their own clocks, 
+ * thus, the leader shortens it by the drift bound
  */
-static int
-log_adjustment()
+int rc_lease_valid()
 {
-    int rc, init;
+    double now, lease;
     server_t *server;
-    dare_ib_ep_t *ep;
-    void *local_buf;
-    uint32_t local_buf_len;
-    struct ibv_mr *local_mr;
-    enum ibv_wr_opcode rdma_opcode;
-    rem_mem_t rm;        
-    uint8_t i, size;
-    uint32_t offset;
-    uint64_t remote_commit, *remote_end;
-    dare_nc_buf_t *nc_buf;
-    TIMER_INIT;
+    uint8_t i, j, size, count;
     
-    /* Adjust the log of all servers; 
-    including the ones in the extended configuration;
-    Note: the leader cannot access the logs of not-recovered servers 
-    and all log adjustment operations are going through the LOG QP */
-    size = get_extended_group_size(SRV_DATA->config);
-    for (i = 0, init = 0; i < size; i++) {
-        if ( (i == SRV_DATA->config.idx) ||
-            !CID_IS_SERVER_ON(SRV_DATA->config.cid, i) )
-            continue;
-        
-        /* Server is on and it's not me */
-        server = &SRV_DATA->config.servers[i];
-        if (server->fail_count >= PERMANENT_FAILURE) {
-            /* The leader suspects this server */
-            continue;
-        }
-        if (!server->send_flag) {
-            /* Already waiting for a WR on this QP */
-            continue;
-        }
-
-        ep = (dare_ib_ep_t*)server->ep;
-        if (0 == ep->rc_connected) {
-            /* No RC data for this endpoint */
-            continue;
-        }
-        remote_commit = SRV_DATA->ctrl_data->vote_ack[i];
-        if (SRV_DATA->log->len == remote_commit) {
+    if (lease_period <= 0) {
+        return 0;
+    }
+    if ( !SID_GET_L(SRV_DATA->ctrl_data->sid) || 
+        (SID_GET_IDX(SRV_DATA->ctrl_data->sid) != SRV_DATA->config.idx) )
+    {
+        /* Not the leader */
+        return 0;
+    }
+    lease_check_acks();
+    
+    now = now_usec();
+    lease = lease_period * 1e6 * (1 - lease_drift);
+    for (j = 0; j < 2; j++) {
+        size = SRV_DATA->config.cid.size[j];
+        for (i = 0, count = 0; i < size; i++) {
+            if (i == SRV_DATA->config.idx) {
+                count++;
+                continue;
+            }
+            if (!CID_IS_SERVER_ON(SRV_DATA->config.cid, i)) {
+                continue;
+            }
+            server = &SRV_DATA->config.servers[i];
+            if ( (server->lease_ts > 0) && (now < server->lease_ts + lease) ) {
+                count++;
+            }
+        }
+        if (count <= size / 2) {
+            return 0;
+        }
+        /* Note: for transitional configurations, we need both majorities */
+        if (CID_TRANSIT != SRV_DATA->config.cid.state) break;
+    }
+    return 1;
+}
+
+/**
+ * A server renews its lease before acknowledging new entries; thus, 
+ * the ack of an entry renews the lease from when the entry was posted
+ */
+static void
+lease_check_acks()
+{
+    server_t *server;
+    uint8_t i, size = get_extended_group_size(SRV_DATA->config);
+    
+    for (i = 0; i < size; i++) {
+        server = &SRV_DATA->config.servers[i];
+        if ( (0 == server->lease_idx) || 
+            (status_ack_idx(i) < server->lease_idx) ) {
+            continue;
+        }
+        if (server->lease_idx_ts > server->lease_ts) {
+            server->lease_ts = server->lease_idx_ts;
+        }
+        server->lease_idx = 0;
+    }
+}
+
+/**
+ * A delivered HB renews the lease from when it was posted
+ */
+static void
+lease_work_completion( struct ibv_wc *wc, int qp_id )
+{
+    uint64_t wr_id = wc->wr_id;
+    server_t *server;
+    
+    if (CTRL_QP != qp_id) {
+        return;
+    }
+    server = &SRV_DATA->config.servers[WRID_GET_CONN(wr_id)];
+    if ( (0 == server->lease_ssn) || 
+        (WRID_GET_SSN(wr_id) != server->lease_ssn) ) {
+        return;
+    }
+    if ( (IBV_WC_SUCCESS == wc->status) && 
+        (server->lease_hb_ts > server->lease_ts) ) 
+    {
+        server->lease_ts = server->lease_hb_ts;
+    }
+    server->lease_ssn = 0;
+}
+
+/**
+ * Log adjustment phase
+ *  - read the remote commit offset (note that if the remote server has 
+ * no not committed entries, we need to set the end offset to the 
+ * remote commit offset)
+ *  - read the number of not committed entries
+ *  - read the not committed entries, in chunks, and find offset of 
+ * first non-matching entry
+ *  - update remote end offset
+ * Note: only the leader calls this function
+ */
+static int
+log_adjustment()
+{
+    int rc, init;
+    server_t *server;
+    dare_ib_ep_t *ep;
+    void *local_buf;
+    uint32_t local_buf_len;
+    struct ibv_mr *local_mr;
+    enum ibv_wr_opcode rdma_opcode;
+    rem_mem_t rm;        
+    uint8_t i, size;
+    uint32_t offset;
+    uint64_t remote_commit, *remote_end;
+    dare_nc_desc_t *nc;
+    dare_log_entry_det_t *chunk, *check_chunk = NULL;
+    uint64_t check_len;
+    TIMER_INIT;
+    
+    /* Adjust the log of all servers; 
+    including the ones in the extended configuration;
+    Note: the leader cannot access the logs of not-recovered servers 
+    and all log adjustment operations are going through the LOG QP */
+    size = get_extended_group_size(SRV_DATA->config);
+    for (i = 0, init = 0; i < size; i++) {
+        if ( (i == SRV_DATA->config.idx) ||
+            !CID_IS_SERVER_ON(SRV_DATA->config.cid, i) )
+            continue;
+        
+        /* Server is on and it's not me */
+        server = &SRV_DATA->config.servers[i];
+        if (server->fail_count >= PERMANENT_FAILURE) {
+            /* The leader suspects this server */
+            continue;
+        }
+        if (!server->send_flag) {
+            /* Already waiting for a WR on this QP */
+            continue;
+        }
+
+        ep = (dare_ib_ep_t*)server->ep;
+        if (0 == ep->rc_connected) {
+            /* No RC data for this endpoint */
+            continue;
+        }
+        remote_commit = SRV_DATA->ctrl_data->vote_ack[i];
+        if (SRV_DATA->log->len == remote_commit) {
             /* No vote ACK from this server */
             continue;
         }
@@ -1344,6 +1790,7 @@ log_adjustment()
             init = 1;
         }
         /* Check in what state of log adjustment is this server */
+        check_len = 0;
         switch(server->next_lr_step) {
             case LR_GET_WRITE: 
             { /* Step I: Read the remote commit offset --
@@ -1367,55 +1814,89 @@ log_adjustment()
                     SRV_DATA->log->commit = remote_commit;
                 }
                 /* Set remote offset */
-                offset = (uint32_t) (offsetof(dare_log_t, nc_buf) 
-                            + sizeof(dare_nc_buf_t) * i 
-                            + offsetof(dare_nc_buf_t, len));
+                offset = (uint32_t) (offsetof(dare_log_t, nc) 
+                            + sizeof(dare_nc_desc_t) * i);
                 /* Set send fields */
-                local_buf = &SRV_DATA->log->nc_buf[i].len;
-                local_buf_len = sizeof(uint64_t);
+                local_buf = &SRV_DATA->log->nc[i];
+                local_buf_len = sizeof(dare_nc_desc_t);
                 local_mr = IBDEV->lcl_mr[LOG_QP];;
                 rdma_opcode = IBV_WR_RDMA_READ;
+                server->nc_read = 0;
+                server->nc_checked = 0;
+                server->nc_done = 0;
                 break;
             }
             case LR_GET_NCE:
-            { /*Step II.b): Read the not committed entries */
-                nc_buf = &SRV_DATA->log->nc_buf[i];
-                if (0 == nc_buf->len) {
+            { /*Step II.b): Read the not committed entries in chunks; 
+                 a chunk is compared with the local log while the next 
+                 one is read */
+                nc = &SRV_DATA->log->nc[i];
+                if (0 == nc->len) {
                     /* This server has no not committed entries; 
-                     * log adjustment done */
-                    SRV_DATA->ctrl_data->log_offsets[i].end = 
-                                SRV_DATA->ctrl_data->log_offsets[i].commit;
-                    server->next_lr_step = LR_UPDATE_LOG;
+                     * the end offset is the commit offset */
+                    server->nc_end = SRV_DATA->ctrl_data->log_offsets[i].commit;
+                    server->nc_done = 1;
+                    server->next_lr_step = LR_SET_END;
                     TIMER_INFO(log_fp, "   (p%"PRIu8
                             ": all remote entries are committed)\n", i);
                     continue;
                 }
-                TIMER_INFO(log_fp, "   (p%"PRIu8": get %"PRIu64
-                            " not committed entries)\n", i, nc_buf->len);
-                /* Set remote offset */
-                offset = (uint32_t) (offsetof(dare_log_t, nc_buf) 
-                            + sizeof(dare_nc_buf_t) * i 
-                            + offsetof(dare_nc_buf_t, entries));
-                /* Set send fields */
-                local_buf = nc_buf->entries;
-                local_buf_len = nc_buf->len * sizeof(dare_log_entry_det_t);
-                local_mr = IBDEV->lcl_mr[LOG_QP];;
+                if (server->nc_read > server->nc_checked) {
+                    /* The chunk from nc_checked was read */
+                    check_chunk = SRV_DATA->nc_chunks + NC_CHUNK_ENTRIES * 
+                        (2 * i + (server->nc_checked / NC_CHUNK_ENTRIES) % 2);
+                    check_len = server->nc_read - server->nc_checked;
+                }
+                if (server->nc_done || (server->nc_read == nc->len)) {
+                    /* Nothing more to read */
+                    if (check_len) {
+                        lr_check_nc_chunk(server, check_chunk, check_len, 
+                                          nc->len);
+                    }
+                    if (server->nc_done) {
+                        server->next_lr_step = LR_SET_END;
+                    }
+                    continue;
+                }
+                if (0 == server->nc_read) {
+                    TIMER_INFO(log_fp, "   (p%"PRIu8": get %"PRIu64
+                            " not committed entries)\n", i, nc->len);
+                }
+                /* Read the next chunk */
+                chunk = SRV_DATA->nc_chunks + NC_CHUNK_ENTRIES * 
+                        (2 * i + (server->nc_read / NC_CHUNK_ENTRIES) % 2);
+                local_buf = chunk;
+                local_buf_len = (uint32_t)sizeof(dare_log_entry_det_t) * 
+                        ((nc->len - server->nc_read < NC_CHUNK_ENTRIES) ?
+                        (nc->len - server->nc_read) : NC_CHUNK_ENTRIES);
+                local_mr = IBDEV->nc_mr;
                 rdma_opcode = IBV_WR_RDMA_READ;
+                rm.raddr = nc->raddr + 
+                        server->nc_read * sizeof(dare_log_entry_det_t);
+                rm.rkey = (uint32_t)nc->rkey;
+                server->nc_read += local_buf_len / sizeof(dare_log_entry_det_t);
                 break;
             }
             case LR_SET_END:
             { /* Step III: Adjust remote end offset */
                 /* Set remote offset */
                 offset = (uint32_t) (offsetof(dare_log_t, end));
-                /* Find last matching entry */
+                /* The last matching entry was found while reading 
+                the not committed entries */
                 remote_end = &SRV_DATA->ctrl_data->log_offsets[i].end;
-                *remote_end = log_find_remote_end_offset(SRV_DATA->log, 
-                                            &SRV_DATA->log->nc_buf[i]);
+                *remote_end = server->nc_end;
+                /* Together with the idx of the entry at the end offset 
+                and the term; from now on, the server appends the entries 
+                of this term in-band (see log_scan_entries) */
+                SRV_DATA->ctrl_data->log_offsets[i].band_idx = 
+                        log_offset_idx(SRV_DATA->log, server->nc_end);
+                SRV_DATA->ctrl_data->log_offsets[i].band_term = 
+                        SID_GET_TERM(SRV_DATA->ctrl_data->sid);
                 TIMER_INFO(log_fp, "   (p%"PRIu8
                     ": set end offset to %"PRIu64")\n", i, *remote_end);
                 /* Set send fields */
                 local_buf = remote_end;
-                local_buf_len = sizeof(uint64_t);
+                local_buf_len = 3 * sizeof(uint64_t);
                 local_mr = IBDEV->lcl_mr[CTRL_QP];;
                 rdma_opcode = IBV_WR_RDMA_WRITE;
                 break;
@@ -1425,9 +1906,12 @@ log_adjustment()
                 continue;
             }
         }
-        /* Set address and key of remote memory region */
-        rm.raddr = ep->rc_ep.rmt_mr[LOG_QP].raddr + offset;
-        rm.rkey = ep->rc_ep.rmt_mr[LOG_QP].rkey;
+        /* Set address and key of remote memory region 
+        (the NC-Buffer chunks are in their own region) */
+        if (LR_GET_NCE != server->next_lr_step) {
+            rm.raddr = ep->rc_ep.rmt_mr[LOG_QP].raddr + offset;
+            rm.rkey = ep->rc_ep.rmt_mr[LOG_QP].rkey;
+        }
         
         /* Stop posting sends until a WC is received */
         server->send_flag = 0;
@@ -1443,6 +1927,12 @@ log_adjustment()
             /* This should never happen */
             error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
         }
+        
+        if (check_len) {
+            /* Compare the previous chunk while the next one is read */
+            lr_check_nc_chunk(server, check_chunk, check_len, 
+                              SRV_DATA->log->nc[i].len);
+        }
     }
     if (init) {
         TIMER_STOP(log_fp);
@@ -1450,31 +1940,149 @@ log_adjustment()
     return 0;
 }
 
+/**
+ * Compare a chunk of a remote NC-Buffer with the local log, i.e., the 
+ * len determinants from nc_checked; the last matching entry is known 
+ * once a determinant does not match, or after the last chunk
+ */
+static void
+lr_check_nc_chunk( server_t *server, dare_log_entry_det_t *chunk, 
+                   uint64_t len, uint64_t total )
+{
+    int last_chunk = (server->nc_checked + len == total);
+    
+    if (server->nc_done) {
+        /* A previous chunk did not match; the chunk was read ahead */
+        server->nc_checked += len;
+        return;
+    }
+    if (!log_match_nc_chunk(SRV_DATA->log, chunk, len, last_chunk, 
+                            &server->nc_end) || last_chunk) 
+    {
+        server->nc_done = 1;
+    }
+    server->nc_checked += len;
+}
+
+/**
+ * Start the log update window of a server, once the log adjustment 
+ * is done; end is the remote end offset
+ */
+static void
+lr_window_init( server_t *server, uint64_t end )
+{
+    memset(&server->win, 0, sizeof(lr_window_t));
+    server->win.sent_end = end;
+    server->win.acked_end = end;
+    server->win.remote_end = end;
+}
+
+/**
+ * Drop the outstanding log updates of a server, e.g., the LOG QP was 
+ * restarted and its WRs were cleared; the log is written again 
+ * starting with the end of the last completed range
+ */
+static void
+lr_window_drop( server_t *server )
+{
+    server->win.count = 0;
+    server->win.failed = 0;
+    server->win.end_wr_id = 0;
+    server->win.sent_end = server->win.acked_end;
+}
+
+/**
+ * Handle the WC for a log update of a server; the WRs of a QP complete 
+ * in order, and thus, the WC is either for the end offset update or 
+ * for the oldest range in the window
+ */
+static void
+lr_window_completion( server_t *server, uint64_t wr_id, int wc_rc )
+{
+    lr_window_t *win = &server->win;
+    uint8_t slot;
+    
+    if (wr_id == win->end_wr_id) {
+        /* The end offset update is queued before the range with 
+        the same WR ID */
+        if (WC_SUCCESS == wc_rc) {
+            win->remote_end = 
+                SRV_DATA->ctrl_data->log_offsets[WRID_GET_CONN(wr_id)].end;
+        }
+        else {
+            win->failed = 1;
+        }
+        win->end_wr_id = 0;
+    }
+    else if ( (win->count) && (wr_id == win->wr_id[win->head]) ) {
+        slot = win->head;
+        if (WC_SUCCESS != wc_rc) {
+            /* The following writes are flushed with errors */
+            win->failed = 1;
+        }
+        win->parts[slot]--;
+        if (0 == win->parts[slot]) {
+            /* All the writes of the range completed */
+            if (!win->failed) {
+                win->acked_end = win->end[slot];
+            }
+            win->head = (slot + 1) % LR_WINDOW_MAX;
+            win->count--;
+        }
+    }
+    else {
+        /* Past work completion */
+        return;
+    }
+    if ( (win->failed) && (0 == win->count) && (0 == win->end_wr_id) ) {
+        /* The window is drained; write the log again starting 
+        with the end of the last completed range */
+        win->failed = 0;
+        win->sent_end = win->acked_end;
+    }
+}
+
+/**
+ * Check if a server appends in-band the entries from a given offset, 
+ * i.e., the entry at this offset is of the current term; the entries 
+ * of previous terms (before the first entry of the term) are appended 
+ * only through the end offset (see log_scan_entries)
+ */
+static int
+lr_inband( uint64_t offset )
+{
+    dare_log_entry_t *entry = log_get_entry(SRV_DATA->log, &offset);
+    return ( (NULL != entry) && 
+             (entry->term == SID_GET_TERM(SRV_DATA->ctrl_data->sid)) );
+}
+
 /**
  * Update remote logs that are cleaned up
- *  - write log entries starting with the remote end offset until the 
- * local end offset
- *  - update remote end offset
+ *  - write log entries starting with the end of the last range posted 
+ * until the local end offset; up to log_window ranges are outstanding
+ *  - update remote end offset once a range completes
  * Note: only the leader calls this function
  */
 uint64_t wr_rm_log_cnt;
 int committed;
 char posted_sends_str[512];
 
-uint64_t offsets[MAX_SERVER_COUNT];
 static int
 update_remote_logs()
 {
-    int rc, init, replies;
+    int rc, init;
     server_t *server;
     dare_ib_ep_t *ep;
+    lr_window_t *win;
     void *local_buf[2];
     uint32_t local_buf_len[2];
-    struct ibv_mr *local_mr;
     rem_mem_t rm;
     register uint8_t i, size;
+    uint8_t slot, window, new_range, new_end;
     uint32_t offset;
-    uint64_t *remote_end, *remote_commit;
+    uint64_t *remote_end, *remote_commit, ack_end, lease_idx = 0;
+    dare_log_entry_t *acked;
+    double now = 0;
     TIMER_INIT;
 
     //int posted_sends[MAX_SERVER_COUNT];
@@ -1487,6 +2095,12 @@ update_remote_logs()
     Note: the leader cannot access the logs of not-recovered servers 
     and all log update operations are going through the LOG QP */
     size = get_extended_group_size(SRV_DATA->config);
+    window = (log_window < 1) ? 1 : 
+            ((log_window > LR_WINDOW_MAX) ? LR_WINDOW_MAX : log_window);
+    if (lease_period > 0) {
+        lease_check_acks();
+        now = now_usec();
+    }
 //info(log_fp, "%s:%d size=%d\n", __func__, __LINE__, size);
 //HRT_GET_TIMESTAMP(SRV_DATA->t1);
     for (i = 0, init = 0; i < size; i++) {
@@ -1498,251 +2112,172 @@ update_remote_logs()
         server = &SRV_DATA->config.servers[i];
         ep = (dare_ib_ep_t*)server->ep;
         if ( (server->fail_count >= PERMANENT_FAILURE) 
-                || !server->send_flag
+                || (LR_UPDATE_LOG != server->next_lr_step)
                 || (0 == ep->rc_connected) ) {
-            /* The leader suspects this server */
+            /* The leader suspects this server or 
+            the log adjustment is not done yet */
             continue;
         }
-        /* Check in what state of log adjustment is this server */
-        if (LR_UPDATE_LOG == server->next_lr_step)  { 
-            /* Step I: Update remote logs */
-            /* Check if the server requires a log update */
-            remote_end = &SRV_DATA->ctrl_data->log_offsets[i].end;
-            if (0 == log_offset_end_distance(SRV_DATA->log, *remote_end)) {
-                /* Remote server has all entries */
-                continue;
-            }
-            if (!init) {
-                ssn++;  // increase ssn to avoid past work completions
-                TIMER_START(log_fp, "### Log update (%"PRIu64")\n", ssn);
-                //info_wtime(log_fp, "### Log update (%"PRIu64")\n", ssn);
-                init = 1;
-            }
-            TIMER_INFO(log_fp, "   (p%"PRIu8": write log[%"PRIu64":%"PRIu64"])\n", 
-                        i, *remote_end, SRV_DATA->log->end);
-            //info(log_fp, "   # (p%"PRIu8": write log[%"PRIu64":%"PRIu64"])\n", 
-            //        i, *remote_end, SRV_DATA->log->end);
-            /* Set remote offset */
-            offset = (uint32_t)(offsetof(dare_log_t, entries) + *remote_end);
-                
-            /* Store the leader's current end offset; the remote end offset 
-             * is set to this value after the update completes successfully */
-            server->cached_end_offset = SRV_DATA->log->end;
-            /* Set send fields */
-            if (SRV_DATA->log->end > *remote_end) {
-                local_buf[0] = SRV_DATA->log->entries + *remote_end;
-                local_buf_len[0] = SRV_DATA->log->end - *remote_end;
-                local_buf[1] = NULL;
-                local_buf_len[1] = 0;
-                server->send_count = 1;
-            }
-            else {
-                local_buf[0] = SRV_DATA->log->entries + *remote_end;
-                local_buf_len[0] = SRV_DATA->log->len - *remote_end;
-                local_buf[1] = SRV_DATA->log->entries;
-                local_buf_len[1] = SRV_DATA->log->end;
-                server->send_count = 2;
-            }
-            /* Set send fields */
-            local_mr = IBDEV->lcl_mr[LOG_QP];
-        }
-        else if (LR_UPDATE_END == server->next_lr_step)  { 
-            /* Step II: Update the remote end offsets */
-            if (!init) {
-                ssn++;  // increase ssn to avoid past work completions
-                TIMER_START(log_fp, "### Log update (%"PRIu64")\n", ssn);
-                init = 1;
-//HRT_GET_TIMESTAMP(SRV_DATA->t1);
-//HRT_GET_TIMESTAMP(SRV_DATA->t2);
-            }
-            /* Set remote offset */
-            offset = (uint32_t) (offsetof(dare_log_t, end));
-            /* Set the remote end offset to the cached end offset */
+        win = &server->win;
+        if (win->failed) {
+            /* Wait for the outstanding writes to complete */
+            continue;
+        }
+        /* Check if the server requires a log update: either new entries 
+        (if the window is not full) or a new end offset */
+        new_range = (win->count < window) && 
+                (0 != log_offset_end_distance(SRV_DATA->log, win->sent_end));
+        new_end = (0 == win->end_wr_id) && 
+                (win->acked_end != win->remote_end);
+        if (new_end && lr_inband(win->remote_end)) {
+            /* The server appends the entries in-band; no need for 
+            the end offset update */
+            SRV_DATA->ctrl_data->log_offsets[i].end = win->acked_end;
+            win->remote_end = win->acked_end;
+            new_end = 0;
+        }
+        if (!new_range && !new_end) {
+            continue;
+        }
+        if (!init) {
+            ssn++;  // increase ssn to avoid past work completions
+            TIMER_START(log_fp, "### Log update (%"PRIu64")\n", ssn);
+            init = 1;
+        }
+        rm.rkey = ep->rc_ep.rmt_mr[LOG_QP].rkey;
+        
+        if (new_end) {
+            /* Step II: Update the remote end offset to the end of the 
+            last completed range, while the server cannot append the 
+            entries in-band; the end offset update is queued before 
+            the next range, and thus, it completes first */
             remote_end = &SRV_DATA->ctrl_data->log_offsets[i].end;
-            *remote_end = server->cached_end_offset;
+            *remote_end = win->acked_end;
             TIMER_INFO(log_fp, "   (p%"PRIu8".end=%"PRIu64")\n", i, *remote_end);
-            //info(log_fp, "   # (p%"PRIu8
-            //    ": update end offset to %"PRIu64")\n", i, *remote_end);
-            /* Set send fields */
-            local_buf[0] = remote_end;
-            local_buf_len[0] = sizeof(uint64_t);
+            offset = (uint32_t) (offsetof(dare_log_t, end));
+            rm.raddr = ep->rc_ep.rmt_mr[LOG_QP].raddr + offset;
+            WRID_SET_SSN(win->end_wr_id, ssn);
+            WRID_SET_CONN(win->end_wr_id, i);
+            /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
+            rc = queue_send(i, LOG_QP, remote_end, sizeof(uint64_t), 
+                    IBDEV->lcl_mr[CTRL_QP], IBV_WR_RDMA_WRITE, SIGNALED, rm, NULL); 
+            if (0 != rc) {
+                /* This should never happen */
+                error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
+            }
+        }
+        if (!new_range) {
+            continue;
+        }
+        
+        /* Step I: Write the log entries from the end of the last range 
+        posted until the local end offset */
+        TIMER_INFO(log_fp, "   (p%"PRIu8": write log[%"PRIu64":%"PRIu64"])\n", 
+                    i, win->sent_end, SRV_DATA->log->end);
+        if (SRV_DATA->log->end > win->sent_end) {
+            local_buf[0] = SRV_DATA->log->entries + win->sent_end;
+            local_buf_len[0] = SRV_DATA->log->end - win->sent_end;
             local_buf[1] = NULL;
             local_buf_len[1] = 0;
-            /* Set send fields */
-            local_mr = IBDEV->lcl_mr[CTRL_QP];
         }
         else {
-            continue;
+            local_buf[0] = SRV_DATA->log->entries + win->sent_end;
+            local_buf_len[0] = SRV_DATA->log->len - win->sent_end;
+            local_buf[1] = SRV_DATA->log->entries;
+            local_buf_len[1] = SRV_DATA->log->end;
         }
-
-        /* Set address and key of remote memory region */
+        /* Set remote offset */
+        offset = (uint32_t)(offsetof(dare_log_t, entries) + win->sent_end);
         rm.raddr = ep->rc_ep.rmt_mr[LOG_QP].raddr + offset;
-        rm.rkey = ep->rc_ep.rmt_mr[LOG_QP].rkey;
         
-        /* Stop posting sends until a WC is received */
-        server->send_flag = 0;
-        /* Wait for the completion of the following work request */
-        WRID_SET_SSN(server->next_wr_id, ssn);
-        WRID_SET_CONN(server->next_wr_id, i);
+        /* Add the range to the window */
+        slot = (win->head + win->count) % LR_WINDOW_MAX;
+        win->wr_id[slot] = 0;
+        WRID_SET_SSN(win->wr_id[slot], ssn);
+        WRID_SET_CONN(win->wr_id[slot], i);
+        win->end[slot] = SRV_DATA->log->end;
+        win->parts[slot] = (local_buf_len[1] > 0) ? 2 : 1;
+        win->count++;
+        win->sent_end = SRV_DATA->log->end;
         
-        /* Post send operation */
+        if (now > 0) {
+            /* The ack of the last entry of the range renews the lease 
+            (see lease_check_acks); entries that are never acknowledged 
+            are given up after a lease period */
+            if ( (server->lease_idx) && 
+                (now - server->lease_idx_ts > lease_period * 1e6) ) 
+            {
+                server->lease_idx = 0;
+            }
+            if (0 == server->lease_idx) {
+                if (0 == lease_idx) {
+                    ack_end = log_get_tail(SRV_DATA->log);
+                    acked = log_get_entry(SRV_DATA->log, &ack_end);
+                    lease_idx = acked ? acked->idx : 0;
+                }
+                server->lease_idx = lease_idx;
+                server->lease_idx_ts = now;
+            }
+        }
+        
+        /* Queue send operation; posted with the others (see flush_all_sends) */
         /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
-        //info(log_fp, "Posting send for p%"PRIu8" %"PRIu32" bytes\n", i, local_buf_len[0]);
-//if (server->next_lr_step != LR_UPDATE_END) {
-//    HRT_GET_TIMESTAMP(SRV_DATA->t1);
-//}
-//posted_sends[i] = 1;
-#if 0
-if (server->next_lr_step == LR_UPDATE_END) {
-    sprintf(posted_sends_str, "%s %d-end", posted_sends_str, i);
-}
-else {
-    sprintf(posted_sends_str, "%s %d-log", posted_sends_str, i);
-}
-#endif
-#ifdef DEBUG
-        rc = 
-#endif        
-        post_send(i, LOG_QP, local_buf[0], local_buf_len[0], 
-            local_mr, IBV_WR_RDMA_WRITE, SIGNALED, rm, NULL); 
-//post_send(i, LOG_QP, local_buf[0], local_buf_len[0], 
-//      local_mr, rdma_opcode, SIGNALED, rm, posted_sends); 
-#ifdef DEBUG
+        rc = queue_send(i, LOG_QP, local_buf[0], local_buf_len[0], 
+                IBDEV->lcl_mr[LOG_QP], IBV_WR_RDMA_WRITE, SIGNALED, rm, NULL); 
         if (0 != rc) {
             /* This should never happen */
             error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
         }
-#endif        
-//wait_for_one(posted_sends, LOG_QP);
-//posted_sends[i] = -1;
-
         if (local_buf_len[1] > 0) {
             /* Set remote starting offset */
             offset = (uint32_t)(offsetof(dare_log_t, entries));                            
             rm.raddr = ep->rc_ep.rmt_mr[LOG_QP].raddr + offset;
-            /* Stop posting sends until a WC is received */
-            server->send_flag = 0;
             /* Set Wrap-Around flag */
             wa_flag = 1;
             
-            /* Post send operation */
+            /* Queue send operation; it is chained with the first one */
             /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
-            //info(log_fp, "!!! Posting send for p%"PRIu8" %"PRIu32" bytes\n", i, local_buf_len[1]);
-#ifndef DEBUG            
-            rc = 
-#endif            
-            post_send(i, LOG_QP, local_buf[1], local_buf_len[1], 
-                    local_mr, IBV_WR_RDMA_WRITE, SIGNALED, rm, NULL);
-#ifndef DEBUG            
+            rc = queue_send(i, LOG_QP, local_buf[1], local_buf_len[1], 
+                    IBDEV->lcl_mr[LOG_QP], IBV_WR_RDMA_WRITE, SIGNALED, rm, NULL);
             if (0 != rc) {
                 /* This should never happen */
                 error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
             }
-#endif            
         } 
     }
     if (init) {
         TIMER_STOP(log_fp);
     }
-//HRT_GET_TIMESTAMP(SRV_DATA->t2);
-
-
-    /* Find minimum offset that exists on a majority of servers 
-     * a.k.a find committed entries */
-    uint64_t min_offset = SRV_DATA->log->commit;
-    int j = 0;
-    while(j < 2) {
-        int larger_offset_count = 0;
-        size = SRV_DATA->config.cid.size[j];
-        /* Find the offset of the last valid entry for all servers */
-        for (i = 0; i < size; i++) {
-            if (i == SRV_DATA->config.idx) {
-                offsets[i] = SRV_DATA->log->end;
-                continue;
-            }
-            if ( !CID_IS_SERVER_ON(SRV_DATA->config.cid, i) || 
-                (SRV_DATA->config.servers[i].fail_count >= PERMANENT_FAILURE) ||
-                (SRV_DATA->config.servers[i].next_lr_step != LR_UPDATE_LOG) )
-            {
-                offsets[i] = SRV_DATA->log->commit;
-                continue;
-            }
-            /* Log entries up to the end offset of this server are valid */
-            offsets[i] = SRV_DATA->ctrl_data->log_offsets[i].end;
-            if (log_is_offset_larger(SRV_DATA->log, offsets[i], min_offset)) {
-                larger_offset_count++;
-            }
-        }
-        if (larger_offset_count < size / 2) {
-            if (CID_TRANSIT != SRV_DATA->config.cid.state) 
-                break;
-            if (!j)  {
-                j++; continue;
-            }
-            break;
-        }
-#if 1
-        //sprintf(posted_sends_str, "%s sort", posted_sends_str);
-        /* Sort offsets in ascending order */
-        uint64_t tmp; int k;
-        for (i = 1; i < size; i++) {
-            tmp = offsets[i];
-            k = i;
-            while ((k > 0) && (offsets[k-1] > tmp)) {
-                offsets[k] = offsets[k-1];
-                k--;
-            }
-            offsets[k] = tmp;
-        }
-#else        
-        qsort(offsets, size, sizeof(uint64_t), cmpfunc_offset);
-#endif        
-#if 0        
-char buf[256] = "end offsets: ";
-for (i = 0; i < size; i++) {
-    sprintf(buf, "%s %"PRIu64" ", buf, offsets[i]);
-}
-info(log_fp, "%s\n", buf);
-#endif
-        
-        /* Note: for transitional configurations, we need to keep 
-        the minimum offset over both majorities */
-        if (CID_TRANSIT != SRV_DATA->config.cid.state) {
-            min_offset = offsets[(size-1)/2];
-            break;
-        }
-        else {
-            /* Transitional configuration */
-            uint64_t median = offsets[(size-1)/2];
-            if (!j)  min_offset = median;
-            else if (log_is_offset_larger(SRV_DATA->log, min_offset, median))
-            //else if (min_offset > offsets[(size-1)/2]) 
-                min_offset = offsets[(size-1)/2]; 
-        }
-        j++;
-    }
-
-    min_offset = SRV_DATA->log->commit;
-    while (log_offset_end_distance(SRV_DATA->log, min_offset)) {
-        dare_log_entry_t *entry = log_get_entry(SRV_DATA->log, &min_offset);
-        if (!log_fit_entry(SRV_DATA->log, min_offset, entry)) {
-            min_offset = 0;
-            continue;
-        }
-        replies = 0;
-        for (i = 0; i < size; ++i) {
-            if ((i == SRV_DATA->config.idx) || (entry->reply[i] == 1)) {
-                replies++;
-            }
-        }
-        if (replies < (size / 2 + 1)) {
-            break;
+//HRT_GET_TIMESTAMP(SRV_DATA->t2);
+
+
+    /* Find the last entry that exists on a majority of servers 
+     * a.k.a find committed entries; the acks are the idx of the last 
+     * entry persisted by each server, i.e., monotonic positions in 
+     * the log, and thus, they are compared as plain integers */
+    uint64_t acks[MAX_SERVER_COUNT], commit_idx = 0, last_idx, idx;
+    uint64_t min_offset = log_get_tail(SRV_DATA->log);
+    dare_log_entry_t *last = log_get_entry(SRV_DATA->log, &min_offset);
+    int j;
+    last_idx = last ? last->idx : 0;
+    for (j = 0; j < 2; j++) {
+        size = SRV_DATA->config.cid.size[j];
+        for (i = 0; i < size; i++) {
+            acks[i] = (i == SRV_DATA->config.idx) ? 
+                        last_idx : status_ack_idx(i);
         }
-        min_offset += log_entry_len(entry);
+        idx = log_majority_idx(acks, size);
+        /* Note: for transitional configurations, we need to keep 
+        the minimum idx over both majorities */
+        if (!j || (idx < commit_idx)) commit_idx = idx;
+        if (CID_TRANSIT != SRV_DATA->config.cid.state) break;
     }
+    if (commit_idx > last_idx) {
+        commit_idx = last_idx;
+    }
+    min_offset = log_commit_offset(SRV_DATA->log, commit_idx);
 
-    if (log_is_offset_larger(SRV_DATA->log, min_offset, SRV_DATA->log->commit)) {
-    //if (SRV_DATA->log->commit < min_offset) {
+    if (min_offset != SRV_DATA->log->commit) {
         /* Update local commit offset... */ 
         SRV_DATA->log->commit = min_offset;
 //uint64_t ticks;
@@ -1774,16 +2309,28 @@ info(log_fp, "%s\n", buf);
             continue;
         }
         remote_commit = &SRV_DATA->ctrl_data->log_offsets[i].commit;
-        remote_end = &SRV_DATA->ctrl_data->log_offsets[i].end;
-        if ( (*remote_commit == *remote_end) ||  /* No new log entries on this server */
-            (*remote_commit == SRV_DATA->log->commit) ) /* Remote commit offset is up to date */
-        {
+        if (*remote_commit == SRV_DATA->log->commit) {
+            /* Remote commit offset is up to date */
+            continue;
+        }
+        /* The server appends entries in-band, i.e., its end offset is 
+        not known; the remote commit offset does not pass the last 
+        entry acknowledged by the server */
+        acked = log_get_entry_by_idx(SRV_DATA->log, 
+                    status_ack_idx(i), &ack_end);
+        if (NULL == acked) {
+            /* No acknowledged entries */
+            continue;
+        }
+        ack_end = log_next_offset(SRV_DATA->log, ack_end, acked);
+        if (*remote_commit == ack_end) {
+            /* No new log entries on this server */
             continue;
         }
         *remote_commit = SRV_DATA->log->commit;
-        if (log_is_offset_larger(SRV_DATA->log, *remote_commit, *remote_end)) {
+        if (log_is_offset_larger(SRV_DATA->log, *remote_commit, ack_end)) {
             /* The remote log does not contain all the committed entries */
-            *remote_commit = *remote_end;
+            *remote_commit = ack_end;
         }
         if (!init) {
             ssn++;  // increase ssn to avoid past work completions
@@ -1799,7 +2346,7 @@ info(log_fp, "%s\n", buf);
         rm.raddr = ep->rc_ep.rmt_mr[LOG_QP].raddr + offset;
         rm.rkey = ep->rc_ep.rmt_mr[LOG_QP].rkey;
         
-        /* Post send operation */
+        /* Queue send operation */
         /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
 #if 0        
 sprintf(posted_sends_str, "%s %d-wr", posted_sends_str, i);
@@ -1807,7 +2354,7 @@ sprintf(posted_sends_str, "%s %d-wr", posted_sends_str, i);
 #ifdef DEBUG 
         rc = 
 #endif        
-        post_send(i, LOG_QP, remote_commit, sizeof(uint64_t), 
+        queue_send(i, LOG_QP, remote_commit, sizeof(uint64_t), 
                         IBDEV->lcl_mr[CTRL_QP], IBV_WR_RDMA_WRITE, 
                         NOTSIGNALED, rm, NULL); 
 #ifdef DEBUG        
@@ -1821,22 +2368,29 @@ sprintf(posted_sends_str, "%s %d-wr", posted_sends_str, i);
         TIMER_STOP(log_fp);
     }
 //HRT_GET_TIMESTAMP(SRV_DATA->t2);
+
+    /* Post the log updates and the commit offsets: one doorbell per 
+    server, and then empty the completion queue once */
+    rc = flush_all_sends(LOG_QP);
+    if (0 != rc) {
+        error_return(RC_ERROR, log_fp, "Cannot flush send operations\n");
+    }
     
     return RC_SUCCESS;
 }
 
-int rc_send_entries_reply( uint8_t idx )
+int rc_send_entries_reply( uint8_t idx, uint64_t entry_idx )
 {
     int rc;
     
-    /* Set offset accordingly */
-    uint32_t offset = (uint32_t)offsetof(dare_log_entry_t, reply) 
-                    + sizeof(uint8_t) * SRV_DATA->config.idx
-                    + SRV_DATA->log->old_end
-                    + (uint32_t)offsetof(dare_log_t, entries);
-
-    void *local_buf = (uint8_t*)SRV_DATA->log + offset;
-    *(uint8_t*)local_buf = 1;
+    /* Ack all the entries up to entry_idx: write my status record 
+    into the leader's status[my idx]; through the LOG QP, so that a 
+    server that revoked log access does not get acks; the ack is 
+    stamped with my term, as the record goes out also with later SIDs 
+    (e.g., HB replies), when the entries may have been removed */
+    status_t *status = &SRV_DATA->ctrl_data->status[SRV_DATA->config.idx];
+    status->ack_idx = entry_idx;
+    status->ack_term = SID_GET_TERM(SRV_DATA->ctrl_data->sid);
 
     /* Issue RDMA Write operations */
     ssn++;
@@ -1845,15 +2399,8 @@ int rc_send_entries_reply( uint8_t idx )
     if (0 == ep->rc_connected) {
         return 0;
     }
-
-    rem_mem_t rm;
-    rm.raddr = ep->rc_ep.rmt_mr[LOG_QP].raddr + offset;
-    rm.rkey = ep->rc_ep.rmt_mr[LOG_QP].rkey;
     
-    /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
-    rc = post_send(idx, LOG_QP, local_buf,
-                    sizeof(uint8_t), IBDEV->lcl_mr[LOG_QP],
-                    IBV_WR_RDMA_WRITE, NOTSIGNALED, rm, NULL);
+    rc = send_status(idx, LOG_QP, NOTSIGNALED);
     if (0 != rc) {
         /* This should never happen */
         error_return(1, log_fp, "Cannot post send operation\n");
@@ -1866,17 +2413,24 @@ int rc_send_entries_reply( uint8_t idx )
  * Log replication
  */
 uint64_t wrl_count_array[1000];
+uint64_t wrl_ticks_array[1000];
 int wrl_idx;
 int rc_write_remote_logs( int wait_for_commit )
 {
     int rc;
     int threshold = 0;
     uint64_t ticks;
+    double commit_ts = 0;
 
     if (wait_for_commit) {
         committed = 0;
+        if (1 == IBDEV->tuned) {
+            commit_ts = now_usec();
+        }
         wrl_count_array[wrl_idx]=0;
-        //HRT_GET_TIMESTAMP(SRV_DATA->t1);
+#ifdef DEBUG
+        HRT_GET_TIMESTAMP(SRV_DATA->t1);
+#endif
     }
 
 /* Horrible hack to avoid going back through libev before the commit is over */
@@ -1925,17 +2479,28 @@ loop_for_commit:
 //HRT_GET_ELAPSED_TICKS(SRV_DATA->t1, SRV_DATA->t2, &ticks);
 //info(log_fp, "Log update (%s): %lf\n", posted_sends_str, HRT_GET_USEC(ticks)); 
     if (wait_for_commit && committed) {
-        //HRT_GET_TIMESTAMP(SRV_DATA->t2);
-#if 0
+        if (1 == IBDEV->tuned) {
+            tune_observe(now_usec() - commit_ts);
+        }
+#ifdef DEBUG
+        /* Latency of the log writes, from the first write to commit; 
+        reported every 1000 commits (together with the number of forced 
+        prunings, both depend on the size of the log) */
+        HRT_GET_TIMESTAMP(SRV_DATA->t2);
+        HRT_GET_ELAPSED_TICKS(SRV_DATA->t1, SRV_DATA->t2, &wrl_ticks_array[wrl_idx]);
         wrl_idx++;
         if (wrl_idx == 1000) {
             qsort(wrl_count_array, 1000, sizeof(uint64_t), cmpfunc_uint64);
-            info(log_fp, "WRL COUNT: %"PRIu64" (%"PRIu64", %"PRIu64")\n", 
-                    wrl_count_array[500], wrl_count_array[19], 
-                    wrl_count_array[1000-21]);
+            qsort(wrl_ticks_array, 1000, sizeof(uint64_t), cmpfunc_uint64);
+            info_wtime(log_fp, "LOG WRITE: %.2lf us (%.2lf, %.2lf); "
+                    "%"PRIu64" rounds; %"PRIu64" forced prunings\n", 
+                    HRT_GET_USEC(wrl_ticks_array[500]), 
+                    HRT_GET_USEC(wrl_ticks_array[19]), 
+                    HRT_GET_USEC(wrl_ticks_array[1000-21]), 
+                    wrl_count_array[500], SRV_DATA->forced_prunings);
             wrl_idx = 0;
         }
-#endif        
+#endif
         return 0;
     }
     if (threshold == 1000) {
@@ -1948,37 +2513,19 @@ loop_for_commit:
 }
 
 /**
- * Function used for sorting an array of offsets
- */
-static int 
-cmpfunc_offset( const void *a, const void *b )
-{
-    //return ( *(uint64_t*)a - *(uint64_t*)b );
-    int result = log_is_offset_larger(SRV_DATA->log, *(uint64_t*)a, *(uint64_t*)b);
-    if (result) {
-        return 1;
-    }
-    return -1;
-}
-
-/**
- * Get remote apply offsets
- * Note: do not wait for the reads to complete;
- * yet, we must avoid having more than IBDEV->ib_dev_attr.max_qp_rd_atom
- * outstanding read operations 
+ * Get remote apply offsets: the followers send them with their status 
+ * records (see rc_send_status); only new records from my term are used, 
+ * so that a forced pruning that passed a follower (see 
+ * force_log_pruning) is not undone by an old record
  */
 int rc_get_remote_apply_offsets()
 {
-    int rc, init;
     server_t *server;
-    dare_ib_ep_t *ep;
-    rem_mem_t rm;
-    uint32_t offset;
+    status_t *status;
     uint8_t i, size;
-    TIMER_INIT;
     
     size = get_extended_group_size(SRV_DATA->config);
-    for (init = 0, i = 0; i < size; i++) {
+    for (i = 0; i < size; i++) {
         if ( (i == SRV_DATA->config.idx) || 
             !CID_IS_SERVER_ON(SRV_DATA->config.cid, i) )
         {
@@ -1988,50 +2535,176 @@ int rc_get_remote_apply_offsets()
         
         /* Server is on and it's not me */
         server = &SRV_DATA->config.servers[i];
-        if (server->fail_count >= PERMANENT_FAILURE) {
-            /* The leader suspects this server */
-            continue;
-        }
-        
-        ep = (dare_ib_ep_t*)server->ep;
-        if (0 == ep->rc_connected) {
-            continue;
-        }
         if (SRV_DATA->log->len == SRV_DATA->ctrl_data->vote_ack[i]) {
             /* No vote ACK from this server */
             continue;
         }
-        if (server->last_get_read_ssn) {
-            /* Still waiting for another read */
+        status = &SRV_DATA->ctrl_data->status[i];
+        if ( (status->hb == server->status_hb) || 
+            (SID_GET_TERM(status->sid) != SID_GET_TERM(SRV_DATA->ctrl_data->sid)) )
+        {
             continue;
         }
-        if (!init) {
-            ssn++;  // increase ssn to avoid past work completions
-            TIMER_START(log_fp, "Get remote apply offsets (%"PRIu64")\n", ssn); 
-            //info_wtime(log_fp, "Get remote apply offsets (%"PRIu64")\n", ssn); 
-            offset = (uint32_t) (offsetof(dare_log_t, apply));
-            init = 1;
-        }
-        server->last_get_read_ssn = ssn;
+        server->status_hb = status->hb;
+        SRV_DATA->ctrl_data->apply_offsets[i] = status->apply;
+    }
+    
+    return 0;
+}
 
-        text(log_fp, "   (p%"PRIu8")\n", i);
-        //info(log_fp, "   # (p%"PRIu8") r=%"PRIu64"\n", i, 
-        //    SRV_DATA->ctrl_data->apply_offsets[i]);
+/**
+ * Catch-up: notify a lagging follower that the head offset passed 
+ * its apply offset; the notice is written by the leader
+ */
+int rc_send_catchup_notice( uint8_t idx )
+{
+    int rc;
+    dare_ib_ep_t *ep;
+    rem_mem_t rm;
+    uint32_t offset;
     
-        rm.raddr = ep->rc_ep.rmt_mr[LOG_QP].raddr + offset;
-        rm.rkey = ep->rc_ep.rmt_mr[LOG_QP].rkey;
-        
-        /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
-        rc = post_send(i, LOG_QP, &SRV_DATA->ctrl_data->apply_offsets[i],
-                        sizeof(uint64_t), IBDEV->lcl_mr[CTRL_QP],
-                        IBV_WR_RDMA_READ, NOTSIGNALED, rm, NULL);
-        if (0 != rc) {
-            /* This should never happen */
-            error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
-        }        
+    cu_notice_t *notice = &SRV_DATA->ctrl_data->cu_notice[SRV_DATA->config.idx];
+    offset = (uint32_t) (offsetof(ctrl_data_t, cu_notice) 
+            + sizeof(cu_notice_t) * SRV_DATA->config.idx);
+            
+    ep = (dare_ib_ep_t*)SRV_DATA->config.servers[idx].ep;
+    if (0 == ep->rc_connected) {
+        return 0;
     }
-    if (init) {
-        TIMER_STOP(log_fp);
+    ssn++;  // increase ssn to avoid past work completions
+    
+    rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + offset;
+    rm.rkey = ep->rc_ep.rmt_mr[CTRL_QP].rkey;
+    
+    /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
+    rc = post_send(idx, CTRL_QP, notice, sizeof(cu_notice_t), 
+                IBDEV->lcl_mr[CTRL_QP], IBV_WR_RDMA_WRITE, 
+                NOTSIGNALED, rm, NULL);
+    if (0 != rc) {
+        /* This should never happen */
+        error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
+    }
+    
+    return 0;
+}
+
+/**
+ * Catch-up: ask the donor for the next chunk of records;
+ * the request is in cu_req[my_idx]
+ */
+int rc_send_catchup_request( uint8_t idx )
+{
+    int rc;
+    dare_ib_ep_t *ep;
+    rem_mem_t rm;
+    uint32_t offset;
+    
+    cu_req_t *request = &SRV_DATA->ctrl_data->cu_req[SRV_DATA->config.idx];
+    offset = (uint32_t) (offsetof(ctrl_data_t, cu_req) 
+            + sizeof(cu_req_t) * SRV_DATA->config.idx);
+            
+    ep = (dare_ib_ep_t*)SRV_DATA->config.servers[idx].ep;
+    if (0 == ep->rc_connected) {
+        return 0;
+    }
+    ssn++;  // increase ssn to avoid past work completions
+    
+    rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + offset;
+    rm.rkey = ep->rc_ep.rmt_mr[CTRL_QP].rkey;
+    
+    /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
+    rc = post_send(idx, CTRL_QP, request, sizeof(cu_req_t), 
+                IBDEV->lcl_mr[CTRL_QP], IBV_WR_RDMA_WRITE, 
+                NOTSIGNALED, rm, NULL);
+    if (0 != rc) {
+        /* This should never happen */
+        error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
+    }
+    
+    return 0;
+}
+
+/**
+ * Catch-up: publish the address of the chunk in cu_buf;
+ * the reply (len, last_idx, seq) is already in cu_rep[my_idx]
+ */
+int rc_send_catchup_reply( uint8_t idx )
+{
+    int rc;
+    dare_ib_ep_t *ep;
+    rem_mem_t rm;
+    uint32_t offset;
+    
+    cu_rep_t *reply = &SRV_DATA->ctrl_data->cu_rep[SRV_DATA->config.idx];
+    reply->raddr = (uint64_t)SRV_DATA->cu_buf;
+    reply->rkey = IBDEV->cu_buf_mr->rkey;
+    offset = (uint32_t) (offsetof(ctrl_data_t, cu_rep) 
+            + sizeof(cu_rep_t) * SRV_DATA->config.idx);
+            
+    ep = (dare_ib_ep_t*)SRV_DATA->config.servers[idx].ep;
+    if (0 == ep->rc_connected) {
+        return 0;
+    }
+    ssn++;  // increase ssn to avoid past work completions
+    
+    rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + offset;
+    rm.rkey = ep->rc_ep.rmt_mr[CTRL_QP].rkey;
+    
+    /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
+    rc = post_send(idx, CTRL_QP, reply, sizeof(cu_rep_t), 
+                IBDEV->lcl_mr[CTRL_QP], IBV_WR_RDMA_WRITE, 
+                NOTSIGNALED, rm, NULL);
+    if (0 != rc) {
+        /* This should never happen */
+        error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
+    }
+    
+    return 0;
+}
+
+/**
+ * Catch-up: read the chunk published by the donor into the local 
+ * cu_buf; the same as the SM recovery, but with a bounded size
+ * !!! Note: to avoid connecting the LOG QPs, we use the CTRL QP
+ */
+int rc_recv_catchup_chunk( uint8_t idx )
+{
+    int rc;
+    rem_mem_t rm;
+    uint8_t i, size = get_group_size(SRV_DATA->config);
+    int posted_sends[MAX_SERVER_COUNT];
+    cu_rep_t *reply = &SRV_DATA->ctrl_data->cu_rep[idx];
+    
+    if (reply->len > CATCHUP_BUF_SIZE) {
+        error_return(1, log_fp, "Catch-up chunk too large\n");
+    }
+    
+    /* Post send op only for the donor */
+    for (i = 0; i < size; i++) {
+        posted_sends[i] = -1;
+    }
+    ssn++;  // increase ssn to avoid past work completions
+    
+    rm.raddr = reply->raddr;
+    rm.rkey = reply->rkey;
+    posted_sends[idx] = 1;
+    /* server_id, qp_id, buf, len, mr, opcode, signaled, rm, posted_sends */ 
+    rc = post_send(idx, CTRL_QP, SRV_DATA->cu_buf, reply->len, 
+                    IBDEV->cu_buf_mr, IBV_WR_RDMA_READ, SIGNALED, rm, 
+                    posted_sends);
+    if (0 != rc) {
+        /* This should never happen */
+        error_return(RC_ERROR, log_fp, "Cannot post send operation\n");
+    }
+    
+    rc = wait_for_one(posted_sends, CTRL_QP);
+    if (RC_ERROR == rc) {
+        /* This should never happen */
+        error_return(1, log_fp, "Cannot get catch-up chunk\n");
+    }
+    if (RC_SUCCESS != rc) {
+        /* Operation failed; try again later */
+        return -1;
     }
     
     return 0;
@@ -2124,7 +2797,7 @@ int rc_connect_server( uint8_t idx, int qp_id )
     
     //ev_tstamp start_ts = ev_now(SRV_DATA->loop);
     
-    ibv_query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_STATE, &init_attr);
+    dare_tp->query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_STATE, &init_attr);
     if (attr.qp_state != IBV_QPS_RESET) {
         rc = rc_qp_reset(ep, qp_id);
         if (0 != rc) {
@@ -2268,9 +2941,9 @@ rc_qp_reset( dare_ib_ep_t *ep, int qp_id )
 
     memset(&attr, 0, sizeof(attr));
     attr.qp_state = IBV_QPS_RESET;
-    //while (ibv_poll_cq(IBDEV->rc_cq[qp_id], 1, &wc) > 0);
+    //while (dare_tp->poll_cq(IBDEV->rc_cq[qp_id], 1, &wc) > 0);
     //empty_completion_queue(0, qp_id, 0, NULL);
-    rc = ibv_modify_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_STATE); 
+    rc = dare_tp->modify_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_STATE); 
     if (0 != rc) {
         error_return(1, log_fp, "ibv_modify_qp failed because %s\n", strerror(rc));
     }
@@ -2287,7 +2960,7 @@ rc_qp_reset_to_init( dare_ib_ep_t *ep, int qp_id )
     int rc;
     struct ibv_qp_attr attr;
 //    struct ibv_qp_init_attr init_attr;
-//    ibv_query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_STATE, &init_attr);
+//    dare_tp->query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_STATE, &init_attr);
 //    info(log_fp, "[QP Info (LID=%"PRIu16")] %s QP: %s\n",
 //         ep->ud_ep.lid, (LOG_QP == qp_id) ? "log" : "ctrl",
 //         qp_state_to_str(attr.qp_state));
@@ -2306,7 +2979,7 @@ rc_qp_reset_to_init( dare_ib_ep_t *ep, int qp_id )
                            IBV_ACCESS_REMOTE_ATOMIC |
                            IBV_ACCESS_LOCAL_WRITE;
 
-    rc = ibv_modify_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, 
+    rc = dare_tp->modify_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, 
                         IBV_QP_STATE | IBV_QP_PKEY_INDEX | 
                         IBV_QP_PORT | IBV_QP_ACCESS_FLAGS); 
     if (0 != rc) {
@@ -2332,7 +3005,7 @@ rc_qp_init_to_rtr( dare_ib_ep_t *ep, int qp_id )
 #endif    
     //struct ibv_qp_init_attr init_attr;
     //uint8_t max_dest_rd_atomic;
-    //ibv_query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_MAX_DEST_RD_ATOMIC, &init_attr);
+    //dare_tp->query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_MAX_DEST_RD_ATOMIC, &init_attr);
     //max_dest_rd_atomic = attr.max_dest_rd_atomic;
 
     /* Move the QP into the RTR state */
@@ -2361,7 +3034,7 @@ rc_qp_init_to_rtr( dare_ib_ep_t *ep, int qp_id )
     attr.ah_attr.sl            = 0;
     attr.ah_attr.src_path_bits = 0;
 
-    rc = ibv_modify_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, 
+    rc = dare_tp->modify_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, 
                         IBV_QP_STATE | IBV_QP_PATH_MTU |
                         IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER | 
                         IBV_QP_RQ_PSN | IBV_QP_AV | IBV_QP_DEST_QPN);
@@ -2390,7 +3063,7 @@ rc_qp_rtr_to_rts( dare_ib_ep_t *ep, int qp_id )
     }
 #endif    
     //struct ibv_qp_init_attr init_attr;
-    //ibv_query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_MAX_QP_RD_ATOMIC | IBV_QP_MAX_DEST_RD_ATOMIC, &init_attr);
+    //dare_tp->query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_MAX_QP_RD_ATOMIC | IBV_QP_MAX_DEST_RD_ATOMIC, &init_attr);
     //info_wtime(log_fp, "RC QP[%s] max_rd_atomic=%"PRIu8"; max_dest_rd_atomic=%"PRIu8"\n", qp_id == LOG_QP ? "LOG" : "CTRL", attr.max_rd_atomic, attr.max_dest_rd_atomic);
 
     /* Move the QP into the RTS state */
@@ -2408,7 +3081,7 @@ rc_qp_rtr_to_rts( dare_ib_ep_t *ep, int qp_id )
 //debug(log_fp, "MY SQ PSN: %"PRIu32"\n", attr.sq_psn);
     attr.max_rd_atomic = IBDEV->ib_dev_attr.max_qp_rd_atom;
 
-    rc = ibv_modify_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, 
+    rc = dare_tp->modify_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, 
                         IBV_QP_STATE | IBV_QP_TIMEOUT |
                         IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | 
                         IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC);
@@ -2416,7 +3089,7 @@ rc_qp_rtr_to_rts( dare_ib_ep_t *ep, int qp_id )
         error_return(1, log_fp, "ibv_modify_qp failed because %s\n", strerror(rc));
     }
     
-    //ibv_query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_MAX_QP_RD_ATOMIC | IBV_QP_MAX_DEST_RD_ATOMIC, &init_attr);
+    //dare_tp->query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_MAX_QP_RD_ATOMIC | IBV_QP_MAX_DEST_RD_ATOMIC, &init_attr);
     //info_wtime(log_fp, "RC QP[%s] max_rd_atomic=%"PRIu8"; max_dest_rd_atomic=%"PRIu8"\n", qp_id == LOG_QP ? "LOG" : "CTRL", attr.max_rd_atomic, attr.max_dest_rd_atomic);
 
     
@@ -2451,7 +3124,7 @@ int rc_print_qp_state( void *data )
     struct ibv_qp_attr attr;
     struct ibv_qp_init_attr init_attr;
      
-    rc = ibv_query_qp(ep->rc_ep.rc_qp[LOG_QP].qp, &attr, IBV_QP_STATE, &init_attr);
+    rc = dare_tp->query_qp(ep->rc_ep.rc_qp[LOG_QP].qp, &attr, IBV_QP_STATE, &init_attr);
     if (0 != rc) {
         error_return(1, log_fp, "ibv_query_qp failed because %s\n",
                     strerror(rc));
@@ -2459,7 +3132,7 @@ int rc_print_qp_state( void *data )
     info(log_fp, "[QP Info] LID=%"PRIu16" -> log_qp: %s\n", 
          ep->ud_ep.lid, qp_state_to_str(attr.qp_state));
 
-    rc = ibv_query_qp(ep->rc_ep.rc_qp[CTRL_QP].qp, &attr, IBV_QP_STATE, &init_attr);
+    rc = dare_tp->query_qp(ep->rc_ep.rc_qp[CTRL_QP].qp, &attr, IBV_QP_STATE, &init_attr);
     if (0 != rc) {
         error_return(1, log_fp, "ibv_query_qp failed because %s\n",
                     strerror(rc));
@@ -2491,24 +3164,114 @@ post_send( uint8_t server_id,
            rem_mem_t rm,
            int *posted_sends )
 {
-    int rc, wait_signaled_wr = 0;
+    struct ibv_sge sge;
+    
+    sge.addr   = (uint64_t)buf;
+    sge.length = len;
+    sge.lkey   = mr->lkey;
+    return post_send_sg(server_id, qp_id, &sge, 1, opcode, 
+                        signaled, rm, posted_sends);
+}
+
+/**
+ * Post send operation with a list of (at most RC_MAX_SGE) local buffers
+ */
+static int 
+post_send_sg( uint8_t server_id, 
+              int qp_id,
+              struct ibv_sge *sges,
+              int num_sge,
+              enum ibv_wr_opcode opcode,
+              int signaled,
+              rem_mem_t rm,
+              int *posted_sends )
+{
+    int rc;
+    
+    rc = queue_send_sg(server_id, qp_id, sges, num_sge, opcode, 
+                       signaled, rm, posted_sends);
+    if (0 != rc) {
+        error_return(1, log_fp, "Cannot queue send operation\n");
+    }
+    rc = flush_sends(server_id, qp_id);
+    if (0 != rc) {
+        error_return(1, log_fp, "Cannot flush send operations\n");
+    }
+    
+    rc = empty_completion_queue(server_id, qp_id, 0, posted_sends);
+    if (0 != rc) {
+        error_return(1, log_fp, "Cannot empty completion queue\n");
+    }
+    
+    return 0;
+}
+
+/**
+ * Queue a send operation, i.e., add a WR to the batch of the QP; the 
+ * WRs are posted by flush_sends, at once
+ * Note: the batch is flushed before waiting for a signaled WR
+ */
+static int 
+queue_send( uint8_t server_id, 
+            int qp_id,
+            void *buf,
+            uint32_t len,
+            struct ibv_mr *mr,
+            enum ibv_wr_opcode opcode,
+            int signaled,
+            rem_mem_t rm,
+            int *posted_sends )
+{
+    struct ibv_sge sge;
+    
+    sge.addr   = (uint64_t)buf;
+    sge.length = len;
+    sge.lkey   = mr->lkey;
+    return queue_send_sg(server_id, qp_id, &sge, 1, opcode, 
+                         signaled, rm, posted_sends);
+}
+
+static int 
+queue_send_sg( uint8_t server_id, 
+               int qp_id,
+               struct ibv_sge *sges,
+               int num_sge,
+               enum ibv_wr_opcode opcode,
+               int signaled,
+               rem_mem_t rm,
+               int *posted_sends )
+{
+    int rc, i, wait_signaled_wr = 0;
+    uint32_t len = 0;
     uint32_t *send_count_ptr;
     uint64_t *signaled_wrid_ptr;
     uint8_t  *qp_state_ptr;
     dare_ib_ep_t *ep;
-    struct ibv_sge sg;
-    struct ibv_send_wr wr;
-    struct ibv_send_wr *bad_wr;
+    rc_qp_t *rc_qp;
+    struct ibv_sge *sg;
+    struct ibv_send_wr *wr;
 
     /* Define some temporary variables */
     ep = (dare_ib_ep_t*)SRV_DATA->config.servers[server_id].ep;
-    send_count_ptr = &(ep->rc_ep.rc_qp[qp_id].send_count);
-    signaled_wrid_ptr = &(ep->rc_ep.rc_qp[qp_id].signaled_wr_id);
-    qp_state_ptr = &(ep->rc_ep.rc_qp[qp_id].state);
+    rc_qp = &ep->rc_ep.rc_qp[qp_id];
+    send_count_ptr = &(rc_qp->send_count);
+    signaled_wrid_ptr = &(rc_qp->signaled_wr_id);
+    qp_state_ptr = &(rc_qp->state);
     
+    if (RC_WR_BATCH == rc_qp->wr_count) {
+        /* The batch is full */
+        rc = flush_sends(server_id, qp_id);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot flush send operations\n");
+        }
+    }
     if (RC_QP_BLOCKED == *qp_state_ptr) {
         /* This QP is blocked; need to wait for the signaled WR */
         info_wtime(log_fp, "%s QP of p%"PRIu8" is BLOCKED\n", qp_id == LOG_QP ? "LOG": "CTRL", server_id);
+        rc = flush_sends(server_id, qp_id);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot flush send operations\n");
+        }
         rc = empty_completion_queue(server_id, qp_id, 1, NULL);
         if (0 != rc) {
             error_return(1, log_fp, "Cannot empty completion queue\n");
@@ -2520,6 +3283,10 @@ post_send( uint8_t server_id,
         rc_qp_restart(ep, qp_id);
         *qp_state_ptr = RC_QP_ACTIVE;
         *send_count_ptr = 0;
+        if (LOG_QP == qp_id) {
+            /* The outstanding log updates were cleared */
+            lr_window_drop(&SRV_DATA->config.servers[server_id]);
+        }
     }
     
     /* Increment number of posted sends to avoid QP overflow */
@@ -2527,21 +3294,23 @@ post_send( uint8_t server_id,
     //info_wtime(log_fp, "(ssn=%"PRIu64":p%"PRIu8") send_count[%s] = %"PRIu32"\n", ssn, server_id, qp_id == LOG_QP ? "LOG" : "CTRL", *send_count_ptr);
  
     /* Local memory */
-    memset(&sg, 0, sizeof(sg));
-    sg.addr   = (uint64_t)buf;
-    sg.length = len;
-    sg.lkey   = mr->lkey;
+    sg = rc_qp->sg[rc_qp->wr_count];
+    for (i = 0; i < num_sge; i++) {
+        sg[i] = sges[i];
+        len += sges[i].length;
+    }
  
-    memset(&wr, 0, sizeof(wr));
-    WRID_SET_SSN(wr.wr_id, ssn);
-    WRID_SET_CONN(wr.wr_id, server_id);
+    wr = &rc_qp->wr[rc_qp->wr_count];
+    memset(wr, 0, sizeof(struct ibv_send_wr));
+    WRID_SET_SSN(wr->wr_id, ssn);
+    WRID_SET_CONN(wr->wr_id, server_id);
     if (wa_flag) {
-        WRID_SET_WA(wr.wr_id);
+        WRID_SET_WA(wr->wr_id);
         wa_flag = 0;
     }
-    wr.sg_list    = &sg;
-    wr.num_sge    = 1;
-    wr.opcode     = opcode;
+    wr->sg_list    = sg;
+    wr->num_sge    = num_sge;
+    wr->opcode     = opcode;
     if ( (*signaled_wrid_ptr != 0) && 
         (WRID_GET_TAG(*signaled_wrid_ptr) == 0) ) 
     {
@@ -2549,16 +3318,17 @@ post_send( uint8_t server_id,
         *signaled_wrid_ptr = 0;
         //info_wtime(log_fp, "(signaled WR found) send_count[%s] = %"PRIu32"\n", qp_id == LOG_QP ? "LOG" : "CTRL", *send_count_ptr);
     }
-    if ( (*send_count_ptr == IBDEV->rc_max_send_wr >> 2) && (*signaled_wrid_ptr == 0) ) {
-        /* A quarter of the Send Queue is full; add a special signaled WR */
-        wr.send_flags |= IBV_SEND_SIGNALED;
-        WRID_SET_TAG(wr.wr_id);    // special mark
-        *signaled_wrid_ptr = wr.wr_id;
+    if ( (*send_count_ptr == IBDEV->rc_signal_interval) && (*signaled_wrid_ptr == 0) ) {
+        /* rc_signal_interval WRs were posted (by default, a quarter of 
+        the Send Queue); add a special signaled WR */
+        wr->send_flags |= IBV_SEND_SIGNALED;
+        WRID_SET_TAG(wr->wr_id);    // special mark
+        *signaled_wrid_ptr = wr->wr_id;
         //info_wtime(log_fp, "Signaled WR added on QP %s for p%"PRIu8" with ssn=%"PRIu64"\n", qp_id == LOG_QP ? "LOG" : "CTRL", server_id, WRID_GET_SSN(*signaled_wrid_ptr));
         //info_wtime(log_fp, "SSN = %"PRIu64"\n", ssn);
         *send_count_ptr = 0;
     }
-    else if (*send_count_ptr == 3 * IBDEV->rc_max_send_wr >> 2) {
+    else if (*send_count_ptr == IBDEV->rc_max_send_wr - IBDEV->rc_signal_interval) {
         if (*signaled_wrid_ptr != 0) {
             /* The Send Queue is full; need to wait for the signaled WR */
             wait_signaled_wr = 1;
@@ -2566,17 +3336,62 @@ post_send( uint8_t server_id,
             //info_wtime(log_fp, "waiting for:"); PRINT_WRID_(*signaled_wrid_ptr);
         }
     }
-    if (signaled) {
-        wr.send_flags |= IBV_SEND_SIGNALED;
+    if (signaled) {
+        wr->send_flags |= IBV_SEND_SIGNALED;
+    }
+    if (IBV_WR_RDMA_WRITE == opcode) {
+        if ( (len <= IBDEV->rc_inline_cutoff) && !loggp_not_inline ) {
+            wr->send_flags |= IBV_SEND_INLINE;
+        }
+    }   
+    wr->wr.rdma.remote_addr = rm.raddr;
+    wr->wr.rdma.rkey        = rm.rkey;
+    rc_qp->wr_count++;
+    if (rm.rkey == ep->rc_ep.rmt_mr[LOG_QP].rkey) {
+        IBDEV->log_wr_count++;
+    }
+    else {
+        IBDEV->ctrl_wr_count++;
+    }
+    
+    if (wait_signaled_wr) {
+        /* Post the batch and wait for the signaled WR */
+        rc = flush_sends(server_id, qp_id);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot flush send operations\n");
+        }
+        rc = empty_completion_queue(server_id, qp_id, 1, posted_sends);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot empty completion queue\n");
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Post the queued WRs of a QP as a chain, i.e., with one doorbell
+ */
+static int
+flush_sends( uint8_t server_id, int qp_id )
+{
+    int rc, i;
+    dare_ib_ep_t *ep;
+    rc_qp_t *rc_qp;
+    struct ibv_send_wr *bad_wr;
+    
+    ep = (dare_ib_ep_t*)SRV_DATA->config.servers[server_id].ep;
+    rc_qp = &ep->rc_ep.rc_qp[qp_id];
+    if (0 == rc_qp->wr_count) {
+        return 0;
+    }
+    for (i = 0; i < rc_qp->wr_count - 1; i++) {
+        rc_qp->wr[i].next = &rc_qp->wr[i+1];
     }
-    if (IBV_WR_RDMA_WRITE == opcode) {
-        if ( (len <= IBDEV->rc_max_inline_data) && !loggp_not_inline ) {
-            wr.send_flags |= IBV_SEND_INLINE;
-        }
-    }   
-    wr.wr.rdma.remote_addr = rm.raddr;
-    wr.wr.rdma.rkey        = rm.rkey;
-    rc = ibv_post_send(ep->rc_ep.rc_qp[qp_id].qp, &wr, &bad_wr);
+    rc_qp->wr[i].next = NULL;
+    rc_qp->wr_count = 0;
+    
+    rc = dare_tp->post_send(rc_qp->qp, rc_qp->wr, &bad_wr);
     if (0 != rc) {
         //info(log_fp, "POST ERROR: ssn=%"PRIu64":%"PRIu8"; next=%p; num_sge=%d, opcode=%s\n", 
             //WRID_GET_SSN(bad_wr->wr_id), WRID_GET_CONN(bad_wr->wr_id), 
@@ -2587,11 +3402,30 @@ post_send( uint8_t server_id,
             strerror(rc), rc == EINVAL ? "EINVAL" : rc == ENOMEM ? "ENOMEM" : rc == EFAULT ? "EFAULT" : "UNKNOWN");
     }
     
-    rc = empty_completion_queue(server_id, qp_id, wait_signaled_wr, posted_sends);
+    return 0;
+}
+
+/**
+ * Post the queued WRs of all servers on a QP type (one doorbell 
+ * per QP) and then empty the completion queue once
+ */
+static int
+flush_all_sends( int qp_id )
+{
+    int rc;
+    uint8_t i, size = get_extended_group_size(SRV_DATA->config);
+    
+    for (i = 0; i < size; i++) {
+        if (i == SRV_DATA->config.idx) continue;
+        rc = flush_sends(i, qp_id);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot flush send operations\n");
+        }
+    }
+    rc = empty_completion_queue(SRV_DATA->config.idx, qp_id, 0, NULL);
     if (0 != rc) {
         error_return(1, log_fp, "Cannot empty completion queue\n");
     }
-    
     return 0;
 }
 
@@ -2613,9 +3447,13 @@ empty_completion_queue( uint8_t server_id,
     //info_wtime(log_fp, "calling empty_completion_queue %d\n", wait_signaled_wr);
     
     while(1) {
-        /* Read as many WCs as possible ... */
-        ne = ibv_poll_cq(IBDEV->rc_cq[qp_id], IBDEV->rc_cqe, 
+        /* The WCs found while tuning first (see tune_wait) */
+        ne = tune_unstash(qp_id);
+        if (0 == ne) {
+            /* Read as many WCs as possible ... */
+            ne = dare_tp->poll_cq(IBDEV->rc_cq[qp_id], IBDEV->rc_cqe, 
                         IBDEV->rc_wc_array);
+        }
         if (0 == ne) {
             /* ... but do not wait for them... */
             if (wait_signaled_wr) {
@@ -2672,13 +3510,6 @@ empty_completion_queue( uint8_t server_id,
             server = &SRV_DATA->config.servers[conn];
             ep = (dare_ib_ep_t*)server->ep;
     
-            /* Check last get read ssn */
-            if ( (LOG_QP == qp_id) && 
-                (WRID_GET_SSN(wr_id) >= server->last_get_read_ssn) ) 
-            {
-                server->last_get_read_ssn = 0;
-            }
-
             /* Check signaled WR */
             can_restart_qp = 1;
             signaled_wrid_ptr = &(ep->rc_ep.rc_qp[qp_id].signaled_wr_id);
@@ -2711,6 +3542,7 @@ empty_completion_queue( uint8_t server_id,
 
             rc = handle_work_completion(&(IBDEV->rc_wc_array[i]), qp_id);
             handle_lr_work_completion(i, rc);
+            lease_work_completion(&(IBDEV->rc_wc_array[i]), qp_id);
             if (WC_SUCCESS == rc) {
                 /* Successful send operation: reset failure count */
                 server->fail_count = 0;
@@ -2738,7 +3570,7 @@ empty_completion_queue( uint8_t server_id,
                         ep->rc_ep.rc_qp[qp_id].state = RC_QP_BLOCKED;
                     }
 /* Note: In order to reuse a QP, it can be transitioned to Reset 
-state from any state by calling to ibv_modify_qp(). If prior to 
+state from any state by calling to dare_tp->modify_qp(). If prior to 
 this state transition, there were any Work Requests or completions 
 in the send or receive queues of that QP, they will be cleared 
 from the queues. */                    
@@ -2808,7 +3640,7 @@ wait_for_majority( int *posted_sends, int qp_id )
         }
 //info(log_fp, "WAIT FOR MAJORITY: posted_send_count=%"PRIu8"; success_count=%"PRIu8"; size=%"PRIu8"\n", posted_send_count, success_count, size);
         while ( (success_count <= size / 2) && (posted_send_count) ) {
-            ne = ibv_poll_cq(IBDEV->rc_cq[qp_id], IBDEV->rc_cqe, 
+            ne = dare_tp->poll_cq(IBDEV->rc_cq[qp_id], IBDEV->rc_cqe, 
                         IBDEV->rc_wc_array);
             if (ne < 0) {
                 /* Failure */
@@ -2823,13 +3655,6 @@ wait_for_majority( int *posted_sends, int qp_id )
                 ep = (dare_ib_ep_t*)server->ep;
                 //info_wtime(log_fp, "WR completed:"); PRINT_WRID_(wr_id);
 
-                /* Check last get read ssn */
-                if ( (LOG_QP == qp_id) && 
-                    (WRID_GET_SSN(wr_id) >= server->last_get_read_ssn) )
-                {
-                    server->last_get_read_ssn = 0;
-                }
-
                 /* Check signaled WR */
                 can_restart_qp = 1;
                 signaled_wrid_ptr = &(ep->rc_ep.rc_qp[qp_id].signaled_wr_id);
@@ -2889,6 +3714,7 @@ wait_for_majority( int *posted_sends, int qp_id )
                 /* Handle the WC */
                 rc = handle_work_completion(&(IBDEV->rc_wc_array[0]), qp_id);
                 handle_lr_work_completion(i, rc);
+                lease_work_completion(&(IBDEV->rc_wc_array[i]), qp_id);
                 if (WC_SUCCESS == rc) {
                     /* Successful send operation: reset failure count */
                     server->fail_count = 0;
@@ -2987,7 +3813,7 @@ wait_for_one( int *posted_sends, int qp_id )
         posted_send_count += (uint8_t)posted_sends[i];
     }
     while ( (!success_count) && (posted_send_count) ) {
-        ne = ibv_poll_cq(IBDEV->rc_cq[qp_id], IBDEV->rc_cqe, 
+        ne = dare_tp->poll_cq(IBDEV->rc_cq[qp_id], IBDEV->rc_cqe, 
                     IBDEV->rc_wc_array);
         if (ne < 0) {
             /* Failure */
@@ -3002,13 +3828,6 @@ wait_for_one( int *posted_sends, int qp_id )
             ep = (dare_ib_ep_t*)server->ep;
             //info_wtime(log_fp, "WR completed:"); PRINT_WRID_(wr_id);
 
-            /* Check last get read ssn */
-            if ( (LOG_QP == qp_id) && 
-                (WRID_GET_SSN(wr_id) >= server->last_get_read_ssn) )
-            {
-                server->last_get_read_ssn = 0;
-            }
-
             /* Check signaled WR */
             can_restart_qp = 1;
             signaled_wrid_ptr = &(ep->rc_ep.rc_qp[qp_id].signaled_wr_id);
@@ -3068,6 +3887,7 @@ wait_for_one( int *posted_sends, int qp_id )
             /* Handle the WC */
             rc = handle_work_completion(&(IBDEV->rc_wc_array[0]), qp_id);
             handle_lr_work_completion(i, rc);
+            lease_work_completion(&(IBDEV->rc_wc_array[i]), qp_id);
             if (WC_SUCCESS == rc) {
                 /* Successful send operation: reset failure count */
                 server->fail_count = 0;
@@ -3133,64 +3953,38 @@ handle_lr_work_completion( uint8_t idx, int wc_rc )
     server_t *server = &SRV_DATA->config.servers[idx];
     
 //info_wtime(log_fp, "lr_work_completion: p%"PRIu8"\n", idx);
+    if (server->next_lr_step == LR_UPDATE_LOG) {
+        /* Log update: several WRs are outstanding (see update_remote_logs) */
+        lr_window_completion(server, wr_id, wc_rc);
+        return;
+    }
     if (wr_id == server->next_wr_id) {
         if (WC_SUCCESS == wc_rc) {        
-            if (server->next_lr_step == LR_UPDATE_LOG) {
-                /* Current LR step is update log */
-                switch (server->send_count) {
-                    case 0: 
-                        /* The other part of the send failed */
-                        server->send_flag = 1;
-                        break;
-                    case 1:
-                        /* The log was updated successfully */
-                        server->next_lr_step = LR_UPDATE_END;
-//TIMER_INFO(log_fp, "[p%"PRIu8"->log(:%"PRIu64")]\n", idx, server->cached_end_offset);
-                        server->send_flag = 1;
-                        break;
-                    case 2:
-                        /* First part of the send */
-                        server->send_count--;
-                        break;
-                }
+            if (server->next_lr_step == LR_GET_NCE) {
+                /* A chunk of not committed entries was read; 
+                log_adjustment moves to the next step once all 
+                the chunks are compared */
+                server->send_flag = 1;
             }
-            else if (server->next_lr_step != LR_UPDATE_END) {
+            else {
                 /* Current LR step succeeded */
                 server->next_lr_step++;
 //TIMER_INFO(log_fp, "[p%"PRIu8"->S%"PRIu8"(e=%"PRIu64")]\n", idx, server->next_lr_step, SRV_DATA->ctrl_data->log_offsets[idx].end);
-                server->send_flag = 1;
-            }
-            else {
-                /* Successful end offset update */
-                server->next_lr_step = LR_UPDATE_LOG;
-//TIMER_INFO(log_fp, "[p%"PRIu8"->e=%"PRIu64"]\n", idx, SRV_DATA->ctrl_data->log_offsets[idx].end);
+                if (server->next_lr_step == LR_UPDATE_LOG) {
+                    /* The remote end offset was set; start updating the log */
+                    lr_window_init(server, 
+                            SRV_DATA->ctrl_data->log_offsets[idx].end);
+                }
                 server->send_flag = 1;
             }
         }
         else {
-            if (server->next_lr_step == LR_UPDATE_LOG) {
-                /* Current LR step is update log */
-                switch (server->send_count) {
-                    case 0:
-                    case 1:
-                        /* The update was unsuccessful */
-                        server->send_flag = 1;
-                        break;
-                    case 2:
-                        /* The first part of the update was unsuccessful */
-                        server->send_count = 0;
-                        break;
-                }
-            }
-            else if (server->next_lr_step != LR_UPDATE_END) {
-                /* Current LR step failed */
-                server->send_flag = 1;
-            }
-            else {
-                /* Unsuccessful end offset update */
-                //server->next_lr_step = LR_UPDATE_LOG;
-                server->send_flag = 1;
+            /* Current LR step failed; for a chunk of not committed 
+            entries, the previous chunks were already compared */
+            if (server->next_lr_step == LR_GET_NCE) {
+                server->nc_read = server->nc_checked;
             }
+            server->send_flag = 1;
         }
     }
 }
@@ -3303,7 +4097,7 @@ handle_work_completion( struct ibv_wc *wc, int qp_id )
 #ifdef DEBUG
     struct ibv_qp_attr attr;
     struct ibv_qp_init_attr init_attr;
-    ibv_query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_STATE, &init_attr);
+    dare_tp->query_qp(ep->rc_ep.rc_qp[qp_id].qp, &attr, IBV_QP_STATE, &init_attr);
     info(log_fp, "[QP Info (LID=%"PRIu16")] %s QP: %s\n",
          ep->ud_ep.lid, (LOG_QP == qp_id) ? "log" : "ctrl",
          qp_state_to_str(attr.qp_state));
@@ -3382,7 +4176,7 @@ loop:
             poll_counts[i] = 0;
             while (poll_counts[i] < *poll_count) {
                 poll_counts[i]++;
-                ne = ibv_poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
+                ne = dare_tp->poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
                 if (ne < 0) {
                     error_return(0, log_fp, "ibv_poll_cq() failed\n");
                 }
@@ -3422,7 +4216,7 @@ loop:
             }
             wr.wr.rdma.remote_addr = rm.raddr;
             wr.wr.rdma.rkey        = rm.rkey;
-            rc = ibv_post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
+            rc = dare_tp->post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
             if (0 != rc) {
                 error_return(0, log_fp, "ibv_post_send failed because %s [%s]\n", 
                     strerror(rc), rc == EINVAL ? "EINVAL" : rc == ENOMEM ? 
@@ -3434,7 +4228,7 @@ loop:
             
             /* Measure overhead of polling for completion */
             HRT_GET_TIMESTAMP(t1);           
-            ne = ibv_poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
+            ne = dare_tp->poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
             if (0 == ne) {
                 error_return(0, log_fp, "Increase time\n");
             }
@@ -3466,7 +4260,7 @@ loop:
             //HRT_GET_TIMESTAMP(t3);
             while (1) {
                 poll_counts[i]++;
-                ne = ibv_poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
+                ne = dare_tp->poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
                 if (0 == ne) {
                     continue;
                 }
@@ -3547,14 +4341,14 @@ loop:
         }
         wr.wr.rdma.remote_addr = rm.raddr;
         wr.wr.rdma.rkey        = rm.rkey;
-        rc = ibv_post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
+        rc = dare_tp->post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
         if (0 != rc) {
             error_return(0, log_fp, "ibv_post_send failed because %s [%s]\n", 
                 strerror(rc), rc == EINVAL ? "EINVAL" : rc == ENOMEM ? 
                 "ENOMEM" : rc == EFAULT ? "EFAULT" : "UNKNOWN");
         }
         while (1) {
-            ne = ibv_poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
+            ne = dare_tp->poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
             if (0 == ne) {
                 continue;
             }
@@ -3649,7 +4443,7 @@ double rc_loggp_prtt( int n, double delay, uint32_t size )
             }
             wr.wr.rdma.remote_addr = rm.raddr;
             wr.wr.rdma.rkey        = rm.rkey;
-            rc = ibv_post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
+            rc = dare_tp->post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
             if (0 != rc) {
                 error_return(0, log_fp, "ibv_post_send failed because %s [%s]\n", 
                     strerror(rc), rc == EINVAL ? "EINVAL" : rc == ENOMEM ? 
@@ -3674,7 +4468,7 @@ double rc_loggp_prtt( int n, double delay, uint32_t size )
         }
         wr.wr.rdma.remote_addr = rm.raddr;
         wr.wr.rdma.rkey        = rm.rkey;
-        rc = ibv_post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
+        rc = dare_tp->post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
         if (0 != rc) {
             error_return(0, log_fp, "ibv_post_send failed because %s [%s]\n", 
                 strerror(rc), rc == EINVAL ? "EINVAL" : rc == ENOMEM ? 
@@ -3682,7 +4476,7 @@ double rc_loggp_prtt( int n, double delay, uint32_t size )
         }
         
         while (1) {
-            ne = ibv_poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
+            ne = dare_tp->poll_cq(IBDEV->rc_cq[LOG_QP], 1, IBDEV->rc_wc_array);
             if (0 == ne) {
                 continue;
             }
@@ -3729,7 +4523,7 @@ int rc_loggp_exit()
     wr.send_flags |= IBV_SEND_INLINE;
     wr.wr.rdma.remote_addr = rm.raddr;
     wr.wr.rdma.rkey        = rm.rkey;
-    rc = ibv_post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
+    rc = dare_tp->post_send(ep->rc_ep.rc_qp[LOG_QP].qp, &wr, &bad_wr);
     if (0 != rc) {
         error_return(1, log_fp, "ibv_post_send failed because %s [%s]\n", 
             strerror(rc), rc == EINVAL ? "EINVAL" : rc == ENOMEM ? 
@@ -3745,6 +4539,479 @@ cmpfunc_uint64( const void *a, const void *b )
 }
 
 
+#endif 
+
+/* ================================================================== */
+/* Auto-tuning */
+#if 1
+
+/* Note: the tuning runs once, when the first RC connection is 
+established (i.e., before the server starts an election or recovers, 
+so no HBs, votes or log updates are pending); it measures the LogGP 
+parameters of RDMA writes on the CTRL QP of a connected server (into 
+its tune_buf) and picks the inline cutoff, the signaling interval and 
+the log window from them. The CTRL CQ is shared: the WCs of other WRs 
+that show up while measuring are kept and handled afterwards by 
+empty_completion_queue. The parameters can be loaded from a profile 
+file instead, since they depend only on the fabric */
+
+#define TUNE_SAMPLES        101     // samples per measurement (median)
+#define TUNE_STREAM_LEN     64      // writes per stream
+#define TUNE_ENTRY_SIZE     (sizeof(dare_log_entry_t) + 64)
+#define TUNE_POLL_RATIO     0.05    // max polling overhead per WR (of o)
+#define TUNE_OBSERVED       1000    // commits observed after tuning
+#define TUNE_STASH_SIZE     64      // other WCs kept while measuring
+
+static double tune_obs[TUNE_OBSERVED];
+static int tune_obs_idx;
+static uint64_t tune_wrid;  // ssn 0; the connection of the measured QP
+static struct ibv_wc tune_stash[TUNE_STASH_SIZE];
+static int tune_stash_count;
+
+static double 
+now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int 
+cmpfunc_double( const void *a, const void *b )
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double
+median( double *samples, int count )
+{
+    qsort(samples, count, sizeof(double), cmpfunc_double);
+    return samples[count/2];
+}
+
+/**
+ * Post an RDMA write of size bytes from the local tune_buf to the 
+ * remote one
+ */
+static int
+tune_post( rc_qp_t *rc_qp, rem_mem_t rm, uint32_t size, 
+           int inline_flag, int signaled )
+{
+    int rc;
+    struct ibv_sge sg;
+    struct ibv_send_wr wr;
+    struct ibv_send_wr *bad_wr;
+    
+    memset(&sg, 0, sizeof(sg));
+    sg.addr   = (uint64_t)SRV_DATA->ctrl_data->tune_buf;
+    sg.length = size;
+    sg.lkey   = IBDEV->lcl_mr[CTRL_QP]->lkey;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id      = tune_wrid;
+    wr.sg_list    = &sg;
+    wr.num_sge    = 1;
+    wr.opcode     = IBV_WR_RDMA_WRITE;
+    if (signaled) {
+        wr.send_flags |= IBV_SEND_SIGNALED;
+    }
+    if (inline_flag) {
+        wr.send_flags |= IBV_SEND_INLINE;
+    }
+    wr.wr.rdma.remote_addr = rm.raddr;
+    wr.wr.rdma.rkey        = rm.rkey;
+    rc = dare_tp->post_send(rc_qp->qp, &wr, &bad_wr);
+    if (0 != rc) {
+        error_return(1, log_fp, "ibv_post_send failed because %s\n", 
+                    strerror(rc));
+    }
+    return 0;
+}
+
+/**
+ * Wait for the completion of the signaled write; o_poll is set to 
+ * the duration of the poll that found it
+ */
+static int
+tune_wait( rc_qp_t *rc_qp, double *o_poll )
+{
+    int ne;
+    double t;
+    struct ibv_wc wc;
+    
+    while (1) {
+        t = now_usec();
+        ne = dare_tp->poll_cq(IBDEV->rc_cq[CTRL_QP], 1, &wc);
+        if (0 == ne) continue;
+        if (ne < 0) {
+            error_return(1, log_fp, "ibv_poll_cq() failed\n");
+        }
+        if (o_poll) {
+            *o_poll = now_usec() - t;
+        }
+        if ( (wc.qp_num == rc_qp->qp->qp_num) && (tune_wrid == wc.wr_id) ) {
+            break;
+        }
+        /* Not a tuning write; keep it for empty_completion_queue */
+        if ( (TUNE_STASH_SIZE == tune_stash_count) || 
+            (tune_stash_count == IBDEV->rc_cqe) ) 
+        {
+            error_return(1, log_fp, "Too many other WCs while tuning\n");
+        }
+        tune_stash[tune_stash_count++] = wc;
+    }
+    if (IBV_WC_SUCCESS != wc.status) {
+        rc_qp->state = RC_QP_ERROR;
+        error_return(1, log_fp, "Tuning write failed: %s\n", 
+                    ibv_wc_status_str(wc.status));
+    }
+    return 0;
+}
+
+/**
+ * Move the WCs kept by tune_wait into the WC array
+ * @return the number of WCs
+ */
+static int
+tune_unstash( int qp_id )
+{
+    int ne = tune_stash_count;
+    
+    if ( (CTRL_QP != qp_id) || (0 == ne) ) {
+        return 0;
+    }
+    memcpy(IBDEV->rc_wc_array, tune_stash, ne * sizeof(struct ibv_wc));
+    tune_stash_count = 0;
+    return ne;
+}
+
+/**
+ * Measure the RTT of a write and the overhead of polling its 
+ * completion (medians)
+ */
+static int
+tune_rtt( rc_qp_t *rc_qp, rem_mem_t rm, uint32_t size, int inline_flag,
+          double *rtt, double *o_poll )
+{
+    int i;
+    double t, rtts[TUNE_SAMPLES], polls[TUNE_SAMPLES];
+    
+    for (i = 0; i < TUNE_SAMPLES; i++) {
+        t = now_usec();
+        if (0 != tune_post(rc_qp, rm, size, inline_flag, SIGNALED)) {
+            return 1;
+        }
+        if (0 != tune_wait(rc_qp, &polls[i])) {
+            return 1;
+        }
+        rtts[i] = now_usec() - t;
+    }
+    *rtt = median(rtts, TUNE_SAMPLES);
+    if (o_poll) {
+        *o_poll = median(polls, TUNE_SAMPLES);
+    }
+    return 0;
+}
+
+/**
+ * Measure the overhead of posting a write (o) and the gap between 
+ * writes (g) with streams of unsignaled writes, each ended by a 
+ * signaled one (medians)
+ */
+static int
+tune_stream( rc_qp_t *rc_qp, rem_mem_t rm, uint32_t size, 
+             double *o, double *g )
+{
+    int i, j, count, inline_flag;
+    double t1, t2, os[TUNE_SAMPLES], gs[TUNE_SAMPLES];
+    
+    count = TUNE_STREAM_LEN;
+    if (count > IBDEV->rc_max_send_wr / 2) {
+        count = IBDEV->rc_max_send_wr / 2;
+    }
+    if (count < 1) count = 1;
+    inline_flag = (size <= IBDEV->rc_inline_cutoff);
+    for (i = 0; i < TUNE_SAMPLES; i++) {
+        t1 = now_usec();
+        for (j = 0; j < count; j++) {
+            if (0 != tune_post(rc_qp, rm, size, inline_flag, 
+                                (j == count - 1) ? SIGNALED : NOTSIGNALED)) {
+                return 1;
+            }
+        }
+        t2 = now_usec();
+        if (0 != tune_wait(rc_qp, NULL)) {
+            return 1;
+        }
+        os[i] = (t2 - t1) / count;
+        gs[i] = (now_usec() - t1) / count;
+    }
+    *o = median(os, TUNE_SAMPLES);
+    *g = median(gs, TUNE_SAMPLES);
+    return 0;
+}
+
+/**
+ * Measure the profile on the CTRL QP of a server
+ */
+static int
+tune_measure( uint8_t target, dare_ib_profile_t *p )
+{
+    uint32_t size, cutoff;
+    double rtt[2], g_large, o_large;
+    int done;
+    dare_ib_ep_t *ep = (dare_ib_ep_t*)SRV_DATA->config.servers[target].ep;
+    rc_qp_t *rc_qp = &ep->rc_ep.rc_qp[CTRL_QP];
+    rem_mem_t rm;
+    
+    rm.raddr = ep->rc_ep.rmt_mr[CTRL_QP].raddr + 
+                offsetof(ctrl_data_t, tune_buf);
+    rm.rkey = ep->rc_ep.rmt_mr[CTRL_QP].rkey;
+    tune_wrid = 0;
+    WRID_SET_CONN(tune_wrid, target);
+    
+    /* Inline cutoff: writes are sent inline up to the largest size 
+    for which inlining does not increase the RTT */
+    for (cutoff = 0, done = 0, size = 8; 
+        !done && (size <= IBDEV->rc_max_inline_data); size <<= 1) 
+    {
+        if (0 != tune_rtt(rc_qp, rm, size, 0, &rtt[0], NULL)) return 1;
+        if (0 != tune_rtt(rc_qp, rm, size, 1, &rtt[1], NULL)) return 1;
+        if (rtt[1] <= rtt[0]) {
+            cutoff = size;
+        }
+        else {
+            done = 1;
+        }
+    }
+    if ( !done && (cutoff < IBDEV->rc_max_inline_data) ) {
+        cutoff = IBDEV->rc_max_inline_data;
+    }
+    p->inline_cutoff = cutoff;
+    IBDEV->rc_inline_cutoff = cutoff;
+    
+    /* RTT and polling overhead for log entries */
+    if (0 != tune_rtt(rc_qp, rm, TUNE_ENTRY_SIZE, 0, &p->L[0], &p->o_poll)) {
+        return 1;
+    }
+    p->L[1] = p->L[0];
+    if (TUNE_ENTRY_SIZE <= IBDEV->rc_max_inline_data) {
+        if (0 != tune_rtt(rc_qp, rm, TUNE_ENTRY_SIZE, 1, &p->L[1], NULL)) {
+            return 1;
+        }
+    }
+    
+    /* Posting overhead and gaps */
+    if (0 != tune_stream(rc_qp, rm, TUNE_ENTRY_SIZE, &p->o, &p->g)) {
+        return 1;
+    }
+    if (0 != tune_stream(rc_qp, rm, TUNE_BUF_SIZE, &o_large, &g_large)) {
+        return 1;
+    }
+    p->G = (g_large - p->g) / (TUNE_BUF_SIZE - TUNE_ENTRY_SIZE);
+    if (p->G < 0) p->G = 0;
+    
+    return 0;
+}
+
+/**
+ * Pick the signaling interval and the log window from the profile; 
+ * a log update costs F posts, an RTT and a poll, while w updates in 
+ * flight are paced by the gap of F writes (F followers)
+ */
+static void
+tune_pick( dare_ib_profile_t *p, double latency_target )
+{
+    uint32_t k, w, max_k;
+    double rtt, F;
+    
+    /* Signaling interval: poll for the signaled WR rarely enough to 
+    amortize its overhead; a smaller interval frees the Send Queue 
+    sooner */
+    max_k = IBDEV->rc_max_send_wr / 2;
+    if (max_k < 1) max_k = 1;
+    for (k = 1; (k < max_k) && (p->o_poll / k > TUNE_POLL_RATIO * p->o); k <<= 1);
+    if (k > max_k) k = max_k;
+    p->signal_interval = k;
+    
+    /* Log window: enough updates in flight to cover the RTT (i.e., 
+    maximum modeled throughput), but not more than what the latency 
+    target allows under load */
+    F = get_group_size(SRV_DATA->config) - 1;
+    if (F < 1) F = 1;
+    rtt = p->L[TUNE_ENTRY_SIZE <= p->inline_cutoff];
+    w = (p->g > 0) ? (uint32_t)ceil(rtt / p->g) : 1;
+    if (w < 1) w = 1;
+    if (w > LR_WINDOW_MAX) w = LR_WINDOW_MAX;
+    while ( (w > 1) && (latency_target > 0) && 
+        (F * p->o + rtt + p->o_poll + (w - 1) * F * p->g > latency_target) )
+    {
+        w--;
+    }
+    p->window = w;
+    p->commit[0] = F * p->o + rtt + p->o_poll;
+    p->commit[1] = p->commit[0] + (w - 1) * F * p->g;
+}
+
+/**
+ * Profile file: "key value" lines; valid only for the same device, 
+ * port, MTU and max inline data
+ */
+static int
+tune_load( const char *path, dare_ib_profile_t *p )
+{
+    FILE *fp;
+    char key[64], val[64];
+    int match = 0;
+    
+    fp = fopen(path, "r");
+    if (NULL == fp) {
+        return 1;
+    }
+    memset(p, 0, sizeof(dare_ib_profile_t));
+    while (2 == fscanf(fp, "%63s %63s", key, val)) {
+        if (0 == strcmp(key, "device")) {
+            match += (0 == strcmp(val, dare_tp->get_device_name(IBDEV->ib_dev)));
+        }
+        else if (0 == strcmp(key, "port")) {
+            match += (atoi(val) == IBDEV->port_num);
+        }
+        else if (0 == strcmp(key, "mtu")) {
+            match += (atoi(val) == mtu_value(IBDEV->mtu));
+        }
+        else if (0 == strcmp(key, "max_inline")) {
+            match += ((uint32_t)atoi(val) == IBDEV->rc_max_inline_data);
+        }
+        else if (0 == strcmp(key, "o")) p->o = atof(val);
+        else if (0 == strcmp(key, "o_poll")) p->o_poll = atof(val);
+        else if (0 == strcmp(key, "L")) p->L[0] = atof(val);
+        else if (0 == strcmp(key, "L_inline")) p->L[1] = atof(val);
+        else if (0 == strcmp(key, "g")) p->g = atof(val);
+        else if (0 == strcmp(key, "G")) p->G = atof(val);
+        else if (0 == strcmp(key, "inline_cutoff")) {
+            p->inline_cutoff = atoi(val);
+        }
+    }
+    fclose(fp);
+    if ( (4 != match) || (p->o <= 0) || (p->L[0] <= 0) ) {
+        info(log_fp, "# Profile %s is not for this device\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+static void
+tune_save( const char *path, dare_ib_profile_t *p )
+{
+    FILE *fp;
+    
+    fp = fopen(path, "w");
+    if (NULL == fp) {
+        info(log_fp, "# Cannot write profile %s: %s\n", path, strerror(errno));
+        return;
+    }
+    fprintf(fp, "device %s\nport %d\nmtu %d\nmax_inline %"PRIu32"\n",
+            dare_tp->get_device_name(IBDEV->ib_dev), IBDEV->port_num, 
+            mtu_value(IBDEV->mtu), IBDEV->rc_max_inline_data);
+    fprintf(fp, "o %lf\no_poll %lf\nL %lf\nL_inline %lf\ng %lf\nG %lf\n"
+            "inline_cutoff %"PRIu32"\n", p->o, p->o_poll, p->L[0], p->L[1], 
+            p->g, p->G, p->inline_cutoff);
+    fclose(fp);
+}
+
+/**
+ * Tune the RC parameters; on failure, the defaults are kept
+ * Note: called once the RC connections are established, before the 
+ * server starts an election or recovers (see the note above)
+ */
+int rc_tune( const char *profile_path, double latency_target )
+{
+    int rc;
+    uint8_t i, size, target;
+    dare_ib_ep_t *ep;
+    dare_ib_profile_t p;
+    
+    if (SID_GET_L(SRV_DATA->ctrl_data->sid)) {
+        /* The HBs and the lease accounting need the DARE thread */
+        error_return(1, log_fp, "Cannot tune with a leader\n");
+    }
+    if ( (NULL == profile_path) || ('\0' == profile_path[0]) || 
+        (0 != tune_load(profile_path, &p)) ) 
+    {
+        /* Find a connected server */
+        size = get_extended_group_size(SRV_DATA->config);
+        for (target = size, i = 0; i < size; i++) {
+            if (i == SRV_DATA->config.idx) continue;
+            if (!CID_IS_SERVER_ON(SRV_DATA->config.cid, i)) continue;
+            ep = (dare_ib_ep_t*)SRV_DATA->config.servers[i].ep;
+            if ( (0 != ep->rc_connected) && 
+                (RC_QP_ACTIVE == ep->rc_ep.rc_qp[CTRL_QP].state) && 
+                (0 == ep->rc_ep.rc_qp[CTRL_QP].signaled_wr_id) )
+            {
+                target = i;
+                break;
+            }
+        }
+        if (target == size) {
+            error_return(1, log_fp, "No server to measure the profile\n");
+        }
+        /* Complete the outstanding WRs first */
+        rc = empty_completion_queue(SRV_DATA->config.idx, CTRL_QP, 0, NULL);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot empty completion queue\n");
+        }
+        memset(&p, 0, sizeof(dare_ib_profile_t));
+        rc = tune_measure(target, &p);
+        /* Handle the other WCs found while measuring */
+        if (0 != empty_completion_queue(SRV_DATA->config.idx, CTRL_QP, 0, NULL)) {
+            error_return(1, log_fp, "Cannot empty completion queue\n");
+        }
+        if (0 != rc) {
+            IBDEV->rc_inline_cutoff = IBDEV->rc_max_inline_data;
+            error_return(1, log_fp, "Cannot measure the profile\n");
+        }
+        /* The signaled writes freed the Send Queue */
+        ep = (dare_ib_ep_t*)SRV_DATA->config.servers[target].ep;
+        ep->rc_ep.rc_qp[CTRL_QP].send_count = 0;
+        if ( (NULL != profile_path) && ('\0' != profile_path[0]) ) {
+            tune_save(profile_path, &p);
+        }
+    }
+    tune_pick(&p, latency_target);
+    
+    IBDEV->profile = p;
+    IBDEV->rc_inline_cutoff = p.inline_cutoff;
+    IBDEV->rc_signal_interval = p.signal_interval;
+    log_window = p.window;
+    IBDEV->tuned = 1;
+    tune_obs_idx = 0;
+    
+    info(log_fp, "# LogGP: o=%.3lf o_poll=%.3lf L=%.2lf (inline %.2lf) "
+        "g=%.3lf G=%.5lf us\n", p.o, p.o_poll, p.L[0], p.L[1], p.g, p.G);
+    info(log_fp, "# Tuned: inline cutoff %"PRIu32"; signal interval %"PRIu32
+        "; log window %"PRIu32"; predicted commit latency %.2lf us "
+        "(loaded %.2lf us)\n", p.inline_cutoff, p.signal_interval, p.window, 
+        p.commit[0], p.commit[1]);
+    return 0;
+}
+
+/**
+ * Observed commit latency, reported once next to the predicted one
+ */
+static void
+tune_observe( double usec )
+{
+    tune_obs[tune_obs_idx++] = usec;
+    if (TUNE_OBSERVED != tune_obs_idx) {
+        return;
+    }
+    info_wtime(log_fp, "Commit latency: observed %.2lf us (median of %d); "
+            "predicted %.2lf us (loaded %.2lf us)\n", 
+            median(tune_obs, TUNE_OBSERVED), TUNE_OBSERVED, 
+            IBDEV->profile.commit[0], IBDEV->profile.commit[1]);
+    IBDEV->tuned = 2;
+}
+
 #endif 
 
 void rc_ib_send_msg() 
@@ -3757,13 +5024,13 @@ void rc_ib_send_msg()
         static uint32_t rc_psn2 = 20;
         dare_ib_ep_t *ep = (dare_ib_ep_t*)SRV_DATA->config.servers[0].ep;
         dare_ib_ep_t *ep2 = (dare_ib_ep_t*)SRV_DATA->config.servers[2].ep;
-        ibv_query_qp(ep->rc_ep.rc_qp[LOG_QP].qp, &attr, IBV_QP_RQ_PSN, &init_attr);
+        dare_tp->query_qp(ep->rc_ep.rc_qp[LOG_QP].qp, &attr, IBV_QP_RQ_PSN, &init_attr);
         if (rc_psn0 != attr.rq_psn) {
             info_wtime(log_fp, "RQ_PSN = %"PRIu32"\n", attr.rq_psn);
             rc_psn0 = attr.rq_psn;
         }
         ep = (dare_ib_ep_t*)SRV_DATA->config.servers[2].ep;
-        ibv_query_qp(ep->rc_ep.rc_qp[LOG_QP].qp, &attr, IBV_QP_RQ_PSN, &init_attr);
+        dare_tp->query_qp(ep->rc_ep.rc_qp[LOG_QP].qp, &attr, IBV_QP_RQ_PSN, &init_attr);
         if (rc_psn2 != attr.rq_psn) {
             info_wtime(log_fp, "RQ_PSN = %"PRIu32"\n", attr.rq_psn);
             rc_psn2 = attr.rq_psn;
@@ -3801,6 +5068,6 @@ void rc_ib_send_msg()
     }
     struct ibv_qp_attr attr;
     struct ibv_qp_init_attr init_attr;
-    ibv_query_qp(ep->rc_ep.rc_qp[LOG_QP].qp, &attr, IBV_QP_SQ_PSN, &init_attr);
+    dare_tp->query_qp(ep->rc_ep.rc_qp[LOG_QP].qp, &attr, IBV_QP_SQ_PSN, &init_attr);
     info_wtime(log_fp, "SQ_PSN = %"PRIu32"\n", attr.sq_psn);
 }
@@ -135,18 +135,18 @@ void ud_shutdown()
         free(wc_array);
     }
     if (NULL != IBDEV->ib_mcast_ah) {
-        ibv_destroy_ah(IBDEV->ib_mcast_ah);
+        dare_tp->destroy_ah(IBDEV->ib_mcast_ah);
     }
     ud_qp_destroy();
     ud_memory_dereg(IBDEV->ud_rcqe);
     if (NULL != IBDEV->ud_scq) {
-        ibv_destroy_cq(IBDEV->ud_scq);
+        dare_tp->destroy_cq(IBDEV->ud_scq);
     }
     if (NULL != IBDEV->ud_rcq) {
-        ibv_destroy_cq(IBDEV->ud_rcq);
+        dare_tp->destroy_cq(IBDEV->ud_rcq);
     }
     if (NULL != IBDEV->ud_pd) {
-        ibv_dealloc_pd(IBDEV->ud_pd);
+        dare_tp->dealloc_pd(IBDEV->ud_pd);
     }
         
 }
@@ -165,7 +165,7 @@ struct ibv_ah* ud_ah_create( uint16_t dlid, union ibv_gid dgid )
     ah_attr.src_path_bits = 0;
     ah_attr.port_num      = IBDEV->port_num;
 
-    ah = ibv_create_ah(IBDEV->ud_pd, &ah_attr);
+    ah = dare_tp->create_ah(IBDEV->ud_pd, &ah_attr);
     if (NULL == ah) {
         error(log_fp, "ibv_create_ah() failed because %s\n", strerror(errno));
         return NULL;
@@ -194,7 +194,7 @@ mcast_ah_create()
            &(IBDEV->mgid.raw), 
            sizeof(ah_attr.grh.dgid.raw));
     
-    ah = ibv_create_ah(IBDEV->ud_pd, &ah_attr);
+    ah = dare_tp->create_ah(IBDEV->ud_pd, &ah_attr);
     if (NULL == ah) {
         error_return(1, log_fp, "ibv_create_ah() failed because %s\n", 
                      strerror(errno));
@@ -213,7 +213,7 @@ void ud_ah_destroy( struct ibv_ah* ah )
         return;
     }
         
-    rc = ibv_destroy_ah(ah);
+    rc = dare_tp->destroy_ah(ah);
     if (0 != rc) {
         debug(log_fp, "ibv_destroy_ah() failed because %s\n", strerror(rc));
     }
@@ -227,19 +227,19 @@ static int
 ud_prerequisite( uint32_t receive_count )
 {
     /* Allocate the UD protection domain */
-    IBDEV->ud_pd = ibv_alloc_pd(IBDEV->ib_dev_context);
+    IBDEV->ud_pd = dare_tp->alloc_pd(IBDEV->ib_dev_context);
     if (NULL == IBDEV->ud_pd) {
         error_return(1, log_fp, "Cannot allocate UD PD\n");
     }
     
     /* Create UD completion queues */
     IBDEV->ud_rcqe = receive_count;
-    IBDEV->ud_rcq = ibv_create_cq(IBDEV->ib_dev_context, 
-                   IBDEV->ud_rcqe, NULL, NULL, 0);
+    IBDEV->ud_rcq = dare_tp->create_cq(IBDEV->ib_dev_context, 
+                   IBDEV->ud_rcqe, NULL, IBDEV->cq_channel, 0);
     if (NULL == IBDEV->ud_rcq) {
         error_return(1, log_fp, "Cannot create UD Receive CQ\n");
     }
-    IBDEV->ud_scq = ibv_create_cq(IBDEV->ib_dev_context, 
+    IBDEV->ud_scq = dare_tp->create_cq(IBDEV->ib_dev_context, 
                                    IBDEV->ud_rcqe, NULL, NULL, 0);
     if (NULL == IBDEV->ud_scq) {
         error_return(1, log_fp, "Cannot create UD Send CQ\n");
@@ -279,7 +279,7 @@ ud_memory_reg()
             error_return(1, log_fp, "Cannot allocate memory for receive buffers");
         }
         memset(IBDEV->ud_recv_bufs[i], 0, mtu_value(IBDEV->mtu));
-        IBDEV->ud_recv_mrs[i] = ibv_reg_mr(
+        IBDEV->ud_recv_mrs[i] = dare_tp->reg_mr(
             IBDEV->ud_pd, 
             IBDEV->ud_recv_bufs[i], 
             mtu_value(IBDEV->mtu), 
@@ -295,7 +295,7 @@ ud_memory_reg()
         error_return(1, log_fp, "Cannot allocate memory for send buffer");
     }
     memset(IBDEV->ud_send_buf, 0, mtu_value(IBDEV->mtu)); 
-    IBDEV->ud_send_mr = ibv_reg_mr(
+    IBDEV->ud_send_mr = dare_tp->reg_mr(
         IBDEV->ud_pd, 
         IBDEV->ud_send_buf, 
         mtu_value(IBDEV->mtu), 
@@ -318,7 +318,7 @@ ud_memory_dereg()
         for (i = 0; i < IBDEV->ud_rcqe; i++) {
             if (NULL == IBDEV->ud_recv_mrs[i])
                 continue;
-            rc = ibv_dereg_mr(IBDEV->ud_recv_mrs[i]);
+            rc = dare_tp->dereg_mr(IBDEV->ud_recv_mrs[i]);
             if (0 != rc) {
                 error(log_fp, "Cannot deregister memory");
             }
@@ -339,7 +339,7 @@ ud_memory_dereg()
     
     /* Deregister memory for send buffer */
     if (NULL != IBDEV->ud_send_mr) {
-        rc = ibv_dereg_mr(IBDEV->ud_send_mr);
+        rc = dare_tp->dereg_mr(IBDEV->ud_send_mr);
         if (0 != rc) {
             error(log_fp, "Cannot deregister memory");
         }
@@ -399,7 +399,7 @@ ud_qp_create()
     init_attr.cap.max_recv_wr = IBDEV->ud_rcqe;
     init_attr.cap.max_send_wr = IBDEV->ud_rcqe;
 
-    qp = ibv_create_qp(IBDEV->ud_pd, &init_attr); 
+    qp = dare_tp->create_qp(IBDEV->ud_pd, &init_attr); 
     if (NULL == qp) {
         error_return(1, log_fp, "Could not create UD listen queue pair");
     }
@@ -435,7 +435,7 @@ ud_qp_create()
     // euler: 0xC001
     IBDEV->mlid = 0xc001;
     //IBDEV->mlid = 0xc003;
-    rc = ibv_attach_mcast(qp, 
+    rc = dare_tp->attach_mcast(qp, 
                           &IBDEV->mgid, 
                           IBDEV->mlid);
     if (0 != rc) {
@@ -452,14 +452,14 @@ ud_qp_create()
 #ifdef DEBUG    
     info(log_fp, "# pkey index = %"PRIu16" \n", IBDEV->pkey_index);
     uint16_t pkey;
-    ibv_query_pkey(IBDEV->ib_dev_context, 
+    dare_tp->query_pkey(IBDEV->ib_dev_context, 
                    IBDEV->port_num,
                    IBDEV->pkey_index,
                    &pkey);
     info(log_fp, "# pkey = %"PRIu16" \n", pkey);
 #endif 
 
-    rc = ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX
+    rc = dare_tp->modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX
                        | IBV_QP_PORT | IBV_QP_QKEY); 
     if (0 != rc) {
         error_return(1, log_fp, "ibv_modify_qp failed because %s\n", strerror(rc));
@@ -468,7 +468,7 @@ ud_qp_create()
     /* Move listen QP to RTR */
     attr.qp_state = IBV_QPS_RTR;
 
-    rc = ibv_modify_qp(qp, &attr, IBV_QP_STATE); 
+    rc = dare_tp->modify_qp(qp, &attr, IBV_QP_STATE); 
     if (0 != rc) {
         error_return(1, log_fp, "ibv_modify_qp failed because %s\n", strerror(rc));
     }
@@ -482,7 +482,7 @@ ud_qp_create()
     //attr.sq_psn = lrand48() & 0xffffff;
     attr.sq_psn = 0;
     
-    rc = ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_SQ_PSN); 
+    rc = dare_tp->modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_SQ_PSN); 
     if (0 != rc) {
         error_return(1, log_fp, "ibv_modify_qp failed because %s\n", strerror(rc));
     }
@@ -513,13 +513,13 @@ ud_qp_destroy()
         
         debug(log_fp, "Setting UD QP to err state\n");
 
-        rc = ibv_modify_qp(IBDEV->ud_qp, &attr, IBV_QP_STATE);
+        rc = dare_tp->modify_qp(IBDEV->ud_qp, &attr, IBV_QP_STATE);
         if (0 != rc) {
             debug(log_fp, "ibv_modify_qp failed because %s\n", strerror(rc));
             break;
         }
 
-        while (ibv_poll_cq(IBDEV->ud_rcq, 1, &wc) > 0);
+        while (dare_tp->poll_cq(IBDEV->ud_rcq, 1, &wc) > 0);
 
         /* move the QP into the RESET state */
         memset(&attr, 0, sizeof(attr));
@@ -527,21 +527,21 @@ ud_qp_destroy()
         
         debug(log_fp, "Setting UD QP to reset state\n");
 
-        rc = ibv_modify_qp(IBDEV->ud_qp, &attr, IBV_QP_STATE);
+        rc = dare_tp->modify_qp(IBDEV->ud_qp, &attr, IBV_QP_STATE);
         if (0 != rc) {
             debug(log_fp, "ibv_modify_qp failed because %s\n", strerror(rc));
             break;
         }
     } while (0);
     
-    rc = ibv_detach_mcast(IBDEV->ud_qp, 
+    rc = dare_tp->detach_mcast(IBDEV->ud_qp, 
                           &IBDEV->mgid, 
                           IBDEV->mlid);
     if (0 != rc) {
         debug(log_fp, "ibv_detach_mcast() failed because %s\n", strerror(rc));
     }
 
-    rc = ibv_destroy_qp(IBDEV->ud_qp);
+    rc = dare_tp->destroy_qp(IBDEV->ud_qp);
     if (0 != rc) {
         debug(log_fp, "ibv_destroy_qp failed because %s\n", strerror(rc));
     }
@@ -595,7 +595,7 @@ ud_post_receives()
                             &wr_array[i+1];
     }
     
-    rc = ibv_post_recv(IBDEV->ud_qp, wr_array, &bad_wr);
+    rc = dare_tp->post_recv(IBDEV->ud_qp, wr_array, &bad_wr);
     if (0 != rc) {
         error_return(1, log_fp, "ibv_post_recv failed because %s\n", strerror(rc));
     }
@@ -620,7 +620,7 @@ ud_post_one_receive( int idx )
     wr.sg_list = &sg;
     wr.num_sge = 1;
     
-    rc = ibv_post_recv(IBDEV->ud_qp, &wr, &bad_wr);
+    rc = dare_tp->post_recv(IBDEV->ud_qp, &wr, &bad_wr);
     if (0 != rc) {
         error_return(1, log_fp, "ibv_post_recv failed because %s\n", strerror(rc));
     }
@@ -670,7 +670,7 @@ ud_send_message( ud_ep_t *ud_ep, uint32_t len )
     wr.wr.ud.remote_qpn  = ud_ep->qpn;
     wr.wr.ud.remote_qkey = 0;
      
-    rc = ibv_post_send(IBDEV->ud_qp, &wr, &bad_wr);
+    rc = dare_tp->post_send(IBDEV->ud_qp, &wr, &bad_wr);
     if (0 != rc) {
         error_return(1, log_fp, "ibv_post_send failed because %s\n", strerror(rc));
     }
@@ -680,7 +680,7 @@ ud_send_message( ud_ep_t *ud_ep, uint32_t len )
     int num_comp;
      
     do {
-        num_comp = ibv_poll_cq(IBDEV->ud_scq, 1, &wc);
+        num_comp = dare_tp->poll_cq(IBDEV->ud_scq, 1, &wc);
     } while (num_comp == 0);
       
     if (num_comp < 0) {
@@ -750,7 +750,7 @@ mcast_send_message( uint32_t len )
     wr.wr.ud.remote_qpn  = 0xFFFFFF; // multicast: 0xFFFFFF
     wr.wr.ud.remote_qkey = 0;
      
-    rc = ibv_post_send(IBDEV->ud_qp, &wr, &bad_wr);
+    rc = dare_tp->post_send(IBDEV->ud_qp, &wr, &bad_wr);
     if (0 != rc) {
         error_return(1, log_fp, "ibv_post_send failed because \"%s\"\n", 
                     strerror(rc));
@@ -761,7 +761,7 @@ mcast_send_message( uint32_t len )
     int num_comp;
      
     do {
-        num_comp = ibv_poll_cq(IBDEV->ud_scq, 1, &wc);
+        num_comp = dare_tp->poll_cq(IBDEV->ud_scq, 1, &wc);
     } while (num_comp == 0);
       
     if (num_comp < 0) {
@@ -799,7 +799,7 @@ uint8_t ud_get_message()
     uint8_t read_flag = 0;
 
 get_message:    
-    ne = ibv_poll_cq(IBDEV->ud_rcq, 1, wc);
+    ne = dare_tp->poll_cq(IBDEV->ud_rcq, 1, wc);
     if (ne < 0) {
         error_return(MSG_ERROR, log_fp, "Couldn't poll completion queue\n");
     }
@@ -1047,7 +1047,7 @@ handle_server_join_request( struct ibv_wc *wc, ud_hdr_t *request )
     new_server->fail_count = 0;
     new_server->next_lr_step = LR_GET_WRITE;
     new_server->send_flag = 1;
-    new_server->send_count = 0;
+    memset(&new_server->win, 0, sizeof(lr_window_t));
     SRV_DATA->ctrl_data->vote_ack[empty] = SRV_DATA->log->len;
     SRV_DATA->ctrl_data->apply_offsets[empty] = SRV_DATA->log->head;
     
@@ -1520,10 +1520,18 @@ wc_to_ud_ep(ud_ep_t *ud_ep, struct ibv_wc *wc, union ibv_gid dest_gid, uint16_t
     return 0;
 }
 
+/**
+ * LID of this server as the peers see it; on RoCE, derived from the 
+ * hostname; on the emulated fabric, the hostname is the same for all 
+ * the servers, but the LIDs are unique
+ */
 static uint16_t
 get_unique_slid()
 {
     char name[65];
+    if (&dare_tp_shm_ops == dare_tp) {
+        return IBDEV->lid;
+    }
     gethostname(name, sizeof(name));
     uint16_t lid = name[21] - '0';
     return lid;
@@ -0,0 +1,262 @@
+/**
+ * DARE (Direct Access REplication)
+ *
+ * Memory registration cache
+ *
+ * Copyright (c) 2014-2015 ETH-Zurich. All rights reserved.
+ *
+ * Author(s): Marius Poke <marius.poke@inf.ethz.ch>
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../include/dare/debug.h"
+#include "../../utils/rbtree/include/rbtree_augmented.h"
+
+#include "../include/dare/dare_mr_cache.h"
+#include "../include/dare/dare_tp.h"
+
+static uint64_t mr_clock;
+
+/* ================================================================== */
+
+static uint64_t
+compute_subtree_last( mr_entry_t *e );
+static mr_entry_t*
+mr_search( struct rb_node *node, uint64_t start, uint64_t last, int access );
+static mr_entry_t*
+mr_overlap( struct rb_node *node, uint64_t start, uint64_t last );
+static void
+mr_insert( struct rb_root *root, mr_entry_t *e );
+static void
+mr_erase( struct rb_root *root, mr_entry_t *e );
+static void
+mr_evict( struct rb_root *root );
+
+RB_DECLARE_CALLBACKS(static, mr_augment, mr_entry_t, node,
+                     uint64_t, subtree_last, compute_subtree_last)
+
+/* ================================================================== */
+
+/**
+ * Get a registration that covers [addr, addr+len) with (at least)
+ * the given access flags; register the range if none is cached
+ * Note: release it with mr_cache_put; the registration is kept until
+ * the memory is freed (see mr_cache_invalidate) or it is evicted
+ */
+struct ibv_mr* mr_cache_get( struct rb_root *root, struct ibv_pd *pd,
+                             void *addr, uint64_t len, int access )
+{
+    mr_entry_t *e;
+    struct ibv_mr *mr;
+    uint64_t start = (uint64_t)addr;
+
+    if (0 == len) return NULL;
+
+    e = mr_search(root->rb_node, start, start + len - 1, access);
+    if (NULL != e) {
+        e->refs++;
+        e->used = ++mr_clock;
+        return e->mr;
+    }
+
+    mr = dare_tp->reg_mr(pd, addr, len, access);
+    if (NULL == mr) {
+        error(log_fp, "Cannot register memory because %s\n",
+              strerror(errno));
+        return NULL;
+    }
+    e = (mr_entry_t*)malloc(sizeof(mr_entry_t));
+    if (NULL == e) {
+        dare_tp->dereg_mr(mr);
+        error(log_fp, "Cannot allocate MR cache entry\n");
+        return NULL;
+    }
+    mr_evict(root);
+    e->start = start;
+    e->last = start + len - 1;
+    e->mr = mr;
+    e->access = access;
+    e->refs = 1;
+    e->used = ++mr_clock;
+    mr_insert(root, e);
+
+    return mr;
+}
+
+/**
+ * Release a registration obtained with mr_cache_get
+ */
+void mr_cache_put( struct rb_root *root, struct ibv_mr *mr )
+{
+    struct rb_node *node;
+    mr_entry_t *e;
+
+    for (node = rb_first(root); node; node = rb_next(node)) {
+        e = rb_entry(node, mr_entry_t, node);
+        if (e->mr != mr) continue;
+        if (e->refs) e->refs--;
+        return;
+    }
+}
+
+/**
+ * Free hook: deregister all the cached registrations that overlap
+ * [addr, addr+len); call it before freeing the memory
+ */
+void mr_cache_invalidate( struct rb_root *root, void *addr, uint64_t len )
+{
+    mr_entry_t *e;
+    uint64_t start = (uint64_t)addr;
+
+    if (0 == len) return;
+
+    while (NULL != (e = mr_overlap(root->rb_node, start, start + len - 1))) {
+        if (e->refs) {
+            error(log_fp, "Freeing registered memory that is in use\n");
+        }
+        mr_erase(root, e);
+    }
+}
+
+void mr_cache_free( struct rb_root *root )
+{
+    struct rb_node *node;
+    mr_entry_t *e;
+
+    for (node = rb_first_postorder(root); node;) {
+        e = rb_entry(node, mr_entry_t, node);
+        node = rb_next_postorder(node);
+        if (0 != dare_tp->dereg_mr(e->mr)) {
+            error(log_fp, "Cannot deregister memory");
+        }
+        free(e);
+    }
+    root->rb_node = NULL;
+}
+
+/* ================================================================== */
+
+static uint64_t
+compute_subtree_last( mr_entry_t *e )
+{
+    uint64_t max = e->last;
+    mr_entry_t *child;
+
+    if (e->node.rb_left) {
+        child = rb_entry(e->node.rb_left, mr_entry_t, node);
+        if (child->subtree_last > max) max = child->subtree_last;
+    }
+    if (e->node.rb_right) {
+        child = rb_entry(e->node.rb_right, mr_entry_t, node);
+        if (child->subtree_last > max) max = child->subtree_last;
+    }
+    return max;
+}
+
+/**
+ * Find an entry that covers [start, last] with the access flags;
+ * the entries on the right of a node start after it; thus, once a
+ * node starts after start, only its left subtree can cover the range
+ */
+static mr_entry_t*
+mr_search( struct rb_node *node, uint64_t start, uint64_t last, int access )
+{
+    mr_entry_t *e, *found;
+
+    while (node) {
+        e = rb_entry(node, mr_entry_t, node);
+        if (e->subtree_last < last) {
+            /* No entry in this subtree reaches last */
+            return NULL;
+        }
+        if (node->rb_left) {
+            found = mr_search(node->rb_left, start, last, access);
+            if (found) return found;
+        }
+        if (e->start > start) return NULL;
+        if ( (e->last >= last) && ((e->access & access) == access) ) {
+            return e;
+        }
+        node = node->rb_right;
+    }
+    return NULL;
+}
+
+/**
+ * Find the first entry that overlaps [start, last]
+ */
+static mr_entry_t*
+mr_overlap( struct rb_node *node, uint64_t start, uint64_t last )
+{
+    mr_entry_t *e, *found;
+
+    while (node) {
+        e = rb_entry(node, mr_entry_t, node);
+        if (e->subtree_last < start) return NULL;
+        if (node->rb_left) {
+            found = mr_overlap(node->rb_left, start, last);
+            if (found) return found;
+        }
+        if (e->start > last) return NULL;
+        if (e->last >= start) return e;
+        node = node->rb_right;
+    }
+    return NULL;
+}
+
+static void
+mr_insert( struct rb_root *root, mr_entry_t *e )
+{
+    struct rb_node **new = &(root->rb_node), *parent = NULL;
+    mr_entry_t *this;
+
+    while (*new) {
+        parent = *new;
+        this = rb_entry(parent, mr_entry_t, node);
+        if (this->subtree_last < e->last)
+            this->subtree_last = e->last;
+        if (e->start < this->start)
+            new = &(parent->rb_left);
+        else
+            new = &(parent->rb_right);
+    }
+    e->subtree_last = e->last;
+    rb_link_node(&e->node, parent, new);
+    rb_insert_augmented(&e->node, root, &mr_augment);
+}
+
+static void
+mr_erase( struct rb_root *root, mr_entry_t *e )
+{
+    rb_erase_augmented(&e->node, root, &mr_augment);
+    if (0 != dare_tp->dereg_mr(e->mr)) {
+        error(log_fp, "Cannot deregister memory");
+    }
+    free(e);
+}
+
+/**
+ * Make room for a new entry: drop the least recently used
+ * registration that is not in use
+ */
+static void
+mr_evict( struct rb_root *root )
+{
+    struct rb_node *node;
+    mr_entry_t *e, *lru = NULL;
+    int count = 0;
+
+    for (node = rb_first(root); node; node = rb_next(node)) {
+        e = rb_entry(node, mr_entry_t, node);
+        count++;
+        if (e->refs) continue;
+        if ( (NULL == lru) || (e->used < lru->used) ) lru = e;
+    }
+    if ( (count >= MR_CACHE_MAX) && (NULL != lru) ) {
+        mr_erase(root, lru);
+    }
+}
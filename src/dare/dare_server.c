@@ -17,7 +17,14 @@
 #include <inttypes.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 
 
 #include "../include/dare/dare_ibv.h"
@@ -36,6 +43,11 @@ double recomputed_hb_timeout;
 int leader_failed;
 int hb_timeout_flag;
 uint64_t latest_hb_received;
+uint64_t hb_seen[MAX_SERVER_COUNT];     // HB counters of the last records
+
+/* Leader lease: I do not vote for another candidate until lease_until 
+(see lease_valid) */
+double lease_until;
 
 unsigned long long g_timerfreq;
 
@@ -52,6 +64,12 @@ unsigned long long g_timerfreq;
 #define IS_FOLLOWER (!IS_NONE && !IS_LEADER && !IS_CANDIDATE)
 #define IS_SID_DIRTY (data.ctrl_data->sid != data.ctrl_data->sid)
 
+/* Size of the log (see log_size_mb) */
+#define LOG_LEN (log_size_mb ? (log_size_mb << 20) : (uint64_t)LOG_SIZE)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
 /* DARE server state */
 #define TERMINATE       0x1
 #define INIT            0x2
@@ -59,8 +77,8 @@ unsigned long long g_timerfreq;
 #define RC_ESTABLISHED  0x8
 #define SM_RECOVERED    0x10
 #define LOG_RECOVERED   0x20
-#define SNAPSHOT        0x40
 #define DIE_AF_COMMIT   0x80
+#define CATCHUP         0x100
 uint64_t dare_state;
 
 FILE *log_fp;
@@ -69,9 +87,43 @@ FILE *log_fp;
 dare_server_data_t data;
 
 int prev_log_entry_head = 0;
+log_ring_t log_ring;
+log_rsv_t log_rsv;
 
 dare_log_entry_det_t last_applied_entry;
 
+/* Snapshot production: a helper thread dumps the stable storage into 
+the two registered chunks, while the DARE thread publishes the ready 
+chunks and reuses the acknowledged ones (see poll_sm_requests) */
+#define SM_CHUNK_FREE   0
+#define SM_CHUNK_READY  1
+#define SM_CHUNK_SENT   2
+struct sm_job_t {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             active;         // a snapshot is being sent
+    int             stop;           // the helper thread must exit
+    int             error;          // the dump failed
+    uint8_t         target;         // joiner
+    uint64_t        to_idx;         // last record in the snapshot
+    dare_log_entry_det_t last_entry;
+    uint64_t        total;          // upper bound of the snapshot length
+    int             state[2];       // state of the chunks
+    uint64_t        seq[2];         // chunk numbers
+    uint64_t        offset[2];      // offsets of the chunks in the snapshot
+    int             last[2];        // last chunk of the snapshot
+    uint64_t        sent;           // last chunk published
+    ev_tstamp       start_ts;
+    ev_tstamp       ack_ts;         // time of the last acknowledgement
+    ev_tstamp       loop_ts;        // time of the previous loop iteration
+    ev_tstamp       max_gap;        // longest loop iteration during the job
+};
+struct sm_job_t sm_job = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
 /* ================================================================== */
 /* libEV events */
 
@@ -90,6 +142,12 @@ ev_timer to_adjust_event;
 /* A timer event for log pruning */
 ev_timer prune_event;
 
+/* Idle mode: io events for the completion channel and for the requests 
+of the proxy threads, and a timer event for checking the log */
+ev_io cq_event;
+ev_io kick_event;
+ev_timer idle_event;
+
 /* ================================================================== */
 /* local function - prototypes */
 
@@ -97,11 +155,29 @@ static int
 init_server_data();
 static void
 free_server_data();
+static int
+init_log_region( const char *path );
+static int
+init_log_memory();
+static void
+free_log_memory();
+static void
+free_log_region();
 
+static int
+recover_local_sm();
 static void 
 poll_sm_reply();
 static void
 poll_sm_requests();
+static int
+start_sm_job( uint8_t target );
+static void
+progress_sm_job();
+static void
+stop_sm_job();
+static void*
+sm_job_thread( void *arg );
 static void 
 poll_config_entries();
 static void 
@@ -109,7 +185,27 @@ commit_new_entries();
 static void 
 apply_committed_entries();
 static void 
+append_inband_entries();
+static void 
 persist_new_entries();
+static int
+store_entry( dare_log_entry_t *entry );
+static void
+ack_persisted_entries();
+static uint64_t
+persisted_idx();
+static int
+replay_entry( dare_log_entry_t *entry );
+static void
+persist_stage_cb( stage_rec_t *rec, void *arg );
+static void
+apply_stage_cb( stage_rec_t *rec, void *arg );
+static void
+poll_catchup();
+static void
+poll_catchup_requests();
+static void
+send_catchup_request();
 
 static double
 random_election_timeout();
@@ -117,11 +213,39 @@ static double
 hb_timeout();
 static void
 start_election();
+static uint64_t
+hb_read( uint8_t idx );
+static uint64_t
+hb_peek( uint8_t idx );
+static double
+lease_now();
+static void
+lease_renew();
+static int
+lease_valid();
 static void 
 poll_vote_count();
+static dare_nc_buf_t*
+publish_nc_buf();
+static void
+stop_log_reservations();
 
 static void
 polling();
+static int
+init_idle_mode();
+static uint64_t
+loop_activity();
+static int
+busy_server();
+static void
+check_idle();
+static void
+enter_idle_mode();
+static void
+leave_idle_mode();
+static void
+idle_poll();
 static void 
 poll_ud();
 static void
@@ -132,6 +256,10 @@ static int
 log_pruning();
 static void
 force_log_pruning();
+static void
+send_catchup_notice( uint8_t target );
+static uint8_t
+catchup_donor( uint8_t target );
 static int 
 update_cid( dare_cid_t cid );
 
@@ -164,6 +292,12 @@ static void
 to_adjust_cb( EV_P_ ev_timer *w, int revents );
 static void
 poll_cb( EV_P_ ev_idle *w, int revents );
+static void
+cq_cb( EV_P_ ev_io *w, int revents );
+static void
+kick_cb( EV_P_ ev_io *w, int revents );
+static void
+idle_cb( EV_P_ ev_timer *w, int revents );
 
 /* ================================================================== */
 /* Init and cleaning up */
@@ -180,6 +314,7 @@ void *dare_server_init(void *arg)
     
     /* Store input into server's data structure */
     data.input = input;
+    data.kick_fd = -1;
 
     /* Set log file handler */
     log_fp = input->log;
@@ -246,6 +381,9 @@ void dare_server_shutdown()
     ev_timer_stop(data.loop, &prune_event);
     ev_timer_stop(data.loop, &hb_event);
     ev_timer_stop(data.loop, &to_adjust_event);
+    ev_timer_stop(data.loop, &idle_event);
+    ev_io_stop(data.loop, &cq_event);
+    ev_io_stop(data.loop, &kick_event);
     ev_break(data.loop, EVBREAK_ALL);
     
     dare_ib_srv_shutdown();
@@ -275,13 +413,22 @@ init_server_data()
     data.sm->proxy_store_cmd = data.input->store_cmd;
     data.sm->proxy_do_action = data.input->do_action;
     data.sm->proxy_get_db_size = data.input->get_db_size;
-    data.sm->proxy_create_db_snapshot = data.input->create_db_snapshot;
+    data.sm->proxy_get_db_chunk = data.input->get_db_chunk;
     data.sm->proxy_apply_db_snapshot = data.input->apply_db_snapshot;
     data.sm->proxy_update_state = data.input->update_state;
+    data.sm->proxy_get_db_records = data.input->get_db_records;
+    data.sm->proxy_apply_db_records = data.input->apply_db_records;
+    data.sm->proxy_get_db_last_idx = data.input->get_db_last_idx;
+    data.sm->proxy_replay_db = data.input->replay_db;
     data.sm->up_para = data.input->up_para;
 
     /* Set up the configuration */
     dare_read_config(data.input->config_path);
+    /* The transport provides the memory that the peers access */
+    rc = dare_ib_select_transport();
+    if (0 != rc) {
+        error_return(1, log_fp, "Cannot select the transport\n");
+    }
     data.config.idx = data.input->server_idx;
     data.config.len = MAX_SERVER_COUNT;
     if (data.config.len < data.input->group_size) {
@@ -303,55 +450,166 @@ init_server_data()
         data.config.servers[i].send_flag = 1;
     }
  
-    /* Allocate ctrl_data - needs to be 8 bytes aligned for CAS operations */
-    rc = posix_memalign((void**)&data.ctrl_data, sizeof(uint64_t), sizeof(ctrl_data_t));
-    if (0!= rc) {
-        error_return(1, log_fp, "Cannot allocate control data\n");
+    data.cu_min_idx = 1;
+    data.cu_owner = MAX_SERVER_COUNT;
+    data.sm_donor = MAX_SERVER_COUNT;
+    
+    if ('\0' != data.input->log_region[0]) {
+        /* Control data and log backed by a file */
+        if (0 == strcmp(transport, "shm")) {
+            /* The peers map only the buffers from alloc_buf */
+            error_return(1, log_fp, "A log region needs the ib transport\n");
+        }
+        rc = init_log_region(data.input->log_region);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot map log region\n");
+        }
     }
-    memset(data.ctrl_data, 0, sizeof(ctrl_data_t));
-    data.ctrl_data->sid = SID_NULL;
- 
-    /* Set up log */
-    data.log = log_new();
-    if (NULL == data.log) {
-        error_return(1, log_fp, "Cannot allocate log\n");
+    else {
+        /* Allocate ctrl_data - needs to be 8 bytes aligned for CAS operations */
+        data.ctrl_data = (ctrl_data_t*)dare_tp->alloc_buf(sizeof(ctrl_data_t));
+        if (NULL == data.ctrl_data) {
+            error_return(1, log_fp, "Cannot allocate control data\n");
+        }
+        memset(data.ctrl_data, 0, sizeof(ctrl_data_t));
+        data.ctrl_data->sid = SID_NULL;
+     
+        /* Set up log */
+        rc = init_log_memory();
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot allocate log\n");
+        }
+        data.rst_end = data.log->len;
     }
     
-    /* Allocate preregister snapshot */
-    rc = posix_memalign((void**)&data.prereg_snapshot, sizeof(uint64_t), 
-                    sizeof(snapshot_t) + PREREG_SNAPSHOT_SIZE);
-    if (0!= rc) {
-        error_return(1, log_fp, "Cannot allocate prereg snapshot\n");
+    /* Side ring of the log */
+    rc = log_ring_init(data.log);
+    if (0 != rc) {
+        error_return(1, log_fp, "Cannot allocate log ring\n");
+    }
+    rc = log_rsv_init();
+    if (0 != rc) {
+        error_return(1, log_fp, "Cannot init the log reservations\n");
+    }
+    
+    /* Allocate the snapshot chunks */
+    for (i = 0; i < 2; i++) {
+        data.sm_chunk[i] = dare_tp->alloc_buf(sizeof(snapshot_t) + SM_CHUNK_SIZE);
+        if (NULL == data.sm_chunk[i]) {
+            error_return(1, log_fp, "Cannot allocate snapshot chunk\n");
+        }
     }
     
+    /* Allocate buffer for catch-up chunks */
+    data.cu_buf = dare_tp->alloc_buf(CATCHUP_BUF_SIZE);
+    if (NULL == data.cu_buf) {
+        error_return(1, log_fp, "Cannot allocate catch-up buffer\n");
+    }
+    
+    /* Allocate the NC-Buffers: room for all the entries of the log, 
+    and two chunks per server for reading the remote ones */
+    data.nc_len = sizeof(dare_nc_buf_t) + sizeof(dare_log_entry_det_t) * 
+        (log_nc_buf_cap(data.log->len) + 2 * NC_CHUNK_ENTRIES * MAX_SERVER_COUNT);
+    data.nc_buf = (dare_nc_buf_t*)dare_tp->alloc_buf(data.nc_len);
+    if (NULL == data.nc_buf) {
+        error_return(1, log_fp, "Cannot allocate NC-Buffers\n");
+    }
+    data.nc_buf->len = 0;
+    data.nc_buf->cap = log_nc_buf_cap(data.log->len);
+    data.nc_chunks = data.nc_buf->entries + data.nc_buf->cap;
+    
     data.endpoints = RB_ROOT;
     
+    /* The proxy threads kick the server only when it sleeps */
+    if (idle_timeout > 0) {
+        data.kick_fd = eventfd(0, EFD_NONBLOCK);
+        if (data.kick_fd < 0) {
+            error_return(1, log_fp, "Cannot create eventfd\n");
+        }
+    }
+    
+    /* Pipeline: the DARE thread ingests and replicates the entries, 
+    and runs the HBs and the elections; the stages store and replay 
+    the commands */
+    rc = stage_pin(pthread_self(), cpu_dare);
+    if (0 != rc) {
+        error_return(1, log_fp, "Cannot pin the DARE thread\n");
+    }
+    if (pipeline_stages) {
+        rc = stage_start(&data.persist_stage, "persist", cpu_persist, 
+                        persist_stage_cb, NULL);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot start the persist stage\n");
+        }
+        rc = stage_start(&data.apply_stage, "apply", cpu_apply, 
+                        apply_stage_cb, NULL);
+        if (0 != rc) {
+            error_return(1, log_fp, "Cannot start the apply stage\n");
+        }
+    }
+    
     return 0;
 }
 
 static void
 free_server_data()
 {
+    int i;
+    
     ep_db_free(&data.endpoints);
     
+    /* The helper thread may still use the chunks */
+    stop_sm_job();
+    
+    /* The stages may still use the stable storage */
+    stage_stop(&data.persist_stage);
+    stage_stop(&data.apply_stage);
+    
+    /* The cached registrations were dropped in rc_free */
     if (NULL != data.snapshot) {
         free(data.snapshot);
         data.snapshot = NULL;
+        data.snapshot_size = 0;
     }
     
-    if (NULL != data.prereg_snapshot) {
-        free(data.prereg_snapshot);
-        data.prereg_snapshot = NULL;
+    for (i = 0; i < 2; i++) {
+        if (NULL != data.sm_chunk[i]) {
+            dare_tp->free_buf(data.sm_chunk[i], sizeof(snapshot_t) + SM_CHUNK_SIZE);
+            data.sm_chunk[i] = NULL;
+        }
     }
     
-    /* Free log */
-    log_free(data.log);
-
-    /* Free control data */
-    if (NULL != data.ctrl_data) {
-        free(data.ctrl_data);
-        data.ctrl_data = NULL;
-    } 
+    if (NULL != data.cu_buf) {
+        dare_tp->free_buf(data.cu_buf, CATCHUP_BUF_SIZE);
+        data.cu_buf = NULL;
+    }
+    
+    if (NULL != data.nc_buf) {
+        dare_tp->free_buf(data.nc_buf, data.nc_len);
+        data.nc_buf = NULL;
+    }
+    
+    log_ring_free();
+    
+    if (NULL != data.region) {
+        /* Log and control data are in the log region */
+        free_log_region();
+    }
+    else {
+        /* Free log */
+        free_log_memory();
+    
+        /* Free control data */
+        if (NULL != data.ctrl_data) {
+            dare_tp->free_buf(data.ctrl_data, sizeof(ctrl_data_t));
+            data.ctrl_data = NULL;
+        } 
+    }
+    
+    if (data.kick_fd >= 0) {
+        close(data.kick_fd);
+        data.kick_fd = -1;
+    }
     
     /* Free servers */
     if (NULL != data.config.servers) {
@@ -360,6 +618,183 @@ free_server_data()
     }
 }
 
+/**
+ * Map the log region from a file, so that the control data and the log 
+ * survive a restart (the updates reach the file through the page cache, 
+ * which covers the crash of the process). If the file already holds a 
+ * region, the private data (i.e., the votes replicated here) and the 
+ * valid committed log entries are restored; the rest of the control 
+ * data is reset
+ */
+static int
+init_log_region( const char *path )
+{
+    int fd;
+    struct stat st;
+    void *region;
+    uint64_t ctrl_len, len, count;
+    int valid;
+    prv_data_t prv_data[MAX_SERVER_COUNT];
+    
+    ctrl_len = (sizeof(ctrl_data_t) + PAGE_SIZE - 1) & ~((uint64_t)PAGE_SIZE - 1);
+    len = PAGE_SIZE + ctrl_len + sizeof(dare_log_t) + LOG_LEN;
+    
+    fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        error_return(1, log_fp, "Cannot open %s: %s\n", path, strerror(errno));
+    }
+    if (0 != flock(fd, LOCK_EX | LOCK_NB)) {
+        close(fd);
+        error_return(1, log_fp, "Log region %s is in use\n", path);
+    }
+    if (0 != fstat(fd, &st)) {
+        close(fd);
+        error_return(1, log_fp, "Cannot stat %s: %s\n", path, strerror(errno));
+    }
+    valid = ((uint64_t)st.st_size == len);
+    if (!valid) {
+        /* New region (zero filled) */
+        if ( (0 != ftruncate(fd, 0)) || (0 != ftruncate(fd, len)) ) {
+            close(fd);
+            error_return(1, log_fp, "Cannot resize %s: %s\n", path, strerror(errno));
+        }
+    }
+    /* Prefaulted and locked, like a log in memory (see init_log_memory) */
+    region = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+                  MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (MAP_FAILED == region) {
+        close(fd);
+        error_return(1, log_fp, "Cannot map %s: %s\n", path, strerror(errno));
+    }
+    if (0 != mlock(region, len)) {
+        info(log_fp, "Cannot lock the log region in memory: %s\n", 
+             strerror(errno));
+    }
+    data.region = (log_region_hdr_t*)region;
+    data.region_len = len;
+    data.region_fd = fd;
+    data.ctrl_data = (ctrl_data_t*)((char*)region + PAGE_SIZE);
+    data.log = (dare_log_t*)((char*)data.ctrl_data + ctrl_len);
+    data.rst_end = LOG_LEN;
+    
+    /* Only a server that joins recovers; a server that starts 
+    (a new group) starts with an empty log */
+    valid = valid && (SRV_TYPE_JOIN == data.input->srv_type) &&
+            (LOG_REGION_MAGIC == data.region->magic) && 
+            (LOG_REGION_VERSION == data.region->version) &&
+            (sizeof(ctrl_data_t) == data.region->ctrl_size) && 
+            (sizeof(dare_log_t) + LOG_LEN == data.region->log_size);
+    if (!valid) {
+        info(log_fp, "New log region %s\n", path);
+        memset(data.region, 0, PAGE_SIZE);
+        memset(data.ctrl_data, 0, sizeof(ctrl_data_t));
+        data.ctrl_data->sid = SID_NULL;
+        memset(data.log, 0, sizeof(dare_log_t));
+        data.log->len = LOG_LEN;
+        /* Sets the offsets of an empty log */
+        log_restore(data.log);
+        data.region->version = LOG_REGION_VERSION;
+        data.region->ctrl_size = sizeof(ctrl_data_t);
+        data.region->log_size = sizeof(dare_log_t) + LOG_LEN;
+        data.region->cu_min_idx = data.cu_min_idx;
+        data.region->magic = LOG_REGION_MAGIC;
+        return 0;
+    }
+    
+    /* Restore the private data */
+    memcpy(prv_data, data.ctrl_data->prv_data, sizeof(prv_data));
+    memset(data.ctrl_data, 0, sizeof(ctrl_data_t));
+    memcpy(data.ctrl_data->prv_data, prv_data, sizeof(prv_data));
+    data.ctrl_data->sid = SID_NULL;
+    data.cu_min_idx = data.region->cu_min_idx;
+    
+    /* Restore the log */
+    data.rst_head = data.log->head;
+    count = log_restore(data.log);
+    if (count) {
+        data.rst_end = data.log->end;
+    }
+    info(log_fp, "Restored %"PRIu64" log entries from %s\n", count, path);
+    INFO_PRINT_LOG(log_fp, data.log);
+    
+    return 0;
+}
+
+/**
+ * Allocate the log: from 1 GB hugepages if it fills at least one, from 
+ * 2 MB hugepages otherwise, and from normal pages if no hugepages are 
+ * reserved (see /proc/sys/vm/nr_hugepages). The log is prefaulted and 
+ * locked, so that neither the CPU nor the NIC fault on it; larger pages 
+ * also mean fewer translation entries for the NIC on every RDMA access.
+ * Normal pages come from the transport (see alloc_buf); the shm 
+ * transport needs them, as it shares the log with the other servers
+ */
+static int
+init_log_memory()
+{
+    static const uint64_t page_sizes[] = {1UL << 30, 2UL << 20, PAGE_SIZE};
+    static const int page_shifts[] = {30, 21, 0};
+    uint64_t len = sizeof(dare_log_t) + LOG_LEN, map_len = 0;
+    void *mem = MAP_FAILED;
+    int i, flags;
+    
+    for (i = 0; i < 3; i++) {
+        map_len = (len + page_sizes[i] - 1) & ~(page_sizes[i] - 1);
+        if (0 == page_shifts[i]) {
+            mem = dare_tp->alloc_buf(map_len);
+            if (NULL == mem) mem = MAP_FAILED;
+            break;
+        }
+        if (!log_hugepages || (len < page_sizes[i]) ||
+            (0 == strcmp(transport, "shm"))) continue;
+        flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | 
+                MAP_HUGETLB | (page_shifts[i] << MAP_HUGE_SHIFT);
+        mem = mmap(NULL, map_len, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (MAP_FAILED != mem) break;
+    }
+    if (MAP_FAILED == mem) {
+        error_return(1, log_fp, "Cannot map %"PRIu64" bytes: %s\n", 
+                    map_len, strerror(errno));
+    }
+    if (0 != mlock(mem, map_len)) {
+        /* Still prefaulted, but it may be swapped (see RLIMIT_MEMLOCK) */
+        info(log_fp, "Cannot lock the log in memory: %s\n", strerror(errno));
+    }
+    data.log_map_len = map_len;
+    data.log_page_size = page_sizes[i];
+    data.log = log_init(mem, LOG_LEN);
+    info(log_fp, "Log of %"PRIu64" MB on %"PRIu64" KB pages\n", 
+         data.log->len >> 20, data.log_page_size >> 10);
+    
+    return 0;
+}
+
+static void
+free_log_memory()
+{
+    if (NULL == data.log) return;
+    if (PAGE_SIZE == data.log_page_size) {
+        dare_tp->free_buf(data.log, data.log_map_len);
+    }
+    else if (0 != munmap(data.log, data.log_map_len)) {
+        error(log_fp, "Cannot unmap log\n");
+    }
+    data.log = NULL;
+}
+
+static void
+free_log_region()
+{
+    if (0 != munmap(data.region, data.region_len)) {
+        error(log_fp, "Cannot unmap log region\n");
+    }
+    /* Releases the lock as well */
+    close(data.region_fd);
+    data.region = NULL;
+    data.ctrl_data = NULL;
+    data.log = NULL;
+}
+
 #endif
 
 /* ================================================================== */
@@ -402,6 +837,13 @@ init_network_cb( EV_P_ ev_timer *w, int revents )
         goto shutdown;
     }
     
+    /* Init the idle mode events */
+    rc = init_idle_mode();
+    if (0 != rc) {
+        error(log_fp, "Cannot init idle mode\n");
+        goto shutdown;
+    }
+    
     dare_state |= INIT;
     
     /* Start poll event */   
@@ -419,6 +861,7 @@ init_network_cb( EV_P_ ev_timer *w, int revents )
         SID_SET_TERM(data.ctrl_data->sid, 1);
         SID_SET_L(data.ctrl_data->sid);
         SID_SET_IDX(data.ctrl_data->sid, 0);
+        log_rsv_start(data.log, 1);
         w->repeat = 0.;
         ev_timer_again(EV_A_ w);
     }
@@ -553,6 +996,16 @@ next:
     /* Got replicated vote */
     info_wtime(log_fp, "Latest vote successfully retrieved\n");
     //memset(data.ctrl_data->sm_rep, 0, MAX_SERVER_COUNT * sizeof(sm_rep_t));
+    if (0 == recover_local_sm()) {
+        /* SM recovered from the local stable storage; skip the 
+        snapshot and recover only the missing log entries */
+        info_wtime(log_fp, "SM recovered locally\n");
+        dare_state |= SM_RECOVERED;
+        ev_set_cb(w, recover_log_cb);
+        w->repeat = NOW;
+        ev_timer_again(EV_A_ w);
+        return;
+    }
     /* Go to next recovery step */
     ev_set_cb(w, send_sm_request_cb);
     w->repeat = NOW;
@@ -567,14 +1020,33 @@ shutdown:
 
 /**
  * Send SM request to other servers
- * Note: the timer is stopped when receiving a SM reply
+ * Note: the timer is stopped when the snapshot is recovered; while 
+ * a snapshot is being received, no new requests are sent
  */
 static void
 send_sm_request_cb( EV_P_ ev_timer *w, int revents )
 {
     int rc;
     
+    if (MAX_SERVER_COUNT != data.sm_donor) {
+        if (ev_now(EV_A) - data.sm_ts < SM_LEASE) {
+            /* The transfer progresses; check again later */
+            w->repeat = retransmit_period;
+            ev_timer_again(EV_A_ w);
+            return;
+        }
+        /* The donor stopped sending; start over */
+        info_wtime(log_fp, "Snapshot transfer from p%"PRIu8" stalled "
+                "after %"PRIu64" chunks\n", data.sm_donor, data.sm_seq);
+        data.sm_donor = MAX_SERVER_COUNT;
+        data.sm_seq = 0;
+        memset(data.ctrl_data->sm_rep, 0, MAX_SERVER_COUNT * sizeof(sm_rep_t));
+    }
+    
     text(log_fp, "\n>> RECOVER SM <<\n");
+    if (0 == data.sm_req_ts) {
+        data.sm_req_ts = ev_time();
+    }
     rc = dare_ib_send_sm_request();
     if (0 != rc) {
         error(log_fp, "Cannot recover the SM\n");
@@ -593,66 +1065,301 @@ shutdown:
 }
 
 /**
- * Poll for a SM request
+ * Recover the SM from the local stable storage: replay the records of 
+ * the restored log entries, up to the last entry that is in the stable 
+ * storage; then, only the entries after the restored ones are fetched 
+ * from the other servers (see rc_recover_log)
+ * @return 0 on success; 1 if the restored log cannot be used
+ */
+static int
+recover_local_sm()
+{
+    int rc;
+    dare_log_entry_t *entry;
+    dare_log_entry_det_t last;
+    uint64_t offset, last_idx;
+    
+    if (data.rst_end == data.log->len) {
+        /* Nothing restored */
+        return 1;
+    }
+    text(log_fp, "\n>> RECOVER SM LOCALLY <<\n");
+    if (log_offset_end_distance(data.log, data.log->head) > 
+        log_offset_end_distance(data.log, data.rst_head))
+    {
+        /* The head offset (JOIN reply) passed the restored entries */
+        info(log_fp, "   # the restored log is outdated\n");
+        goto no_local_sm;
+    }
+    
+    /* Find the last restored entry that is in the stable storage */
+    last_idx = data.sm->proxy_get_db_last_idx(data.sm->up_para);
+    memset(&last, 0, sizeof(dare_log_entry_det_t));
+    offset = data.rst_head;
+    while ( (entry = log_get_entry(data.log, &offset)) != NULL ) {
+        if (!log_fit_entry(data.log, offset, entry)) {
+            /* Not enough place for an entry (with the command) */
+            offset = 0;
+            continue;
+        }
+        if (entry->idx > last_idx) break;
+        offset += log_entry_len(entry);
+        last.idx = entry->idx;
+        last.term = entry->term;
+        last.offset = offset;
+    }
+    if ( (0 == last.idx) || 
+        (log_offset_end_distance(data.log, last.offset) > 
+            log_offset_end_distance(data.log, data.log->head)) )
+    {
+        /* The stable storage misses entries before the head offset */
+        info(log_fp, "   # the stable storage is behind the log "
+                "(last idx=%"PRIu64")\n", last_idx);
+        goto no_local_sm;
+    }
+    
+    info(log_fp, "   # replay the local records up to idx=%"PRIu64"\n", last.idx);
+    rc = data.sm->proxy_replay_db(last.idx, data.sm->up_para);
+    if (0 != rc) {
+        /* The SM may be partially updated */
+        error(log_fp, "Cannot replay the local records\n");
+        dare_server_shutdown();
+    }
+    
+    /* The restored entries after last are committed, but not applied 
+    and not stored yet */
+    data.log->apply = last.offset;
+    data.log->old_end = last.offset;
+    last_applied_entry = last;
+    info(log_fp, "   # apply = %"PRIu64"\n", data.log->apply);
+    
+    return 0;
+    
+no_local_sm:
+    /* Recover as a new server */
+    data.rst_end = data.log->len;
+    data.log->apply = data.log->commit = 0;
+    data.log->end = data.log->tail = data.log->old_end = data.log->len;
+    return 1;
+}
+
+/**
+ * Poll for a SM request; the snapshot is produced by a helper thread 
+ * and sent in chunks, one joiner at a time; the other requests wait
  */
 static void
 poll_sm_requests()
 {
     int rc;
     uint8_t i, size = get_group_size(data.config);
-    snapshot_t *snapshot;
-    int reg_mem = 0;
+    
+    if (sm_job.active) {
+        progress_sm_job();
+    }
+    
     for (i = 0; i < size; i++) {
         if (i == data.config.idx)
             continue;
         if (!data.ctrl_data->sm_req[i])
             continue;
+        if (sm_job.active) {
+            if (i != sm_job.target) {
+                /* Serve this request after the current one */
+                continue;
+            }
+            data.ctrl_data->sm_req[i] = 0;
+            if (0 == sm_job.sent) {
+                /* Retransmitted request; the first chunk is not ready */
+                continue;
+            }
+            /* The joiner started over */
+            info_wtime(log_fp, "Snapshot for p%"PRIu8" restarted\n", i);
+            stop_sm_job();
+        }
 
         info_wtime(log_fp, "SM request from p%"PRIu8"\n", i);
         
         /* Found SM request */
         data.ctrl_data->sm_req[i] = 0;
-        if (!(dare_state & SNAPSHOT)) {
-            /* There is no snapshot */
-            info(log_fp, "   # no snapshot\n");
-            uint32_t len = data.sm->proxy_get_db_size(data.sm->up_para);
-            info(log_fp, "   # snapshot len = %"PRIu32"\n", len);
-            if (len <= PREREG_SNAPSHOT_SIZE) {
-                info(log_fp, "   # pre-register snapshot\n");
-                snapshot = data.prereg_snapshot;
-            }
-            else {
-                snapshot = data.snapshot;
-                if (snapshot != NULL) {
-                    /* For some reason the snapshot is already allocated */
-                    free(snapshot);
-                }
-                rc = posix_memalign((void**)&snapshot, sizeof(uint64_t), 
-                            sizeof(snapshot_t) + len);
-                if (0!= rc) {
-                    error(log_fp, "Cannot allocate snapshot\n");
-                    dare_server_shutdown();
-                }
-                reg_mem = 1;
+        rc = start_sm_job(i);
+        if (0 != rc) {
+            error(log_fp, "Cannot start the snapshot thread\n");
+            dare_server_shutdown();
+        }
+        return;
+    }
+}
+
+/**
+ * Start sending a snapshot to a joiner: the snapshot contains the 
+ * records up to the last applied entry
+ */
+static int
+start_sm_job( uint8_t target )
+{
+    int rc;
+    
+    sm_job.target = target;
+    sm_job.to_idx = last_applied_entry.idx;
+    sm_job.last_entry = last_applied_entry;
+    sm_job.total = data.sm->proxy_get_db_size(data.sm->up_para);
+    sm_job.state[0] = sm_job.state[1] = SM_CHUNK_FREE;
+    sm_job.sent = 0;
+    sm_job.stop = 0;
+    sm_job.error = 0;
+    sm_job.start_ts = sm_job.ack_ts = sm_job.loop_ts = ev_now(data.loop);
+    sm_job.max_gap = 0;
+    data.ctrl_data->sm_ack[target] = 0;
+    info(log_fp, "   # snapshot up to idx=%"PRIu64"; len <= %"PRIu64"\n", 
+        sm_job.to_idx, sm_job.total);
+    
+    rc = pthread_create(&sm_job.thread, NULL, sm_job_thread, NULL);
+    if (0 != rc) {
+        return 1;
+    }
+    sm_job.active = 1;
+    return 0;
+}
+
+/**
+ * Publish the ready chunks and reuse the acknowledged ones; a chunk 
+ * is published only after the previous one was acknowledged, since 
+ * there is only one SM reply per server
+ */
+static void
+progress_sm_job()
+{
+    int rc, i, ready = -1, error;
+    uint8_t target = sm_job.target;
+    uint64_t ack = data.ctrl_data->sm_ack[target];
+    ev_tstamp now = ev_now(data.loop);
+    
+    /* The DARE loop must not stall while the snapshot is produced */
+    if (now - sm_job.loop_ts > sm_job.max_gap) {
+        sm_job.max_gap = now - sm_job.loop_ts;
+    }
+    sm_job.loop_ts = now;
+    
+    pthread_mutex_lock(&sm_job.lock);
+    for (i = 0; i < 2; i++) {
+        if ( (SM_CHUNK_SENT == sm_job.state[i]) && (sm_job.seq[i] <= ack) ) {
+            if (sm_job.last[i]) {
+                /* The joiner received the whole snapshot */
+                pthread_mutex_unlock(&sm_job.lock);
+                info_wtime(log_fp, "Snapshot sent to p%"PRIu8": %"PRIu64
+                    " chunks in %.3lf s; max loop gap %.3lf ms\n", target, 
+                    ack, now - sm_job.start_ts, sm_job.max_gap * 1e3);
+                stop_sm_job();
+                return;
             }
-            data.sm->proxy_create_db_snapshot(snapshot->data,data.sm->up_para);
-            snapshot->len = len;
-            snapshot->last_entry = last_applied_entry;
-            
-            /* Avoid updating the snapshot before the head offset is modified */
-            dare_state |= SNAPSHOT;
+            sm_job.state[i] = SM_CHUNK_FREE;
+            sm_job.ack_ts = now;
+            pthread_cond_signal(&sm_job.cond);
         }
-        /* Send a SM reply with the address of the snapshot */
-        rc = dare_ib_send_sm_reply(i, snapshot, reg_mem);
-        if (rc != 0) {
-            error(log_fp, "Cannot send SM reply\n");
-            dare_server_shutdown();
+        if ( (SM_CHUNK_READY == sm_job.state[i]) && 
+            (sm_job.seq[i] == sm_job.sent + 1) && (sm_job.sent == ack) ) 
+        {
+            ready = i;
         }
     }
+    error = sm_job.error;
+    pthread_mutex_unlock(&sm_job.lock);
+    
+    if (error) {
+        error(log_fp, "Cannot dump the stable storage for p%"PRIu8"\n", target);
+        stop_sm_job();
+        return;
+    }
+    if (now - sm_job.ack_ts > SM_LEASE) {
+        /* The joiner recovers from another server or failed */
+        info_wtime(log_fp, "Snapshot for p%"PRIu8" abandoned after %"PRIu64
+                " chunks\n", target, ack);
+        stop_sm_job();
+        return;
+    }
+    if (ready < 0) return;
+    
+    /* Send a SM reply with the address of the chunk */
+    rc = dare_ib_send_sm_reply(target, data.sm_chunk[ready], 
+            sm_job.offset[ready], sm_job.total, sm_job.last[ready], 
+            sm_job.seq[ready]);
+    if (rc != 0) {
+        error(log_fp, "Cannot send SM reply\n");
+        dare_server_shutdown();
+    }
+    pthread_mutex_lock(&sm_job.lock);
+    sm_job.state[ready] = SM_CHUNK_SENT;
+    pthread_mutex_unlock(&sm_job.lock);
+    sm_job.sent = sm_job.seq[ready];
+    sm_job.ack_ts = now;
 }
 
 /**
- * Poll for a SM reply
+ * Stop the helper thread; it exits after the current chunk
+ */
+static void
+stop_sm_job()
+{
+    if (!sm_job.active) return;
+    pthread_mutex_lock(&sm_job.lock);
+    sm_job.stop = 1;
+    pthread_cond_signal(&sm_job.cond);
+    pthread_mutex_unlock(&sm_job.lock);
+    pthread_join(sm_job.thread, NULL);
+    sm_job.active = 0;
+}
+
+/**
+ * Helper thread: dump the stable storage into the free chunks
+ */
+static void*
+sm_job_thread( void *arg )
+{
+    int rc = 1, i;
+    uint64_t pos = 0, offset = 0, seq = 0;
+    uint32_t len;
+    snapshot_t *chunk;
+    
+    while (1 == rc) {
+        i = seq % 2;
+        pthread_mutex_lock(&sm_job.lock);
+        while (!sm_job.stop && (SM_CHUNK_FREE != sm_job.state[i])) {
+            pthread_cond_wait(&sm_job.cond, &sm_job.lock);
+        }
+        if (sm_job.stop) {
+            pthread_mutex_unlock(&sm_job.lock);
+            break;
+        }
+        pthread_mutex_unlock(&sm_job.lock);
+        
+        chunk = data.sm_chunk[i];
+        rc = data.sm->proxy_get_db_chunk(sm_job.to_idx, &pos, chunk->data, 
+                SM_CHUNK_SIZE, &len, data.sm->up_para);
+        if ( (rc < 0) || (offset + len > sm_job.total) ) {
+            pthread_mutex_lock(&sm_job.lock);
+            sm_job.error = 1;
+            pthread_mutex_unlock(&sm_job.lock);
+            break;
+        }
+        chunk->last_entry = sm_job.last_entry;
+        chunk->len = len;
+        chunk->crc = crc32c(chunk->data, len);
+        seq++;
+        
+        pthread_mutex_lock(&sm_job.lock);
+        sm_job.seq[i] = seq;
+        sm_job.offset[i] = offset;
+        sm_job.last[i] = (0 == rc);
+        sm_job.state[i] = SM_CHUNK_READY;
+        pthread_mutex_unlock(&sm_job.lock);
+        offset += len;
+    }
+    return NULL;
+}
+
+/**
+ * Poll for a SM reply; the chunks are received from the first server 
+ * that replies, one at a time
  */
 static void 
 poll_sm_reply()
@@ -660,26 +1367,31 @@ poll_sm_reply()
     int rc;
     uint8_t target, size = get_group_size(data.config);
     sm_rep_t *reply;
-    for (target = 0; target < size; target++) {
-        if (target == data.config.idx) continue;
-        reply = &data.ctrl_data->sm_rep[target];
-        if ( (reply->sid > data.ctrl_data->sid) && (reply->raddr) && 
-            (reply->rkey) && (reply->len) )
-        {
-            /* Found SM reply */
-            data.ctrl_data->sid = reply->sid;
-            break;
+    
+    if (MAX_SERVER_COUNT == data.sm_donor) {
+        for (target = 0; target < size; target++) {
+            if (target == data.config.idx) continue;
+            reply = &data.ctrl_data->sm_rep[target];
+            if ( (reply->sid > data.ctrl_data->sid) && (1 == reply->seq) && 
+                (reply->raddr) && (reply->rkey) && (reply->len) )
+            {
+                /* Found SM reply with the first chunk */
+                break;
+            }
         }
+        if (target == size) return;
+        info_wtime(log_fp, "SM reply from p%"PRIu8" (len <= %"PRIu64")\n", 
+                target, reply->total);
+        data.sm_donor = target;
+        data.sm_seq = 0;
+        data.sm_ts = ev_now(data.loop);
+    }
+    target = data.sm_donor;
+    reply = &data.ctrl_data->sm_rep[target];
+    if (reply->seq != data.sm_seq + 1) {
+        /* The next chunk is not ready */
+        return;
     }
-    if (target == size) return;
-    info_wtime(log_fp, "SM reply from p%"PRIu8"\n", target);
-    
-    /* Update cache SID */
-    info_wtime(log_fp, "SID OBTAINED DURING SM RECOVERY: "
-            "[%020"PRIu64"|%d|%03"PRIu8"]\n", 
-            SID_GET_TERM(data.ctrl_data->sid),
-            (SID_GET_L(data.ctrl_data->sid) ? 1 : 0),
-            SID_GET_IDX(data.ctrl_data->sid));
     
     /* Recover SM */
     rc = dare_ib_recover_sm(target);
@@ -691,8 +1403,34 @@ poll_sm_reply()
         /* Insuccess - try again later */  
         return;
     }
+    data.sm_seq = reply->seq;
+    data.sm_ts = ev_now(data.loop);
+    if (1 == data.sm_seq) {
+        /* Time-to-first-byte: the donor produced the first chunk and 
+        the snapshot buffer was allocated and registered */
+        info_wtime(log_fp, "First snapshot chunk after %.3lf ms\n", 
+                (ev_time() - data.sm_req_ts) * 1e3);
+        data.sm_req_ts = 0;
+    }
+    
+    /* The donor can reuse the chunk */
+    rc = dare_ib_send_sm_ack(target, data.sm_seq);
+    if (rc != 0) {
+        error(log_fp, "Cannot send SM ack\n");
+        dare_server_shutdown();
+    }
+    if (!reply->last) return;
+    
+    /* Update cache SID */
+    data.ctrl_data->sid = reply->sid;
+    info_wtime(log_fp, "SID OBTAINED DURING SM RECOVERY: "
+            "[%020"PRIu64"|%d|%03"PRIu8"]\n", 
+            SID_GET_TERM(data.ctrl_data->sid),
+            (SID_GET_L(data.ctrl_data->sid) ? 1 : 0),
+            SID_GET_IDX(data.ctrl_data->sid));
     
     /* Reset all replies */
+    data.sm_donor = MAX_SERVER_COUNT;
     memset(data.ctrl_data->sm_rep, 0, MAX_SERVER_COUNT * sizeof(sm_rep_t));
     
     /* SM recovered successfully; go to next recovery step */
@@ -726,8 +1464,13 @@ recover_log_cb( EV_P_ ev_timer *w, int revents )
     
     /* Log recovered successfully */
     dare_state |= LOG_RECOVERED;
-    info(log_fp, "Server recovered: ");
+    info_wtime(log_fp, "Server recovered in %.3lf s (%s): ", 
+            ev_now(EV_A) - start_ts, 
+            (data.rst_end != data.log->len) ? "local log" : "remote snapshot");
     INFO_PRINT_LOG(log_fp, data.log);
+    if (NULL != data.region) {
+        data.region->cu_min_idx = data.cu_min_idx;
+    }
     
     /* Set a periodic timer that update the RC info;
     TODO should this be activated during recovery? */
@@ -778,8 +1521,8 @@ to_adjust_cb( EV_P_ ev_timer *w, int revents )
     /* Total number of trials */
     total_count++;
     
-    /* Read HB and reset it - atomic operation */
-    hb = __sync_fetch_and_and(&data.ctrl_data->hb[leader], 0);
+    /* Read HB */
+    hb = hb_read(leader);
     if (0 != hb) {
         /* HB received */
         latest_hb_received = hb;
@@ -848,15 +1591,15 @@ hb_receive_cb( EV_P_ ev_timer *w, int revents )
             continue;
         if (i == leader) {
             if (!latest_hb_received) {
-                latest_hb_received = __sync_fetch_and_and(&data.ctrl_data->hb[leader], 0);
+                latest_hb_received = hb_read(leader);
             }
             /* HBs from leader are checked while adjusting the timeout */
             hb = latest_hb_received;
             latest_hb_received = 0;
         }
         else {
-            /* Read HB and then reset it */
-            hb = __sync_fetch_and_and(&data.ctrl_data->hb[i], 0);
+            /* Read HB */
+            hb = hb_read(i);
         }
         if (0 == hb) {
             /* No heartbeat */
@@ -884,6 +1627,7 @@ hb_receive_cb( EV_P_ ev_timer *w, int revents )
         if (SID_GET_L(hb)) {
             /* The HB was from a leader */
             new_sid = hb;
+            lease_renew();
         }
     }
 //text(log_fp, "\n");    
@@ -913,7 +1657,12 @@ hb_receive_cb( EV_P_ ev_timer *w, int revents )
         return;
     }
     
-rearm:    
+    if (SID_GET_L(data.ctrl_data->sid)) {
+        /* Report my apply offset to the leader (see status_t) */
+        dare_ib_send_status(SID_GET_IDX(data.ctrl_data->sid));
+    }
+    dare_ib_report_wr_rate();
+    
     /* Rearm HB event */
     //w->repeat = random_election_timeout();
     w->repeat = hb_timeout();
@@ -943,9 +1692,9 @@ hb_send_cb( EV_P_ ev_timer *w, int revents )
         if ( (i == data.config.idx) || !CID_IS_SERVER_ON(data.config.cid, i) )
             continue;
 
-        /* Read HB and then reset it */
-        hb = __sync_fetch_and_and(&data.ctrl_data->hb[i], 0);
-        if (hb < new_sid) continue;
+        /* Read HB; the followers' acks have my SID */
+        hb = hb_read(i);
+        if (hb <= new_sid) continue;
 
         /* Somebody sent me an HB reply with a higher term */
         info_wtime(log_fp, "Received HB from p%"PRIu8" with higher term %"PRIu64"\n", 
@@ -979,17 +1728,290 @@ hb_send_cb( EV_P_ ev_timer *w, int revents )
         //info_wtime(log_fp, "TIME ERROR %"PRIu64" out of %"PRIu64"\n", errs, total);
         //dare_server_shutdown();
     }
+    dare_ib_report_wr_rate();
     
     /* Rearm timer */
     w->repeat = hb_period;
     ev_timer_again(EV_A_ w);
     
-    return;
+    return;
+
+shutdown:
+    w->repeat = 0;
+    ev_timer_again(EV_A_ w);
+    dare_server_shutdown();
+}
+
+/**
+ * Monotonic time (seconds) for leases
+ */
+static double
+lease_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Renew my promise not to vote for another candidate; done on every 
+ * HB from the leader and before acknowledging its entries
+ */
+static void
+lease_renew()
+{
+    if (lease_period > 0) {
+        lease_until = lease_now() + lease_period;
+    }
+}
+
+/**
+ * Check if my promise to the leader still holds; the leader counts 
+ * the HBs it knows were delivered (see rc_lease_valid), thus, a HB I 
+ * did not check yet renews the lease as well
+ */
+static int
+lease_valid()
+{
+    uint64_t hb;
+    uint8_t leader = SID_GET_IDX(data.ctrl_data->sid);
+    
+    if (lease_period <= 0) {
+        return 0;
+    }
+    if ( SID_GET_L(data.ctrl_data->sid) && (leader != data.config.idx) ) {
+        hb = latest_hb_received ? latest_hb_received : hb_peek(leader);
+        if ( (0 != hb) && (hb >= data.ctrl_data->sid) ) {
+            lease_renew();
+        }
+    }
+    return (lease_now() < lease_until);
+}
+
+/**
+ * Read the SID of a server's status record if the record is new, 
+ * i.e., its HB counter changed since the last read; 0 otherwise
+ * Note: the records are overwritten remotely (see status_t)
+ */
+static uint64_t
+hb_read( uint8_t idx )
+{
+    uint64_t hb = data.ctrl_data->status[idx].hb;
+    if (hb == hb_seen[idx]) {
+        return 0;
+    }
+    hb_seen[idx] = hb;
+    __sync_synchronize();
+    return data.ctrl_data->status[idx].sid;
+}
+
+/**
+ * Same as hb_read, without marking the record as read
+ */
+static uint64_t
+hb_peek( uint8_t idx )
+{
+    if (data.ctrl_data->status[idx].hb == hb_seen[idx]) {
+        return 0;
+    }
+    __sync_synchronize();
+    return data.ctrl_data->status[idx].sid;
+}
+
+#endif
+
+/* ================================================================== */
+/* Idle mode */
+#if 1
+/**
+ * Idle mode: the server busy-polls while there is work; after 
+ * idle_timeout without activity, it stops the poll event and sleeps 
+ * in the EV loop until either a completion event (the CQs are armed), 
+ * a kick from the proxy threads (new request) or the idle timer; 
+ * the one-sided writes of the other servers (log entries, votes...) 
+ * do not create completions, so the timer polls every idle_poll_period
+ * Note: the first request after idle waits for the followers to check 
+ * their logs, i.e., at most idle_poll_period
+ */
+static int
+init_idle_mode()
+{
+    if (idle_timeout <= 0) return 0;
+    
+    ev_io_init(&cq_event, cq_cb, dare_ib_cq_fd(), EV_READ);
+    ev_set_priority(&cq_event, EV_MAXPRI);
+    ev_io_init(&kick_event, kick_cb, data.kick_fd, EV_READ);
+    ev_set_priority(&kick_event, EV_MAXPRI);
+    ev_timer_init(&idle_event, idle_cb, 0., 0.);
+    ev_set_priority(&idle_event, EV_MAXPRI);
+    
+    data.active_ts = ev_now(data.loop);
+    return 0;
+}
+
+/**
+ * Progress of the server; a change means activity
+ */
+static uint64_t
+loop_activity()
+{
+    if (!(dare_state & LOG_RECOVERED)) {
+        return 0;
+    }
+    return data.log->end + data.log->commit + data.log->apply + 
+           data.log->head + data.ctrl_data->sid;
+}
+
+/**
+ * Check whether the server has ongoing work, i.e., it must not sleep
+ */
+static int
+busy_server()
+{
+    uint8_t i, size;
+    
+    if ( !(dare_state & LOG_RECOVERED) || !(dare_state & SM_RECOVERED) || 
+        (dare_state & CATCHUP) || IS_CANDIDATE || sm_job.active )
+    {
+        return 1;
+    }
+    if (data.log->apply != data.log->commit) {
+        /* Entries to apply */
+        return 1;
+    }
+    if (IS_LEADER) {
+        if (log_offset_end_distance(data.log, data.log->commit)) {
+            /* Entries to commit */
+            return 1;
+        }
+        size = get_group_size(data.config);
+        for (i = 0; i < size; i++) {
+            if (data.config.servers[i].win.count) {
+                /* Outstanding log updates */
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Go to sleep once the server had no activity for idle_timeout
+ */
+static void
+check_idle()
+{
+    uint64_t activity = loop_activity();
+    
+    if ( (activity != data.activity) || busy_server() ) {
+        data.activity = activity;
+        data.active_ts = ev_now(data.loop);
+        return;
+    }
+    if (ev_now(data.loop) - data.active_ts < idle_timeout) return;
+    enter_idle_mode();
+}
+
+static void
+enter_idle_mode()
+{
+    /* Either the proxy threads see the flag and kick the server, or 
+    the polling below sees their requests (see dare_kick) */
+    data.sleeping = 1;
+    __sync_synchronize();
+    if (0 != dare_ib_arm_cqs()) {
+        data.sleeping = 0;
+        return;
+    }
+    /* The completions before the CQs were armed create no events */
+    polling();
+    if ( (loop_activity() != data.activity) || busy_server() ) {
+        leave_idle_mode();
+        return;
+    }
+    
+    ev_idle_stop(data.loop, &poll_event);
+    ev_io_start(data.loop, &cq_event);
+    ev_io_start(data.loop, &kick_event);
+    idle_event.repeat = idle_poll_period;
+    ev_timer_again(data.loop, &idle_event);
+    data.idle_count++;
+}
+
+static void
+leave_idle_mode()
+{
+    data.sleeping = 0;
+    if (!ev_is_active(&poll_event)) {
+        ev_io_stop(data.loop, &cq_event);
+        ev_io_stop(data.loop, &kick_event);
+        ev_timer_stop(data.loop, &idle_event);
+        ev_idle_start(data.loop, &poll_event);
+    }
+    data.activity = loop_activity();
+    data.active_ts = ev_now(data.loop);
+}
+
+/**
+ * Poll once while sleeping; go back to busy-polling on activity
+ */
+static void
+idle_poll()
+{
+    /* Arm first, so that no completion is missed */
+    if (0 != dare_ib_arm_cqs()) {
+        leave_idle_mode();
+        return;
+    }
+    polling();
+    if ( (loop_activity() != data.activity) || busy_server() ) {
+        leave_idle_mode();
+    }
+}
+
+/**
+ * Completion event callback
+ */
+static void
+cq_cb( EV_P_ ev_io *w, int revents )
+{
+    dare_ib_get_cq_events();
+    idle_poll();
+}
+
+/**
+ * Kick callback (new request from the proxy threads)
+ */
+static void
+kick_cb( EV_P_ ev_io *w, int revents )
+{
+    uint64_t count;
+    
+    if (read(data.kick_fd, &count, sizeof(count))) {}
+    idle_poll();
+}
 
-shutdown:
-    w->repeat = 0;
-    ev_timer_again(EV_A_ w);
-    dare_server_shutdown();
+/**
+ * Idle timer callback
+ */
+static void
+idle_cb( EV_P_ ev_timer *w, int revents )
+{
+    idle_poll();
+}
+
+/**
+ * Wake up the server if it sleeps; called by the proxy threads once a 
+ * request is in the log or in the tailq
+ */
+void
+dare_kick()
+{
+    uint64_t one = 1;
+    
+    __sync_synchronize();
+    if (!data.sleeping) return;
+    if (write(data.kick_fd, &one, sizeof(one))) {}
 }
 
 #endif
@@ -1004,6 +2026,9 @@ static void
 poll_cb( EV_P_ ev_idle *w, int revents )
 {
     polling();  
+    if (idle_timeout > 0) {
+        check_idle();
+    }
 }
 
 /**
@@ -1087,25 +2112,38 @@ polling()
     /* Poll for SM requests */
     if (!IS_LEADER) {
         poll_sm_requests();
+        
+        /* Check whether the head offset passed my apply offset */
+        poll_catchup();
     }
     
+    /* Serve lagging followers from stable storage */
+    poll_catchup_requests();
+    
     /* Check the number of failed attempts to access a server 
     through the CTRL QP */
     check_failure_count();
 
-    persist_new_entries();
+    /* While catching up, the entries before the head offset may be 
+    overwritten; the log is used again once the catch-up is over */
+    if (!(dare_state & CATCHUP)) {
+        append_inband_entries();
+        persist_new_entries();
+    }
 
     if (IS_LEADER) {
         /* Try to commit new log entries */
         commit_new_entries();
     }
-    else {
+    else if (!(dare_state & CATCHUP)) {
         /* Poll for non SM log entries (CONFIG, HEAD...) */
         poll_config_entries();
     }
 
     /* Apply new committed entries */
-    apply_committed_entries();
+    if (!(dare_state & CATCHUP)) {
+        apply_committed_entries();
+    }
 
     if (IS_CANDIDATE) {
         /* Check the number of votes */
@@ -1130,6 +2168,10 @@ polling()
 static void
 poll_ud()
 {
+    if (log_rsv.active) {
+        /* Entries appended by the proxy threads */
+        log_adopt_entries(data.log);
+    }
     dare_ib_poll_tailq();
     uint8_t type = dare_ib_poll_ud_queue();
     if (MSG_ERROR == type) {
@@ -1160,6 +2202,13 @@ poll_ud()
                 text(log_fp, "My SID is: "); PRINT_SID_(data.ctrl_data->sid);
                 text(log_fp, "My CID is: "); PRINT_CID_(data.config.cid);
                 print_rc_info();
+                
+                if (loggp_tune) {
+                    /* Pick the RC parameters before any log update */
+                    if (0 != dare_ib_tune(loggp_profile, tune_latency_target)) {
+                        info(log_fp, "Tuning failed; keeping the defaults\n");
+                    }
+                }
 
                 /* For initial start-up, skip recovery */
                 if (!(dare_state & JOINED)) {
@@ -1266,6 +2315,15 @@ start_election()
 {
     int rc, i;
     
+    if (lease_valid()) {
+        /* I promised the leader not to vote for another candidate 
+        (including me) until the lease expires; check the HBs then */
+        ev_set_cb(&hb_event, hb_receive_cb);
+        hb_event.repeat = lease_until - lease_now();
+        ev_timer_again(data.loop, &hb_event);
+        return;
+    }
+    
     /* Get the latest SID */
     uint64_t new_sid = 0;    
     
@@ -1386,6 +2444,9 @@ poll_vote_count()
      */
     //debug(log_fp, "vote count = %"PRIu8"\n", vote_count[0]);
     
+    /* The commands of the previous leader are replayed first */
+    stage_drain(&data.apply_stage);
+    
     /* Update own SID to [t|1|own_idx] */
     uint64_t new_sid = data.ctrl_data->sid;
     SID_SET_L(new_sid);
@@ -1395,7 +2456,21 @@ poll_vote_count()
     }    
     info_wtime(log_fp, "[T%"PRIu64"] LEADER\n", SID_GET_TERM(new_sid));
     INFO_PRINT_LOG(log_fp, data.log);
-    info(log_fp, "CID: [%02"PRIu8"|%02"PRIu8"|%d|%03"PRIu32"]\n", 
+    /* Clear the acks; the ones from a previous term may be for 
+    entries that were removed; also, nobody promised anything to me 
+    yet (see rc_lease_valid) */
+    for (i = 0; i < get_extended_group_size(data.config); i++) {
+        data.ctrl_data->status[i].ack_idx = 0;
+        data.config.servers[i].hb_ack_idx = 0;
+        data.config.servers[i].lease_ts = 0;
+        data.config.servers[i].lease_ssn = 0;
+        data.config.servers[i].lease_idx = 0;
+    }
+    log_rsv_start(data.log, SID_GET_TERM(new_sid));
+    log_entries_to_nc_buf(data.log, data.nc_buf);
+    data.lead_nc = data.nc_buf->len;
+    data.lead_ts = ev_now(data.loop);
+    info(log_fp, "CID: [%02"PRIu8"|%02"PRIu8"|%d|%"PRIx64"]\n", 
             data.config.cid.size[0], data.config.cid.size[1], 
             data.config.cid.state, data.config.cid.bitmask);
     text(log_fp, "SID:"); PRINT_SID_(data.ctrl_data->sid);
@@ -1538,12 +2613,16 @@ poll_vote_requests()
         an HB reply from a server with a larger term */
         return;
     }
+    if (lease_valid()) {
+        /* I promised the leader not to vote for another candidate */
+        return;
+    }
     
     /* No leader known; make sure about this, do not wait for the 
     timeout to check the HB array.
     !! This applies for nodes that voted but are not aware of the outcome */
     uint8_t possible_leader = SID_GET_IDX(data.ctrl_data->sid);
-    uint64_t hb = data.ctrl_data->hb[possible_leader];
+    uint64_t hb = hb_peek(possible_leader);
     if ( (0 != hb) && (SID_GET_TERM(hb) == SID_GET_TERM(data.ctrl_data->sid)) ) {
         /* My vote counts (democracy at its best)...  */
         server_update_sid(hb, data.ctrl_data->sid);
@@ -1588,6 +2667,7 @@ poll_vote_requests()
            
     /* Revoke remote access to local log; need to have exclusive 
      * access to the log to get the last entry */
+    stop_log_reservations();
     rc = dare_ib_revoke_log_access();
     if (0 != rc) {
         /* This should never happen */
@@ -1597,8 +2677,7 @@ poll_vote_requests()
     /* Create not committed buffer & get best request */
     vote_req_t best_request;
     best_request.sid = old_sid;
-    dare_nc_buf_t *nc_buf = &data.log->nc_buf[data.config.idx];
-    log_entries_to_nc_buf(data.log, nc_buf);
+    dare_nc_buf_t *nc_buf = publish_nc_buf();
     if (0 == nc_buf->len) {
         /* There are no not committed entries */
         uint64_t tail = log_get_tail(data.log);
@@ -1742,6 +2821,36 @@ text(log_fp, "   Best [idx=%"PRIu64"; term=%"PRIu64"]\n", best_request.index, be
     TIMER_STOP(log_fp); 
 }
 
+/**
+ * Create the NC-Buffer and publish its descriptor in the log, 
+ * so that the leader can read it (see log_adjustment)
+ * Note: called only with exclusive access to the log
+ */
+static dare_nc_buf_t*
+publish_nc_buf()
+{
+    dare_nc_desc_t *nc = &data.log->nc[data.config.idx];
+    
+    log_entries_to_nc_buf(data.log, data.nc_buf);
+    nc->raddr = (uint64_t)data.nc_buf->entries;
+    nc->rkey = dare_ib_nc_rkey();
+    nc->len = data.nc_buf->len;
+    return data.nc_buf;
+}
+
+/**
+ * Stop the proxy threads from appending to the log (on losing 
+ * leadership); the entries they already reserved are adopted, 
+ * so that the end of the log is consistent
+ */
+static void
+stop_log_reservations()
+{
+    if (!log_rsv.active) return;
+    log_rsv_stop();
+    log_adopt_entries(data.log);
+}
+
 #endif
 
 /* ================================================================== */
@@ -1789,24 +2898,183 @@ commit_new_entries()
     }
 }
 
+/**
+ * Append the entries that the leader wrote after the end offset, 
+ * without waiting for the end offset update; only once the current 
+ * leader adjusted the log, so that a server that voted in a new term 
+ * does not append (and acknowledge) the entries of the old leader
+ */
+static void
+append_inband_entries()
+{
+    uint64_t term;
+    
+    if (IS_LEADER) return;
+    term = data.log->band_term;
+    if (term != SID_GET_TERM(data.ctrl_data->sid)) return;
+    /* band_term is written last */
+    __sync_synchronize();
+    if ( (term != data.band_term) || (data.log->band_idx != data.band_sync) ) {
+        /* The leader adjusted the log, i.e., it set the end offset 
+        and the idx of the entry at the end offset */
+        data.band_term = term;
+        data.band_sync = data.log->band_idx;
+        data.band_idx = data.band_sync;
+        if (log_is_offset_past_end(data.log, data.log->old_end)) {
+            /* Entries were removed */
+            data.log->old_end = data.log->end;
+        }
+    }
+    if (data.log->old_end != data.log->end) {
+        /* Persist the entries up to the end offset first; 
+        band_idx follows the persisted entries */
+        return;
+    }
+    log_scan_entries(data.log, &data.band_idx, term);
+}
+
+/**
+ * Persist the new entries; a follower acknowledges them once per 
+ * batch, i.e., with the idx of the last persisted entry
+ */
 static void
 persist_new_entries()
 {
     dare_log_entry_t *entry;
+    
     while (log_is_offset_larger(data.log, data.log->end, data.log->old_end)) {
         entry = log_get_entry(data.log, &data.log->old_end);
         if (!log_fit_entry(data.log, data.log->old_end, entry)) {
             data.log->old_end = 0;
             continue;
         }
-        data.sm->proxy_store_cmd(&entry->clt_id, data.sm->up_para);
         if (IS_LEADER) {
             entry->sender = data.config.idx;
-        } else {
-            dare_ib_send_entries_reply(entry->sender);
+        } 
+        else if (data.persist_sender != entry->sender) {
+            /* The entries come from a new leader; acknowledge the 
+            ones from the previous leader first */
+            stage_drain(&data.persist_stage);
+            ack_persisted_entries();
+            data.persist_ack = 0;
+        }
+        if (0 != store_entry(entry)) {
+            /* The persist stage is full; go on in the next loop */
+            break;
+        }
+        data.persist_idx = entry->idx;
+        data.persist_sender = entry->sender;
+        if (!IS_LEADER) {
+            data.band_idx = entry->idx + 1;
         }
         data.log->old_end += log_entry_len(entry);
     }
+    ack_persisted_entries();
+}
+
+/**
+ * Store the command of an entry in stable storage, through the persist 
+ * stage if any; the entry is copied, as the log may be overwritten
+ * @return 0 if stored or queued; 1 if the stage is full
+ */
+static int
+store_entry( dare_log_entry_t *entry )
+{
+    int rc;
+    
+    if (data.persist_stage.active) {
+        rc = stage_push(&data.persist_stage, entry->idx, entry->clt_id, 
+                entry->type, entry->sender, &entry->clt_id, 
+                log_entry_len(entry) - offsetof(dare_log_entry_t, clt_id));
+        if (rc >= 0) {
+            return rc;
+        }
+        /* Too large for the ring; keep the order */
+        stage_drain(&data.persist_stage);
+    }
+    data.sm->proxy_store_cmd(entry->idx, &entry->clt_id, data.sm->up_para);
+    return 0;
+}
+
+/**
+ * Acknowledge the entries persisted since the last ack (followers)
+ */
+static void
+ack_persisted_entries()
+{
+    uint64_t ack_idx;
+    uint8_t sender = data.persist_sender;
+    
+    if (IS_LEADER || (sender == data.config.idx)) return;
+    /* Only the leader in my SID gets acks: the ack is stamped with my 
+    term (see rc_send_entries_reply); a server that left the term does 
+    not count them anyway */
+    if ( !SID_GET_L(data.ctrl_data->sid) || 
+        (sender != SID_GET_IDX(data.ctrl_data->sid)) ) 
+    {
+        return;
+    }
+    ack_idx = persisted_idx();
+    if ( (0 == ack_idx) || (ack_idx == data.persist_ack) ) return;
+    data.persist_ack = ack_idx;
+    
+    /* The ack renews the lease on the leader (see rc_lease_valid) */
+    lease_renew();
+    dare_ib_send_entries_reply(sender, ack_idx);
+    if (!latest_hb_received) {
+        /* The leader does not send HBs while it sends entries */
+        latest_hb_received = data.ctrl_data->sid;
+    }
+}
+
+/**
+ * idx of the last entry in stable storage; 0 if the persist stage did 
+ * not store any of the queued entries yet
+ */
+static uint64_t
+persisted_idx()
+{
+    if (!stage_empty(&data.persist_stage)) {
+        return stage_done(&data.persist_stage);
+    }
+    return data.persist_idx;
+}
+
+/**
+ * Replay the command of an entry (followers), through the apply stage 
+ * if any
+ * @return 0 if replayed or queued; 1 if the stage is full
+ */
+static int
+replay_entry( dare_log_entry_t *entry )
+{
+    int rc;
+    
+    if (data.apply_stage.active) {
+        rc = stage_push(&data.apply_stage, entry->idx, entry->clt_id, 
+                entry->type, entry->sender, &entry->data.cmd.cmd, 
+                entry->data.cmd.len);
+        if (rc >= 0) {
+            return rc;
+        }
+        stage_drain(&data.apply_stage);
+    }
+    data.sm->proxy_do_action(entry->clt_id, entry->type, 
+            entry->data.cmd.len, &entry->data.cmd.cmd, data.sm->up_para);
+    return 0;
+}
+
+static void
+persist_stage_cb( stage_rec_t *rec, void *arg )
+{
+    data.sm->proxy_store_cmd(rec->idx, rec->data, data.sm->up_para);
+}
+
+static void
+apply_stage_cb( stage_rec_t *rec, void *arg )
+{
+    data.sm->proxy_do_action(rec->clt_id, rec->type, rec->len, rec->data, 
+            data.sm->up_para);
 }
 
 /**
@@ -1843,6 +3111,30 @@ apply_committed_entries()
             data.log->apply = 0;
             continue;
         }
+        if (entry->crc != log_entry_crc(entry)) {
+            /* The entry was corrupted; the server must rejoin */
+            error(log_fp, "Corrupted log entry (idx=%"PRIu64")\n", 
+                    entry->idx);
+            dare_server_shutdown();
+        }
+        if ( data.persist_stage.active && 
+            ( !log_is_offset_larger(data.log, data.log->old_end, data.log->apply) || 
+              (entry->idx > persisted_idx()) ) )
+        {
+            /* Not in stable storage yet (see store_entry); the applied 
+            entries are always in the snapshots and catch-up records */
+            break;
+        }
+        if ( (0 != data.lead_ts) && IS_LEADER && 
+            (entry->term == SID_GET_TERM(data.ctrl_data->sid)) ) 
+        {
+            /* The first entry of the term is committed, i.e., the logs 
+            of a majority are adjusted */
+            info_wtime(log_fp, "Leadership re-established in %.3lf ms "
+                "(%"PRIu64" not committed entries)\n", 
+                (ev_now(data.loop) - data.lead_ts) * 1e3, data.lead_nc);
+            data.lead_ts = 0;
+        }
         
         if (!IS_LEADER)
             goto apply_entry;
@@ -1949,19 +3241,25 @@ apply_entry:
             //else {
             //    if (SID_GET_TERM(data.ctrl_data->sid) < 50) sleep(1);
             //}
-            if (!IS_LEADER)
-                data.sm->proxy_do_action(entry->clt_id, entry->type, entry->data.cmd.len, &entry->data.cmd.cmd, data.sm->up_para);
+            if (!IS_LEADER) {
+                if (0 != replay_entry(entry)) {
+                    /* The apply stage is full; go on in the next loop */
+                    break;
+                }
+            }
             else
                 data.sm->proxy_update_state(data.sm->up_para);
                 
-            last_applied_entry.idx = entry->idx;
-            last_applied_entry.term = entry->term;
-            last_applied_entry.offset = data.log->apply + log_entry_len(entry);
             /* Needed for answering read requests */
             data.last_cmt_write_csm_idx = entry->idx;
         }
         
 apply_next_entry:        
+        /* Note: all entry types are accounted for, so that a lagging 
+        follower knows exactly from where to catch up */
+        last_applied_entry.idx = entry->idx;
+        last_applied_entry.term = entry->term;
+        last_applied_entry.offset = data.log->apply + log_entry_len(entry);
         /* Advance apply offset */
         data.log->apply += log_entry_len(entry);
     }
@@ -2049,8 +3347,6 @@ log_pruning()
           //          data.log->head, min_offset);
         data.log->head = min_offset;
         
-        dare_state &= ~SNAPSHOT;
-        
         /* Append a HEAD log entry */
         log_append_entry(data.log, SID_GET_TERM(data.ctrl_data->sid), 
                         0, 0, HEAD, &data.log->head);
@@ -2076,7 +3372,8 @@ force_log_pruning()
         return;
     
     /* Too many entries in the log */
-    info_wtime(log_fp, "FORCED LOG PRUNING\n");
+    data.forced_prunings++;
+    info_wtime(log_fp, "FORCED LOG PRUNING (#%"PRIu64")\n", data.forced_prunings);
     info(log_fp, "   # log_size=%"PRIu64"; threshold=%lf\n", 
                 log_size, 0.75 * data.log->len);
     size = get_extended_group_size(data.config);
@@ -2096,24 +3393,15 @@ force_log_pruning()
             log_pruning();
             return;
         }
-        /* Server to slow; remove it */
-        dare_cid_t old_cid = data.config.cid;
-        CID_SERVER_RM(data.config.cid, target);
-        dare_ib_disconnect_server(target);
-        info_wtime(log_fp, "REMOVE SERVER p%"PRIu8"\n", target);
-        data.config.req_id = 0;
-        data.config.clt_id = 0;
-        PRINT_CONF_TRANSIT(old_cid, data.config.cid);
-        
-        /* Append CONFIG entry */
-        log_append_entry(data.log, SID_GET_TERM(data.ctrl_data->sid), 
-                        0, 0, CONFIG, &data.config.cid);
-        
-        /* Update apply offset for this target */
-        data.ctrl_data->apply_offsets[i] = data.log->apply;
+        /* Server too slow; instead of removing it, let the head offset 
+        pass it -- the server catches up from stable storage */
+        data.ctrl_data->apply_offsets[target] = data.log->apply;
 
         /* Prune the log */
         log_pruning();
+        
+        /* Let the server know from where its log is valid */
+        send_catchup_notice(target);
     }
     else {
         /* All apply offsets equal the leader's apply offset */
@@ -2121,6 +3409,269 @@ force_log_pruning()
     }
 }
 
+/**
+ * Notify a lagging server that the head offset passed its apply offset
+ */
+static void
+send_catchup_notice( uint8_t target )
+{
+    int rc;
+    uint64_t offset = data.log->head;
+    dare_log_entry_t *entry = log_get_entry(data.log, &offset);
+    
+    if (NULL == entry) return;
+    if (entry->idx == data.config.servers[target].cu_head_idx) {
+        /* Already notified for this head offset */
+        return;
+    }
+    
+    cu_notice_t *notice = &data.ctrl_data->cu_notice[data.config.idx];
+    notice->sid = data.ctrl_data->sid;
+    notice->head = offset;
+    notice->head_idx = entry->idx;
+    notice->donor = catchup_donor(target);
+    info_wtime(log_fp, "LAGGING SERVER p%"PRIu8": catch up until "
+        "idx=%"PRIu64" from p%"PRIu64"\n", target, notice->head_idx, 
+        notice->donor);
+    
+    rc = dare_ib_send_catchup_notice(target);
+    if (0 != rc) {
+        error(log_fp, "Cannot send catch-up notice\n");
+        return;
+    }
+    data.config.servers[target].cu_head_idx = entry->idx;
+}
+
+/**
+ * Choose the server that serves a lagging server from stable storage;
+ * prefer an up-to-date follower to keep the leader's NIC free
+ */
+static uint8_t
+catchup_donor( uint8_t target )
+{
+    uint8_t i, size = get_group_size(data.config);
+    
+    for (i = 0; i < size; i++) {
+        if ( (i == data.config.idx) || (i == target) ||
+            !CID_IS_SERVER_ON(data.config.cid, i) ||
+            (data.config.servers[i].fail_count >= PERMANENT_FAILURE) )
+        {
+            continue;
+        }
+        if (data.ctrl_data->vote_ack[i] == data.log->len) {
+            /* No vote ACK from this server */
+            continue;
+        }
+        if (log_is_offset_larger(data.log, data.log->head, 
+                    data.ctrl_data->apply_offsets[i]))
+        {
+            /* This server did not apply all entries before the head */
+            continue;
+        }
+        return i;
+    }
+    return data.config.idx;
+}
+
+/**
+ * Poll for catch-up notices and fetch the records the leader pruned 
+ * before I could apply them; the records are read in chunks from the 
+ * stable storage of a donor
+ */
+static void
+poll_catchup()
+{
+    int rc;
+    uint8_t i, size = get_group_size(data.config);
+    cu_notice_t *notice;
+    cu_rep_t *reply;
+    
+    for (i = 0; i < size; i++) {
+        if (i == data.config.idx) continue;
+        notice = &data.ctrl_data->cu_notice[i];
+        if (notice->head_idx <= data.cu_to_idx) continue;
+        
+        /* Found new catch-up notice */
+        data.cu_to_idx = notice->head_idx;
+        if (notice->head_idx <= last_applied_entry.idx + 1) {
+            /* All entries before the head offset are already applied */
+            continue;
+        }
+        if (!(dare_state & CATCHUP)) {
+            info_wtime(log_fp, "CATCH-UP from idx=%"PRIu64"\n", 
+                last_applied_entry.idx + 1);
+            dare_state |= CATCHUP;
+            /* The catch-up records go to stable storage from here */
+            stage_drain(&data.persist_stage);
+            stage_drain(&data.apply_stage);
+            data.cu_from_idx = last_applied_entry.idx + 1;
+            data.cu_seq++;
+            data.cu_req_ts = 0;
+        }
+        data.cu_head = notice->head;
+        data.cu_donor = (uint8_t)notice->donor;
+        
+        /* Do not hold back log pruning while catching up */
+        data.log->apply = notice->head;
+    }
+    if (!(dare_state & CATCHUP)) return;
+    
+    if (data.cu_from_idx >= data.cu_to_idx) {
+        /* Caught up; the log is valid from the head offset */
+        data.log->head = data.cu_head;
+        data.log->apply = data.cu_head;
+        data.log->old_end = data.cu_head;
+        data.config.cid_offset = data.cu_head;
+        last_applied_entry.idx = data.cu_to_idx - 1;
+        last_applied_entry.offset = data.cu_head;
+        dare_state &= ~CATCHUP;
+        
+        /* Release the donor's buffer with an empty request */
+        send_catchup_request();
+        info_wtime(log_fp, "CATCH-UP DONE: idx=%"PRIu64"\n", 
+                data.cu_to_idx - 1);
+        INFO_PRINT_LOG(log_fp, data.log);
+        return;
+    }
+    
+    reply = &data.ctrl_data->cu_rep[data.cu_donor];
+    if (reply->seq != data.cu_seq) {
+        /* No reply yet */
+        if (ev_now(data.loop) - data.cu_req_ts >= retransmit_period) {
+            send_catchup_request();
+        }
+        return;
+    }
+    if (0 == reply->last_idx) {
+        /* The donor cannot serve the records; ask the leader */
+        if (data.cu_donor == SID_GET_IDX(data.ctrl_data->sid)) {
+            error(log_fp, "Cannot catch up from stable storage\n");
+            dare_server_shutdown();
+        }
+        data.cu_donor = SID_GET_IDX(data.ctrl_data->sid);
+        send_catchup_request();
+        return;
+    }
+    
+    if (reply->len) {
+        /* Get the chunk */
+        rc = dare_ib_recv_catchup_chunk(data.cu_donor);
+        if (rc > 0) {
+            error(log_fp, "Cannot get catch-up chunk\n");
+            dare_server_shutdown();
+        }
+        if (rc != 0) {
+            /* Insuccess - try again */
+            send_catchup_request();
+            return;
+        }
+        
+        /* Store and apply the records */
+        rc = data.sm->proxy_apply_db_records(data.cu_buf, reply->len, 
+                        data.sm->up_para);
+        if (0 != rc) {
+            error(log_fp, "Cannot apply catch-up records\n");
+            dare_server_shutdown();
+        }
+    }
+    data.cu_from_idx = reply->last_idx + 1;
+    if (data.cu_from_idx < data.cu_to_idx) {
+        /* Get the next chunk */
+        send_catchup_request();
+    }
+}
+
+/**
+ * Send a catch-up request for the records in [cu_from_idx, cu_to_idx)
+ */
+static void
+send_catchup_request()
+{
+    int rc;
+    cu_req_t *request = &data.ctrl_data->cu_req[data.config.idx];
+    
+    if (!CID_IS_SERVER_ON(data.config.cid, data.cu_donor)) {
+        /* The donor is gone; ask the leader */
+        data.cu_donor = SID_GET_IDX(data.ctrl_data->sid);
+    }
+    request->from_idx = data.cu_from_idx;
+    request->to_idx = data.cu_to_idx;
+    request->seq = ++data.cu_seq;
+    data.cu_req_ts = ev_now(data.loop);
+    
+    rc = dare_ib_send_catchup_request(data.cu_donor);
+    if (0 != rc) {
+        error(log_fp, "Cannot send catch-up request\n");
+    }
+}
+
+/**
+ * Poll for catch-up requests and serve them from stable storage;
+ * a single chunk is outstanding at a time and the rate is bounded 
+ * by catchup_rate
+ */
+static void
+poll_catchup_requests()
+{
+    int rc;
+    uint8_t i, size = get_group_size(data.config);
+    cu_req_t *request;
+    cu_rep_t *reply = &data.ctrl_data->cu_rep[data.config.idx];
+    ev_tstamp now = ev_now(data.loop);
+    
+    for (i = 0; i < size; i++) {
+        if (i == data.config.idx) continue;
+        request = &data.ctrl_data->cu_req[i];
+        if (request->seq == data.config.servers[i].cu_seq) continue;
+        
+        /* Found new catch-up request */
+        if (data.cu_owner == i) {
+            /* The previous chunk was read */
+            data.cu_owner = MAX_SERVER_COUNT;
+        }
+        if (request->from_idx >= request->to_idx) {
+            /* The server caught up */
+            data.config.servers[i].cu_seq = request->seq;
+            continue;
+        }
+        if (data.cu_owner != MAX_SERVER_COUNT) {
+            if (now - data.cu_owner_ts < CATCHUP_LEASE) {
+                /* The buffer is in use */
+                continue;
+            }
+            data.cu_owner = MAX_SERVER_COUNT;
+        }
+        if (now < data.cu_next_ts) {
+            /* Throttled */
+            return;
+        }
+        
+        data.config.servers[i].cu_seq = request->seq;
+        reply->seq = request->seq;
+        if (request->from_idx < data.cu_min_idx) {
+            /* No records before the recovered snapshot */
+            reply->len = 0;
+            reply->last_idx = 0;
+        }
+        else {
+            reply->len = data.sm->proxy_get_db_records(request->from_idx, 
+                    request->to_idx, data.cu_buf, CATCHUP_BUF_SIZE, 
+                    &reply->last_idx, data.sm->up_para);
+            data.cu_owner = i;
+            data.cu_owner_ts = now;
+            if (catchup_rate > 0) {
+                data.cu_next_ts = now + reply->len / (catchup_rate * 1e6);
+            }
+        }
+        
+        /* Send a catch-up reply with the address of the chunk */
+        rc = dare_ib_send_catchup_reply(i);
+        if (0 != rc) {
+            error(log_fp, "Cannot send catch-up reply\n");
+        }
+    }
+}
+
 #endif
 
 /* ================================================================== */
@@ -2166,7 +3717,6 @@ poll_config_entries()
             thus, the leader's head offset is always >= */
             if (!log_is_offset_larger(data.log, offset, commit)) {
                 head_offset = entry->data.head;
-                dare_state &= ~SNAPSHOT;
             }
         } 
         /* Advance offset */
@@ -2255,11 +3805,11 @@ void server_to_follower()
     }
 
     /* Revoke log access */
+    stop_log_reservations();
     dare_ib_revoke_log_access();
     
     /* Populate buffer with not committed entries */
-    log_entries_to_nc_buf(data.log, 
-            &data.log->nc_buf[data.config.idx]);
+    publish_nc_buf();
             
     /* Restore log access according to the new term */
     dare_ib_restore_log_access();
@@ -2301,6 +3851,37 @@ int is_leader()
     return IS_LEADER;
 }
 
+/**
+ * Reserve a log entry for a client request, i.e., the request is 
+ * appended directly into the log; called by the proxy threads
+ * @return the entry (to be filled with the command and published) 
+ * or NULL (not leader or not enough room in the log)
+ */
+dare_log_entry_t* 
+dare_reserve_request( uint64_t req_id, 
+                    uint16_t clt_id, 
+                    uint8_t type, 
+                    uint16_t len, 
+                    uint64_t *prev_end )
+{
+    if (!log_rsv.active) return NULL;
+    return log_reserve_entry(data.log, req_id, clt_id, type, len, prev_end);
+}
+
+/**
+ * Copy the command into a reserved entry and publish it
+ */
+void
+dare_publish_request( dare_log_entry_t* entry, 
+                    void *buf, 
+                    uint64_t prev_end )
+{
+    if (entry->data.cmd.len) {
+        memcpy(entry->data.cmd.cmd, buf, entry->data.cmd.len);
+    }
+    log_publish_entry(data.log, entry, prev_end);
+}
+
 uint8_t get_node_id() 
 {
     return data.config.idx;
@@ -0,0 +1,233 @@
+/**
+ * DARE (Direct Access REplication)
+ *
+ * Pipeline stages: helper threads fed by the DARE thread through
+ * single-producer single-consumer rings
+ *
+ * Copyright (c) 2014-2015 ETH-Zurich. All rights reserved.
+ *
+ * Author(s): Marius Poke <marius.poke@inf.ethz.ch>
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "../include/dare/debug.h"
+#include "../include/dare/dare_stage.h"
+
+/* Records are 8-byte aligned */
+#define STAGE_REC_LEN(len) \
+    ((sizeof(stage_rec_t) + (uint64_t)(len) + 7) & ~(uint64_t)7)
+
+/* ================================================================== */
+
+static void*
+stage_thread( void *arg );
+static void
+stage_wakeup( stage_t *stage );
+
+/* ================================================================== */
+
+int stage_start( stage_t *stage, const char *name, int cpu,
+                 stage_handler_t handler, void *arg )
+{
+    int rc;
+
+    memset(stage, 0, sizeof(stage_t));
+    stage->ring = (char*)malloc(STAGE_RING_SIZE);
+    if (NULL == stage->ring) {
+        error_return(1, log_fp, "Cannot allocate the %s ring\n", name);
+    }
+    stage->name = name;
+    stage->cpu = cpu;
+    stage->handler = handler;
+    stage->arg = arg;
+    pthread_mutex_init(&stage->lock, NULL);
+    pthread_cond_init(&stage->cond, NULL);
+
+    rc = pthread_create(&stage->thread, NULL, stage_thread, stage);
+    if (0 != rc) {
+        free(stage->ring);
+        stage->ring = NULL;
+        error_return(1, log_fp, "Cannot create the %s thread\n", name);
+    }
+    stage->active = 1;
+    info(log_fp, "   # %s stage started (CPU %d)\n", name, cpu);
+
+    return 0;
+}
+
+/**
+ * Stop the stage thread once it handled the queued records
+ */
+void stage_stop( stage_t *stage )
+{
+    if (!stage->active) return;
+
+    stage_drain(stage);
+    pthread_mutex_lock(&stage->lock);
+    stage->stop = 1;
+    pthread_cond_signal(&stage->cond);
+    pthread_mutex_unlock(&stage->lock);
+    pthread_join(stage->thread, NULL);
+    stage->active = 0;
+
+    free(stage->ring);
+    stage->ring = NULL;
+}
+
+/**
+ * Queue a record (a copy of the data)
+ * Note: only the DARE thread calls this
+ * @return 0 if queued; 1 if the ring is full; -1 if the record
+ * does not fit in the ring
+ */
+int stage_push( stage_t *stage, uint64_t idx, uint16_t clt_id,
+                uint8_t type, uint8_t sender, void *data, uint32_t len )
+{
+    uint64_t rec_len = STAGE_REC_LEN(len);
+    uint64_t head = stage->head, pos, room;
+    stage_rec_t *rec;
+
+    if (rec_len > STAGE_RING_SIZE / 2) {
+        return -1;
+    }
+    pos = head % STAGE_RING_SIZE;
+    room = STAGE_RING_SIZE - pos;
+    if (room < rec_len) {
+        /* Skip the end of the ring */
+        if (head + room + rec_len - stage->tail > STAGE_RING_SIZE) {
+            return 1;
+        }
+        if (room >= sizeof(stage_rec_t)) {
+            ((stage_rec_t*)(stage->ring + pos))->len = STAGE_PAD;
+        }
+        head += room;
+        pos = 0;
+    }
+    else if (head + rec_len - stage->tail > STAGE_RING_SIZE) {
+        return 1;
+    }
+
+    rec = (stage_rec_t*)(stage->ring + pos);
+    rec->idx = idx;
+    rec->len = len;
+    rec->clt_id = clt_id;
+    rec->type = type;
+    rec->sender = sender;
+    memcpy(rec->data, data, len);
+
+    /* The record is written before the head is advanced */
+    __sync_synchronize();
+    stage->head = head + rec_len;
+    __sync_synchronize();
+    if (stage->sleeping) {
+        stage_wakeup(stage);
+    }
+
+    return 0;
+}
+
+/**
+ * Wait for the stage to handle all the queued records; then, done is
+ * reset, so that it refers only to the records queued afterwards
+ */
+void stage_drain( stage_t *stage )
+{
+    if (!stage->active) return;
+
+    while (!stage_empty(stage)) {
+        if (stage->sleeping) {
+            stage_wakeup(stage);
+        }
+        sched_yield();
+    }
+    __sync_synchronize();
+    stage->done = 0;
+}
+
+/**
+ * Pin a thread to a CPU; a negative CPU leaves the thread as it is
+ */
+int stage_pin( pthread_t thread, int cpu )
+{
+    int rc;
+    cpu_set_t set;
+
+    if (cpu < 0) return 0;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    rc = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set);
+    if (0 != rc) {
+        error_return(1, log_fp, "Cannot pin thread to CPU %d\n", cpu);
+    }
+    return 0;
+}
+
+/* ================================================================== */
+
+/**
+ * Handle the records in order; after STAGE_SPIN empty polls, sleep
+ * until the DARE thread queues a new record
+ */
+static void*
+stage_thread( void *arg )
+{
+    stage_t *stage = (stage_t*)arg;
+    stage_rec_t *rec;
+    uint64_t tail, pos, spin = 0;
+
+    stage_pin(pthread_self(), stage->cpu);
+
+    while (!stage->stop) {
+        tail = stage->tail;
+        if (tail == stage->head) {
+            if (++spin < STAGE_SPIN) continue;
+            pthread_mutex_lock(&stage->lock);
+            stage->sleeping = 1;
+            /* Either the producer sees the flag or I see the record */
+            __sync_synchronize();
+            while ( (stage->tail == stage->head) && !stage->stop ) {
+                pthread_cond_wait(&stage->cond, &stage->lock);
+            }
+            stage->sleeping = 0;
+            pthread_mutex_unlock(&stage->lock);
+            spin = 0;
+            continue;
+        }
+        spin = 0;
+        /* The record is read after the head */
+        __sync_synchronize();
+
+        pos = tail % STAGE_RING_SIZE;
+        rec = (stage_rec_t*)(stage->ring + pos);
+        if ( (STAGE_RING_SIZE - pos < sizeof(stage_rec_t)) ||
+            (STAGE_PAD == rec->len) )
+        {
+            /* Skip the end of the ring */
+            stage->tail = tail + STAGE_RING_SIZE - pos;
+            continue;
+        }
+
+        stage->handler(rec, stage->arg);
+        stage->done = rec->idx;
+        /* The record is handled before its room is reused */
+        __sync_synchronize();
+        stage->tail = tail + STAGE_REC_LEN(rec->len);
+    }
+
+    return NULL;
+}
+
+static void
+stage_wakeup( stage_t *stage )
+{
+    pthread_mutex_lock(&stage->lock);
+    pthread_cond_signal(&stage->cond);
+    pthread_mutex_unlock(&stage->lock);
+}
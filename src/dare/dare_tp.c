@@ -0,0 +1,309 @@
+/**
+ * DARE (Direct Access REplication)
+ *
+ * Transport: selection and the libibverbs backend
+ *
+ * Copyright (c) 2014-2015 ETH-Zurich. All rights reserved.
+ *
+ * Author(s): Marius Poke <marius.poke@inf.ethz.ch>
+ *
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "../include/dare/dare_tp.h"
+
+const dare_tp_ops_t *dare_tp = &dare_tp_ibv_ops;
+
+static const dare_tp_ops_t *transports[] = {&dare_tp_ibv_ops, &dare_tp_shm_ops};
+
+/* ================================================================== */
+/* libibverbs; wrappers, since some of the verbs are inline functions
+or macros */
+#if 1
+
+static struct ibv_device**
+tp_ibv_get_device_list( int *num_devices )
+{
+    return ibv_get_device_list(num_devices);
+}
+
+static void
+tp_ibv_free_device_list( struct ibv_device **list )
+{
+    ibv_free_device_list(list);
+}
+
+static const char*
+tp_ibv_get_device_name( struct ibv_device *device )
+{
+    return ibv_get_device_name(device);
+}
+
+static struct ibv_context*
+tp_ibv_open_device( struct ibv_device *device )
+{
+    return ibv_open_device(device);
+}
+
+static int
+tp_ibv_close_device( struct ibv_context *context )
+{
+    return ibv_close_device(context);
+}
+
+static int
+tp_ibv_query_device( struct ibv_context *context,
+                     struct ibv_device_attr *attr )
+{
+    return ibv_query_device(context, attr);
+}
+
+static int
+tp_ibv_query_device_ex( struct ibv_context *context,
+                        const struct ibv_query_device_ex_input *input,
+                        struct ibv_device_attr_ex *attr )
+{
+    return ibv_query_device_ex(context, input, attr);
+}
+
+static int
+tp_ibv_query_port( struct ibv_context *context, uint8_t port_num,
+                   struct ibv_port_attr *attr )
+{
+    return ibv_query_port(context, port_num, attr);
+}
+
+static int
+tp_ibv_query_gid( struct ibv_context *context, uint8_t port_num,
+                  int index, union ibv_gid *gid )
+{
+    return ibv_query_gid(context, port_num, index, gid);
+}
+
+static int
+tp_ibv_query_pkey( struct ibv_context *context, uint8_t port_num,
+                   int index, uint16_t *pkey )
+{
+    return ibv_query_pkey(context, port_num, index, pkey);
+}
+
+static struct ibv_pd*
+tp_ibv_alloc_pd( struct ibv_context *context )
+{
+    return ibv_alloc_pd(context);
+}
+
+static int
+tp_ibv_dealloc_pd( struct ibv_pd *pd )
+{
+    return ibv_dealloc_pd(pd);
+}
+
+static struct ibv_mr*
+tp_ibv_reg_mr( struct ibv_pd *pd, void *addr, size_t length, int access )
+{
+    return ibv_reg_mr(pd, addr, length, access);
+}
+
+static int
+tp_ibv_dereg_mr( struct ibv_mr *mr )
+{
+    return ibv_dereg_mr(mr);
+}
+
+static void*
+tp_ibv_alloc_buf( size_t length )
+{
+    void *mem = mmap(NULL, length ? length : 1, PROT_READ | PROT_WRITE, 
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    return (MAP_FAILED == mem) ? NULL : mem;
+}
+
+static void
+tp_ibv_free_buf( void *addr, size_t length )
+{
+    if (NULL != addr) {
+        munmap(addr, length ? length : 1);
+    }
+}
+
+static struct ibv_comp_channel*
+tp_ibv_create_comp_channel( struct ibv_context *context )
+{
+    return ibv_create_comp_channel(context);
+}
+
+static int
+tp_ibv_destroy_comp_channel( struct ibv_comp_channel *channel )
+{
+    return ibv_destroy_comp_channel(channel);
+}
+
+static struct ibv_cq*
+tp_ibv_create_cq( struct ibv_context *context, int cqe, void *cq_context,
+                  struct ibv_comp_channel *channel, int comp_vector )
+{
+    return ibv_create_cq(context, cqe, cq_context, channel, comp_vector);
+}
+
+static int
+tp_ibv_destroy_cq( struct ibv_cq *cq )
+{
+    return ibv_destroy_cq(cq);
+}
+
+static int
+tp_ibv_req_notify_cq( struct ibv_cq *cq, int solicited_only )
+{
+    return ibv_req_notify_cq(cq, solicited_only);
+}
+
+static int
+tp_ibv_get_cq_event( struct ibv_comp_channel *channel,
+                     struct ibv_cq **cq, void **cq_context )
+{
+    return ibv_get_cq_event(channel, cq, cq_context);
+}
+
+static void
+tp_ibv_ack_cq_events( struct ibv_cq *cq, unsigned int nevents )
+{
+    ibv_ack_cq_events(cq, nevents);
+}
+
+static int
+tp_ibv_poll_cq( struct ibv_cq *cq, int num_entries, struct ibv_wc *wc )
+{
+    return ibv_poll_cq(cq, num_entries, wc);
+}
+
+static struct ibv_qp*
+tp_ibv_create_qp( struct ibv_pd *pd, struct ibv_qp_init_attr *attr )
+{
+    return ibv_create_qp(pd, attr);
+}
+
+static int
+tp_ibv_modify_qp( struct ibv_qp *qp, struct ibv_qp_attr *attr,
+                  int attr_mask )
+{
+    return ibv_modify_qp(qp, attr, attr_mask);
+}
+
+static int
+tp_ibv_query_qp( struct ibv_qp *qp, struct ibv_qp_attr *attr,
+                 int attr_mask, struct ibv_qp_init_attr *init_attr )
+{
+    return ibv_query_qp(qp, attr, attr_mask, init_attr);
+}
+
+static int
+tp_ibv_destroy_qp( struct ibv_qp *qp )
+{
+    return ibv_destroy_qp(qp);
+}
+
+static int
+tp_ibv_post_send( struct ibv_qp *qp, struct ibv_send_wr *wr,
+                  struct ibv_send_wr **bad_wr )
+{
+    return ibv_post_send(qp, wr, bad_wr);
+}
+
+static int
+tp_ibv_post_recv( struct ibv_qp *qp, struct ibv_recv_wr *wr,
+                  struct ibv_recv_wr **bad_wr )
+{
+    return ibv_post_recv(qp, wr, bad_wr);
+}
+
+static struct ibv_ah*
+tp_ibv_create_ah( struct ibv_pd *pd, struct ibv_ah_attr *attr )
+{
+    return ibv_create_ah(pd, attr);
+}
+
+static int
+tp_ibv_destroy_ah( struct ibv_ah *ah )
+{
+    return ibv_destroy_ah(ah);
+}
+
+static int
+tp_ibv_attach_mcast( struct ibv_qp *qp, const union ibv_gid *gid,
+                     uint16_t lid )
+{
+    return ibv_attach_mcast(qp, gid, lid);
+}
+
+static int
+tp_ibv_detach_mcast( struct ibv_qp *qp, const union ibv_gid *gid,
+                     uint16_t lid )
+{
+    return ibv_detach_mcast(qp, gid, lid);
+}
+
+const dare_tp_ops_t dare_tp_ibv_ops = {
+    .name                   = "ib",
+    .get_device_list        = tp_ibv_get_device_list,
+    .free_device_list       = tp_ibv_free_device_list,
+    .get_device_name        = tp_ibv_get_device_name,
+    .open_device            = tp_ibv_open_device,
+    .close_device           = tp_ibv_close_device,
+    .query_device           = tp_ibv_query_device,
+    .query_device_ex        = tp_ibv_query_device_ex,
+    .query_port             = tp_ibv_query_port,
+    .query_gid              = tp_ibv_query_gid,
+    .query_pkey             = tp_ibv_query_pkey,
+    .alloc_pd               = tp_ibv_alloc_pd,
+    .dealloc_pd             = tp_ibv_dealloc_pd,
+    .reg_mr                 = tp_ibv_reg_mr,
+    .dereg_mr               = tp_ibv_dereg_mr,
+    .alloc_buf              = tp_ibv_alloc_buf,
+    .free_buf               = tp_ibv_free_buf,
+    .create_comp_channel    = tp_ibv_create_comp_channel,
+    .destroy_comp_channel   = tp_ibv_destroy_comp_channel,
+    .create_cq              = tp_ibv_create_cq,
+    .destroy_cq             = tp_ibv_destroy_cq,
+    .req_notify_cq          = tp_ibv_req_notify_cq,
+    .get_cq_event           = tp_ibv_get_cq_event,
+    .ack_cq_events          = tp_ibv_ack_cq_events,
+    .poll_cq                = tp_ibv_poll_cq,
+    .create_qp              = tp_ibv_create_qp,
+    .modify_qp              = tp_ibv_modify_qp,
+    .query_qp               = tp_ibv_query_qp,
+    .destroy_qp             = tp_ibv_destroy_qp,
+    .post_send              = tp_ibv_post_send,
+    .post_recv              = tp_ibv_post_recv,
+    .create_ah              = tp_ibv_create_ah,
+    .destroy_ah             = tp_ibv_destroy_ah,
+    .attach_mcast           = tp_ibv_attach_mcast,
+    .detach_mcast           = tp_ibv_detach_mcast,
+};
+
+#endif
+
+/* ================================================================== */
+
+/**
+ * Select the transport by name ("ib" or "shm"); called before the
+ * device is opened
+ */
+int dare_tp_select( const char *name )
+{
+    int i;
+
+    if ( (NULL == name) || ('\0' == name[0]) ) {
+        dare_tp = &dare_tp_ibv_ops;
+        return 0;
+    }
+    for (i = 0; i < sizeof(transports)/sizeof(transports[0]); i++) {
+        if (0 == strcmp(name, transports[i]->name)) {
+            dare_tp = transports[i];
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,2004 @@
+/**
+ * DARE (Direct Access REplication)
+ *
+ * Transport: shared-memory emulation of the fabric, so that a group
+ * runs on one host without RDMA hardware (transport = "shm")
+ *
+ * The fabric is a shared segment (/dev/shm/<fabric>) with one port per
+ * opened device. A port holds what the peers need to reach a process:
+ * the state of its QPs, its MRs and a mailbox for UD messages.
+ * One-sided operations are executed by the process that posts them,
+ * directly on the memory of the target; memory registered for remote
+ * access comes from alloc_buf, i.e., from a file in /dev/shm that the
+ * peers map (see shm_alloc_buf). As an RC responder,
+ * the target accepts them only if its QP is connected back and
+ * expects the PSN; thus, resetting a QP revokes the access (see
+ * rc_revoke_log_access) and a stale leader gets retry-exceeded errors.
+ * The WRs of a QP are executed and completed in order, as on the HCA.
+ *
+ * With an injected latency L, an RC operation reaches the target L
+ * after it is posted and completes L later; a UD message is received
+ * L after it is sent. The WRs progress whenever the process posts or
+ * polls.
+ *
+ * Copyright (c) 2014-2015 ETH-Zurich. All rights reserved.
+ *
+ * Author(s): Marius Poke <marius.poke@inf.ethz.ch>
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "../include/dare/debug.h"
+#include "../include/dare/dare_tp.h"
+
+#define SHM_MAX_PORTS   64      // processes on the fabric (LIDs 1..64)
+#define SHM_MAX_QPS     256     // per process
+#define SHM_MAX_MRS     256     // per process
+#define SHM_MAX_MCAST   4       // multicast attachments per process
+#define SHM_MAX_CQS     64      // per process
+#define SHM_MAX_SEGS    64      // buffers from alloc_buf per process
+#define SHM_MAX_MAPS    64      // mapped MRs of the peers
+#define SHM_MBOX_SLOTS  64      // UD messages in flight to a process
+#define SHM_MTU         4096
+#define SHM_MAX_INLINE  1024
+#define SHM_MAX_SGE     4
+#define SHM_MAX_WR      16384
+#define SHM_MCAST_LID   0xC000  // multicast LIDs start here
+#define SHM_GRH         40      // UD receives start with the GRH
+#define SHM_PAGE        4096UL
+#define SHM_PSN_MASK    0xFFFFFF
+/* Interval of checking whether a peer process is still alive (ns) */
+#define SHM_ALIVE_CHECK 1000000UL
+
+#define PAGE_DOWN(a) ((uint64_t)(a) & ~(SHM_PAGE - 1))
+#define PAGE_UP(a)   (((uint64_t)(a) + SHM_PAGE - 1) & ~(SHM_PAGE - 1))
+#define CONTAINER(ptr, type) ((type*)(ptr))
+
+/* ================================================================== */
+/* Fabric (shared) */
+
+/* QP state seen by the peers */
+struct shm_qp_info_t {
+    volatile uint32_t qpn;      // 0: free
+    volatile uint32_t state;    // enum ibv_qp_state
+    volatile uint32_t access;   // qp_access_flags
+    volatile uint32_t dest_qpn;
+    volatile uint32_t rq_psn;   // next PSN expected by the responder
+    volatile uint16_t dlid;
+    uint16_t type;
+};
+typedef struct shm_qp_info_t shm_qp_info_t;
+
+/* MR seen by the peers: the file that backs it and the offset of its
+first page; gen changes when the slot is registered again */
+struct shm_mr_info_t {
+    volatile uint32_t rkey;     // 0: free
+    volatile uint32_t gen;
+    uint32_t access;
+    uint64_t addr;
+    uint64_t len;
+    uint64_t off;
+    char path[96];              // empty: not shared
+};
+typedef struct shm_mr_info_t shm_mr_info_t;
+
+struct shm_mcast_t {
+    volatile uint32_t qpn;      // 0: free
+    uint16_t mlid;
+    uint8_t mgid[16];
+};
+typedef struct shm_mcast_t shm_mcast_t;
+
+/* UD message; seq orders the slot between the producers (the peers)
+and the consumer (the owner of the port) */
+struct shm_msg_t {
+    volatile uint64_t seq;
+    uint64_t due;               // delivered from then on (ns)
+    uint32_t src_qpn;
+    uint32_t dest_qpn;
+    uint32_t len;
+    uint16_t slid;
+    char data[SHM_MTU];
+};
+typedef struct shm_msg_t shm_msg_t;
+
+struct shm_port_t {
+    volatile int32_t pid;       // 0: closed; -1: being opened
+    volatile uint32_t armed;    // a message wakes up the owner
+    shm_qp_info_t qps[SHM_MAX_QPS];
+    shm_mr_info_t mrs[SHM_MAX_MRS];
+    shm_mcast_t mcast[SHM_MAX_MCAST];
+    volatile uint64_t enq __attribute__((aligned(64)));
+    volatile uint64_t deq __attribute__((aligned(64)));
+    shm_msg_t mbox[SHM_MBOX_SLOTS];
+};
+typedef struct shm_port_t shm_port_t;
+
+struct shm_fabric_t {
+    volatile uint32_t next_lid; // highest LID handed out
+    shm_port_t ports[SHM_MAX_PORTS];    // ports[lid - 1]
+};
+typedef struct shm_fabric_t shm_fabric_t;
+
+/* ================================================================== */
+/* Verbs objects (private) */
+
+struct shm_cq_t {
+    struct ibv_cq cq;
+    struct ibv_wc *ring;
+    uint32_t mask;
+    uint64_t head;
+    uint64_t tail;
+    int armed;
+};
+typedef struct shm_cq_t shm_cq_t;
+
+/* Posted send WR */
+struct shm_op_t {
+    uint64_t wr_id;
+    uint64_t due;               // executed from then on (ns)
+    uint64_t done;              // completed from then on (ns)
+    int signaled;
+    enum ibv_wr_opcode opcode;
+    enum ibv_wc_status status;
+    uint32_t len;
+    int num_sge;
+    struct ibv_sge sge[SHM_MAX_SGE];
+    char *data;                 // copy of inline data; NULL: the SGEs
+    uint64_t raddr;
+    uint32_t rkey;
+    uint64_t compare_add;
+    uint64_t swap;
+    struct shm_ah_t *ah;        // UD
+    uint32_t remote_qpn;        // UD
+};
+typedef struct shm_op_t shm_op_t;
+
+struct shm_recv_t {
+    uint64_t wr_id;
+    uint64_t addr;
+    uint32_t length;
+    uint32_t lkey;
+};
+typedef struct shm_recv_t shm_recv_t;
+
+struct shm_qp_t {
+    struct ibv_qp qp;
+    struct shm_ctx_t *c;
+    shm_qp_info_t *info;
+    int slot;
+    int sq_sig_all;
+    struct ibv_qp_cap cap;
+    uint32_t sq_psn;            // PSN of the next request
+    int last_map;               // last mapped MR used
+    shm_op_t *sq;
+    uint32_t sq_mask;
+    uint64_t sq_head;
+    uint64_t sq_exec;           // next WR to execute
+    uint64_t sq_tail;
+    shm_recv_t *rq;
+    uint32_t rq_mask;
+    uint64_t rq_head;
+    uint64_t rq_tail;
+};
+typedef struct shm_qp_t shm_qp_t;
+
+struct shm_ah_t {
+    struct ibv_ah ah;
+    uint16_t dlid;
+    union ibv_gid dgid;
+};
+typedef struct shm_ah_t shm_ah_t;
+
+/* Buffer from alloc_buf: [start, end) is mapped from the file */
+struct shm_seg_t {
+    uint64_t start;
+    uint64_t end;
+    char path[96];
+};
+typedef struct shm_seg_t shm_seg_t;
+
+/* MR of a peer, mapped from its first page */
+struct shm_map_t {
+    int32_t pid;
+    uint16_t lid;
+    uint32_t rkey;
+    uint32_t gen;
+    char *base;
+    uint64_t len;
+};
+typedef struct shm_map_t shm_map_t;
+
+struct shm_ctx_t {
+    struct ibv_context ctx;
+    shm_fabric_t *fabric;
+    shm_port_t *port;
+    uint16_t lid;
+    int ev_fd;                  // event pipe (completion channel)
+    char ev_path[128];
+    uint32_t qp_gen;
+    uint32_t mr_gen;
+    uint64_t pending;           // posted WRs not completed yet
+    shm_qp_t *qps[SHM_MAX_QPS];
+    shm_cq_t *cqs[SHM_MAX_CQS];
+    shm_map_t maps[SHM_MAX_MAPS];
+    uint32_t map_next;
+    int32_t peer_pid[SHM_MAX_PORTS + 1];    // of the opened event pipes
+    int peer_fd[SHM_MAX_PORTS + 1];
+    int32_t peer_dead[SHM_MAX_PORTS + 1];   // pid found dead
+    uint64_t peer_check[SHM_MAX_PORTS + 1];
+};
+typedef struct shm_ctx_t shm_ctx_t;
+
+static char fabric_name[64] = "dare";
+static uint64_t latency_ns = 0;
+/* The verbs are thread-safe */
+static pthread_mutex_t shm_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The buffers are allocated before the device is opened */
+static shm_seg_t segs[SHM_MAX_SEGS];
+static uint32_t seg_count;
+static uint32_t seg_id;
+
+static struct ibv_device shm_device;
+static struct ibv_device *shm_device_list[2];
+
+/* ================================================================== */
+/* local function - prototypes */
+
+static uint64_t
+now_ns();
+static int
+port_alive( shm_ctx_t *c, uint16_t lid );
+static void
+kick( shm_ctx_t *c, uint16_t lid );
+static int
+mbox_put( shm_ctx_t *c, uint16_t lid, uint32_t src_qpn,
+          uint32_t dest_qpn, void *data, uint32_t len, uint64_t due );
+static void
+progress( shm_ctx_t *c );
+static void
+qp_progress( shm_qp_t *q, uint64_t now );
+static void
+mbox_progress( shm_ctx_t *c, uint64_t now );
+static enum ibv_wc_status
+rc_execute( shm_qp_t *q, shm_op_t *op );
+static enum ibv_wc_status
+ud_execute( shm_qp_t *q, shm_op_t *op );
+static int
+cq_push( shm_ctx_t *c, shm_cq_t *cq, struct ibv_wc *wc );
+static void
+qp_flush( shm_qp_t *q );
+static void*
+shm_alloc_buf( size_t length );
+static void
+shm_free_buf( void *addr, size_t length );
+static int
+seg_lookup( uint64_t addr, uint64_t len, char *path, uint64_t *off );
+static char*
+remote_ptr( shm_qp_t *q, uint16_t lid, uint32_t rkey,
+            uint64_t raddr, uint64_t len, uint32_t need );
+static int
+local_ok( shm_ctx_t *c, struct ibv_sge *sge, int write );
+
+/* ================================================================== */
+/* Configuration */
+
+/**
+ * Name of the fabric (shared by the processes of a group) and the
+ * injected one-way latency (usec)
+ */
+void dare_tp_shm_config( const char *fabric, double latency )
+{
+    if ( (NULL != fabric) && ('\0' != fabric[0]) ) {
+        snprintf(fabric_name, sizeof(fabric_name), "%s", fabric);
+    }
+    latency_ns = (latency > 0) ? (uint64_t)(latency * 1000) : 0;
+}
+
+/* ================================================================== */
+/* Device */
+#if 1
+
+static struct ibv_device**
+shm_get_device_list( int *num_devices )
+{
+    memset(&shm_device, 0, sizeof(shm_device));
+    shm_device.node_type = IBV_NODE_CA;
+    shm_device.transport_type = IBV_TRANSPORT_IB;
+    snprintf(shm_device.name, sizeof(shm_device.name), "shm0");
+    snprintf(shm_device.dev_name, sizeof(shm_device.dev_name), "shm0");
+    shm_device_list[0] = &shm_device;
+    shm_device_list[1] = NULL;
+    if (NULL != num_devices) {
+        *num_devices = 1;
+    }
+    return shm_device_list;
+}
+
+static void
+shm_free_device_list( struct ibv_device **list )
+{
+}
+
+static const char*
+shm_get_device_name( struct ibv_device *device )
+{
+    return device->name;
+}
+
+/**
+ * Map the fabric (created by the first process) and open a port:
+ * the port of a closed or dead process is reused, with its LID, as
+ * a restarted host keeps its LID
+ */
+static struct ibv_context*
+shm_open_device( struct ibv_device *device )
+{
+    int fd, i;
+    char path[128];
+    struct stat st;
+    uint32_t lid;
+    int32_t pid;
+    shm_ctx_t *c;
+    shm_port_t *p = NULL;
+
+    c = (shm_ctx_t*)malloc(sizeof(shm_ctx_t));
+    if (NULL == c) {
+        return NULL;
+    }
+    memset(c, 0, sizeof(shm_ctx_t));
+    c->ev_fd = -1;
+    for (i = 0; i <= SHM_MAX_PORTS; i++) {
+        c->peer_fd[i] = -1;
+    }
+
+    snprintf(path, sizeof(path), "/dev/shm/%s", fabric_name);
+    fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        error(log_fp, "Cannot open %s: %s\n", path, strerror(errno));
+        goto error;
+    }
+    if ( (0 != fstat(fd, &st)) ||
+        ( ((uint64_t)st.st_size < sizeof(shm_fabric_t)) &&
+          (0 != ftruncate(fd, sizeof(shm_fabric_t))) ) )
+    {
+        error(log_fp, "Cannot resize %s: %s\n", path, strerror(errno));
+        close(fd);
+        goto error;
+    }
+    c->fabric = (shm_fabric_t*)mmap(NULL, sizeof(shm_fabric_t),
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == c->fabric) {
+        c->fabric = NULL;
+        error(log_fp, "Cannot map %s: %s\n", path, strerror(errno));
+        goto error;
+    }
+
+    /* Reuse a port... */
+    for (lid = 1; lid <= c->fabric->next_lid; lid++) {
+        p = &c->fabric->ports[lid - 1];
+        pid = p->pid;
+        if ( (pid < 0) ||
+            ( (pid > 0) && !( (0 != kill(pid, 0)) && (ESRCH == errno) ) ) )
+        {
+            continue;
+        }
+        if (__sync_bool_compare_and_swap(&p->pid, pid, -1)) break;
+    }
+    /* ...or open a new one */
+    if (lid > c->fabric->next_lid) {
+        lid = __sync_add_and_fetch(&c->fabric->next_lid, 1);
+        if (lid > SHM_MAX_PORTS) {
+            error(log_fp, "Fabric %s is full (remove %s)\n",
+                  fabric_name, path);
+            goto error;
+        }
+        p = &c->fabric->ports[lid - 1];
+        p->pid = -1;
+    }
+    c->lid = (uint16_t)lid;
+    c->port = p;
+
+    /* Initialize the port */
+    memset(p->qps, 0, sizeof(p->qps));
+    memset(p->mrs, 0, sizeof(p->mrs));
+    memset(p->mcast, 0, sizeof(p->mcast));
+    for (i = 0; i < SHM_MBOX_SLOTS; i++) {
+        p->mbox[i].seq = i;
+    }
+    p->enq = 0;
+    p->deq = 0;
+    p->armed = 0;
+
+    /* Event pipe: written by the peers as well */
+    snprintf(c->ev_path, sizeof(c->ev_path), "/dev/shm/%s_%"PRIu16".ev",
+             fabric_name, c->lid);
+    unlink(c->ev_path);
+    if ( (0 != mkfifo(c->ev_path, S_IRUSR | S_IWUSR)) ||
+        ((c->ev_fd = open(c->ev_path, O_RDWR | O_NONBLOCK)) < 0) )
+    {
+        error(log_fp, "Cannot create %s: %s\n", c->ev_path, strerror(errno));
+        p->pid = 0;
+        goto error;
+    }
+
+    c->ctx.device = device;
+    c->ctx.async_fd = -1;
+    c->ctx.num_comp_vectors = 1;
+    pthread_mutex_init(&c->ctx.mutex, NULL);
+    __sync_synchronize();
+    p->pid = getpid();
+
+    info(log_fp, "# shm fabric %s: LID %"PRIu16"; injected latency "
+         "%.1lf usec\n", fabric_name, c->lid, latency_ns / 1000.);
+    return &c->ctx;
+
+error:
+    if (NULL != c->fabric) {
+        munmap(c->fabric, sizeof(shm_fabric_t));
+    }
+    free(c);
+    return NULL;
+}
+
+static int
+shm_close_device( struct ibv_context *context )
+{
+    uint32_t i;
+    shm_ctx_t *c = CONTAINER(context, shm_ctx_t);
+
+    c->port->armed = 0;
+    __sync_synchronize();
+    c->port->pid = 0;
+
+    /* The peers may still have them mapped; the buffers stay valid 
+    until freed (see shm_free_buf) */
+    pthread_mutex_lock(&shm_lock);
+    for (i = 0; i < seg_count; i++) {
+        unlink(segs[i].path);
+    }
+    pthread_mutex_unlock(&shm_lock);
+    for (i = 0; i < SHM_MAX_MAPS; i++) {
+        if (NULL != c->maps[i].base) {
+            munmap(c->maps[i].base, c->maps[i].len);
+        }
+    }
+    for (i = 0; i <= SHM_MAX_PORTS; i++) {
+        if (c->peer_fd[i] >= 0) close(c->peer_fd[i]);
+    }
+    close(c->ev_fd);
+    unlink(c->ev_path);
+    munmap(c->fabric, sizeof(shm_fabric_t));
+    free(c);
+
+    return 0;
+}
+
+static int
+shm_query_device( struct ibv_context *context,
+                  struct ibv_device_attr *attr )
+{
+    memset(attr, 0, sizeof(struct ibv_device_attr));
+    snprintf(attr->fw_ver, sizeof(attr->fw_ver), "shm");
+    attr->max_mr_size = ~0ULL;
+    attr->page_size_cap = SHM_PAGE;
+    attr->max_qp = SHM_MAX_QPS;
+    attr->max_qp_wr = SHM_MAX_WR;
+    attr->max_sge = SHM_MAX_SGE;
+    attr->max_sge_rd = SHM_MAX_SGE;
+    attr->max_cq = SHM_MAX_CQS;
+    attr->max_cqe = 1 << 20;
+    attr->max_mr = SHM_MAX_MRS;
+    attr->max_pd = 1024;
+    attr->max_qp_rd_atom = 16;
+    attr->max_qp_init_rd_atom = 16;
+    attr->max_res_rd_atom = 16 * SHM_MAX_QPS;
+    attr->atomic_cap = IBV_ATOMIC_HCA;
+    attr->max_mcast_grp = 1;
+    attr->max_mcast_qp_attach = SHM_MAX_MCAST;
+    attr->max_total_mcast_qp_attach = SHM_MAX_MCAST;
+    attr->max_ah = 1 << 16;
+    attr->max_srq = 0;
+    attr->max_pkeys = 1;
+    attr->phys_port_cnt = 1;
+    return 0;
+}
+
+/**
+ * No on-demand paging: the memory is always there
+ */
+static int
+shm_query_device_ex( struct ibv_context *context,
+                     const struct ibv_query_device_ex_input *input,
+                     struct ibv_device_attr_ex *attr )
+{
+    memset(attr, 0, sizeof(struct ibv_device_attr_ex));
+    return shm_query_device(context, &attr->orig_attr);
+}
+
+static int
+shm_query_port( struct ibv_context *context, uint8_t port_num,
+                struct ibv_port_attr *attr )
+{
+    shm_ctx_t *c = CONTAINER(context, shm_ctx_t);
+
+    if (1 != port_num) {
+        return EINVAL;
+    }
+    memset(attr, 0, sizeof(struct ibv_port_attr));
+    attr->state = IBV_PORT_ACTIVE;
+    attr->max_mtu = IBV_MTU_4096;
+    attr->active_mtu = IBV_MTU_4096;
+    attr->gid_tbl_len = 1;
+    attr->max_msg_sz = 1U << 31;
+    attr->pkey_tbl_len = 1;
+    attr->lid = c->lid;
+    attr->sm_lid = 1;
+    attr->phys_state = 5;   // LinkUp
+    attr->link_layer = IBV_LINK_LAYER_INFINIBAND;
+    return 0;
+}
+
+/**
+ * GID: fe80::<LID>
+ */
+static int
+shm_query_gid( struct ibv_context *context, uint8_t port_num,
+               int index, union ibv_gid *gid )
+{
+    shm_ctx_t *c = CONTAINER(context, shm_ctx_t);
+
+    if ( (1 != port_num) || (0 != index) ) {
+        return EINVAL;
+    }
+    memset(gid, 0, sizeof(union ibv_gid));
+    gid->raw[0] = 0xfe;
+    gid->raw[1] = 0x80;
+    gid->raw[14] = c->lid >> 8;
+    gid->raw[15] = c->lid & 0xFF;
+    return 0;
+}
+
+static int
+shm_query_pkey( struct ibv_context *context, uint8_t port_num,
+                int index, uint16_t *pkey )
+{
+    if ( (1 != port_num) || (0 != index) ) {
+        return EINVAL;
+    }
+    *pkey = htons(0xFFFF);
+    return 0;
+}
+
+#endif
+
+/* ================================================================== */
+/* Protection domains and memory regions */
+#if 1
+
+static struct ibv_pd*
+shm_alloc_pd( struct ibv_context *context )
+{
+    struct ibv_pd *pd = (struct ibv_pd*)malloc(sizeof(struct ibv_pd));
+    if (NULL == pd) {
+        return NULL;
+    }
+    memset(pd, 0, sizeof(struct ibv_pd));
+    pd->context = context;
+    return pd;
+}
+
+static int
+shm_dealloc_pd( struct ibv_pd *pd )
+{
+    free(pd);
+    return 0;
+}
+
+/**
+ * Register memory; memory with remote access must come from alloc_buf,
+ * so that the peers can map it
+ */
+static struct ibv_mr*
+shm_reg_mr( struct ibv_pd *pd, void *addr, size_t length, int access )
+{
+    int slot;
+    uint32_t key;
+    struct ibv_mr *mr;
+    shm_mr_info_t *mi = NULL;
+    shm_ctx_t *c = CONTAINER(pd->context, shm_ctx_t);
+
+    mr = (struct ibv_mr*)malloc(sizeof(struct ibv_mr));
+    if (NULL == mr) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    pthread_mutex_lock(&shm_lock);
+    for (slot = 0; slot < SHM_MAX_MRS; slot++) {
+        if (0 == c->port->mrs[slot].rkey) {
+            mi = &c->port->mrs[slot];
+            break;
+        }
+    }
+    if (NULL == mi) {
+        pthread_mutex_unlock(&shm_lock);
+        free(mr);
+        errno = ENOMEM;
+        return NULL;
+    }
+    mi->path[0] = '\0';
+    mi->off = 0;
+    if (access & (IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ |
+                  IBV_ACCESS_REMOTE_ATOMIC))
+    {
+        if (0 != seg_lookup((uint64_t)addr, length, mi->path, &mi->off)) {
+            pthread_mutex_unlock(&shm_lock);
+            free(mr);
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+    /* The keys are not reused */
+    key = ((++c->mr_gen & 0xFFFFFF) << 8) | slot;
+    if (0 == key) {
+        key = ((++c->mr_gen & 0xFFFFFF) << 8) | slot;
+    }
+    mi->access = access;
+    mi->addr = (uint64_t)addr;
+    mi->len = length;
+    mi->gen += 2;
+    __sync_synchronize();
+    mi->rkey = key;
+    pthread_mutex_unlock(&shm_lock);
+
+    memset(mr, 0, sizeof(struct ibv_mr));
+    mr->context = pd->context;
+    mr->pd = pd;
+    mr->addr = addr;
+    mr->length = length;
+    mr->handle = slot;
+    mr->lkey = key;
+    mr->rkey = key;
+    return mr;
+}
+
+/**
+ * Deregister memory; the memory stays shared until freed
+ */
+static int
+shm_dereg_mr( struct ibv_mr *mr )
+{
+    shm_ctx_t *c = CONTAINER(mr->context, shm_ctx_t);
+
+    pthread_mutex_lock(&shm_lock);
+    c->port->mrs[mr->handle].rkey = 0;
+    __sync_synchronize();
+    pthread_mutex_unlock(&shm_lock);
+    free(mr);
+    return 0;
+}
+
+#endif
+
+/* ================================================================== */
+/* Completion queues and events */
+#if 1
+
+static struct ibv_comp_channel*
+shm_create_comp_channel( struct ibv_context *context )
+{
+    shm_ctx_t *c = CONTAINER(context, shm_ctx_t);
+    struct ibv_comp_channel *channel;
+
+    channel = (struct ibv_comp_channel*)
+            malloc(sizeof(struct ibv_comp_channel));
+    if (NULL == channel) {
+        return NULL;
+    }
+    memset(channel, 0, sizeof(struct ibv_comp_channel));
+    channel->context = context;
+    channel->fd = c->ev_fd;
+    return channel;
+}
+
+static int
+shm_destroy_comp_channel( struct ibv_comp_channel *channel )
+{
+    /* The event pipe is closed with the device */
+    free(channel);
+    return 0;
+}
+
+static struct ibv_cq*
+shm_create_cq( struct ibv_context *context, int cqe, void *cq_context,
+               struct ibv_comp_channel *channel, int comp_vector )
+{
+    int i;
+    uint32_t size = 2;
+    shm_cq_t *cq;
+    shm_ctx_t *c = CONTAINER(context, shm_ctx_t);
+
+    while (size < (uint32_t)cqe + 1) size <<= 1;
+    cq = (shm_cq_t*)malloc(sizeof(shm_cq_t));
+    if (NULL == cq) {
+        return NULL;
+    }
+    memset(cq, 0, sizeof(shm_cq_t));
+    cq->ring = (struct ibv_wc*)malloc(size * sizeof(struct ibv_wc));
+    if (NULL == cq->ring) {
+        free(cq);
+        return NULL;
+    }
+    cq->mask = size - 1;
+    cq->cq.context = context;
+    cq->cq.channel = channel;
+    cq->cq.cq_context = cq_context;
+    cq->cq.cqe = cqe;
+    pthread_mutex_init(&cq->cq.mutex, NULL);
+    pthread_cond_init(&cq->cq.cond, NULL);
+
+    pthread_mutex_lock(&shm_lock);
+    for (i = 0; i < SHM_MAX_CQS; i++) {
+        if (NULL == c->cqs[i]) {
+            c->cqs[i] = cq;
+            cq->cq.handle = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shm_lock);
+    if (SHM_MAX_CQS == i) {
+        free(cq->ring);
+        free(cq);
+        return NULL;
+    }
+    return &cq->cq;
+}
+
+static int
+shm_destroy_cq( struct ibv_cq *ibcq )
+{
+    shm_cq_t *cq = CONTAINER(ibcq, shm_cq_t);
+    shm_ctx_t *c = CONTAINER(ibcq->context, shm_ctx_t);
+
+    pthread_mutex_lock(&shm_lock);
+    c->cqs[ibcq->handle] = NULL;
+    pthread_mutex_unlock(&shm_lock);
+    free(cq->ring);
+    free(cq);
+    return 0;
+}
+
+/**
+ * Request an event for the next completion; the peers write the event
+ * pipe when they send a UD message (see ud_execute). If there is
+ * already something to poll, the event is raised right away
+ */
+static int
+shm_req_notify_cq( struct ibv_cq *ibcq, int solicited_only )
+{
+    shm_cq_t *cq = CONTAINER(ibcq, shm_cq_t);
+    shm_ctx_t *c = CONTAINER(ibcq->context, shm_ctx_t);
+
+    pthread_mutex_lock(&shm_lock);
+    cq->armed = 1;
+    c->port->armed = 1;
+    __sync_synchronize();
+    if ( (cq->head != cq->tail) || c->pending ||
+        (c->port->deq != c->port->enq) )
+    {
+        cq->armed = 0;
+        kick(c, c->lid);
+    }
+    pthread_mutex_unlock(&shm_lock);
+    return 0;
+}
+
+static int
+shm_get_cq_event( struct ibv_comp_channel *channel,
+                  struct ibv_cq **ibcq, void **cq_context )
+{
+    int i;
+    char b;
+    shm_cq_t *cq = NULL;
+    shm_ctx_t *c = CONTAINER(channel->context, shm_ctx_t);
+
+    if (1 != read(channel->fd, &b, 1)) {
+        return -1;
+    }
+    /* The pipe does not tell which CQ; prefer one with completions */
+    pthread_mutex_lock(&shm_lock);
+    for (i = 0; i < SHM_MAX_CQS; i++) {
+        if ( (NULL == c->cqs[i]) || (c->cqs[i]->cq.channel != channel) ) {
+            continue;
+        }
+        if ( (NULL == cq) || (c->cqs[i]->head != c->cqs[i]->tail) ) {
+            cq = c->cqs[i];
+        }
+    }
+    pthread_mutex_unlock(&shm_lock);
+    if (NULL == cq) {
+        return -1;
+    }
+    *ibcq = &cq->cq;
+    *cq_context = cq->cq.cq_context;
+    return 0;
+}
+
+static void
+shm_ack_cq_events( struct ibv_cq *cq, unsigned int nevents )
+{
+}
+
+static int
+shm_poll_cq( struct ibv_cq *ibcq, int num_entries, struct ibv_wc *wc )
+{
+    int n = 0;
+    shm_cq_t *cq = CONTAINER(ibcq, shm_cq_t);
+    shm_ctx_t *c = CONTAINER(ibcq->context, shm_ctx_t);
+
+    pthread_mutex_lock(&shm_lock);
+    progress(c);
+    while ( (n < num_entries) && (cq->head != cq->tail) ) {
+        wc[n++] = cq->ring[cq->head & cq->mask];
+        cq->head++;
+    }
+    pthread_mutex_unlock(&shm_lock);
+    return n;
+}
+
+#endif
+
+/* ================================================================== */
+/* Queue pairs */
+#if 1
+
+static struct ibv_qp*
+shm_create_qp( struct ibv_pd *pd, struct ibv_qp_init_attr *attr )
+{
+    int slot;
+    uint32_t size;
+    shm_qp_t *q;
+    shm_ctx_t *c = CONTAINER(pd->context, shm_ctx_t);
+
+    if ( ( (IBV_QPT_RC != attr->qp_type) &&
+           (IBV_QPT_UD != attr->qp_type) ) ||
+        (attr->cap.max_inline_data > SHM_MAX_INLINE) ||
+        (attr->cap.max_send_sge > SHM_MAX_SGE) ||
+        (attr->cap.max_recv_sge > SHM_MAX_SGE) ||
+        (attr->cap.max_send_wr > SHM_MAX_WR) ||
+        (attr->cap.max_recv_wr > SHM_MAX_WR) )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    q = (shm_qp_t*)malloc(sizeof(shm_qp_t));
+    if (NULL == q) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(q, 0, sizeof(shm_qp_t));
+    for (size = 2; size < attr->cap.max_send_wr; size <<= 1);
+    q->sq = (shm_op_t*)malloc(size * sizeof(shm_op_t));
+    q->sq_mask = size - 1;
+    for (size = 2; size < attr->cap.max_recv_wr; size <<= 1);
+    q->rq = (shm_recv_t*)malloc(size * sizeof(shm_recv_t));
+    q->rq_mask = size - 1;
+    if ( (NULL == q->sq) || (NULL == q->rq) ) {
+        goto error;
+    }
+
+    pthread_mutex_lock(&shm_lock);
+    for (slot = 0; slot < SHM_MAX_QPS; slot++) {
+        if (NULL == c->qps[slot]) break;
+    }
+    if (SHM_MAX_QPS == slot) {
+        pthread_mutex_unlock(&shm_lock);
+        goto error;
+    }
+    c->qps[slot] = q;
+    q->c = c;
+    q->slot = slot;
+    q->info = &c->port->qps[slot];
+    q->sq_sig_all = attr->sq_sig_all;
+    q->cap = attr->cap;
+    q->last_map = -1;
+
+    q->qp.context = pd->context;
+    q->qp.qp_context = attr->qp_context;
+    q->qp.pd = pd;
+    q->qp.send_cq = attr->send_cq;
+    q->qp.recv_cq = attr->recv_cq;
+    q->qp.handle = slot;
+    q->qp.qp_num = ((uint32_t)c->lid << 16) |
+                   ((++c->qp_gen & 0xFF) << 8) | slot;
+    q->qp.state = IBV_QPS_RESET;
+    q->qp.qp_type = attr->qp_type;
+    pthread_mutex_init(&q->qp.mutex, NULL);
+    pthread_cond_init(&q->qp.cond, NULL);
+
+    memset(q->info, 0, sizeof(shm_qp_info_t));
+    q->info->type = attr->qp_type;
+    q->info->state = IBV_QPS_RESET;
+    __sync_synchronize();
+    q->info->qpn = q->qp.qp_num;
+    pthread_mutex_unlock(&shm_lock);
+
+    return &q->qp;
+
+error:
+    free(q->sq);
+    free(q->rq);
+    free(q);
+    errno = ENOMEM;
+    return NULL;
+}
+
+/**
+ * Move a QP through RESET->INIT->RTR->RTS, or to RESET or ERR from
+ * any state; the peers see the state once the attributes are set,
+ * and stop seeing it at once when it is reset
+ */
+static int
+shm_modify_qp( struct ibv_qp *qp, struct ibv_qp_attr *attr,
+               int attr_mask )
+{
+    shm_qp_t *q = CONTAINER(qp, shm_qp_t);
+    shm_qp_info_t *info = q->info;
+    enum ibv_qp_state cur = qp->state, state = qp->state;
+
+    if (attr_mask & IBV_QP_STATE) {
+        state = attr->qp_state;
+    }
+    if ( ( (IBV_QPS_INIT == state) && (IBV_QPS_RESET != cur) &&
+           (IBV_QPS_INIT != cur) ) ||
+        ( (IBV_QPS_RTR == state) && (IBV_QPS_INIT != cur) ) ||
+        ( (IBV_QPS_RTS == state) && (IBV_QPS_RTR != cur) &&
+          (IBV_QPS_RTS != cur) ) ||
+        (IBV_QPS_SQD == state) || (IBV_QPS_SQE == state) )
+    {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&shm_lock);
+    switch (state) {
+        case IBV_QPS_RESET:
+            info->state = IBV_QPS_RESET;
+            __sync_synchronize();
+            /* The queued WRs are dropped */
+            while (q->sq_head != q->sq_tail) {
+                free(q->sq[q->sq_head & q->sq_mask].data);
+                q->sq_head++;
+                q->c->pending--;
+            }
+            q->sq_exec = q->sq_tail;
+            q->rq_head = q->rq_tail;
+            info->dest_qpn = 0;
+            info->dlid = 0;
+            info->rq_psn = 0;
+            q->sq_psn = 0;
+            break;
+        case IBV_QPS_ERR:
+            info->state = IBV_QPS_ERR;
+            __sync_synchronize();
+            qp->state = IBV_QPS_ERR;
+            qp_flush(q);
+            break;
+        default:
+            if (attr_mask & IBV_QP_ACCESS_FLAGS) {
+                info->access = attr->qp_access_flags;
+            }
+            if (attr_mask & IBV_QP_DEST_QPN) {
+                info->dest_qpn = attr->dest_qp_num;
+            }
+            if (attr_mask & IBV_QP_AV) {
+                info->dlid = attr->ah_attr.dlid;
+            }
+            if (attr_mask & IBV_QP_RQ_PSN) {
+                info->rq_psn = attr->rq_psn & SHM_PSN_MASK;
+            }
+            if (attr_mask & IBV_QP_SQ_PSN) {
+                q->sq_psn = attr->sq_psn & SHM_PSN_MASK;
+            }
+            __sync_synchronize();
+            info->state = state;
+    }
+    qp->state = state;
+    pthread_mutex_unlock(&shm_lock);
+
+    return 0;
+}
+
+static int
+shm_query_qp( struct ibv_qp *qp, struct ibv_qp_attr *attr,
+              int attr_mask, struct ibv_qp_init_attr *init_attr )
+{
+    shm_qp_t *q = CONTAINER(qp, shm_qp_t);
+
+    memset(attr, 0, sizeof(struct ibv_qp_attr));
+    pthread_mutex_lock(&shm_lock);
+    attr->qp_state = qp->state;
+    attr->cur_qp_state = qp->state;
+    attr->path_mtu = IBV_MTU_4096;
+    attr->qp_access_flags = q->info->access;
+    attr->rq_psn = q->info->rq_psn;
+    attr->sq_psn = q->sq_psn;
+    attr->dest_qp_num = q->info->dest_qpn;
+    attr->ah_attr.dlid = q->info->dlid;
+    attr->ah_attr.port_num = 1;
+    attr->port_num = 1;
+    attr->max_rd_atomic = 16;
+    attr->max_dest_rd_atomic = 16;
+    attr->cap = q->cap;
+    pthread_mutex_unlock(&shm_lock);
+    if (NULL != init_attr) {
+        memset(init_attr, 0, sizeof(struct ibv_qp_init_attr));
+        init_attr->qp_context = qp->qp_context;
+        init_attr->send_cq = qp->send_cq;
+        init_attr->recv_cq = qp->recv_cq;
+        init_attr->cap = q->cap;
+        init_attr->qp_type = qp->qp_type;
+        init_attr->sq_sig_all = q->sq_sig_all;
+    }
+    return 0;
+}
+
+static int
+shm_destroy_qp( struct ibv_qp *qp )
+{
+    int i;
+    shm_qp_t *q = CONTAINER(qp, shm_qp_t);
+    shm_ctx_t *c = q->c;
+
+    pthread_mutex_lock(&shm_lock);
+    for (i = 0; i < SHM_MAX_MCAST; i++) {
+        if (c->port->mcast[i].qpn == qp->qp_num) {
+            c->port->mcast[i].qpn = 0;
+        }
+    }
+    q->info->state = IBV_QPS_RESET;
+    __sync_synchronize();
+    q->info->qpn = 0;
+    while (q->sq_head != q->sq_tail) {
+        free(q->sq[q->sq_head & q->sq_mask].data);
+        q->sq_head++;
+        c->pending--;
+    }
+    c->qps[q->slot] = NULL;
+    pthread_mutex_unlock(&shm_lock);
+
+    free(q->sq);
+    free(q->rq);
+    free(q);
+    return 0;
+}
+
+/**
+ * Queue send WRs; without injected latency, they are executed
+ * right away
+ */
+static int
+shm_post_send( struct ibv_qp *qp, struct ibv_send_wr *wr,
+               struct ibv_send_wr **bad_wr )
+{
+    int i, rc = 0;
+    uint32_t off;
+    uint64_t now = 0;
+    shm_op_t *op;
+    shm_qp_t *q = CONTAINER(qp, shm_qp_t);
+
+    if ( (IBV_QPS_RTS != qp->state) && (IBV_QPS_ERR != qp->state) ) {
+        *bad_wr = wr;
+        return EINVAL;
+    }
+    pthread_mutex_lock(&shm_lock);
+    if (latency_ns) {
+        now = now_ns();
+    }
+    for (; NULL != wr; wr = wr->next) {
+        if ( (q->sq_tail - q->sq_head > q->sq_mask) ||
+            (q->sq_tail - q->sq_head >= q->cap.max_send_wr) )
+        {
+            rc = ENOMEM;
+            break;
+        }
+        if ( (wr->num_sge > SHM_MAX_SGE) || (wr->num_sge < 0) ) {
+            rc = EINVAL;
+            break;
+        }
+        op = &q->sq[q->sq_tail & q->sq_mask];
+        memset(op, 0, sizeof(shm_op_t));
+        op->wr_id = wr->wr_id;
+        op->opcode = wr->opcode;
+        op->signaled = q->sq_sig_all || (wr->send_flags & IBV_SEND_SIGNALED);
+        op->num_sge = wr->num_sge;
+        for (i = 0; i < wr->num_sge; i++) {
+            op->sge[i] = wr->sg_list[i];
+            op->len += wr->sg_list[i].length;
+        }
+        if (wr->send_flags & IBV_SEND_INLINE) {
+            if (op->len > q->cap.max_inline_data) {
+                rc = EINVAL;
+                break;
+            }
+            if (latency_ns && (IBV_QPT_RC == qp->qp_type)) {
+                /* The buffers may be reused once posted */
+                op->data = (char*)malloc(op->len ? op->len : 1);
+                if (NULL == op->data) {
+                    rc = ENOMEM;
+                    break;
+                }
+                for (i = 0, off = 0; i < op->num_sge; i++) {
+                    memcpy(op->data + off, (void*)op->sge[i].addr,
+                           op->sge[i].length);
+                    off += op->sge[i].length;
+                }
+            }
+        }
+        if (IBV_QPT_UD == qp->qp_type) {
+            op->ah = CONTAINER(wr->wr.ud.ah, shm_ah_t);
+            op->remote_qpn = wr->wr.ud.remote_qpn;
+        }
+        else if ( (IBV_WR_ATOMIC_CMP_AND_SWP == wr->opcode) ||
+                  (IBV_WR_ATOMIC_FETCH_AND_ADD == wr->opcode) )
+        {
+            op->raddr = wr->wr.atomic.remote_addr;
+            op->rkey = wr->wr.atomic.rkey;
+            op->compare_add = wr->wr.atomic.compare_add;
+            op->swap = wr->wr.atomic.swap;
+        }
+        else {
+            op->raddr = wr->wr.rdma.remote_addr;
+            op->rkey = wr->wr.rdma.rkey;
+        }
+        if ( (IBV_QPS_RTS == qp->state) && (IBV_QPT_RC == qp->qp_type) ) {
+            op->due = now + latency_ns;
+        }
+        q->sq_tail++;
+        q->c->pending++;
+    }
+    qp_progress(q, now);
+    pthread_mutex_unlock(&shm_lock);
+
+    if (0 != rc) {
+        *bad_wr = wr;
+    }
+    return rc;
+}
+
+static int
+shm_post_recv( struct ibv_qp *qp, struct ibv_recv_wr *wr,
+               struct ibv_recv_wr **bad_wr )
+{
+    int rc = 0;
+    shm_recv_t *r;
+    shm_qp_t *q = CONTAINER(qp, shm_qp_t);
+
+    pthread_mutex_lock(&shm_lock);
+    for (; NULL != wr; wr = wr->next) {
+        if ( (q->rq_tail - q->rq_head > q->rq_mask) || (1 != wr->num_sge) ) {
+            rc = (1 != wr->num_sge) ? EINVAL : ENOMEM;
+            break;
+        }
+        r = &q->rq[q->rq_tail & q->rq_mask];
+        r->wr_id = wr->wr_id;
+        r->addr = wr->sg_list[0].addr;
+        r->length = wr->sg_list[0].length;
+        r->lkey = wr->sg_list[0].lkey;
+        q->rq_tail++;
+    }
+    pthread_mutex_unlock(&shm_lock);
+
+    if (0 != rc) {
+        *bad_wr = wr;
+    }
+    return rc;
+}
+
+#endif
+
+/* ================================================================== */
+/* UD: address handles and multicast */
+#if 1
+
+static struct ibv_ah*
+shm_create_ah( struct ibv_pd *pd, struct ibv_ah_attr *attr )
+{
+    shm_ah_t *ah = (shm_ah_t*)malloc(sizeof(shm_ah_t));
+    if (NULL == ah) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(ah, 0, sizeof(shm_ah_t));
+    ah->ah.context = pd->context;
+    ah->ah.pd = pd;
+    ah->dlid = attr->dlid;
+    ah->dgid = attr->grh.dgid;
+    return &ah->ah;
+}
+
+static int
+shm_destroy_ah( struct ibv_ah *ah )
+{
+    free(ah);
+    return 0;
+}
+
+static int
+shm_attach_mcast( struct ibv_qp *qp, const union ibv_gid *gid,
+                  uint16_t lid )
+{
+    int i, rc = ENOMEM;
+    shm_qp_t *q = CONTAINER(qp, shm_qp_t);
+    shm_mcast_t *m;
+
+    pthread_mutex_lock(&shm_lock);
+    for (i = 0; i < SHM_MAX_MCAST; i++) {
+        m = &q->c->port->mcast[i];
+        if (0 != m->qpn) continue;
+        memcpy(m->mgid, gid->raw, 16);
+        m->mlid = lid;
+        __sync_synchronize();
+        m->qpn = qp->qp_num;
+        rc = 0;
+        break;
+    }
+    pthread_mutex_unlock(&shm_lock);
+    return rc;
+}
+
+static int
+shm_detach_mcast( struct ibv_qp *qp, const union ibv_gid *gid,
+                  uint16_t lid )
+{
+    int i, rc = EINVAL;
+    shm_qp_t *q = CONTAINER(qp, shm_qp_t);
+    shm_mcast_t *m;
+
+    pthread_mutex_lock(&shm_lock);
+    for (i = 0; i < SHM_MAX_MCAST; i++) {
+        m = &q->c->port->mcast[i];
+        if ( (m->qpn == qp->qp_num) && (0 == memcmp(m->mgid, gid->raw, 16)) ) {
+            m->qpn = 0;
+            rc = 0;
+        }
+    }
+    pthread_mutex_unlock(&shm_lock);
+    return rc;
+}
+
+#endif
+
+const dare_tp_ops_t dare_tp_shm_ops = {
+    .name                   = "shm",
+    .get_device_list        = shm_get_device_list,
+    .free_device_list       = shm_free_device_list,
+    .get_device_name        = shm_get_device_name,
+    .open_device            = shm_open_device,
+    .close_device           = shm_close_device,
+    .query_device           = shm_query_device,
+    .query_device_ex        = shm_query_device_ex,
+    .query_port             = shm_query_port,
+    .query_gid              = shm_query_gid,
+    .query_pkey             = shm_query_pkey,
+    .alloc_pd               = shm_alloc_pd,
+    .dealloc_pd             = shm_dealloc_pd,
+    .reg_mr                 = shm_reg_mr,
+    .dereg_mr               = shm_dereg_mr,
+    .alloc_buf              = shm_alloc_buf,
+    .free_buf               = shm_free_buf,
+    .create_comp_channel    = shm_create_comp_channel,
+    .destroy_comp_channel   = shm_destroy_comp_channel,
+    .create_cq              = shm_create_cq,
+    .destroy_cq             = shm_destroy_cq,
+    .req_notify_cq          = shm_req_notify_cq,
+    .get_cq_event           = shm_get_cq_event,
+    .ack_cq_events          = shm_ack_cq_events,
+    .poll_cq                = shm_poll_cq,
+    .create_qp              = shm_create_qp,
+    .modify_qp              = shm_modify_qp,
+    .query_qp               = shm_query_qp,
+    .destroy_qp             = shm_destroy_qp,
+    .post_send              = shm_post_send,
+    .post_recv              = shm_post_recv,
+    .create_ah              = shm_create_ah,
+    .destroy_ah             = shm_destroy_ah,
+    .attach_mcast           = shm_attach_mcast,
+    .detach_mcast           = shm_detach_mcast,
+};
+
+/* ================================================================== */
+/* Progress (called with the lock held) */
+#if 1
+
+static void
+progress( shm_ctx_t *c )
+{
+    int i;
+    uint64_t now = latency_ns ? now_ns() : 0;
+
+    if (c->pending) {
+        for (i = 0; i < SHM_MAX_QPS; i++) {
+            if ( (NULL != c->qps[i]) &&
+                (c->qps[i]->sq_head != c->qps[i]->sq_tail) )
+            {
+                qp_progress(c->qps[i], now);
+            }
+        }
+    }
+    mbox_progress(c, now);
+}
+
+/**
+ * Execute the due WRs of a QP and complete the executed ones, in
+ * order; after an error, the QP is in ERR and the other WRs are
+ * flushed
+ */
+static void
+qp_progress( shm_qp_t *q, uint64_t now )
+{
+    shm_op_t *op;
+    struct ibv_wc wc;
+
+    /* Execute: an operation does not wait for the previous ones
+    to complete, as the requests are pipelined */
+    while (q->sq_exec != q->sq_tail) {
+        op = &q->sq[q->sq_exec & q->sq_mask];
+        if (op->due > now) break;
+        if (IBV_QPS_ERR == q->qp.state) {
+            op->status = IBV_WC_WR_FLUSH_ERR;
+        }
+        else if (IBV_QPT_RC == q->qp.qp_type) {
+            op->status = rc_execute(q, op);
+            op->done = now + latency_ns;
+        }
+        else {
+            op->status = ud_execute(q, op);
+        }
+        free(op->data);
+        op->data = NULL;
+        if ( (IBV_WC_SUCCESS != op->status) &&
+            (IBV_WC_WR_FLUSH_ERR != op->status) )
+        {
+            q->info->state = IBV_QPS_ERR;
+            q->qp.state = IBV_QPS_ERR;
+            op->done = now;
+        }
+        q->sq_exec++;
+    }
+
+    /* Complete, in order */
+    while (q->sq_head != q->sq_exec) {
+        op = &q->sq[q->sq_head & q->sq_mask];
+        if (op->done > now) break;
+        if (op->signaled || (IBV_WC_SUCCESS != op->status)) {
+            memset(&wc, 0, sizeof(wc));
+            wc.wr_id = op->wr_id;
+            wc.status = op->status;
+            wc.qp_num = q->qp.qp_num;
+            wc.byte_len = op->len;
+            switch (op->opcode) {
+                case IBV_WR_RDMA_WRITE:
+                case IBV_WR_RDMA_WRITE_WITH_IMM:
+                    wc.opcode = IBV_WC_RDMA_WRITE; break;
+                case IBV_WR_RDMA_READ:
+                    wc.opcode = IBV_WC_RDMA_READ; break;
+                case IBV_WR_ATOMIC_CMP_AND_SWP:
+                    wc.opcode = IBV_WC_COMP_SWAP; break;
+                case IBV_WR_ATOMIC_FETCH_AND_ADD:
+                    wc.opcode = IBV_WC_FETCH_ADD; break;
+                default:
+                    wc.opcode = IBV_WC_SEND;
+            }
+            if (0 != cq_push(q->c, CONTAINER(q->qp.send_cq, shm_cq_t), &wc)) {
+                /* CQ full: completed once there is room */
+                break;
+            }
+        }
+        q->sq_head++;
+        q->c->pending--;
+    }
+}
+
+/**
+ * Complete the posted receives with the due UD messages; a message
+ * without a posted receive is dropped, as on the fabric
+ */
+static void
+mbox_progress( shm_ctx_t *c, uint64_t now )
+{
+    shm_port_t *p = c->port;
+    shm_msg_t *m;
+    shm_qp_t *q;
+    shm_recv_t *r;
+    shm_cq_t *cq;
+    struct ibv_wc wc;
+    uint64_t pos;
+
+    while (1) {
+        pos = p->deq;
+        m = &p->mbox[pos % SHM_MBOX_SLOTS];
+        if (m->seq != pos + 1) break;
+        __sync_synchronize();
+        if (m->due > now) break;
+
+        q = c->qps[m->dest_qpn & 0xFF];
+        if ( (NULL != q) && (q->qp.qp_num == m->dest_qpn) &&
+            (IBV_QPT_UD == q->qp.qp_type) &&
+            ( (IBV_QPS_RTR == q->qp.state) ||
+              (IBV_QPS_RTS == q->qp.state) ) &&
+            (q->rq_head != q->rq_tail) )
+        {
+            cq = CONTAINER(q->qp.recv_cq, shm_cq_t);
+            if (cq->tail - cq->head > cq->mask) break;
+            r = &q->rq[q->rq_head & q->rq_mask];
+            memset(&wc, 0, sizeof(wc));
+            wc.wr_id = r->wr_id;
+            wc.opcode = IBV_WC_RECV;
+            wc.byte_len = m->len + SHM_GRH;
+            wc.qp_num = q->qp.qp_num;
+            wc.src_qp = m->src_qpn;
+            wc.slid = m->slid;
+            wc.wc_flags = IBV_WC_GRH;
+            wc.status = IBV_WC_SUCCESS;
+            if (m->len + SHM_GRH > r->length) {
+                wc.status = IBV_WC_LOC_LEN_ERR;
+            }
+            else {
+                struct ibv_sge sge = {r->addr, m->len + SHM_GRH, r->lkey};
+                if (!local_ok(c, &sge, 1)) {
+                    wc.status = IBV_WC_LOC_PROT_ERR;
+                }
+                else {
+                    memset((void*)r->addr, 0, SHM_GRH);
+                    memcpy((char*)r->addr + SHM_GRH, m->data, m->len);
+                }
+            }
+            q->rq_head++;
+            cq_push(c, cq, &wc);
+        }
+
+        /* The slot is read before it is released */
+        __sync_synchronize();
+        m->seq = pos + SHM_MBOX_SLOTS;
+        p->deq = pos + 1;
+    }
+}
+
+/**
+ * Flush the WRs of a QP in ERR
+ */
+static void
+qp_flush( shm_qp_t *q )
+{
+    uint64_t i;
+    struct ibv_wc wc;
+    shm_op_t *op;
+
+    for (i = q->sq_exec; i != q->sq_tail; i++) {
+        op = &q->sq[i & q->sq_mask];
+        op->done = 0;
+        op->status = IBV_WC_WR_FLUSH_ERR;
+        free(op->data);
+        op->data = NULL;
+    }
+    q->sq_exec = q->sq_tail;
+    while (q->rq_head != q->rq_tail) {
+        memset(&wc, 0, sizeof(wc));
+        wc.wr_id = q->rq[q->rq_head & q->rq_mask].wr_id;
+        wc.status = IBV_WC_WR_FLUSH_ERR;
+        wc.opcode = IBV_WC_RECV;
+        wc.qp_num = q->qp.qp_num;
+        if (0 != cq_push(q->c, CONTAINER(q->qp.recv_cq, shm_cq_t), &wc)) {
+            break;
+        }
+        q->rq_head++;
+    }
+}
+
+static int
+cq_push( shm_ctx_t *c, shm_cq_t *cq, struct ibv_wc *wc )
+{
+    if (cq->tail - cq->head > cq->mask) {
+        return 1;
+    }
+    cq->ring[cq->tail & cq->mask] = *wc;
+    cq->tail++;
+    if (cq->armed && (NULL != cq->cq.channel)) {
+        cq->armed = 0;
+        kick(c, c->lid);
+    }
+    return 0;
+}
+
+#endif
+
+/* ================================================================== */
+/* Operations (called with the lock held) */
+#if 1
+
+/**
+ * Execute an RC operation on the memory of the target
+ */
+static enum ibv_wc_status
+rc_execute( shm_qp_t *q, shm_op_t *op )
+{
+    int i;
+    uint32_t npkt, need, off;
+    uint16_t lid = q->info->dlid;
+    uint32_t dest_qpn = q->info->dest_qpn;
+    shm_ctx_t *c = q->c;
+    shm_qp_info_t *tq;
+    char *rmem;
+
+    /* The responder: alive, connected back and expecting the PSN;
+    otherwise, the requests are not answered and the retries run out */
+    if (!port_alive(c, lid)) {
+        return IBV_WC_RETRY_EXC_ERR;
+    }
+    tq = &c->fabric->ports[lid - 1].qps[dest_qpn & 0xFF];
+    if ( (tq->qpn != dest_qpn) ||
+        ( (IBV_QPS_RTR != tq->state) && (IBV_QPS_RTS != tq->state) ) ||
+        (tq->dlid != c->lid) || (tq->dest_qpn != q->qp.qp_num) ||
+        (tq->rq_psn != q->sq_psn) )
+    {
+        return IBV_WC_RETRY_EXC_ERR;
+    }
+    switch (op->opcode) {
+        case IBV_WR_RDMA_WRITE:
+            need = IBV_ACCESS_REMOTE_WRITE; break;
+        case IBV_WR_RDMA_READ:
+            need = IBV_ACCESS_REMOTE_READ; break;
+        case IBV_WR_ATOMIC_CMP_AND_SWP:
+        case IBV_WR_ATOMIC_FETCH_AND_ADD:
+            if ( (op->len != sizeof(uint64_t)) || (op->raddr & 7) ) {
+                return IBV_WC_REM_INV_REQ_ERR;
+            }
+            need = IBV_ACCESS_REMOTE_ATOMIC; break;
+        default:
+            return IBV_WC_REM_INV_REQ_ERR;
+    }
+    if (!(tq->access & need)) {
+        return IBV_WC_REM_ACCESS_ERR;
+    }
+    for (i = 0; i < op->num_sge; i++) {
+        if (!local_ok(c, &op->sge[i], IBV_WR_RDMA_WRITE != op->opcode)) {
+            return IBV_WC_LOC_PROT_ERR;
+        }
+    }
+    rmem = remote_ptr(q, lid, op->rkey, op->raddr, op->len, need);
+    if (NULL == rmem) {
+        return IBV_WC_REM_ACCESS_ERR;
+    }
+
+    switch (op->opcode) {
+        case IBV_WR_RDMA_WRITE:
+            if (NULL != op->data) {
+                memcpy(rmem, op->data, op->len);
+                break;
+            }
+            for (i = 0, off = 0; i < op->num_sge; i++) {
+                memcpy(rmem + off, (void*)op->sge[i].addr, op->sge[i].length);
+                off += op->sge[i].length;
+            }
+            break;
+        case IBV_WR_RDMA_READ:
+            for (i = 0, off = 0; i < op->num_sge; i++) {
+                memcpy((void*)op->sge[i].addr, rmem + off, op->sge[i].length);
+                off += op->sge[i].length;
+            }
+            break;
+        case IBV_WR_ATOMIC_CMP_AND_SWP:
+            *(uint64_t*)op->sge[0].addr = __sync_val_compare_and_swap(
+                    (uint64_t*)rmem, op->compare_add, op->swap);
+            break;
+        default:
+            *(uint64_t*)op->sge[0].addr = __sync_fetch_and_add(
+                    (uint64_t*)rmem, op->compare_add);
+    }
+    /* Visible before the next WR (memcpy may use non-temporal stores) */
+    __sync_synchronize();
+
+    npkt = op->len ? (op->len + SHM_MTU - 1) / SHM_MTU : 1;
+    tq->rq_psn = (tq->rq_psn + npkt) & SHM_PSN_MASK;
+    q->sq_psn = (q->sq_psn + npkt) & SHM_PSN_MASK;
+
+    return IBV_WC_SUCCESS;
+}
+
+/**
+ * Send a UD message to a port, or to all the QPs attached to the
+ * multicast group (the sender included, as on the fabric)
+ */
+static enum ibv_wc_status
+ud_execute( shm_qp_t *q, shm_op_t *op )
+{
+    int i;
+    uint16_t lid, last;
+    uint32_t off, qpn;
+    uint64_t due = latency_ns ? now_ns() + latency_ns : 0;
+    shm_ctx_t *c = q->c;
+    shm_ah_t *ah = op->ah;
+    shm_port_t *p;
+    char buf[SHM_MTU];
+
+    if (IBV_WR_SEND != op->opcode) {
+        return IBV_WC_LOC_QP_OP_ERR;
+    }
+    if (op->len > SHM_MTU) {
+        return IBV_WC_LOC_LEN_ERR;
+    }
+    for (i = 0, off = 0; i < op->num_sge; i++) {
+        memcpy(buf + off, (void*)op->sge[i].addr, op->sge[i].length);
+        off += op->sge[i].length;
+    }
+
+    if (ah->dlid < SHM_MCAST_LID) {
+        mbox_put(c, ah->dlid, q->qp.qp_num, op->remote_qpn, buf, op->len, due);
+        return IBV_WC_SUCCESS;
+    }
+    last = c->fabric->next_lid;
+    for (lid = 1; (lid <= last) && (lid <= SHM_MAX_PORTS); lid++) {
+        if (!port_alive(c, lid)) continue;
+        p = &c->fabric->ports[lid - 1];
+        for (i = 0; i < SHM_MAX_MCAST; i++) {
+            qpn = p->mcast[i].qpn;
+            if ( (0 == qpn) ||
+                (0 != memcmp(p->mcast[i].mgid, ah->dgid.raw, 16)) )
+            {
+                continue;
+            }
+            mbox_put(c, lid, q->qp.qp_num, qpn, buf, op->len, due);
+        }
+    }
+    return IBV_WC_SUCCESS;
+}
+
+/**
+ * Put a message in the mailbox of a port; if the mailbox is full, the
+ * message is dropped
+ */
+static int
+mbox_put( shm_ctx_t *c, uint16_t lid, uint32_t src_qpn,
+          uint32_t dest_qpn, void *data, uint32_t len, uint64_t due )
+{
+    uint64_t pos;
+    int64_t diff;
+    shm_port_t *p;
+    shm_msg_t *m;
+
+    if (!port_alive(c, lid)) {
+        return 1;
+    }
+    p = &c->fabric->ports[lid - 1];
+    pos = p->enq;
+    while (1) {
+        m = &p->mbox[pos % SHM_MBOX_SLOTS];
+        diff = (int64_t)m->seq - (int64_t)pos;
+        if (0 == diff) {
+            if (__sync_bool_compare_and_swap(&p->enq, pos, pos + 1)) break;
+        }
+        else if (diff < 0) {
+            return 1;
+        }
+        pos = p->enq;
+    }
+    m->due = due;
+    m->src_qpn = src_qpn;
+    m->dest_qpn = dest_qpn;
+    m->len = len;
+    m->slid = c->lid;
+    memcpy(m->data, data, len);
+    __sync_synchronize();
+    m->seq = pos + 1;
+    __sync_synchronize();
+
+    if (p->armed && __sync_bool_compare_and_swap(&p->armed, 1, 0)) {
+        kick(c, lid);
+    }
+    return 0;
+}
+
+/**
+ * Check a local SGE against the MRs of the process
+ */
+static int
+local_ok( shm_ctx_t *c, struct ibv_sge *sge, int write )
+{
+    shm_mr_info_t *mi = &c->port->mrs[sge->lkey & 0xFF];
+
+    if ( (0 == sge->lkey) || (mi->rkey != sge->lkey) ) {
+        return 0;
+    }
+    if ( (sge->addr < mi->addr) ||
+        (sge->addr + sge->length > mi->addr + mi->len) )
+    {
+        return 0;
+    }
+    if (write && !(mi->access & IBV_ACCESS_LOCAL_WRITE)) {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Pointer to remote memory, [raddr, raddr + len) in the MR rkey of
+ * a peer; the MR is mapped from its file on first use
+ */
+static char*
+remote_ptr( shm_qp_t *q, uint16_t lid, uint32_t rkey,
+            uint64_t raddr, uint64_t len, uint32_t need )
+{
+    int i, fd, try;
+    uint32_t gen, access;
+    uint64_t addr, mlen, off, span;
+    char path[96];
+    void *base;
+    shm_ctx_t *c = q->c;
+    shm_port_t *p = &c->fabric->ports[lid - 1];
+    shm_mr_info_t *mi = &p->mrs[rkey & 0xFF];
+    shm_map_t *map;
+    int32_t pid = p->pid;
+
+    /* Consistent copy of the MR (updated only while registering) */
+    for (try = 0; try < 3; try++) {
+        gen = mi->gen;
+        __sync_synchronize();
+        if ( (0 == rkey) || (mi->rkey != rkey) ) {
+            return NULL;
+        }
+        if (gen & 1) continue;
+        access = mi->access;
+        addr = mi->addr;
+        mlen = mi->len;
+        off = mi->off;
+        memcpy(path, mi->path, sizeof(path));
+        path[sizeof(path) - 1] = '\0';
+        __sync_synchronize();
+        if ( (mi->rkey == rkey) && (mi->gen == gen) ) break;
+    }
+    if ( (3 == try) || !(access & need) || ('\0' == path[0]) ||
+        (raddr < addr) || (raddr + len > addr + mlen) )
+    {
+        return NULL;
+    }
+
+    /* Mapped already? */
+    map = (q->last_map >= 0) ? &c->maps[q->last_map] : NULL;
+    if ( (NULL == map) || (map->lid != lid) || (map->pid != pid) ||
+        (map->rkey != rkey) || (map->gen != gen) || (NULL == map->base) )
+    {
+        map = NULL;
+        for (i = 0; i < SHM_MAX_MAPS; i++) {
+            if ( (c->maps[i].lid == lid) && (c->maps[i].pid == pid) &&
+                (c->maps[i].rkey == rkey) && (c->maps[i].gen == gen) &&
+                (NULL != c->maps[i].base) )
+            {
+                map = &c->maps[i];
+                break;
+            }
+        }
+    }
+    if (NULL == map) {
+        span = PAGE_UP(addr + mlen) - PAGE_DOWN(addr);
+        fd = open(path, O_RDWR);
+        if (fd < 0) {
+            return NULL;
+        }
+        base = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_SHARED, fd, off);
+        close(fd);
+        if (MAP_FAILED == base) {
+            return NULL;
+        }
+        i = c->map_next++ % SHM_MAX_MAPS;
+        map = &c->maps[i];
+        if (NULL != map->base) {
+            munmap(map->base, map->len);
+        }
+        map->pid = pid;
+        map->lid = lid;
+        map->rkey = rkey;
+        map->gen = gen;
+        map->base = (char*)base;
+        map->len = span;
+    }
+    q->last_map = map - c->maps;
+
+    return map->base + (raddr - PAGE_DOWN(addr));
+}
+
+#endif
+
+/* ================================================================== */
+/* Shared memory */
+#if 1
+
+/**
+ * Allocate a buffer that can be registered for remote access: a new 
+ * file in /dev/shm, mapped shared, so that the peers can map it too; 
+ * page aligned and zero filled (like the "ib" backend)
+ */
+static void*
+shm_alloc_buf( size_t length )
+{
+    int fd;
+    uint64_t len = PAGE_UP(length ? length : 1);
+    char path[96];
+    void *mem;
+
+    pthread_mutex_lock(&shm_lock);
+    if (seg_count == SHM_MAX_SEGS) {
+        pthread_mutex_unlock(&shm_lock);
+        error(log_fp, "Too many shared buffers\n");
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "/dev/shm/%s_%d_%"PRIu32,
+             fabric_name, (int)getpid(), seg_id++);
+    unlink(path);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        pthread_mutex_unlock(&shm_lock);
+        error(log_fp, "Cannot create %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (0 != ftruncate(fd, len)) {
+        close(fd);
+        unlink(path);
+        pthread_mutex_unlock(&shm_lock);
+        error(log_fp, "Cannot resize %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+               MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == mem) {
+        unlink(path);
+        pthread_mutex_unlock(&shm_lock);
+        error(log_fp, "Cannot map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    segs[seg_count].start = (uint64_t)mem;
+    segs[seg_count].end = (uint64_t)mem + len;
+    snprintf(segs[seg_count].path, sizeof(segs[0].path), "%s", path);
+    seg_count++;
+    pthread_mutex_unlock(&shm_lock);
+
+    return mem;
+}
+
+/**
+ * Free a buffer from alloc_buf; it must not be registered anymore
+ */
+static void
+shm_free_buf( void *addr, size_t length )
+{
+    uint32_t i;
+
+    if (NULL == addr) return;
+    pthread_mutex_lock(&shm_lock);
+    for (i = 0; i < seg_count; i++) {
+        if (segs[i].start == (uint64_t)addr) break;
+    }
+    if (i == seg_count) {
+        pthread_mutex_unlock(&shm_lock);
+        error(log_fp, "%p is not a shared buffer\n", addr);
+        return;
+    }
+    munmap(addr, segs[i].end - segs[i].start);
+    unlink(segs[i].path);
+    segs[i] = segs[--seg_count];
+    pthread_mutex_unlock(&shm_lock);
+}
+
+/**
+ * Find the buffer from alloc_buf that holds [addr, addr + len); 
+ * called with the lock held
+ * @return 0 if found (the file and the offset of the first page)
+ */
+static int
+seg_lookup( uint64_t addr, uint64_t len, char *path, uint64_t *off )
+{
+    uint32_t i;
+    uint64_t a0 = PAGE_DOWN(addr), a1 = addr + (len ? len : 1);
+
+    for (i = 0; i < seg_count; i++) {
+        if ( (segs[i].start <= a0) && (segs[i].end >= a1) ) {
+            snprintf(path, 96, "%s", segs[i].path);
+            *off = a0 - segs[i].start;
+            return 0;
+        }
+    }
+    error_return(1, log_fp, "[%"PRIx64", %"PRIx64") is not from alloc_buf; "
+                 "cannot register it for remote access\n", addr, a1);
+}
+
+#endif
+
+/* ================================================================== */
+/* Peers */
+#if 1
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/**
+ * Check whether the process of a port is alive (at most every
+ * SHM_ALIVE_CHECK); a killed server stops answering, as a crashed host
+ */
+static int
+port_alive( shm_ctx_t *c, uint16_t lid )
+{
+    int32_t pid;
+    uint64_t now;
+
+    if ( (0 == lid) || (lid > SHM_MAX_PORTS) ) {
+        return 0;
+    }
+    pid = c->fabric->ports[lid - 1].pid;
+    if (pid <= 0) {
+        return 0;
+    }
+    if (lid == c->lid) {
+        return 1;
+    }
+    if (pid == c->peer_dead[lid]) {
+        return 0;
+    }
+    now = now_ns();
+    if (now - c->peer_check[lid] > SHM_ALIVE_CHECK) {
+        c->peer_check[lid] = now;
+        if ( (0 != kill(pid, 0)) && (ESRCH == errno) ) {
+            c->peer_dead[lid] = pid;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Raise an event on the completion channel of a port
+ */
+static void
+kick( shm_ctx_t *c, uint16_t lid )
+{
+    char path[128];
+    int32_t pid = c->fabric->ports[lid - 1].pid;
+
+    if (lid == c->lid) {
+        if (write(c->ev_fd, "", 1) < 0) {}
+        return;
+    }
+    if ( (c->peer_fd[lid] >= 0) && (c->peer_pid[lid] != pid) ) {
+        /* Reopened port */
+        close(c->peer_fd[lid]);
+        c->peer_fd[lid] = -1;
+    }
+    if (c->peer_fd[lid] < 0) {
+        snprintf(path, sizeof(path), "/dev/shm/%s_%"PRIu16".ev",
+                 fabric_name, lid);
+        c->peer_fd[lid] = open(path, O_WRONLY | O_NONBLOCK);
+        c->peer_pid[lid] = pid;
+        if (c->peer_fd[lid] < 0) return;
+    }
+    /* A full pipe has events already */
+    if (write(c->peer_fd[lid], "", 1) < 0) {}
+}
+
+#endif
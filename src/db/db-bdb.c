@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <db.h>
+#include "../include/db/db-backend.h"
+#include "../include/util/debug.h"
+
+/* BerkeleyDB backend: the records are appended to a DB_RECNO database
+as [data][idx][crc]; a DB_BTREE maps the log idx (big-endian) to the
+record number. The position of a record (see walk) is its record
+number minus one */
+
+#define RECORD_TRAILER_SIZE (sizeof(uint64_t) + sizeof(uint32_t))
+#define RECORD_STACK_SIZE 4096
+
+struct bdb_t{
+    DB* bdb_ptr;
+    DB* idx_ptr;
+};
+typedef struct bdb_t bdb;
+
+static void idx_to_key(uint64_t idx,unsigned char* key_buf){
+    int i;
+    /* Big-endian, so that the B-tree order is the log order */
+    for(i=7;i>=0;i--){
+        key_buf[i] = (unsigned char)(idx & 0xFF);
+        idx >>= 8;
+    }
+}
+
+static uint64_t key_to_idx(const unsigned char* key_buf){
+    int i;
+    uint64_t idx = 0;
+    for(i=0;i<8;i++){
+        idx = (idx << 8) | key_buf[i];
+    }
+    return idx;
+}
+
+static int bdb_open_idx(db* db_p,const char* db_name,uint32_t flag){
+    bdb* b = db_p->priv;
+    DB* i_db;
+    DBC* dbcp;
+    DBT key,data;
+    char idx_name[256];
+    int ret;
+
+    if((ret = db_create(&i_db,NULL,flag))!=0){
+        return ret;
+    }
+    b->idx_ptr = i_db;
+    snprintf(idx_name,sizeof(idx_name),"%s.idx",db_name);
+    if((ret = i_db->open(i_db,NULL,idx_name,NULL,DB_BTREE,DB_THREAD|DB_CREATE,0))!=0){
+        return ret;
+    }
+
+    /* Recover the highest indexed idx */
+    if((ret = i_db->cursor(i_db,NULL,&dbcp,0))!=0){
+        return ret;
+    }
+    memset(&key,0,sizeof(key));
+    memset(&data,0,sizeof(data));
+    key.flags = DB_DBT_MALLOC;
+    data.flags = DB_DBT_MALLOC;
+    if((ret = dbcp->c_get(dbcp,&key,&data,DB_LAST))==0){
+        db_p->last_idx = key_to_idx(key.data);
+        free(key.data);
+        free(data.data);
+    }
+    dbcp->c_close(dbcp);
+    return (ret==DB_NOTFOUND)?0:ret;
+}
+
+/* Recover the counters of an existing database */
+static int bdb_count(uint64_t idx,const void* data,uint32_t size,uint32_t crc,void* arg){
+    db* db_p = arg;
+    db_p->record_count++;
+    db_p->records_len += size;
+    return 0;
+}
+
+static int bdb_walk(db* db_p,uint64_t* pos,db_record_cb cb,void* arg);
+static void bdb_close(db* db_p,uint32_t mode);
+
+static int bdb_open(db* db_p,const char* db_name,uint32_t flag){
+    bdb* b;
+    DB* b_db;
+    int ret;
+
+    b = malloc(sizeof(bdb));
+    if(NULL==b){
+        return 1;
+    }
+    memset(b,0,sizeof(bdb));
+    db_p->priv = b;
+
+    /* Initialize the DB handle */
+    if((ret = db_create(&b_db,NULL,flag))!=0){
+        err_log("DB : %s.\n",db_strerror(ret));
+        goto bdb_open_error;
+    }
+    b->bdb_ptr = b_db;
+    if((ret = b_db->set_pagesize(b_db,db_p->cfg.page_size))!=0){
+        goto bdb_open_error;
+    }
+    if((ret = b_db->set_cachesize(b_db, 0, db_p->cfg.cache_size, 1))!=0){
+        goto bdb_open_error;
+    }
+    if((ret = b_db->open(b_db,NULL,db_name,NULL,DB_RECNO,DB_THREAD|DB_CREATE,0))!=0){
+        goto bdb_open_error;
+    }
+
+    /* Index the records by log idx, so that they can be served
+    to lagging replicas */
+    if((ret = bdb_open_idx(db_p,db_name,flag))!=0){
+        err_log("DB : cannot open index: %s.\n",db_strerror(ret));
+        goto bdb_open_error;
+    }
+    uint64_t pos = 0;
+    bdb_walk(db_p,&pos,bdb_count,db_p);
+    return 0;
+
+bdb_open_error:
+    bdb_close(db_p,0);
+    return 1;
+}
+
+static void bdb_close(db* db_p,uint32_t mode){
+    bdb* b = db_p->priv;
+    if(NULL==b){
+        return;
+    }
+    if(b->idx_ptr!=NULL){
+        b->idx_ptr->close(b->idx_ptr,mode);
+        b->idx_ptr=NULL;
+    }
+    if(b->bdb_ptr!=NULL){
+        b->bdb_ptr->close(b->bdb_ptr,mode);
+        b->bdb_ptr=NULL;
+    }
+    free(b);
+    db_p->priv = NULL;
+}
+
+static int bdb_append(db* db_p,uint64_t idx,const void* data,uint32_t size,uint32_t crc){
+    bdb* b = db_p->priv;
+    DB* b_db = b->bdb_ptr;
+    DBT key,db_data;
+    db_recno_t recno;
+    char stack_buf[RECORD_STACK_SIZE];
+    char* rec_buf = stack_buf;
+    int ret;
+
+    if(size + RECORD_TRAILER_SIZE > RECORD_STACK_SIZE){
+        rec_buf = malloc(size + RECORD_TRAILER_SIZE);
+        if(NULL==rec_buf){
+            err_log("DB store_record : cannot allocate record.\n");
+            return 1;
+        }
+    }
+    memcpy(rec_buf,data,size);
+    memcpy(rec_buf+size,&idx,sizeof(uint64_t));
+    memcpy(rec_buf+size+sizeof(uint64_t),&crc,sizeof(uint32_t));
+    memset(&db_data,0,sizeof(db_data));
+    db_data.data = rec_buf;
+    db_data.size = size + RECORD_TRAILER_SIZE;
+
+    memset(&key,0,sizeof(key));
+    key.data = &recno;
+    key.ulen = sizeof(recno);
+    key.flags = DB_DBT_USERMEM;
+    if ((ret=b_db->put(b_db,NULL,&key,&db_data,DB_AUTO_COMMIT|DB_APPEND))==0){
+        //debug_log("db : %ld record stored. \n",*(uint64_t*)key_data);
+        if(db_p->cfg.sync){
+            b_db->sync(b_db,0);
+        }
+        if(0!=idx){
+            DBT idx_key,idx_data;
+            unsigned char key_buf[8];
+            idx_to_key(idx,key_buf);
+            memset(&idx_key,0,sizeof(idx_key));
+            memset(&idx_data,0,sizeof(idx_data));
+            idx_key.data = key_buf;
+            idx_key.size = sizeof(key_buf);
+            idx_data.data = &recno;
+            idx_data.size = sizeof(recno);
+            if((ret=b->idx_ptr->put(b->idx_ptr,NULL,&idx_key,&idx_data,0))!=0){
+                err_log("DB index : %s.\n",db_strerror(ret));
+            }
+        }
+    }
+    else{
+        err_log("DB : %s.\n",db_strerror(ret));
+        //debug_log("db : can not save record %ld from database.\n",*(uint64_t*)key_data);
+        //b_db->err(b_db,ret,"DB->Put");
+    }
+    if(rec_buf!=stack_buf){
+        free(rec_buf);
+    }
+    return ret;
+}
+
+/* The last record number (0 if empty) */
+static int bdb_last_recno(DB* b_db,db_recno_t* recno){
+    DBT key,db_data;
+    DBC *dbcp;
+    int ret;
+
+    *recno = 0;
+    if((ret = b_db->cursor(b_db,NULL,&dbcp,0))!=0){
+        b_db->err(b_db,ret,"DB->cursor");
+        return ret;
+    }
+    memset(&key,0,sizeof(key));
+    memset(&db_data,0,sizeof(db_data));
+    key.data = recno;
+    key.ulen = sizeof(*recno);
+    key.flags = DB_DBT_USERMEM;
+    db_data.flags = DB_DBT_PARTIAL;
+    ret = dbcp->c_get(dbcp,&key,&db_data,DB_LAST);
+    dbcp->c_close(dbcp);
+    if(ret==DB_NOTFOUND){
+        *recno = 0;
+        return 0;
+    }
+    if(ret!=0){
+        b_db->err(b_db,ret,"DBcursor->get");
+    }
+    return ret;
+}
+
+static int bdb_append_batch(db* db_p,uint32_t count,void** data,uint32_t* sizes,uint32_t* crcs,uint32_t* stored){
+    bdb* b = db_p->priv;
+    DB* b_db = b->bdb_ptr;
+    DBT key,db_data;
+    db_recno_t recno = 0,last;
+    uint32_t i,total = 0;
+    void *p,*bulk;
+    int ret;
+
+    /* The records are appended after the last record number */
+    *stored = 0;
+    if((ret = bdb_last_recno(b_db,&recno))!=0){
+        return ret;
+    }
+
+    /* Build the bulk buffer: the data plus a (recno,offset,size)
+    triple per record */
+    for(i=0;i<count;i++){
+        total += sizes[i];
+    }
+    memset(&key,0,sizeof(key));
+    key.ulen = total + count * RECORD_TRAILER_SIZE + (count + 1) * 4 * sizeof(uint32_t);
+    bulk = malloc(key.ulen);
+    if(NULL==bulk){
+        err_log("DB store_records : cannot allocate bulk buffer.\n");
+        return 1;
+    }
+    key.data = bulk;
+    key.flags = DB_DBT_USERMEM | DB_DBT_BULK;
+    DB_MULTIPLE_RECNO_WRITE_INIT(p,&key);
+    for(i=0;i<count;i++){
+        void* rec;
+        uint64_t no_idx = 0;
+        DB_MULTIPLE_RECNO_RESERVE_NEXT(p,&key,recno+i+1,rec,sizes[i]+RECORD_TRAILER_SIZE);
+        if(NULL==p){
+            err_log("DB store_records : bulk buffer too small.\n");
+            free(bulk);
+            return 1;
+        }
+        memcpy(rec,data[i],sizes[i]);
+        memcpy((char*)rec+sizes[i],&no_idx,sizeof(uint64_t));
+        memcpy((char*)rec+sizes[i]+sizeof(uint64_t),&crcs[i],sizeof(uint32_t));
+    }
+
+    /* One batch write for all the records */
+    memset(&db_data,0,sizeof(db_data));
+    if((ret=b_db->put(b_db,NULL,&key,&db_data,DB_MULTIPLE_KEY))==0){
+        if(db_p->cfg.sync){
+            b_db->sync(b_db,0);
+        }
+    }
+    else{
+        err_log("DB : %s.\n",db_strerror(ret));
+    }
+    free(bulk);
+    if(0==ret){
+        *stored = count;
+    }
+    else if(0==bdb_last_recno(b_db,&last) && last > recno){
+        /* Part of the batch was written; the record numbers are 
+        consecutive */
+        *stored = last - recno;
+    }
+    return ret;
+}
+
+static int bdb_walk(db* db_p,uint64_t* pos,db_record_cb cb,void* arg){
+    bdb* b = db_p->priv;
+    DB* b_db = b->bdb_ptr;
+    DBT key, data;
+    DBC *dbcp;
+    db_recno_t recno;
+    uint64_t idx;
+    uint32_t crc,size;
+    int ret;
+
+    /* Acquire a cursor for the database. */
+    if ((ret = b_db->cursor(b_db, NULL, &dbcp, 0)) != 0) {
+        b_db->err(b_db, ret, "DB->cursor");
+        return -1;
+    }
+
+    /* Position the cursor on the record at pos */
+    recno = (db_recno_t)(*pos + 1);
+    memset(&key, 0, sizeof(key));
+    memset(&data, 0, sizeof(data));
+    key.data = &recno;
+    key.size = key.ulen = sizeof(recno);
+    key.flags = DB_DBT_USERMEM;
+
+    /* Walk through the database */
+    ret = dbcp->c_get(dbcp, &key, &data, DB_SET);
+    while (ret == 0) {
+        size = data.size - RECORD_TRAILER_SIZE;
+        memcpy(&idx, (char*)data.data + size, sizeof(uint64_t));
+        memcpy(&crc, (char*)data.data + size + sizeof(uint64_t), sizeof(uint32_t));
+        if (cb(idx, data.data, size, crc, arg)) {
+            ret = DB_NOTFOUND;
+            break;
+        }
+        (*pos)++;
+        ret = dbcp->c_get(dbcp, &key, &data, DB_NEXT);
+    }
+    if (ret != DB_NOTFOUND)
+        b_db->err(b_db, ret, "DBcursor->get");
+
+    /* Close the cursor. */
+    if ((dbcp->c_close(dbcp)) != 0) {
+        b_db->err(b_db, 0, "DBcursor->close");
+    }
+    return (ret == DB_NOTFOUND) ? 0 : -1;
+}
+
+static int bdb_scan(db* db_p,uint64_t from_idx,db_record_cb cb,void* arg){
+    bdb* b = db_p->priv;
+    DB* i_db = b->idx_ptr;
+    DB* b_db = b->bdb_ptr;
+    DBT key,data,rec_key,rec_data;
+    DBC *dbcp;
+    unsigned char key_buf[8];
+    db_recno_t recno;
+    uint32_t crc,size;
+    int ret;
+
+    if ((ret = i_db->cursor(i_db, NULL, &dbcp, 0)) != 0) {
+        i_db->err(i_db, ret, "DB->cursor");
+        return -1;
+    }
+
+    idx_to_key(from_idx,key_buf);
+    memset(&key, 0, sizeof(key));
+    memset(&data, 0, sizeof(data));
+    memset(&rec_data, 0, sizeof(rec_data));
+    key.data = key_buf;
+    key.size = key.ulen = sizeof(key_buf);
+    key.flags = DB_DBT_USERMEM;
+    data.data = &recno;
+    data.ulen = sizeof(recno);
+    data.flags = DB_DBT_USERMEM;
+    rec_data.flags = DB_DBT_REALLOC;
+
+    /* Walk the index from the first idx >= from_idx */
+    ret = dbcp->c_get(dbcp, &key, &data, DB_SET_RANGE);
+    while (ret == 0) {
+        memset(&rec_key, 0, sizeof(rec_key));
+        rec_key.data = &recno;
+        rec_key.size = sizeof(recno);
+        if ((ret = b_db->get(b_db, NULL, &rec_key, &rec_data, 0)) != 0) {
+            break;
+        }
+        size = rec_data.size - RECORD_TRAILER_SIZE;
+        memcpy(&crc, (char*)rec_data.data + size + sizeof(uint64_t), sizeof(uint32_t));
+        if (cb(key_to_idx(key_buf), rec_data.data, size, crc, arg)) {
+            ret = DB_NOTFOUND;
+            break;
+        }
+        ret = dbcp->c_get(dbcp, &key, &data, DB_NEXT);
+    }
+    if (ret != DB_NOTFOUND) {
+        b_db->err(b_db, ret, "DBcursor->get");
+    }
+    if (NULL != rec_data.data) {
+        free(rec_data.data);
+    }
+
+    if (ret == DB_NOTFOUND) {
+        ret = 0;
+    }
+    if ((dbcp->c_close(dbcp)) != 0) {
+        i_db->err(i_db, 0, "DBcursor->close");
+    }
+    return (ret == 0) ? 0 : -1;
+}
+
+const db_ops db_bdb_ops = {
+    .name = "bdb",
+    .open = bdb_open,
+    .close = bdb_close,
+    .append = bdb_append,
+    .append_batch = bdb_append_batch,
+    .walk = bdb_walk,
+    .scan = bdb_scan,
+};
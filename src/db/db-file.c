@@ -0,0 +1,862 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include "../include/db/db-backend.h"
+#include "../include/util/debug.h"
+#include "../include/util/crc32c.h"
+#include "../include/util/lz.h"
+
+/* Append-file backend: the records are appended as [header][data] to
+segments <db_name>.<seq>.dat; once the active segment reaches the
+segment size, it is sealed and a new one is started. A background
+thread compresses the sealed segments into <db_name>.<seq>.lz, as
+blocks of whole records followed by a block index (see
+file_compress_segment). An in-memory index maps the log idx of the
+records in the uncompressed segments to their position and is rebuilt
+on open; for the compressed segments, the block index is enough.
+The position of a record (see walk) is its offset in the concatenation
+of the uncompressed segments */
+
+struct file_rec_hdr_t{
+    uint64_t idx;
+    uint32_t size;
+    uint32_t crc;
+};
+typedef struct file_rec_hdr_t file_rec_hdr;
+
+/* Records per writev (two buffers per record; IOV_MAX is 1024) */
+#define IOV_BATCH 512
+
+/* Compressed segment: [block]...[block][file_blk x count][file_lz_tail] */
+#define LZ_BLOCK_SIZE (64*1024)
+#define LZ_SEG_MAGIC 0x4c5a534547303031ULL
+
+struct file_blk_t{
+    uint64_t raw_off;   /* offset of the block in the segment */
+    uint64_t file_off;  /* offset of the block in the file */
+    uint32_t raw_len;
+    uint32_t zlen;      /* == raw_len if stored uncompressed */
+    uint64_t last_idx;  /* highest indexed idx; 0 if none */
+    uint64_t data_len;  /* length of the records (without headers) */
+    uint32_t count;     /* number of records */
+    uint32_t crc;       /* CRC32C of the stored block */
+};
+typedef struct file_blk_t file_blk;
+
+struct file_lz_tail_t{
+    uint64_t magic;
+    uint64_t raw_len;
+    uint64_t index_off;
+    uint32_t blk_count;
+    uint32_t crc;       /* CRC32C of the block index */
+};
+typedef struct file_lz_tail_t file_lz_tail;
+
+struct file_seg_t{
+    uint32_t seq;
+    int fd;
+    uint64_t start;     /* position of the first record */
+    uint64_t end;       /* position after the last record */
+    uint64_t last_idx;  /* highest indexed idx; 0 if none */
+    int sealed;
+    file_blk* blks;     /* block index; NULL if not compressed */
+    uint32_t blk_count;
+};
+typedef struct file_seg_t file_seg;
+
+struct file_db_t{
+    db* db_p;
+    char name[256];
+    file_seg* segs;     /* the last segment is the active one */
+    uint32_t seg_count;
+    uint32_t seg_cap;
+    /* index of the records with idx != 0 in the uncompressed segments */
+    uint64_t* idx;
+    uint64_t* off;
+    uint64_t count;
+    uint64_t cap;
+    /* last block read from a compressed segment */
+    uint8_t* blk_buf;
+    uint32_t blk_cap;
+    uint8_t* blk_zbuf;
+    uint32_t blk_zcap;
+    uint32_t blk_seq;
+    uint32_t blk_no;
+    int blk_valid;
+    /* compaction of the sealed segments (under db_p->lock) */
+    pthread_t compactor;
+    pthread_cond_t cond;        /* a segment was sealed */
+    pthread_cond_t done;        /* a segment was compressed */
+    int compactor_on;
+    int failed;
+    int stop;
+};
+typedef struct file_db_t file_db;
+
+#define ACTIVE(f) (&(f)->segs[(f)->seg_count-1])
+
+static int file_index_add(file_db* f,uint64_t idx,uint64_t off){
+    if(f->count == f->cap){
+        uint64_t cap = f->cap ? 2*f->cap : 4096;
+        uint64_t* new_idx = realloc(f->idx,cap*sizeof(uint64_t));
+        if(NULL==new_idx){
+            return 1;
+        }
+        f->idx = new_idx;
+        uint64_t* new_off = realloc(f->off,cap*sizeof(uint64_t));
+        if(NULL==new_off){
+            return 1;
+        }
+        f->off = new_off;
+        f->cap = cap;
+    }
+    f->idx[f->count] = idx;
+    f->off[f->count] = off;
+    f->count++;
+    return 0;
+}
+
+static void file_seg_path(file_db* f,uint32_t seq,const char* ext,char* path,size_t len){
+    snprintf(path,len,"%s.%"PRIu32".%s",f->name,seq,ext);
+}
+
+static file_seg* file_seg_add(file_db* f,uint32_t seq,uint64_t start){
+    file_seg* seg;
+    if(f->seg_count == f->seg_cap){
+        uint32_t cap = f->seg_cap ? 2*f->seg_cap : 16;
+        file_seg* new_segs = realloc(f->segs,cap*sizeof(file_seg));
+        if(NULL==new_segs){
+            return NULL;
+        }
+        f->segs = new_segs;
+        f->seg_cap = cap;
+    }
+    seg = &f->segs[f->seg_count++];
+    memset(seg,0,sizeof(file_seg));
+    seg->seq = seq;
+    seg->fd = -1;
+    seg->start = seg->end = start;
+    return seg;
+}
+
+/* Index of the first sealed segment that is not compressed */
+static uint32_t file_seg_pending(file_db* f){
+    uint32_t i;
+    for(i = 0; i < f->seg_count; i++){
+        if(f->segs[i].sealed && (NULL==f->segs[i].blks)) break;
+    }
+    return i;
+}
+
+/* Open an uncompressed segment and index its records */
+static int file_seg_open_raw(file_db* f,file_seg* seg){
+    db* db_p = f->db_p;
+    file_rec_hdr hdr;
+    char path[300];
+    off_t file_size;
+    uint64_t len = 0;
+
+    file_seg_path(f,seg->seq,"dat",path,sizeof(path));
+    seg->fd = open(path,O_RDWR|O_CREAT|O_APPEND,S_IRUSR|S_IWUSR|S_IRGRP);
+    if(seg->fd < 0){
+        err_log("DB : cannot open %s: %s.\n",path,strerror(errno));
+        return 1;
+    }
+    file_size = lseek(seg->fd,0,SEEK_END);
+    while(len + sizeof(file_rec_hdr) <= (uint64_t)file_size){
+        if(pread(seg->fd,&hdr,sizeof(file_rec_hdr),len) != sizeof(file_rec_hdr)){
+            break;
+        }
+        if(len + sizeof(file_rec_hdr) + hdr.size > (uint64_t)file_size){
+            /* Partially written record */
+            break;
+        }
+        if(hdr.idx){
+            if(file_index_add(f,hdr.idx,seg->start + len)){
+                return 1;
+            }
+            seg->last_idx = hdr.idx;
+            db_p->last_idx = hdr.idx;
+        }
+        db_p->record_count++;
+        db_p->records_len += hdr.size;
+        len += sizeof(file_rec_hdr) + hdr.size;
+    }
+    if(len != (uint64_t)file_size){
+        err_log("DB : dropping %"PRIu64" bytes after the last record of %s.\n",
+                (uint64_t)file_size - len,path);
+        if(ftruncate(seg->fd,len) != 0){
+            return 1;
+        }
+    }
+    seg->end = seg->start + len;
+    return 0;
+}
+
+/* Load the block index of a compressed segment */
+static int file_seg_load_lz(file_db* f,file_seg* seg,int fd){
+    db* db_p = f->db_p;
+    file_lz_tail tail;
+    off_t file_size;
+    uint32_t i;
+
+    file_size = lseek(fd,0,SEEK_END);
+    if((file_size < (off_t)sizeof(file_lz_tail)) ||
+        (pread(fd,&tail,sizeof(tail),file_size - sizeof(tail)) != sizeof(tail)) ||
+        (tail.magic != LZ_SEG_MAGIC) ||
+        (tail.index_off + tail.blk_count*sizeof(file_blk) + sizeof(tail) != (uint64_t)file_size))
+    {
+        err_log("DB : invalid compressed segment %"PRIu32".\n",seg->seq);
+        return 1;
+    }
+    seg->blks = malloc(tail.blk_count*sizeof(file_blk) + 1);
+    if(NULL==seg->blks){
+        return 1;
+    }
+    if((pread(fd,seg->blks,tail.blk_count*sizeof(file_blk),tail.index_off) !=
+            (ssize_t)(tail.blk_count*sizeof(file_blk))) ||
+        (tail.crc != crc32c(seg->blks,tail.blk_count*sizeof(file_blk))))
+    {
+        err_log("DB : corrupted block index in segment %"PRIu32".\n",seg->seq);
+        free(seg->blks);
+        seg->blks = NULL;
+        return 1;
+    }
+    seg->blk_count = tail.blk_count;
+    seg->fd = fd;
+    seg->end = seg->start + tail.raw_len;
+    seg->sealed = 1;
+    for(i = 0; i < seg->blk_count; i++){
+        if(seg->blks[i].last_idx){
+            seg->last_idx = seg->blks[i].last_idx;
+            db_p->last_idx = seg->blks[i].last_idx;
+        }
+        db_p->record_count += seg->blks[i].count;
+        db_p->records_len += seg->blks[i].data_len;
+    }
+    return 0;
+}
+
+static void file_close(db* db_p,uint32_t mode);
+static void* file_compactor(void* arg);
+
+static int file_open(db* db_p,const char* db_name,uint32_t flag){
+    file_db* f;
+    file_seg* seg;
+    char path[300],old_path[300];
+    uint32_t seq;
+    uint64_t end = 0;
+    int fd;
+
+    f = malloc(sizeof(file_db));
+    if(NULL==f){
+        return 1;
+    }
+    memset(f,0,sizeof(file_db));
+    f->db_p = db_p;
+    strncpy(f->name,db_name,sizeof(f->name)-1);
+    pthread_cond_init(&f->cond,NULL);
+    pthread_cond_init(&f->done,NULL);
+    db_p->priv = f;
+
+    /* A single <db_name>.dat becomes the first segment */
+    snprintf(old_path,sizeof(old_path),"%s.dat",db_name);
+    file_seg_path(f,0,"dat",path,sizeof(path));
+    if((0 == access(old_path,F_OK)) && (0 != access(path,F_OK))){
+        if(rename(old_path,path) != 0){
+            err_log("DB : cannot rename %s: %s.\n",old_path,strerror(errno));
+            goto file_open_error;
+        }
+    }
+
+    for(seq = 0; ; seq++){
+        file_seg_path(f,seq,"lz.tmp",path,sizeof(path));
+        unlink(path);
+        file_seg_path(f,seq,"lz",path,sizeof(path));
+        fd = open(path,O_RDONLY);
+        if(fd >= 0){
+            seg = file_seg_add(f,seq,end);
+            if((NULL==seg) || file_seg_load_lz(f,seg,fd)){
+                close(fd);
+                goto file_open_error;
+            }
+            /* Compressed, but not yet removed */
+            file_seg_path(f,seq,"dat",path,sizeof(path));
+            unlink(path);
+        }
+        else{
+            file_seg_path(f,seq,"dat",path,sizeof(path));
+            if(0 != access(path,F_OK)){
+                break;
+            }
+            seg = file_seg_add(f,seq,end);
+            if((NULL==seg) || file_seg_open_raw(f,seg)){
+                goto file_open_error;
+            }
+            seg->sealed = 1;
+        }
+        end = seg->end;
+    }
+    if((0 == f->seg_count) || (NULL != ACTIVE(f)->blks)){
+        /* Start a new active segment */
+        seg = file_seg_add(f,seq,end);
+        if((NULL==seg) || file_seg_open_raw(f,seg)){
+            goto file_open_error;
+        }
+    }
+    ACTIVE(f)->sealed = 0;
+
+    if(db_p->cfg.segment_size){
+        if(pthread_create(&f->compactor,NULL,file_compactor,f) != 0){
+            err_log("DB : cannot start the compaction thread.\n");
+            goto file_open_error;
+        }
+        f->compactor_on = 1;
+    }
+    return 0;
+
+file_open_error:
+    file_close(db_p,0);
+    return 1;
+}
+
+static void file_close(db* db_p,uint32_t mode){
+    file_db* f = db_p->priv;
+    uint32_t i;
+    if(NULL==f){
+        return;
+    }
+    if(f->compactor_on){
+        pthread_mutex_lock(&db_p->lock);
+        f->stop = 1;
+        pthread_cond_signal(&f->cond);
+        pthread_mutex_unlock(&db_p->lock);
+        pthread_join(f->compactor,NULL);
+    }
+    for(i = 0; i < f->seg_count; i++){
+        if(f->segs[i].fd >= 0){
+            close(f->segs[i].fd);
+        }
+        if(NULL!=f->segs[i].blks) free(f->segs[i].blks);
+    }
+    if(NULL!=f->segs) free(f->segs);
+    if(NULL!=f->idx) free(f->idx);
+    if(NULL!=f->off) free(f->off);
+    if(NULL!=f->blk_buf) free(f->blk_buf);
+    if(NULL!=f->blk_zbuf) free(f->blk_zbuf);
+    pthread_cond_destroy(&f->cond);
+    pthread_cond_destroy(&f->done);
+    free(f);
+    db_p->priv = NULL;
+}
+
+static int file_write(file_db* f,struct iovec* iov,int iovcnt,uint64_t len){
+    file_seg* seg = ACTIVE(f);
+    ssize_t n;
+    uint64_t written = 0;
+    while(written < len){
+        n = writev(seg->fd,iov,iovcnt);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            err_log("DB : cannot write record: %s.\n",strerror(errno));
+            /* Drop what was written */
+            if(ftruncate(seg->fd,seg->end - seg->start) != 0){
+                err_log("DB : cannot truncate: %s.\n",strerror(errno));
+            }
+            return 1;
+        }
+        written += n;
+        /* Skip what was written */
+        while(iovcnt > 0 && (size_t)n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* Seal the active segment once it is full; the compactor takes it */
+static void file_seal(file_db* f,int force){
+    db* db_p = f->db_p;
+    file_seg* seg = ACTIVE(f);
+    uint32_t seq = seg->seq;
+    uint64_t end = seg->end;
+
+    if(!db_p->cfg.segment_size || (seg->end == seg->start) ||
+        (!force && (seg->end - seg->start < db_p->cfg.segment_size))){
+        return;
+    }
+    fdatasync(seg->fd);
+    seg = file_seg_add(f,seq + 1,end);
+    if((NULL==seg) || file_seg_open_raw(f,seg)){
+        /* Keep appending to the current segment */
+        err_log("DB : cannot start segment %"PRIu32".\n",seq + 1);
+        if(NULL!=seg){
+            f->seg_count--;
+        }
+        return;
+    }
+    f->segs[f->seg_count-2].sealed = 1;
+    pthread_cond_signal(&f->cond);
+}
+
+static int file_append(db* db_p,uint64_t idx,const void* data,uint32_t size,uint32_t crc){
+    file_db* f = db_p->priv;
+    file_seg* seg = ACTIVE(f);
+    file_rec_hdr hdr;
+    struct iovec iov[2];
+
+    hdr.idx = idx;
+    hdr.size = size;
+    hdr.crc = crc;
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(file_rec_hdr);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = size;
+    if(file_write(f,iov,2,sizeof(file_rec_hdr) + size)){
+        return 1;
+    }
+    if(db_p->cfg.sync){
+        fdatasync(seg->fd);
+    }
+    if(idx){
+        if(file_index_add(f,idx,seg->end)){
+            err_log("DB : cannot index record %"PRIu64".\n",idx);
+        }
+        seg->last_idx = idx;
+    }
+    seg->end += sizeof(file_rec_hdr) + size;
+    file_seal(f,0);
+    return 0;
+}
+
+static int file_append_batch(db* db_p,uint32_t count,void** data,uint32_t* sizes,uint32_t* crcs,uint32_t* stored){
+    file_db* f = db_p->priv;
+    file_rec_hdr* hdrs;
+    struct iovec* iov;
+    uint64_t len = 0;
+    uint32_t i,first,batch;
+    int ret = 0;
+
+    *stored = 0;
+    hdrs = malloc(count*sizeof(file_rec_hdr));
+    iov = malloc(2*IOV_BATCH*sizeof(struct iovec));
+    if(NULL==hdrs || NULL==iov){
+        err_log("DB store_records : cannot allocate batch.\n");
+        ret = 1;
+        goto file_append_batch_exit;
+    }
+    /* A writev per IOV_BATCH records */
+    for(first = 0; first < count; first += batch){
+        batch = (count - first < IOV_BATCH) ? count - first : IOV_BATCH;
+        len = 0;
+        for(i = 0; i < batch; i++){
+            hdrs[first+i].idx = 0;
+            hdrs[first+i].size = sizes[first+i];
+            hdrs[first+i].crc = crcs[first+i];
+            iov[2*i].iov_base = &hdrs[first+i];
+            iov[2*i].iov_len = sizeof(file_rec_hdr);
+            iov[2*i+1].iov_base = data[first+i];
+            iov[2*i+1].iov_len = sizes[first+i];
+            len += sizeof(file_rec_hdr) + sizes[first+i];
+        }
+        if(file_write(f,iov,2*batch,len)){
+            ret = 1;
+            goto file_append_batch_exit;
+        }
+        ACTIVE(f)->end += len;
+        file_seal(f,0);
+        /* The chunk is in its segment; an error later leaves it there */
+        *stored = first + batch;
+    }
+    if(db_p->cfg.sync){
+        fdatasync(ACTIVE(f)->fd);
+    }
+
+file_append_batch_exit:
+    if(NULL!=hdrs) free(hdrs);
+    if(NULL!=iov) free(iov);
+    return ret;
+}
+
+/* Find the segment that holds the position pos */
+static file_seg* file_seg_find(file_db* f,uint64_t pos){
+    uint32_t lo = 0, hi = f->seg_count, mid;
+    while(hi - lo > 1){
+        mid = (lo + hi) / 2;
+        if(f->segs[mid].start <= pos) lo = mid;
+        else hi = mid;
+    }
+    return &f->segs[lo];
+}
+
+static int file_grow(uint8_t** buf,uint32_t* cap,uint32_t len){
+    if(len > *cap){
+        uint8_t* new_buf = realloc(*buf,len);
+        if(NULL==new_buf){
+            return 1;
+        }
+        *buf = new_buf;
+        *cap = len;
+    }
+    return 0;
+}
+
+/* Read and decompress the block of a compressed segment that holds
+the offset off; the last block read is kept */
+static file_blk* file_read_block(file_db* f,file_seg* seg,uint64_t off){
+    uint32_t lo = 0, hi = seg->blk_count, mid;
+    file_blk* blk;
+    while(hi - lo > 1){
+        mid = (lo + hi) / 2;
+        if(seg->blks[mid].raw_off <= off) lo = mid;
+        else hi = mid;
+    }
+    blk = &seg->blks[lo];
+    if(f->blk_valid && (f->blk_seq == seg->seq) && (f->blk_no == lo)){
+        return blk;
+    }
+    f->blk_valid = 0;
+    if(file_grow(&f->blk_buf,&f->blk_cap,blk->raw_len) ||
+        file_grow(&f->blk_zbuf,&f->blk_zcap,blk->zlen)){
+        return NULL;
+    }
+    if(pread(seg->fd,f->blk_zbuf,blk->zlen,blk->file_off) != (ssize_t)blk->zlen){
+        return NULL;
+    }
+    if(blk->crc != crc32c(f->blk_zbuf,blk->zlen)){
+        err_log("DB : corrupted block %"PRIu32" in segment %"PRIu32".\n",lo,seg->seq);
+        return NULL;
+    }
+    if(blk->zlen == blk->raw_len){
+        memcpy(f->blk_buf,f->blk_zbuf,blk->raw_len);
+    }
+    else if(lz_decompress(f->blk_zbuf,blk->zlen,f->blk_buf,blk->raw_len)){
+        err_log("DB : cannot decompress block %"PRIu32" in segment %"PRIu32".\n",lo,seg->seq);
+        return NULL;
+    }
+    f->blk_seq = seg->seq;
+    f->blk_no = lo;
+    f->blk_valid = 1;
+    return blk;
+}
+
+/* Read the record at the position pos; data points to the record data,
+either in buf or in the last block read */
+static int file_read_record(file_db* f,uint64_t pos,file_rec_hdr* hdr,const void** data,void** buf,uint32_t* buf_len){
+    file_seg* seg = file_seg_find(f,pos);
+    uint64_t off = pos - seg->start;
+    file_blk* blk;
+
+    if(NULL!=seg->blks){
+        blk = file_read_block(f,seg,off);
+        if(NULL==blk){
+            return 1;
+        }
+        off -= blk->raw_off;
+        if(off + sizeof(file_rec_hdr) > blk->raw_len){
+            return 1;
+        }
+        memcpy(hdr,f->blk_buf + off,sizeof(file_rec_hdr));
+        if(off + sizeof(file_rec_hdr) + hdr->size > blk->raw_len){
+            return 1;
+        }
+        *data = f->blk_buf + off + sizeof(file_rec_hdr);
+        return 0;
+    }
+    if(pread(seg->fd,hdr,sizeof(file_rec_hdr),off) != sizeof(file_rec_hdr)){
+        return 1;
+    }
+    if(file_grow((uint8_t**)buf,buf_len,hdr->size)){
+        return 1;
+    }
+    if(pread(seg->fd,*buf,hdr->size,off + sizeof(file_rec_hdr)) != (ssize_t)hdr->size){
+        return 1;
+    }
+    *data = *buf;
+    return 0;
+}
+
+static int file_walk(db* db_p,uint64_t* pos,db_record_cb cb,void* arg){
+    file_db* f = db_p->priv;
+    file_rec_hdr hdr;
+    const void* data;
+    void* buf = NULL;
+    uint32_t buf_len = 0;
+    uint64_t end = ACTIVE(f)->end;
+    int ret = 0;
+
+    while(*pos < end){
+        if(file_read_record(f,*pos,&hdr,&data,&buf,&buf_len)){
+            ret = -1;
+            break;
+        }
+        if(cb(hdr.idx,data,hdr.size,hdr.crc,arg)){
+            break;
+        }
+        *pos += sizeof(file_rec_hdr) + hdr.size;
+    }
+    if(NULL!=buf) free(buf);
+    return ret;
+}
+
+struct file_scan_arg_t{
+    uint64_t from_idx;
+    db_record_cb cb;
+    void* arg;
+};
+
+static int file_scan_record(uint64_t idx,const void* data,uint32_t size,uint32_t crc,void* arg){
+    struct file_scan_arg_t* scan = arg;
+    if(idx < scan->from_idx){
+        /* Also skips the records that are not indexed */
+        return 0;
+    }
+    return scan->cb(idx,data,size,crc,scan->arg);
+}
+
+static int file_scan(db* db_p,uint64_t from_idx,db_record_cb cb,void* arg){
+    file_db* f = db_p->priv;
+    struct file_scan_arg_t scan;
+    file_seg* seg;
+    uint64_t pos = ACTIVE(f)->end, lo, hi, mid;
+    uint32_t i,j;
+
+    /* Find the first block or record with idx >= from_idx */
+    for(i = 0; i < f->seg_count; i++){
+        seg = &f->segs[i];
+        if(NULL==seg->blks){
+            /* The uncompressed segments are indexed */
+            lo = 0;
+            hi = f->count;
+            while(lo < hi){
+                mid = (lo + hi) / 2;
+                if(f->idx[mid] < from_idx) lo = mid + 1;
+                else hi = mid;
+            }
+            if(lo < f->count){
+                pos = f->off[lo];
+            }
+            break;
+        }
+        if(seg->last_idx < from_idx){
+            continue;
+        }
+        for(j = 0; j < seg->blk_count; j++){
+            if(seg->blks[j].last_idx >= from_idx) break;
+        }
+        pos = seg->start + seg->blks[j].raw_off;
+        break;
+    }
+
+    scan.from_idx = from_idx;
+    scan.cb = cb;
+    scan.arg = arg;
+    return file_walk(db_p,&pos,file_scan_record,&scan);
+}
+
+/* Compress a sealed segment into blocks of whole records; the result
+is written to a temporary file that is renamed once complete */
+static int file_compress_segment(file_db* f,uint32_t seq,int raw_fd,uint64_t raw_len,
+                                 int* lz_fd,file_blk** blks,uint32_t* blk_count){
+    char path[300],tmp_path[300];
+    file_rec_hdr hdr;
+    file_lz_tail tail;
+    file_blk *blk,*blk_index = NULL;
+    uint32_t cap = 0,count = 0;
+    uint8_t *raw = NULL,*z = NULL;
+    uint32_t raw_cap = 0,z_cap = 0,len;
+    uint64_t off = 0,file_off = 0;
+    int fd,stop;
+
+    file_seg_path(f,seq,"lz.tmp",tmp_path,sizeof(tmp_path));
+    file_seg_path(f,seq,"lz",path,sizeof(path));
+    fd = open(tmp_path,O_RDWR|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR|S_IRGRP);
+    if(fd < 0){
+        err_log("DB : cannot open %s: %s.\n",tmp_path,strerror(errno));
+        return 1;
+    }
+    while(off < raw_len){
+        pthread_mutex_lock(&f->db_p->lock);
+        stop = f->stop;
+        pthread_mutex_unlock(&f->db_p->lock);
+        if(stop){
+            goto file_compress_error;
+        }
+        if(count == cap){
+            cap = cap ? 2*cap : 1024;
+            file_blk* new_index = realloc(blk_index,cap*sizeof(file_blk));
+            if(NULL==new_index){
+                goto file_compress_error;
+            }
+            blk_index = new_index;
+        }
+        blk = &blk_index[count];
+        memset(blk,0,sizeof(file_blk));
+        blk->raw_off = off;
+        blk->file_off = file_off;
+        /* Whole records, up to LZ_BLOCK_SIZE (or a single larger record) */
+        while(off < raw_len){
+            if(pread(raw_fd,&hdr,sizeof(hdr),off) != sizeof(hdr)){
+                goto file_compress_error;
+            }
+            len = sizeof(hdr) + hdr.size;
+            if(blk->raw_len && (blk->raw_len + len > LZ_BLOCK_SIZE)){
+                break;
+            }
+            if(file_grow(&raw,&raw_cap,blk->raw_len + len) ||
+                (pread(raw_fd,raw + blk->raw_len,len,off) != (ssize_t)len)){
+                goto file_compress_error;
+            }
+            if(hdr.idx) blk->last_idx = hdr.idx;
+            blk->data_len += hdr.size;
+            blk->count++;
+            blk->raw_len += len;
+            off += len;
+        }
+        if(file_grow(&z,&z_cap,blk->raw_len)){
+            goto file_compress_error;
+        }
+        blk->zlen = lz_compress(raw,blk->raw_len,z,blk->raw_len - 1);
+        if(0 == blk->zlen){
+            /* Not compressible; store it as it is */
+            blk->zlen = blk->raw_len;
+            memcpy(z,raw,blk->raw_len);
+        }
+        blk->crc = crc32c(z,blk->zlen);
+        if(pwrite(fd,z,blk->zlen,file_off) != (ssize_t)blk->zlen){
+            goto file_compress_error;
+        }
+        file_off += blk->zlen;
+        count++;
+    }
+
+    /* Block index and tail */
+    tail.magic = LZ_SEG_MAGIC;
+    tail.raw_len = raw_len;
+    tail.index_off = file_off;
+    tail.blk_count = count;
+    tail.crc = crc32c(blk_index,count*sizeof(file_blk));
+    if((pwrite(fd,blk_index,count*sizeof(file_blk),file_off) != (ssize_t)(count*sizeof(file_blk))) ||
+        (pwrite(fd,&tail,sizeof(tail),file_off + count*sizeof(file_blk)) != sizeof(tail)) ||
+        (fdatasync(fd) != 0) || (rename(tmp_path,path) != 0))
+    {
+        err_log("DB : cannot write %s: %s.\n",path,strerror(errno));
+        goto file_compress_error;
+    }
+    if(NULL!=raw) free(raw);
+    if(NULL!=z) free(z);
+    *lz_fd = fd;
+    *blks = blk_index;
+    *blk_count = count;
+    return 0;
+
+file_compress_error:
+    close(fd);
+    unlink(tmp_path);
+    if(NULL!=raw) free(raw);
+    if(NULL!=z) free(z);
+    if(NULL!=blk_index) free(blk_index);
+    return 1;
+}
+
+/* Compaction thread: compress the sealed segments, oldest first */
+static void* file_compactor(void* arg){
+    file_db* f = arg;
+    db* db_p = f->db_p;
+    file_seg* seg;
+    file_blk* blks;
+    char path[300];
+    uint32_t i,seq,blk_count;
+    uint64_t len,end,n;
+    int raw_fd,lz_fd,rc;
+
+    pthread_mutex_lock(&db_p->lock);
+    while(!f->stop){
+        i = file_seg_pending(f);
+        if(i == f->seg_count){
+            pthread_cond_wait(&f->cond,&db_p->lock);
+            continue;
+        }
+        /* The segment does not change once sealed */
+        seq = f->segs[i].seq;
+        raw_fd = f->segs[i].fd;
+        len = f->segs[i].end - f->segs[i].start;
+        end = f->segs[i].end;
+        pthread_mutex_unlock(&db_p->lock);
+
+        rc = file_compress_segment(f,seq,raw_fd,len,&lz_fd,&blks,&blk_count);
+
+        pthread_mutex_lock(&db_p->lock);
+        if(0 != rc){
+            if(!f->stop){
+                err_log("DB : cannot compress segment %"PRIu32".\n",seq);
+                f->failed = 1;
+                pthread_cond_broadcast(&f->done);
+                /* Try again once another segment is sealed */
+                pthread_cond_wait(&f->cond,&db_p->lock);
+            }
+            continue;
+        }
+        /* Switch to the compressed segment; the segments may have
+        been reallocated, but not reordered */
+        seg = &f->segs[i];
+        seg->fd = lz_fd;
+        seg->blks = blks;
+        seg->blk_count = blk_count;
+        /* Drop the index entries of the segment */
+        for(n = 0; (n < f->count) && (f->off[n] < end); n++);
+        memmove(f->idx,f->idx + n,(f->count - n)*sizeof(uint64_t));
+        memmove(f->off,f->off + n,(f->count - n)*sizeof(uint64_t));
+        f->count -= n;
+        close(raw_fd);
+        file_seg_path(f,seq,"dat",path,sizeof(path));
+        unlink(path);
+        pthread_cond_broadcast(&f->done);
+    }
+    pthread_mutex_unlock(&db_p->lock);
+    return NULL;
+}
+
+/* Seal the active segment and wait until all the sealed segments are
+compressed (called under db_p->lock) */
+static int file_compact(db* db_p){
+    file_db* f = db_p->priv;
+    if(!f->compactor_on){
+        return 1;
+    }
+    f->failed = 0;
+    file_seal(f,1);
+    pthread_cond_signal(&f->cond);
+    while(file_seg_pending(f) < f->seg_count){
+        if(f->failed){
+            return 1;
+        }
+        pthread_cond_wait(&f->done,&db_p->lock);
+    }
+    return 0;
+}
+
+const db_ops db_file_ops = {
+    .name = "file",
+    .open = file_open,
+    .close = file_close,
+    .append = file_append,
+    .append_batch = file_append_batch,
+    .walk = file_walk,
+    .scan = file_scan,
+    .compact = file_compact,
+};
@@ -1,134 +1,337 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <sys/time.h>
-#include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
-#include <db.h>
-#include "../include/db/db-interface.h"
+#include "../include/db/db-backend.h"
 #include "../include/util/debug.h"
+#include "../include/util/crc32c.h"
 
-const char* db_dir="./.db";
+/* Every record is stored together with its CRC32C, which is checked
+whenever the record is read back. The lock serializes the stores of the
+proxy with the dumps of the snapshot thread */
 
-u_int32_t pagesize = 32 * 1024;
-u_int cachesize = 32 * 1024 * 1024;
+static const db_ops* backends[] = {&db_bdb_ops,&db_file_ops,&db_mem_ops};
 
-struct db_t{
-    DB* bdb_ptr;
-};
-
-uint32_t records_len;
+void db_config_default(db_config* cfg){
+    memset(cfg,0,sizeof(db_config));
+    strcpy(cfg->backend,"bdb");
+    cfg->page_size = 32 * 1024;
+    cfg->cache_size = 32 * 1024 * 1024;
+    cfg->mem_size = 64 * 1024 * 1024;
+    cfg->sync = 0;
+}
 
-db* initialize_db(const char* db_name,uint32_t flag){
+db* initialize_db(const char* db_name,db_config* cfg,uint32_t flag){
     db* db_ptr=NULL;
-    DB* b_db;
-    int ret;
-    /* Initialize the DB handle */
-    if((ret = db_create(&b_db,NULL,flag))!=0){
-        err_log("DB : %s.\n",db_strerror(ret));
+    const db_ops* ops=NULL;
+    uint32_t i;
+
+    db_ptr = (db*)(malloc(sizeof(db)));
+    if(NULL==db_ptr){
+        err_log("DB : Cannot Malloc Memory For The DB.\n");
         goto db_init_return;
     }
-    
-    if((ret = b_db->set_pagesize(b_db,pagesize))!=0){
-        goto db_init_return;
+    memset(db_ptr,0,sizeof(db));
+    if(NULL==cfg){
+        db_config_default(&db_ptr->cfg);
+    }else{
+        db_ptr->cfg = *cfg;
+    }
+    for(i=0;i<sizeof(backends)/sizeof(backends[0]);i++){
+        if(0==strcmp(db_ptr->cfg.backend,backends[i]->name)){
+            ops = backends[i];
+            break;
+        }
     }
-    if((ret = b_db->set_cachesize(b_db, 0, cachesize, 1))!=0){
+    if(NULL==ops){
+        err_log("DB : unknown backend %s.\n",db_ptr->cfg.backend);
+        free(db_ptr);
+        db_ptr = NULL;
         goto db_init_return;
     }
-
-    if((ret = b_db->open(b_db,NULL,db_name,NULL,DB_RECNO,DB_THREAD|DB_CREATE,0))!=0){
-        //b_db->err(b_db,ret,"%s","test.db");
+    db_ptr->ops = ops;
+    /* The backend may start threads that use the lock */
+    pthread_mutex_init(&db_ptr->lock,NULL);
+    if(ops->open(db_ptr,db_name,flag)!=0){
+        err_log("DB : cannot open %s (%s backend).\n",db_name,ops->name);
+        pthread_mutex_destroy(&db_ptr->lock);
+        free(db_ptr);
+        db_ptr = NULL;
         goto db_init_return;
     }
-    db_ptr = (db*)(malloc(sizeof(db)));
-    db_ptr->bdb_ptr = b_db;
 
 db_init_return:
-    if(db_ptr!=NULL){
-        //debug_log("DB Initialization Finished\n");
-        ;
-    }
     return db_ptr;
 }
 
 void close_db(db* db_p,uint32_t mode){
     if(db_p!=NULL){
-        if(db_p->bdb_ptr!=NULL){
-            db_p->bdb_ptr->close(db_p->bdb_ptr,mode);
-            db_p->bdb_ptr=NULL;
-        }
+        db_p->ops->close(db_p,mode);
+        pthread_mutex_destroy(&db_p->lock);
         free(db_p);
         db_p = NULL;
     }
     return;
 }
 
-int store_record(db* db_p,size_t data_size,void* data){
+int store_record(db* db_p,uint64_t idx,size_t data_size,void* data){
     int ret = 1;
-    if((NULL==db_p)||(NULL==db_p->bdb_ptr)){
-        if(db_p == NULL){
-          err_log("DB store_record : db_p is null.\n");
-        } else{
-          err_log("DB store_recor : db_p->bdb_ptr is null.\n");
-        }
+    if(NULL==db_p){
+        err_log("DB store_record : db_p is null.\n");
         goto db_store_return;
     }
-    DB* b_db = db_p->bdb_ptr;
-    DBT key,db_data;
-    memset(&db_data,0,sizeof(db_data));
-    db_data.data = data;
-    db_data.size = data_size;
+    pthread_mutex_lock(&db_p->lock);
+    if((0!=idx)&&(idx<=db_p->last_idx)){
+        /* Already stored */
+        ret = 0;
+        goto db_store_unlock;
+    }
+    ret = db_p->ops->append(db_p,idx,data,data_size,crc32c(data,data_size));
+    if(0==ret){
+        db_p->record_count++;
+        db_p->records_len += data_size;
+        if(0!=idx){
+            db_p->last_idx = idx;
+        }
+    }
+db_store_unlock:
+    pthread_mutex_unlock(&db_p->lock);
+db_store_return:
+    return ret;
+}
 
-    records_len += data_size;
+int store_records(db* db_p,uint32_t count,void** data,uint32_t* sizes,uint32_t* stored){
+    int ret = 1;
+    uint32_t i,done = 0;
+    uint32_t* crcs;
 
-    memset(&key,0,sizeof(key));
-    key.flags = DB_DBT_MALLOC;
-    if ((ret=b_db->put(b_db,NULL,&key,&db_data,DB_AUTO_COMMIT|DB_APPEND))==0){
-        //debug_log("db : %ld record stored. \n",*(uint64_t*)key_data);
-        //b_db->sync(b_db,0);
+    if(NULL!=stored){
+        *stored = 0;
     }
-    else{
-        err_log("DB : %s.\n",db_strerror(ret));
-        //debug_log("db : can not save record %ld from database.\n",*(uint64_t*)key_data);
-        //b_db->err(b_db,ret,"DB->Put");
+    if(NULL==db_p){
+        err_log("DB store_records : db_p is null.\n");
+        return ret;
+    }
+    if(0==count){
+        return 0;
+    }
+    if(NULL==db_p->ops->append_batch){
+        for(i=0;i<count;i++){
+            if((ret=store_record(db_p,0,sizes[i],data[i]))!=0){
+                return ret;
+            }
+            if(NULL!=stored){
+                *stored = i+1;
+            }
+        }
+        return 0;
+    }
+
+    crcs = malloc(count*sizeof(uint32_t));
+    if(NULL==crcs){
+        err_log("DB store_records : cannot allocate CRCs.\n");
+        return ret;
+    }
+    for(i=0;i<count;i++){
+        crcs[i] = crc32c(data[i],sizes[i]);
+    }
+    pthread_mutex_lock(&db_p->lock);
+    ret = db_p->ops->append_batch(db_p,count,data,sizes,crcs,&done);
+    /* Also the records written before an error are on disk */
+    db_p->record_count += done;
+    for(i=0;i<done;i++){
+        db_p->records_len += sizes[i];
+    }
+    pthread_mutex_unlock(&db_p->lock);
+    free(crcs);
+    if(NULL!=stored){
+        *stored = done;
     }
-db_store_return:
     return ret;
 }
 
+struct dump_arg_t{
+    void* buf;
+    uint64_t len;
+    uint32_t max_len;
+    uint64_t to_idx;
+    uint64_t last_idx;
+    int full;
+    int corrupted;
+};
+
+static int dump_record(uint64_t idx,const void* data,uint32_t size,uint32_t crc,void* arg){
+    struct dump_arg_t* dump = arg;
+    if(crc!=crc32c(data,size)){
+        err_log("DB : record %"PRIu64" is corrupted.\n",idx);
+        dump->corrupted = 1;
+    }
+    memcpy((char*)dump->buf+dump->len,data,size);
+    dump->len += size;
+    return 0;
+}
+
 void dump_records(db* db_p, void* buf){
-    DB* b_db = db_p->bdb_ptr;
-    DBT key, data;
-    DBC *dbcp;
+    struct dump_arg_t dump;
+    uint64_t pos = 0;
+    memset(&dump,0,sizeof(dump));
+    dump.buf = buf;
+    pthread_mutex_lock(&db_p->lock);
+    db_p->ops->walk(db_p,&pos,dump_record,&dump);
+    pthread_mutex_unlock(&db_p->lock);
+}
+
+static int dump_record_to(uint64_t idx,const void* data,uint32_t size,uint32_t crc,void* arg){
+    struct dump_arg_t* dump = arg;
+    if(idx>dump->to_idx){
+        return 1;
+    }
+    return dump_record(idx,data,size,crc,arg);
+}
+
+uint64_t dump_records_to(db* db_p,uint64_t to_idx,void* buf){
+    struct dump_arg_t dump;
+    uint64_t pos = 0;
     int ret;
+    memset(&dump,0,sizeof(dump));
+    dump.buf = buf;
+    dump.to_idx = to_idx;
+    pthread_mutex_lock(&db_p->lock);
+    ret = db_p->ops->walk(db_p,&pos,dump_record_to,&dump);
+    pthread_mutex_unlock(&db_p->lock);
+    if((ret!=0)||dump.corrupted){
+        return 0;
+    }
+    return dump.len;
+}
 
-    uint32_t len = 0;
+static int dump_record_chunk(uint64_t idx,const void* data,uint32_t size,uint32_t crc,void* arg){
+    struct dump_arg_t* dump = arg;
+    if(idx>dump->to_idx){
+        return 1;
+    }
+    if(dump->len + size > dump->max_len){
+        /* The chunk is full */
+        dump->full = 1;
+        return 1;
+    }
+    if(crc!=crc32c(data,size)){
+        err_log("DB : record %"PRIu64" is corrupted.\n",idx);
+        dump->corrupted = 1;
+        return 1;
+    }
+    memcpy((char*)dump->buf+dump->len,data,size);
+    dump->len += size;
+    return 0;
+}
+
+int dump_records_chunk(db* db_p,uint64_t to_idx,uint64_t* pos,void* buf,uint32_t max_len,uint32_t* len){
+    struct dump_arg_t dump;
+    int ret;
+    memset(&dump,0,sizeof(dump));
+    dump.buf = buf;
+    dump.max_len = max_len;
+    dump.to_idx = to_idx;
+    /* Only one chunk under the lock, so that the stores are not held 
+    back for the whole dump */
+    pthread_mutex_lock(&db_p->lock);
+    ret = db_p->ops->walk(db_p,pos,dump_record_chunk,&dump);
+    pthread_mutex_unlock(&db_p->lock);
+    *len = dump.len;
+    if((ret!=0)||dump.corrupted){
+        return -1;
+    }
+    if(dump.full){
+        if(0==dump.len){
+            err_log("DB : record larger than a chunk of %"PRIu32" bytes.\n",max_len);
+            return -1;
+        }
+        return 1;
+    }
+    return 0;
+}
 
-    /* Acquire a cursor for the database. */
-    if ((ret = b_db->cursor(b_db, NULL, &dbcp, 0)) != 0) {
-        b_db->err(b_db, ret, "DB->cursor");
+static int dump_record_from(uint64_t idx,const void* data,uint32_t size,uint32_t crc,void* arg){
+    struct dump_arg_t* dump = arg;
+    uint32_t rec_len = sizeof(uint64_t) + sizeof(uint32_t) + size;
+    if(idx>=dump->to_idx){
+        return 1;
     }
+    if(dump->len + rec_len > dump->max_len){
+        /* The chunk is full */
+        dump->full = 1;
+        return 1;
+    }
+    if(crc!=crc32c(data,size)){
+        /* Do not serve corrupted records */
+        err_log("DB : record %"PRIu64" is corrupted.\n",idx);
+        dump->corrupted = 1;
+        return 1;
+    }
+    /* Every record is copied as [idx][size][data] */
+    memcpy((char*)dump->buf + dump->len, &idx, sizeof(uint64_t));
+    memcpy((char*)dump->buf + dump->len + sizeof(uint64_t), &size, sizeof(uint32_t));
+    memcpy((char*)dump->buf + dump->len + sizeof(uint64_t) + sizeof(uint32_t), data, size);
+    dump->len += rec_len;
+    dump->last_idx = idx;
+    return 0;
+}
 
-    /* Re-initialize the key/data pair. */
-    memset(&key, 0, sizeof(key));
-    memset(&data, 0, sizeof(data));
+uint32_t dump_records_from(db* db_p,uint64_t from_idx,uint64_t to_idx,void* buf,uint32_t max_len,uint64_t* last_idx){
+    struct dump_arg_t dump;
+    int ret;
+    memset(&dump,0,sizeof(dump));
+    dump.buf = buf;
+    dump.max_len = max_len;
+    dump.to_idx = to_idx;
+    dump.last_idx = from_idx - 1;
 
-    /* Walk through the database and print out the key/data pairs. */
-    while ((ret = dbcp->c_get(dbcp, &key, &data, DB_NEXT)) == 0) {
-        //debug_log("%lu : %.*s\n", *(u_long *)key.data, (int)data.size, (char *)data.data);
-        memcpy((char*)buf+len, data.data, data.size);
-        len += data.size;
+    if(0==from_idx){
+        *last_idx = 0;
+        return 0;
+    }
+    pthread_mutex_lock(&db_p->lock);
+    ret = db_p->ops->scan(db_p,from_idx,dump_record_from,&dump);
+    pthread_mutex_unlock(&db_p->lock);
+    if((ret!=0)||dump.corrupted){
+        /* The records cannot be served */
+        *last_idx = 0;
+        return 0;
     }
-    if (ret != DB_NOTFOUND)
-        b_db->err(b_db, ret, "DBcursor->get");
+    /* If the chunk is not full, no more records in the range */
+    *last_idx = dump.full ? dump.last_idx : to_idx - 1;
+    return dump.len;
+}
 
-    /* Close the cursor. */
-    if ((ret = dbcp->c_close(dbcp)) != 0) {
-        b_db->err(b_db, ret, "DBcursor->close");
+int compact_db(db* db_p){
+    int ret = 1;
+    if(NULL==db_p->ops->compact){
+        return ret;
     }
+    pthread_mutex_lock(&db_p->lock);
+    ret = db_p->ops->compact(db_p);
+    pthread_mutex_unlock(&db_p->lock);
+    return ret;
 }
 
+uint64_t get_records_len(db* db_p)
+{
+    return db_p->records_len;
+}
+
+uint64_t get_records_count(db* db_p)
+{
+    return db_p->record_count;
+}
 
-uint32_t get_records_len()
+uint64_t get_last_idx(db* db_p)
 {
-    return records_len;
-}
\ No newline at end of file
+    return db_p->last_idx;
+}
+
+const char* get_db_backend(db* db_p)
+{
+    return db_p->ops->name;
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../include/db/db-backend.h"
+#include "../include/util/debug.h"
+
+/* In-memory ring backend (for benchmarking): the records are kept in a
+ring buffer of mem_size bytes as [header][data]; when the ring is full,
+the oldest records are dropped. The position of a record (see walk) is
+its sequence number since the ring was opened. Nothing survives a
+restart */
+
+struct mem_rec_hdr_t{
+    uint64_t idx;
+    uint32_t size;
+    uint32_t crc;
+};
+typedef struct mem_rec_hdr_t mem_rec_hdr;
+
+/* Marks the end of the ring; the next record is at offset 0 */
+#define MEM_WRAP UINT32_MAX
+#define MEM_REC_LEN(size) ((sizeof(mem_rec_hdr) + (size) + 7) & ~7ULL)
+
+struct mem_db_t{
+    uint8_t* buf;
+    uint64_t len;
+    uint64_t head;          /* offset of the oldest record */
+    uint64_t tail;          /* offset after the newest record */
+    uint64_t dropped_idx;   /* highest idx dropped from the ring */
+    uint64_t first_seq;     /* sequence number of the oldest record */
+};
+typedef struct mem_db_t mem_db;
+
+static int mem_open(db* db_p,const char* db_name,uint32_t flag){
+    mem_db* m = malloc(sizeof(mem_db));
+    if(NULL==m){
+        return 1;
+    }
+    memset(m,0,sizeof(mem_db));
+    m->len = db_p->cfg.mem_size & ~7ULL;
+    m->buf = malloc(m->len);
+    if(NULL==m->buf){
+        err_log("DB : cannot allocate %"PRIu64" bytes for the ring.\n",m->len);
+        free(m);
+        return 1;
+    }
+    db_p->priv = m;
+    return 0;
+}
+
+static void mem_close(db* db_p,uint32_t mode){
+    mem_db* m = db_p->priv;
+    if(NULL==m){
+        return;
+    }
+    free(m->buf);
+    free(m);
+    db_p->priv = NULL;
+}
+
+/* Get the record at an offset, following the wrap-around */
+static mem_rec_hdr* mem_get_record(mem_db* m,uint64_t* offset){
+    mem_rec_hdr* hdr;
+    if((m->len - *offset < sizeof(mem_rec_hdr)) ||
+        (MEM_WRAP == ((mem_rec_hdr*)(m->buf + *offset))->size)){
+        *offset = 0;
+    }
+    hdr = (mem_rec_hdr*)(m->buf + *offset);
+    return hdr;
+}
+
+static void mem_drop_oldest(db* db_p){
+    mem_db* m = db_p->priv;
+    mem_rec_hdr* hdr = mem_get_record(m,&m->head);
+    if(hdr->idx){
+        m->dropped_idx = hdr->idx;
+    }
+    db_p->record_count--;
+    db_p->records_len -= hdr->size;
+    m->first_seq++;
+    m->head += MEM_REC_LEN(hdr->size);
+    if(0 == db_p->record_count){
+        m->head = m->tail = 0;
+    }
+    else{
+        mem_get_record(m,&m->head);
+    }
+}
+
+/* Make room for a record of len bytes at the tail */
+static int mem_reserve(db* db_p,uint64_t len){
+    mem_db* m = db_p->priv;
+    if(len > m->len){
+        err_log("DB : record larger than the ring.\n");
+        return 1;
+    }
+    while(1){
+        if(0 == db_p->record_count){
+            m->head = m->tail = 0;
+            return 0;
+        }
+        if(m->head < m->tail){
+            if(m->tail + len <= m->len){
+                return 0;
+            }
+            /* Wrap around */
+            if(m->len - m->tail >= sizeof(mem_rec_hdr)){
+                ((mem_rec_hdr*)(m->buf + m->tail))->size = MEM_WRAP;
+            }
+            m->tail = 0;
+            continue;
+        }
+        /* The tail is behind the head */
+        if(m->tail + len <= m->head){
+            return 0;
+        }
+        mem_drop_oldest(db_p);
+    }
+}
+
+static int mem_append(db* db_p,uint64_t idx,const void* data,uint32_t size,uint32_t crc){
+    mem_db* m = db_p->priv;
+    mem_rec_hdr* hdr;
+    uint64_t len = MEM_REC_LEN(size);
+
+    if(mem_reserve(db_p,len)){
+        return 1;
+    }
+    hdr = (mem_rec_hdr*)(m->buf + m->tail);
+    hdr->idx = idx;
+    hdr->size = size;
+    hdr->crc = crc;
+    memcpy(hdr + 1,data,size);
+    m->tail += len;
+    return 0;
+}
+
+static int mem_walk(db* db_p,uint64_t* pos,db_record_cb cb,void* arg){
+    mem_db* m = db_p->priv;
+    mem_rec_hdr* hdr;
+    uint64_t i,offset = m->head;
+
+    if(*pos < m->first_seq){
+        /* The records were dropped from the ring */
+        return -1;
+    }
+    for(i = 0; i < db_p->record_count; i++){
+        hdr = mem_get_record(m,&offset);
+        offset += MEM_REC_LEN(hdr->size);
+        if(m->first_seq + i < *pos){
+            continue;
+        }
+        if(cb(hdr->idx,hdr + 1,hdr->size,hdr->crc,arg)){
+            break;
+        }
+        (*pos)++;
+    }
+    return 0;
+}
+
+static int mem_scan(db* db_p,uint64_t from_idx,db_record_cb cb,void* arg){
+    mem_db* m = db_p->priv;
+    mem_rec_hdr* hdr;
+    uint64_t i,offset = m->head;
+
+    if(from_idx <= m->dropped_idx){
+        /* The records were dropped from the ring */
+        return -1;
+    }
+    for(i = 0; i < db_p->record_count; i++){
+        hdr = mem_get_record(m,&offset);
+        offset += MEM_REC_LEN(hdr->size);
+        if(hdr->idx < from_idx){
+            /* Also skips the records that are not indexed */
+            continue;
+        }
+        if(cb(hdr->idx,hdr + 1,hdr->size,hdr->crc,arg)){
+            break;
+        }
+    }
+    return 0;
+}
+
+const db_ops db_mem_ops = {
+    .name = "mem",
+    .open = mem_open,
+    .close = mem_close,
+    .append = mem_append,
+    .append_batch = NULL,
+    .walk = mem_walk,
+    .scan = mem_scan,
+};
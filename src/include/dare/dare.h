@@ -23,7 +23,12 @@
 #define NOW 0.000000001
 
 #define MAX_CLIENT_COUNT 64
-#define MAX_SERVER_COUNT 13
+/* Maximum group size, including the servers being added; the control 
+data and the log have room for this many servers and the CID bitmask 
+has a bit for each, i.e., at most 64 */
+#ifndef MAX_SERVER_COUNT
+#define MAX_SERVER_COUNT 64
+#endif
 
 #define PAGE_SIZE 4096
 
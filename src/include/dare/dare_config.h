@@ -23,9 +23,9 @@
  * !!! only old majority needed */
 #define CID_EXTENDED  2
 
-#define CID_IS_SERVER_ON(cid, idx) ((cid).bitmask & (1 << (idx)))
-#define CID_SERVER_ADD(cid, idx) (cid).bitmask |= 1 << (idx)
-#define CID_SERVER_RM(cid, idx) (cid).bitmask &= ~(1 << (idx))
+#define CID_IS_SERVER_ON(cid, idx) ((cid).bitmask & ((uint64_t)1 << (idx)))
+#define CID_SERVER_ADD(cid, idx) (cid).bitmask |= (uint64_t)1 << (idx)
+#define CID_SERVER_RM(cid, idx) (cid).bitmask &= ~((uint64_t)1 << (idx))
 
 /** 
  * Configuration ID: A configuration is given by a 
@@ -39,8 +39,8 @@ struct dare_cid_t {
     uint64_t epoch;
     uint8_t size[2];
     uint8_t state;
-    uint8_t pad[1];
-    uint32_t bitmask;
+    uint8_t pad[5];
+    uint64_t bitmask;
 };
 typedef struct dare_cid_t dare_cid_t;
 
@@ -97,14 +97,14 @@ get_group_size( server_config_t config )
 }
 
 #define PRINT_CID(cid) text(log_fp,     \
-    " [E%"PRIu64":%02"PRIu8"|%02"PRIu8"|%d|%03"PRIu32"] ", \
+    " [E%"PRIu64":%02"PRIu8"|%02"PRIu8"|%d|%"PRIx64"] ", \
     (cid).epoch, (cid).size[0], (cid).size[1], (cid).state, (cid).bitmask)
 #define PRINT_CID_(cid) PRINT_CID(cid); text(log_fp, "\n");
 
 #define PRINT_CONF_TRANSIT(old_cid, new_cid) \
     info_wtime(log_fp, "(%s:%d) Configuration transition: " \
-        "[E%"PRIu64":%02"PRIu8"|%02"PRIu8"|%d|%03"PRIu32"] -> " \
-        "[E%"PRIu64":%02"PRIu8"|%02"PRIu8"|%d|%03"PRIu32"]\n", \
+        "[E%"PRIu64":%02"PRIu8"|%02"PRIu8"|%d|%"PRIx64"] -> " \
+        "[E%"PRIu64":%02"PRIu8"|%02"PRIu8"|%d|%"PRIx64"]\n", \
         __func__, __LINE__, \
         (old_cid).epoch, (old_cid).size[0], (old_cid).size[1], \
         (old_cid).state, (old_cid).bitmask, \
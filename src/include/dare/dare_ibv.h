@@ -11,11 +11,12 @@
  
 #include <infiniband/verbs.h> /* OFED IB verbs */
 #include "./dare.h"
+#include "./dare_mr_cache.h"
+#include "./dare_tp.h"
  
 #ifndef DARE_IBV_H
 #define DARE_IBV_H
 
-#define DARE_WR_COUNT    32
 #define IB_PKEY_MASK 0x7fff
 
 #define IBV_SERVER  1
@@ -62,12 +63,23 @@ typedef struct rem_mem_t rem_mem_t;
 #define RC_QP_BLOCKED   1
 #define RC_QP_ERROR     2
 
+/* Max number of WRs chained in one post (one doorbell) per QP; the 
+ * leader queues the writes of a polling iteration, e.g., the two writes 
+ * of a wrapped log update, and posts them at once (see flush_sends) */
+#define RC_WR_BATCH 4
+/* Max number of SGEs per WR; a snapshot chunk is scattered into its 
+ * header and the snapshot buffer (see rc_recover_sm) */
+#define RC_MAX_SGE 2
+
 struct rc_qp_t {
     struct ibv_qp *qp;          // RC QP
     uint64_t signaled_wr_id;    // ID of signaled WR (to avoid overflow)
     uint32_t qpn;               // remote QP number
     uint32_t send_count;        // number of posted sends
     uint8_t  state;             // QP's state
+    uint8_t  wr_count;          // number of queued WRs
+    struct ibv_send_wr wr[RC_WR_BATCH]; // queued WRs (not posted yet)
+    struct ibv_sge     sg[RC_WR_BATCH][RC_MAX_SGE];
 }; 
 typedef struct rc_qp_t rc_qp_t;
 
@@ -87,6 +99,22 @@ struct dare_ib_ep_t {
 };
 typedef struct dare_ib_ep_t dare_ib_ep_t;
 
+/* RC parameters picked from LogGP measurements on the fabric (see 
+ * rc_tune); times in usec, for writes of TUNE_ENTRY_SIZE bytes unless 
+ * stated otherwise */
+struct dare_ib_profile_t {
+    double o;               // overhead of posting a WR
+    double o_poll;          // overhead of polling a completion
+    double L[2];            // RTT of a write (not inline / inline)
+    double g;               // gap between writes
+    double G;               // gap per byte (large writes)
+    uint32_t inline_cutoff; // largest write sent inline
+    uint32_t signal_interval;   // WRs between signaled WRs
+    uint32_t window;        // log updates in flight (log_window)
+    double commit[2];       // predicted commit latency (idle / loaded)
+};
+typedef struct dare_ib_profile_t dare_ib_profile_t;
+
 struct dare_ib_device_t {
     /* General fields */
     struct ibv_device *ib_dev;
@@ -98,6 +126,7 @@ struct dare_ib_device_t {
     uint8_t port_num;       // port number 
     enum ibv_mtu mtu;       // MTU for this device
     uint16_t lid;           // local ID for this device        
+    struct ibv_comp_channel *cq_channel;    // events of the CQs (idle mode)
 
     /* QP for listening for clients requests - UD */
     struct ibv_pd           *ud_pd;
@@ -125,10 +154,23 @@ struct dare_ib_device_t {
     struct ibv_mr *lcl_mr[2];
     uint32_t      rc_max_inline_data;
     uint32_t      rc_max_send_wr;
+    uint32_t      rc_inline_cutoff;     // largest write sent inline
+    uint32_t      rc_signal_interval;   // WRs between signaled WRs
+    dare_ib_profile_t profile;          // valid if tuned
+    uint64_t      ctrl_wr_count;        // WRs to the control data
+    uint64_t      log_wr_count;         // WRs to the log
+    int           tuned;    // 1: observing the commit latency; 2: done
     
     /* Snapshot */
-    struct ibv_mr *prereg_snapshot_mr;
-    struct ibv_mr *snapshot_mr;
+    struct ibv_mr *sm_chunk_mr[2];
+    struct rb_root mr_cache;    // registrations reused across recoveries
+    int           odp;          // RC reads into on-demand paging MRs
+    
+    /* Catch-up chunk */
+    struct ibv_mr *cu_buf_mr;
+    
+    /* NC-Buffers */
+    struct ibv_mr *nc_mr;
     
     int ulp_type;
     void *udata;
@@ -138,6 +180,7 @@ typedef struct dare_ib_device_t dare_ib_device_t;
 /* ================================================================== */
 
 /* Init and cleaning up */
+int dare_ib_select_transport();
 int dare_init_ib_device();
 int dare_start_ib_ud();
 int dare_init_ib_srv_data( void *data );
@@ -155,13 +198,17 @@ int dare_ib_exchange_rc_info();
 int dare_ib_update_rc_info();
 int dare_ib_get_replicated_vote();
 int dare_ib_send_sm_request();
-int dare_ib_send_sm_reply( uint8_t idx, void *s, int reg_mem );
+int dare_ib_send_sm_reply( uint8_t idx, void *s, uint64_t offset, 
+                           uint64_t total, int last, uint64_t seq );
+int dare_ib_send_sm_ack( uint8_t idx, uint64_t seq );
 int dare_ib_recover_sm( uint8_t idx );
 int dare_ib_recover_log();
 
 /* HB mechanism */
 int dare_ib_send_hb();
 int dare_ib_send_hb_reply( uint8_t idx );
+int dare_ib_send_status( uint8_t idx );
+void dare_ib_report_wr_rate();
 
 /* Leader election */
 int dare_ib_send_vote_request();
@@ -171,8 +218,12 @@ int dare_ib_send_vote_ack();
 /* Normal operation */
 int dare_ib_establish_leadership();
 int dare_ib_write_remote_logs( int wait_for_commit );
-int dare_ib_send_entries_reply( uint8_t idx );
+int dare_ib_send_entries_reply( uint8_t idx, uint64_t entry_idx );
 int dare_ib_get_remote_apply_offsets();
+int dare_ib_send_catchup_notice( uint8_t idx );
+int dare_ib_send_catchup_request( uint8_t idx );
+int dare_ib_send_catchup_reply( uint8_t idx );
+int dare_ib_recv_catchup_chunk( uint8_t idx );
 
 /* Handle client requests */
 int dare_ib_apply_cmd_locally();
@@ -185,6 +236,15 @@ int dare_ib_send_clt_reply( uint16_t lid, uint64_t req_id, uint8_t type );
 void dare_ib_disconnect_server( uint8_t idx );
 int dare_ib_revoke_log_access();
 int dare_ib_restore_log_access();
+uint32_t dare_ib_nc_rkey();
+
+/* Auto-tuning */
+int dare_ib_tune( const char *profile_path, double latency_target );
+
+/* Idle mode */
+int dare_ib_arm_cqs();
+void dare_ib_get_cq_events();
+int dare_ib_cq_fd();
 
 /* LogGP */
 double dare_ib_get_loggp_params( uint32_t size, int type, int *poll_count, int write, int inline_flag );
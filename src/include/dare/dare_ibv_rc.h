@@ -56,13 +56,17 @@ void rc_free();
 /* Start up */
 int rc_get_replicated_vote();
 int rc_send_sm_request();
-int rc_send_sm_reply( uint8_t idx, void *s, int reg_mem );
+int rc_send_sm_reply( uint8_t idx, void *s, uint64_t offset, 
+                      uint64_t total, int last, uint64_t seq );
+int rc_send_sm_ack( uint8_t idx, uint64_t seq );
 int rc_recover_sm( uint8_t idx );
 int rc_recover_log();
 
 /* HB mechanism */
 int rc_send_hb();
 int rc_send_hb_reply( uint8_t idx );
+int rc_send_status( uint8_t idx );
+void rc_report_wr_rate();
 
 /* Leader election */
 int rc_send_vote_request();
@@ -71,9 +75,14 @@ int rc_send_vote_ack();
 
 /* Normal operation */
 int rc_verify_leadership( int *leader );
+int rc_lease_valid();
 int rc_write_remote_logs( int wait_for_commit );
-int rc_send_entries_reply( uint8_t idx );
+int rc_send_entries_reply( uint8_t idx, uint64_t entry_idx );
 int rc_get_remote_apply_offsets();
+int rc_send_catchup_notice( uint8_t idx );
+int rc_send_catchup_request( uint8_t idx );
+int rc_send_catchup_reply( uint8_t idx );
+int rc_recv_catchup_chunk( uint8_t idx );
 
 /* QP interface */
 int rc_disconnect_server( uint8_t idx );
@@ -85,6 +94,7 @@ int rc_restore_log_access();
 double rc_get_loggp_params( uint32_t size, int type, int *poll_count, int write, int inline_flag );
 double rc_loggp_prtt( int n, double delay, uint32_t size );
 int rc_loggp_exit();
+int rc_tune( const char *profile_path, double latency_target );
  
 int rc_print_qp_state( void *data );
 void rc_ib_send_msg();
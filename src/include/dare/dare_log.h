@@ -14,10 +14,13 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <pthread.h>
 
 #include "./dare.h"
 #include "./dare_sm.h"
 #include "./dare_config.h"
+#include "../util/crc32c.h"
 
 #define NOOP    0
 #define CSM     1
@@ -29,16 +32,23 @@ extern int prev_log_entry_head;
 /* Entry types: <CSM, cmd> 
  *              OR <CONFIG, cid> 
  *              OR <NOOP, __ >
- *              OR <HEAD, head_offset> */
+ *              OR <HEAD, head_offset> 
+ * The header is 32 bytes; an entry takes only the bytes of its data, 
+ * rounded up to LOG_ENTRY_ALIGN (see log_entry_len), so that the next 
+ * entry starts aligned. The replies are not in the entry; each 
+ * follower acknowledges the last entry it persisted, through the 
+ * control data of the leader (see status_t) */
+#ifndef LOG_ENTRY_ALIGN
+#define LOG_ENTRY_ALIGN 8   /* 8 or 64 (a cache line) */
+#endif
 struct dare_log_entry_t {
     uint64_t idx;
     uint64_t term;
     uint64_t req_id;    /* The request ID of the client */
+    uint32_t crc;       /* CRC32C of the entry; see log_entry_crc() */
     uint16_t clt_id;    /* LID of client */
     uint8_t  type;      /* CSM, CONFIG, NOOP, HEAD */
-    //uint8_t  pad[5];
     uint8_t  sender;
-    uint8_t  reply[MAX_SERVER_COUNT];
     union {
         sm_cmd_t   cmd;
         dare_cid_t cid;
@@ -55,25 +65,42 @@ struct dare_log_entry_det_t {
 };
 typedef struct dare_log_entry_det_t dare_log_entry_det_t;
 
-/* NC-Buffer: stores the determinant of not committed log entries */
-// TODO This shouldn't be static 
-#define MAX_NC_ENTRIES 1024 /* this implies 24 kb of memory */
+/* NC-Buffer: stores the determinant of not committed log entries;
+ * it has room for one determinant per (smallest) entry that fits in 
+ * the log (see log_nc_buf_cap) and it lives in its own registered 
+ * region, outside the log */
 struct dare_nc_buf_t {
     uint64_t len;
-    dare_log_entry_det_t entries[MAX_NC_ENTRIES];
+    uint64_t cap;       /* max number of determinants */
+    dare_log_entry_det_t entries[0];
 };
 typedef struct dare_nc_buf_t dare_nc_buf_t;
 
+/* Descriptor of the NC-Buffer of a server; each server publishes its 
+ * own in the log (nc[own idx]), so that the leader reads the length and 
+ * the location of the NC-Buffer, and then the determinants in chunks 
+ * of NC_CHUNK_ENTRIES (see log_adjustment) */
+#define NC_CHUNK_ENTRIES 4096   /* 96 kb per chunk */
+struct dare_nc_desc_t {
+    uint64_t len;       /* number of determinants */
+    uint64_t raddr;     /* address of the determinants */
+    uint64_t rkey;
+};
+typedef struct dare_nc_desc_t dare_nc_desc_t;
+
 struct log_offsets_t {
     uint64_t head;
     uint64_t apply;
     uint64_t commit;
     uint64_t end;
+    uint64_t band_idx;      /* end, band_idx and band_term are set */
+    uint64_t band_term;     /* with one write (see dare_log_t) */
 };
 typedef struct log_offsets_t log_offsets_t;
 
-/* The log (a circular buffer) used to replicate SM operations */
-#define LOG_SIZE  16384*PAGE_SIZE
+/* The log (a circular buffer) used to replicate SM operations; its 
+size is set by log_size_mb (the same on all servers) */
+#define LOG_SIZE  16384*PAGE_SIZE   /* Default size */
 struct dare_log_t
 {
     uint64_t head;  /* offset of the first entry;
@@ -86,6 +113,11 @@ struct dare_log_t
     uint64_t end;  /* offset after the last entry; 
                     if end==len the buffer is empty;
                     if end==head the buffer is full */
+    uint64_t band_idx;  /* idx of the entry at end, when the leader 
+                    adjusted the log */
+    uint64_t band_term; /* term of that leader; written after end and 
+                    band_idx: the server appends the entries of this 
+                    term in-band (see log_scan_entries) */
     uint64_t tail;  /* offset of the last entry
                     Note: tail + sizeof(last_entry) == end */
 
@@ -94,40 +126,73 @@ struct dare_log_t
     
     uint64_t len;
     
-    /* Special buffer that stores the determinant of not committed log 
-     * entries */
-    dare_nc_buf_t nc_buf[MAX_SERVER_COUNT]; 
+    /* Descriptors of the buffers that store the determinant of not 
+     * committed log entries */
+    dare_nc_desc_t nc[MAX_SERVER_COUNT]; 
     
-    uint8_t entries[0];
+    uint8_t entries[0] __attribute__((aligned(64)));
 }; 
 typedef struct dare_log_t dare_log_t;
 
-/* Snapshot of a generic SM */
-#define PREREG_SNAPSHOT_SIZE 128*PAGE_SIZE
+/* Side ring: the determinants of the last appended entries, indexed by 
+ * idx modulo the window; kept by the server that appends (the leader), 
+ * so that the tail and the offset of an idx are found without walking 
+ * the log; the ring is local, i.e., not remotely accessible */
+#define LOG_RING_MAX_WINDOW (1 << 20)
+struct log_ring_t {
+    uint64_t first;     /* idx of the oldest entry in the ring */
+    uint64_t last;      /* idx of the last entry; 0 if empty */
+    uint64_t mask;      /* window - 1 */
+    dare_log_entry_det_t *dets;
+};
+typedef struct log_ring_t log_ring_t;
+extern log_ring_t log_ring;
+
+/* Reservations: while leader, the proxy threads append client requests 
+ * directly into the log (see dare_reserve_request); an entry is reserved
+ * under the lock (idx and offset), filled in place and published in 
+ * reservation order; the server thread adopts the published entries, 
+ * i.e., it moves the end of the log (see log_adopt_entries) */
+struct log_rsv_t {
+    pthread_spinlock_t lock;
+    int active;
+    uint64_t term;
+    uint64_t idx;                   /* idx of the last reserved entry */
+    uint64_t end;                   /* offset after the last reserved entry */
+    volatile uint64_t published;    /* offset after the last published entry */
+};
+typedef struct log_rsv_t log_rsv_t;
+extern log_rsv_t log_rsv;
+
+/* Snapshot of a generic SM; it is sent in chunks of at most 
+ * SM_CHUNK_SIZE bytes, each with its own snapshot_t header */
+#define SM_CHUNK_SIZE 128*PAGE_SIZE
 struct snapshot_t {
     dare_log_entry_det_t last_entry;    /* The last applied entry */
     uint32_t len;                       /* Length of data */
+    uint32_t crc;                       /* CRC32C of data */
     char data[0];                       /* SM specific data */
 };
 typedef struct snapshot_t snapshot_t;
 
+/* Buffer for catching up from stable storage; a lagging follower 
+ * receives the missing records in chunks of at most this size */
+#define CATCHUP_BUF_SIZE 128*PAGE_SIZE
+
 /* ================================================================== */
 /* Static functions to handle the log */
 
 /**
- * Create new log
+ * Initialize a new log of len bytes in buf (sizeof(dare_log_t) + len 
+ * zeroed bytes; see init_log_memory)
  */
 static dare_log_t* 
-log_new()
+log_init( void *buf, uint64_t len )
 {
-    dare_log_t* log = (dare_log_t*)malloc(sizeof(dare_log_t)+LOG_SIZE);
-    if (NULL == log) {
-        error(log_fp, "Cannot allocate log memory\n");
-        return NULL;
-    }    
+    dare_log_t* log = (dare_log_t*)buf;
+
     /* Initialize log offsets */
-    memset(log, 0, sizeof(dare_log_t)+LOG_SIZE);
-    log->len  = LOG_SIZE;
+    log->len  = len;
     log->end  = log->len;
     log->tail = log->len;
 
@@ -137,14 +202,74 @@ log_new()
 }
 
 /**
- * Free log
+ * Get the capacity of the NC-Buffer for a log of a given length: 
+ * the log cannot hold more entries than that
  */
-static void 
-log_free( dare_log_t* log )
+static inline uint64_t
+log_nc_buf_cap( uint64_t len )
+{
+    return len / offsetof(dare_log_entry_t, data);
+}
+
+/**
+ * Allocate the side ring: a window of one entry per (smallest) entry 
+ * that fits in the log, up to LOG_RING_MAX_WINDOW
+ */
+static int
+log_ring_init( dare_log_t* log )
+{
+    uint64_t window = 1;
+    while ( (window < LOG_RING_MAX_WINDOW) && 
+            (window * offsetof(dare_log_entry_t, data) < log->len) ) {
+        window <<= 1;
+    }
+    log_ring.dets = (dare_log_entry_det_t*)
+                malloc(window * sizeof(dare_log_entry_det_t));
+    if (NULL == log_ring.dets) {
+        return 1;
+    }
+    log_ring.mask = window - 1;
+    log_ring.first = log_ring.last = 0;
+    return 0;
+}
+
+static void
+log_ring_free()
 {
-    if (NULL != log) {
-        free(log);
-        log = NULL;
+    if (NULL != log_ring.dets) {
+        free(log_ring.dets);
+        log_ring.dets = NULL;
+    }
+    log_ring.first = log_ring.last = 0;
+}
+
+static inline void
+log_ring_reset()
+{
+    log_ring.first = log_ring.last = 0;
+}
+
+/**
+ * Add the determinant of an appended entry; an entry that does not 
+ * follow the last one starts the ring over
+ */
+static inline void
+log_ring_push( uint64_t idx, uint64_t term, uint64_t offset )
+{
+    dare_log_entry_det_t *det;
+    
+    if (NULL == log_ring.dets) return;
+    if ( (0 == log_ring.last) || (idx != log_ring.last + 1) ) {
+        log_ring.first = idx;
+    }
+    det = &log_ring.dets[idx & log_ring.mask];
+    det->idx = idx;
+    det->term = term;
+    det->offset = offset;
+    log_ring.last = idx;
+    if (idx - log_ring.first > log_ring.mask) {
+        /* The oldest entry was overwritten */
+        log_ring.first = idx - log_ring.mask;
     }
 }
 
@@ -201,7 +326,7 @@ not_applied_entries( dare_log_t* log )
 static inline int
 log_fit_entry_header( dare_log_t* log, uint64_t offset )
 {
-    return (log->len - offset >= sizeof(dare_log_entry_t));
+    return (log->len - offset > sizeof(dare_log_entry_t));
 }
 
 /**
@@ -221,6 +346,29 @@ log_add_new_entry( dare_log_t* log )
 }
 
 
+/**
+ * Get the length of an entry of the given type (and command length)
+ * ! safe over RDMA 
+ */
+static inline uint32_t 
+log_entry_size( uint8_t type, uint32_t cmd_len )
+{
+    uint32_t len = (uint32_t)offsetof(dare_log_entry_t, data);
+    switch(type) {
+        case NOOP:
+            break;
+        case CONFIG:
+            len += (uint32_t)sizeof(dare_cid_t);
+            break;
+        case HEAD:
+            len += (uint32_t)sizeof(uint64_t);
+            break;
+        default:
+            len += (uint32_t)sizeof(sm_cmd_t) + cmd_len;
+    }
+    return (len + LOG_ENTRY_ALIGN - 1) & ~(uint32_t)(LOG_ENTRY_ALIGN - 1);
+}
+
 /**
  * Get the length of an entry
  * ! safe over RDMA 
@@ -228,14 +376,46 @@ log_add_new_entry( dare_log_t* log )
 static inline uint32_t 
 log_entry_len( dare_log_entry_t* entry )
 {
-    if (entry->type == NOOP || entry->type == CONFIG || entry->type == HEAD)
-        return (uint32_t)sizeof(dare_log_entry_t);
-    return (uint32_t)(sizeof(dare_log_entry_t) + entry->data.cmd.len);
+    switch(entry->type) {
+        case NOOP:
+        case CONFIG:
+        case HEAD:
+            return log_entry_size(entry->type, 0);
+    }
+    return log_entry_size(entry->type, entry->data.cmd.len);
+}
+    
+/**
+ * Compute the CRC32C of an entry; the sender is not covered, since 
+ * it is updated after the entry is appended
+ * ! safe over RDMA 
+ */
+static inline uint32_t
+log_entry_crc( dare_log_entry_t* entry )
+{
+    uint32_t crc = crc32c(entry, offsetof(dare_log_entry_t, crc));
+    crc = crc32c_extend(crc, &entry->clt_id, 
+                    sizeof(entry->clt_id) + sizeof(entry->type));
+    switch(entry->type) {
+        case NOOP:
+            break;
+        case CONFIG:
+            crc = crc32c_extend(crc, &entry->data.cid, sizeof(dare_cid_t));
+            break;
+        case HEAD:
+            crc = crc32c_extend(crc, &entry->data.head, sizeof(uint64_t));
+            break;
+        default:
+            crc = crc32c_extend(crc, &entry->data.cmd, 
+                    sizeof(sm_cmd_t) + entry->data.cmd.len);
+    }
+    return crc;
 }
     
 /** 
  * Check if an entry with data fits between the specified offset and 
- * the buffer end
+ * the buffer end; an entry never ends exactly at the buffer end, 
+ * since end == len means that the log is empty
  * ! safe over RDMA 
  */
 static inline int 
@@ -243,7 +423,41 @@ log_fit_entry( dare_log_t* log,
                 uint64_t offset, 
                 dare_log_entry_t* entry )
 {
-    return (log->len - offset >= log_entry_len(entry));
+    return (log->len - offset > log_entry_len(entry));
+}
+
+/**
+ * Read the end offset once; the leader writes it over RDMA and the 
+ * server thread moves it (log_adopt_entries, log_scan_entries) while 
+ * other threads read it, so the callers work on one atomic snapshot
+ * ! safe over RDMA 
+ */
+static inline uint64_t
+log_load_end( dare_log_t* log )
+{
+    return __atomic_load_n(&log->end, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Set the end offset after the entries before it are written
+ * Note: called only by the server thread
+ */
+static inline void
+log_store_end( dare_log_t* log, uint64_t end )
+{
+    __atomic_store_n(&log->end, end, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the distance between an offset and a snapshot of the end offset 
+ * in the circular buffer
+ */
+static inline uint64_t
+log_end_distance( dare_log_t* log, uint64_t end, uint64_t offset )
+{
+    if (end == log->len) return 0;
+    if (end >= offset) return (end - offset);
+    return (log->len - (offset - end));
 }
 
 /**
@@ -255,14 +469,12 @@ log_fit_entry( dare_log_t* log,
 static inline uint64_t
 log_offset_end_distance( dare_log_t* log, uint64_t offset )
 {
-    uint64_t end = log->end;    // to avoid concurrency
-    if (end == log->len) return 0;
-    if (end >= offset) return (end - offset);
-    return (log->len - (offset - end));
+    return log_end_distance(log, log_load_end(log), offset);
 }
     
 /**
- * Compare two offsets (the larger offset is closer to the end)
+ * Compare two offsets (the larger offset is closer to the end); both 
+ * are measured from the same end offset
  * Note: called by all servers
  * ! safe over RDMA 
  */
@@ -271,14 +483,9 @@ log_is_offset_larger( dare_log_t* log,
                         uint64_t loffset, 
                         uint64_t roffset )
 {
-    uint64_t end = log->end;    // to avoid concurrency
-    uint64_t a = ( end == log->len ? 0 :
-                    (end >= loffset ? end - loffset :
-                        log->len - (loffset - end)) );
-    uint64_t b = ( end == log->len ? 0 :
-                    (end >= roffset ? end - roffset :
-                        log->len - (roffset - end)) );
-    return a < b;
+    uint64_t end = log_load_end(log);
+    return ( log_end_distance(log, end, loffset) < 
+             log_end_distance(log, end, roffset) );
 }
 
                     
@@ -331,6 +538,125 @@ log_get_entry( dare_log_t* log, uint64_t *offset )
     return (dare_log_entry_t*)(log->entries + *offset); 
 }
 
+/**
+ * Get the offset of the entry that follows an existing entry
+ * ! safe over RDMA
+ */
+static inline uint64_t
+log_next_offset( dare_log_t* log, uint64_t offset, dare_log_entry_t *entry )
+{
+    if (!log_fit_entry(log, offset, entry)) {
+        /* Not enough place for an entry (with the command); that 
+         * means the log entry continues on the other side */
+        offset = 0;
+    }
+    return offset + log_entry_len(entry);
+}
+
+/**
+ * Get the entry with a certain idx from the side ring, i.e., in O(1);
+ * the offset is checked against the log, since the entry may have been 
+ * pruned or overwritten in the meantime
+ * Note: called only by the leader or servers with exclusive access 
+ * to local log
+ * @return the entry, or NULL if the ring does not have it
+ */
+static dare_log_entry_t*
+log_ring_get_entry( dare_log_t* log, uint64_t idx, uint64_t *offset )
+{
+    dare_log_entry_det_t *det;
+    dare_log_entry_t *entry;
+    
+    if ( (0 == log_ring.last) || (idx < log_ring.first) || 
+        (idx > log_ring.last) ) 
+    {
+        return NULL;
+    }
+    det = &log_ring.dets[idx & log_ring.mask];
+    if (log_offset_end_distance(log, det->offset) > 
+        log_offset_end_distance(log, log->head)) 
+    {
+        /* Pruned */
+        return NULL;
+    }
+    *offset = det->offset;
+    entry = log_get_entry(log, offset);
+    if ( (NULL == entry) || (entry->idx != idx) || 
+        (entry->term != det->term) ) 
+    {
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+ * Get the entry with a certain idx: from the side ring, or by walking 
+ * the log from the head offset
+ * Note: called only by the leader or servers with exclusive access 
+ * to local log
+ */
+static dare_log_entry_t*
+log_get_entry_by_idx( dare_log_t* log, uint64_t idx, uint64_t *offset )
+{
+    dare_log_entry_t *entry = log_ring_get_entry(log, idx, offset);
+    if (NULL != entry) {
+        return entry;
+    }
+    *offset = log->head;
+    while ( (entry = log_get_entry(log, offset)) != NULL ) {
+        if (entry->idx == idx) return entry;
+        if (entry->idx > idx) return NULL;
+        *offset = log_next_offset(log, *offset, entry);
+    }
+    return NULL;
+}
+
+/**
+ * Get the largest idx that exists on a majority of size servers, given 
+ * the idx of the last entry of each server; the indexes are monotonic, 
+ * so they are compared as plain integers (acks is sorted in place)
+ */
+static inline uint64_t
+log_majority_idx( uint64_t *acks, uint8_t size )
+{
+    uint64_t tmp;
+    int i, k;
+    
+    /* Sort in ascending order (insertion sort; size is small) */
+    for (i = 1; i < size; i++) {
+        tmp = acks[i];
+        for (k = i; (k > 0) && (acks[k-1] > tmp); k--) {
+            acks[k] = acks[k-1];
+        }
+        acks[k] = tmp;
+    }
+    return acks[(size-1)/2];
+}
+
+/**
+ * Get the commit offset once all entries up to idx are committed, 
+ * i.e., the offset after the entry idx (from the side ring)
+ * Note: called only by the leader
+ * @return the new commit offset, or the current one if there are no 
+ * new committed entries
+ */
+static uint64_t
+log_commit_offset( dare_log_t* log, uint64_t idx )
+{
+    dare_log_entry_t *entry;
+    uint64_t offset = log->commit;
+    
+    entry = log_get_entry(log, &offset);
+    if ( (NULL == entry) || (entry->idx > idx) ) {
+        return log->commit;
+    }
+    entry = log_get_entry_by_idx(log, idx, &offset);
+    if (NULL == entry) {
+        return log->commit;
+    }
+    return log_next_offset(log, offset, entry);
+}
+
 /**
  * Create log entry determinants for all not committed log entries
  * Note: called only with exclusive access to local log
@@ -339,11 +665,34 @@ log_get_entry( dare_log_t* log, uint64_t *offset )
 static void 
 log_entries_to_nc_buf( dare_log_t* log, dare_nc_buf_t* nc_buf )
 {
-    dare_log_entry_t *entry;
-    uint64_t offset = log->commit;
-    uint64_t len = 0;
+    dare_log_entry_t *entry, *last;
+    uint64_t offset = log->commit, tail;
+    uint64_t len = 0, idx;
+    
+    /* If the ring has all the entries from the commit offset up to 
+    the tail, copy their determinants */
+    entry = log_get_entry(log, &offset);
+    last = log_ring_get_entry(log, log_ring.last, &tail);
+    if ( (NULL != entry) && (NULL != last) &&
+        (log_ring_get_entry(log, entry->idx, &offset) == entry) &&
+        (log_next_offset(log, tail, last) == log->end) ) 
+    {
+        for (idx = entry->idx; 
+            (idx <= log_ring.last) && (len < nc_buf->cap); idx++) 
+        {
+            nc_buf->entries[len++] = log_ring.dets[idx & log_ring.mask];
+        }
+        nc_buf->len = len;
+        return;
+    }
     
-    while ( (entry = log_get_entry(log, &offset)) != NULL ) {
+    /* Note: the NC-Buffer cannot be full, unless it is smaller than the 
+    log; in that case, the remaining entries are considered not matching 
+    during log adjustment, i.e., they are removed */
+    offset = log->commit;
+    while ( (len < nc_buf->cap) && 
+            (entry = log_get_entry(log, &offset)) != NULL ) 
+    {
         nc_buf->entries[len].idx = entry->idx;
         nc_buf->entries[len].term = entry->term;
         nc_buf->entries[len].offset = offset;
@@ -359,38 +708,70 @@ log_entries_to_nc_buf( dare_log_t* log, dare_nc_buf_t* nc_buf )
 }
 
 /**
- * Seach for the last matching entry between local log and a remote NC-Buffer;
+ * Seach for the last matching entry between local log and a chunk of 
+ * a remote NC-Buffer, i.e., len determinants; the chunks are checked in 
+ * order, so that the leader compares a chunk while reading the next one;
  * used during log adjustment to adjust the remote end offset;
  * called only by the leader
+ * @return 1 if all the determinants match; otherwise, 0 and *end is 
+ * the remote end offset; for the last chunk, *end is set in any case
  * ! safe over RDMA
  */
-static uint64_t 
-log_find_remote_end_offset( dare_log_t* log, dare_nc_buf_t* nc_buf )
+static int
+log_match_nc_chunk( dare_log_t* log, 
+                    dare_log_entry_det_t* dets, 
+                    uint64_t len, 
+                    int last_chunk, 
+                    uint64_t *end )
 {
     uint64_t i;
     dare_log_entry_t *entry;
-    uint64_t offset;
+    dare_log_entry_det_t *det;
+    uint64_t offset = 0;
        
-    for (i = 0; i < nc_buf->len; i++) {
-        offset = nc_buf->entries[i].offset;
+    for (i = 0; i < len; i++) {
+        offset = dets[i].offset;
+        if ( (!last_chunk || (i + 1 < len)) && (0 != log_ring.last) && 
+            (dets[i].idx >= log_ring.first) &&
+            (dets[i].idx <= log_ring.last) ) 
+        {
+            /* Compare with the ring; the last entry is compared with 
+            the log, since the next offset is needed */
+            det = &log_ring.dets[dets[i].idx & log_ring.mask];
+            if ( (det->term != dets[i].term) || (det->offset != offset) ) {
+                *end = offset;
+                return 0;
+            }
+            continue;
+        }
         entry = log_get_entry(log, &offset);
         if (NULL == entry) {
             /* No more local entries */
-            return offset;
+            *end = offset;
+            return 0;
         }
-        if ( (entry->idx != nc_buf->entries[i].idx) ||
-            (entry->term != nc_buf->entries[i].term) )
-        {
-            return offset;
+        if ( (entry->idx != dets[i].idx) || (entry->term != dets[i].term) ) {
+            *end = offset;
+            return 0;
         }
-        if (!log_fit_entry(log, offset, entry)) {
-            /* Not enough place for an entry (with the command); that 
-             * means the log entry continues on the other side */
-            offset = 0;
-        }
-        offset += log_entry_len(entry);
+        offset = log_next_offset(log, offset, entry);
+    }
+    if (last_chunk) {
+        *end = offset;
     }
-    return offset;
+    return 1;
+}
+
+/**
+ * Seach for the last matching entry between local log and a remote NC-Buffer
+ * ! safe over RDMA
+ */
+static uint64_t 
+log_find_remote_end_offset( dare_log_t* log, dare_nc_buf_t* nc_buf )
+{
+    uint64_t end = 0;
+    log_match_nc_chunk(log, nc_buf->entries, nc_buf->len, 1, &end);
+    return end;
 }
 
 /** 
@@ -411,51 +792,360 @@ log_get_tail( dare_log_t* log )
     
     dare_log_entry_t* entry;
     uint64_t offset, tail = log->len;
+    uint64_t starts[3] = {log->commit, log->apply, log->head};
+    int i;
     
-    /* Try to find the tail starting from the commit offset */
-    offset = log->commit;
-    while ( (entry = log_get_entry(log, &offset)) != NULL ) {
-        tail = offset;
-        if (!log_fit_entry(log, offset, entry)) {
-            /* Not enough place for an entry (with the command); that 
-             * means the log entry continues on the other side */
-            offset = 0;
+    /* The last appended entry, if it is still the last one */
+    entry = log_ring_get_entry(log, log_ring.last, &offset);
+    if ( (NULL != entry) && (log_next_offset(log, offset, entry) == log->end) ) {
+        return offset;
+    }
+    
+    /* Try to find the tail starting from the commit offset, then from 
+    the apply offset and then from the head offset; the ring is rebuilt 
+    along the way */
+    for (i = 0; i < 3; i++) {
+        log_ring_reset();
+        offset = starts[i];
+        while ( (entry = log_get_entry(log, &offset)) != NULL ) {
+            tail = offset;
+            log_ring_push(entry->idx, entry->term, offset);
+            offset = log_next_offset(log, offset, entry);
         }
-        offset += log_entry_len(entry);
+        if (tail != log->len) {
+            return tail;
+        }
+    }
+    return tail;
+}
+
+/**
+ * Get the idx of the entry at an offset; if the offset is the end 
+ * offset, the idx of the next entry
+ * Note: called only by the leader
+ */
+static uint64_t
+log_offset_idx( dare_log_t* log, uint64_t offset )
+{
+    dare_log_entry_t *entry = log_get_entry(log, &offset);
+    if (NULL != entry) {
+        return entry->idx;
     }
-    if (tail != log->len) {
-        return tail;
+    if (log->tail == log->len) {
+        log->tail = log_get_tail(log);
     }
+    offset = log->tail;
+    entry = log_get_entry(log, &offset);
+    return entry ? entry->idx + 1 : 1;
+}
+
+/**
+ * Check if an offset is past the end offset, i.e., the leader moved 
+ * the end offset back (log adjustment)
+ * ! safe over RDMA 
+ */
+static inline int
+log_is_offset_past_end( dare_log_t* log, uint64_t offset )
+{
+    uint64_t end = log_load_end(log);
+    if (end == log->len) return (offset != log->len);
+    if ( (offset == log->len) || (end == log->head) ) return 0;
+    return ( (offset + log->len - log->head) % log->len > 
+             (end + log->len - log->head) % log->len );
+}
+
+/**
+ * Append in-band the entries that the leader of a term wrote after 
+ * the end offset, i.e., without waiting for the end offset update: 
+ * an entry is appended once it has the expected idx, the leader's term 
+ * and a valid CRC; the RDMA writes are placed in order, so an entry 
+ * that is not fully written fails the CRC check
+ * Note: an entry of another term may be a left-over of a previous 
+ * leader; such entries are appended only through the end offset 
+ * (the leader writes it until the entries of its term are reached)
+ * Note: called only by followers
+ * @return the number of appended entries; *idx is the idx of the next 
+ * entry
+ */
+static uint64_t
+log_scan_entries( dare_log_t* log, uint64_t *idx, uint64_t term )
+{
+    dare_log_entry_t *entry, *marker;
+    uint64_t offset, end = log_load_end(log), count = 0;
     
-    /* Try to find the tail starting from the apply offset */
-    offset = log->apply;
-    while ( (entry = log_get_entry(log, &offset)) != NULL ) {
-        tail = offset;
+    while (1) {
+        offset = (end == log->len) ? 0 : end;
+        if (!log_fit_entry_header(log, offset)) {
+            offset = 0;
+        }
+        entry = (dare_log_entry_t*)(log->entries + offset);
+        if ( (entry->idx != *idx) || (entry->term != term) ) break;
         if (!log_fit_entry(log, offset, entry)) {
-            /* Not enough place for an entry (with the command); that 
-             * means the log entry continues on the other side */
+            /* The header is a marker; the entry starts from the 
+            beginning and it has the same idx, term and req_id (the 
+            marker has no CRC) */
+            marker = entry;
             offset = 0;
+            entry = (dare_log_entry_t*)(log->entries);
+            if ( (0 != memcmp(entry, marker, 
+                        offsetof(dare_log_entry_t, crc))) ||
+                !log_fit_entry(log, offset, entry) ) 
+            {
+                break;
+            }
+        }
+        if (entry->crc != log_entry_crc(entry)) break;
+        end = offset + log_entry_len(entry);
+        (*idx)++;
+        count++;
+        if (end == log->head) {
+            /* The log is full */
+            break;
         }
-        offset += log_entry_len(entry);
     }
-    if (tail != log->len) {
-        return tail;
+    if (count) {
+        log_store_end(log, end);
     }
+    return count;
+}
+
+/* ================================================================== */
+/* Reservations */
+
+static inline int
+log_rsv_init()
+{
+    log_rsv.active = 0;
+    return pthread_spin_init(&log_rsv.lock, PTHREAD_PROCESS_PRIVATE);
+}
+
+/**
+ * Start accepting reservations after the last entry of the log 
+ * (on becoming leader)
+ * Note: called only by the server thread, with the log adopted
+ */
+static void
+log_rsv_start( dare_log_t* log, uint64_t term )
+{
+    dare_log_entry_t *last_entry;
+    uint64_t offset;
     
-    /* Try to find the tail starting from the head offset */
-    offset = log->head;
-    while ( (entry = log_get_entry(log, &offset)) != NULL ) {
-        tail = offset;
+    if (log->tail == log->len) {
+        log->tail = log_get_tail(log);
+    }
+    offset = log->tail;
+    last_entry = log_get_entry(log, &offset);
+    
+    pthread_spin_lock(&log_rsv.lock);
+    log_rsv.term = term;
+    log_rsv.idx = last_entry ? last_entry->idx : 0;
+    log_rsv.end = log_rsv.published = log->end;
+    log_rsv.active = 1;
+    pthread_spin_unlock(&log_rsv.lock);
+}
+
+/**
+ * Stop accepting reservations (on losing leadership) and wait for 
+ * the reserved entries to be published; the caller adopts them, if 
+ * it still owns the log
+ */
+static void
+log_rsv_stop()
+{
+    pthread_spin_lock(&log_rsv.lock);
+    log_rsv.active = 0;
+    pthread_spin_unlock(&log_rsv.lock);
+    while (log_rsv.published != log_rsv.end);
+}
+
+static inline dare_log_entry_t*
+log_set_entry_header( dare_log_t* log, 
+                    uint64_t offset,
+                    uint64_t req_id, 
+                    uint16_t clt_id, 
+                    uint8_t  type, 
+                    uint16_t cmd_len )
+{
+    dare_log_entry_t *entry = (dare_log_entry_t*)(log->entries + offset);
+    
+    entry->idx     = log_rsv.idx;
+    entry->term    = log_rsv.term;
+    entry->req_id  = req_id;
+    entry->clt_id  = clt_id;
+    entry->type    = type;
+    if ( (NOOP != type) && (CONFIG != type) && (HEAD != type) ) {
+        entry->data.cmd.len = cmd_len;
+    }
+    return entry;
+}
+
+/**
+ * Reserve room for an entry after the last reserved one and fill its 
+ * header; the room is taken from the head, which the server thread 
+ * moves only up to entries that were already adopted
+ * Note: called by the server thread and by the proxy threads
+ * @return the reserved entry or NULL (no reservations or log full);
+ * prev_end is needed to publish the entry
+ */
+static dare_log_entry_t*
+log_reserve_entry( dare_log_t* log, 
+                    uint64_t req_id, 
+                    uint16_t clt_id, 
+                    uint8_t  type, 
+                    uint16_t cmd_len,
+                    uint64_t *prev_end )
+{
+    dare_log_entry_t *entry;
+    uint64_t head, end, offset;
+    uint32_t len = log_entry_size(type, cmd_len);
+    int fits;
+    
+    pthread_spin_lock(&log_rsv.lock);
+    if (!log_rsv.active) goto no_room;
+    end = log_rsv.end;
+    head = log->head;
+    if ( (end != log->len) && log_fit_entry_header(log, end) && 
+        (log->len - end > len) )
+    {
+        offset = end;
+    }
+    else {
+        offset = 0;
+    }
+    if (end == log->len) {
+        /* Empty log */
+        fits = (log->len > len);
+    }
+    else if (end > head) {
+        fits = (offset == end) || (len < head);
+    }
+    else if (end < head) {
+        fits = (offset == end) && (head - end > len);
+    }
+    else {
+        /* Full log */
+        fits = 0;
+    }
+    if (!fits) goto no_room;
+    
+    log_rsv.idx++;
+    if ( (offset != end) && (end != log->len) && 
+        log_fit_entry_header(log, end) ) 
+    {
+        /* Not enough place for the entry (with the command); the 
+        header at the end tells that the entry starts from the 
+        beginning (see log_next_offset) */
+        log_set_entry_header(log, end, req_id, clt_id, type, cmd_len);
+    }
+    entry = log_set_entry_header(log, offset, req_id, clt_id, type, cmd_len);
+    *prev_end = end;
+    log_rsv.end = offset + len;
+    pthread_spin_unlock(&log_rsv.lock);
+    return entry;
+
+no_room:
+    pthread_spin_unlock(&log_rsv.lock);
+    return NULL;
+}
+
+/**
+ * Publish a filled entry, after the entries reserved before it
+ * Note: called by the thread that reserved the entry
+ */
+static inline void
+log_publish_entry( dare_log_t* log, 
+                    dare_log_entry_t* entry, 
+                    uint64_t prev_end )
+{
+    uint64_t offset = (uint8_t*)entry - log->entries;
+    
+    entry->crc = log_entry_crc(entry);
+    while (log_rsv.published != prev_end);
+    __sync_synchronize();
+    log_rsv.published = offset + log_entry_len(entry);
+}
+
+/**
+ * Adopt the published entries: the end (and the tail) of the log 
+ * moves over them
+ * Note: called only by the server thread, while leader
+ * @return the number of adopted entries
+ */
+static uint64_t
+log_adopt_entries( dare_log_t* log )
+{
+    dare_log_entry_t *entry;
+    uint64_t offset, count = 0;
+    uint64_t published = log_rsv.published;
+    
+    __sync_synchronize();
+    while (log->end != published) {
+        offset = log->end;
+        if ( (offset == log->len) || !log_fit_entry_header(log, offset) ) {
+            offset = 0;
+        }
+        entry = (dare_log_entry_t*)(log->entries + offset);
         if (!log_fit_entry(log, offset, entry)) {
-            /* Not enough place for an entry (with the command); that 
-             * means the log entry continues on the other side */
             offset = 0;
+            entry = (dare_log_entry_t*)(log->entries);
         }
-        offset += log_entry_len(entry);
+        log_ring_push(entry->idx, entry->term, offset);
+        log->tail = offset;
+        log_store_end(log, offset + log_entry_len(entry));
+        count++;
     }
-    return tail;
+    if (count) {
+        /* Avoid double HEAD */
+        prev_log_entry_head = 0;
+    }
+    return count;
+}
+
+/**
+ * Append an entry through a reservation; see log_append_entry
+ * Note: called only by the server thread
+ */
+static uint64_t
+log_append_reserved( dare_log_t* log,
+                    uint64_t req_id,
+                    uint16_t clt_id,
+                    uint8_t  type,
+                    void *data )
+{
+    dare_log_entry_t *entry;
+    uint64_t prev_end;
+    sm_cmd_t *cmd = (sm_cmd_t*)data;
+    uint16_t cmd_len = 0;
+    
+    if ( (NOOP != type) && (CONFIG != type) && (HEAD != type) ) {
+        cmd_len = cmd->len;
+    }
+    entry = log_reserve_entry(log, req_id, clt_id, type, cmd_len, &prev_end);
+    if (!entry) {
+        info_wtime(log_fp, "The LOG is full\n");
+        return 0;
+    }
+    switch(type) {
+        case CONFIG:
+            entry->data.cid = *(dare_cid_t*)data;
+            break;
+        case HEAD:
+            entry->data.head = *(uint64_t*)data;
+            break;
+        case NOOP:
+            break;
+        default:
+            if (cmd_len) {
+                memcpy(entry->data.cmd.cmd, cmd->cmd, cmd_len);
+            }
+    }
+    log_publish_entry(log, entry, prev_end);
+    log_adopt_entries(log);
+    return entry->idx;
 }
 
+/* ================================================================== */
+
 /**
  * Append an entry to the local log; 
  * called only by the leader
@@ -478,6 +1168,11 @@ log_append_entry( dare_log_t* log,
         /* Avoid double HEAD */
         prev_log_entry_head = 0;
     }
+    
+    if (log_rsv.active) {
+        /* Reserve the entry after the ones of the proxy threads */
+        return log_append_reserved(log, req_id, clt_id, type, data);
+    }
 
     /* Compute new index */
     if (log->tail == log->len) {
@@ -498,7 +1193,6 @@ log_append_entry( dare_log_t* log,
     entry->req_id  = req_id;
     entry->clt_id  = clt_id;
     entry->type    = type;
-    memset(entry->reply, 0, MAX_SERVER_COUNT);
     if (!log_fit_entry_header(log, log->end)) {
         log->end = 0;
     }
@@ -534,7 +1228,6 @@ log_append_entry( dare_log_t* log,
                 entry->clt_id       = clt_id;
                 entry->type         = type;
                 entry->data.cmd.len = cmd->len;
-                memset(entry->reply, 0, MAX_SERVER_COUNT);
             }
             /* Copy the command */
             if (cmd->len) {
@@ -543,8 +1236,11 @@ log_append_entry( dare_log_t* log,
             break;
         }
     }
+    entry->crc = log_entry_crc(entry);
+    
     /* Set new tail (offset of last entry) */
     log->tail = log->end;
+    log_ring_push(idx, term, log->tail);
     /* Set new end */
     log->end += log_entry_len(entry);
 
@@ -557,4 +1253,69 @@ log_append_entry( dare_log_t* log,
     return idx;
 }
 
+/**
+ * Validate a log restored from a file: walk the entries from the head 
+ * offset up to the commit offset and stop at the first entry that fails 
+ * the CRC check or does not follow its predecessor; only the valid 
+ * committed entries are kept, i.e., end = commit = apply
+ * Note: called only with exclusive access to local log
+ * @return the number of restored entries
+ */
+static uint64_t
+log_restore( dare_log_t* log )
+{
+    dare_log_entry_t *entry, *prev = NULL;
+    uint64_t offset, walked = 0, count = 0;
+    
+    memset(log->nc, 0, MAX_SERVER_COUNT * sizeof(dare_nc_desc_t));
+    /* No in-band entries until a leader adjusts the log */
+    log->band_idx = log->band_term = 0;
+    if ( (0 == log->len) || (log->end >= log->len) || 
+        (log->head >= log->len) || (log->commit >= log->len) ) 
+    {
+        /* Empty or not a valid log */
+        goto empty_log;
+    }
+    
+    offset = log->head;
+    while (walked < log->len) {
+        if ( (offset == log->commit) || (offset == log->end) ) break;
+        if (!log_fit_entry_header(log, offset)) {
+            offset = 0;
+            if ( (offset == log->commit) || (offset == log->end) ) break;
+        }
+        entry = (dare_log_entry_t*)(log->entries + offset);
+        if (!log_fit_entry(log, offset, entry)) {
+            /* The entry continues on the other side */
+            offset = 0;
+            entry = (dare_log_entry_t*)(log->entries);
+            if (!log_fit_entry(log, offset, entry)) break;
+        }
+        if ( (entry->crc != log_entry_crc(entry)) || 
+            ((NULL != prev) && ((entry->idx != prev->idx + 1) || 
+                                (entry->term < prev->term))) )
+        {
+            /* Not a valid entry */
+            break;
+        }
+        prev = entry;
+        count++;
+        walked += log_entry_len(entry);
+        offset += log_entry_len(entry);
+    }
+    if (0 == count) {
+        goto empty_log;
+    }
+    log->end = log->commit = log->apply = offset;
+    log->tail = log->len;
+    log->old_end = log->old_commit = offset;
+    return count;
+
+empty_log:
+    log->head = log->apply = log->commit = 0;
+    log->end = log->tail = log->old_end = log->len;
+    log->old_commit = 0;
+    return 0;
+}
+
 #endif /* DARE_LOG_H */
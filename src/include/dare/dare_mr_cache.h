@@ -0,0 +1,47 @@
+/**
+ * DARE (Direct Access REplication)
+ *
+ * Memory registration cache
+ *
+ * Copyright (c) 2014-2015 ETH-Zurich. All rights reserved.
+ *
+ * Author(s): Marius Poke <marius.poke@inf.ethz.ch>
+ *
+ */
+
+#ifndef DARE_MR_CACHE_H
+#define DARE_MR_CACHE_H
+
+#include <infiniband/verbs.h> /* OFED stuff */
+#include "../../../utils/rbtree/include/rbtree.h"
+
+/* Registrations kept while not in use; the least recently used
+ * unused one is dropped first */
+#define MR_CACHE_MAX 16
+
+/* ================================================================== */
+
+/* Registered address range [start, last]; the entries are kept in
+ * an interval tree, i.e., an RB-tree sorted by start and augmented
+ * with the largest last of each subtree */
+struct mr_entry_t {
+    struct rb_node node;
+    uint64_t start;
+    uint64_t last;
+    uint64_t subtree_last;
+    struct ibv_mr *mr;
+    int access;             // access flags of the registration
+    uint32_t refs;          // users of the registration
+    uint64_t used;          // last use (see mr_cache_get)
+};
+typedef struct mr_entry_t mr_entry_t;
+
+/* ================================================================== */
+
+struct ibv_mr* mr_cache_get( struct rb_root *root, struct ibv_pd *pd,
+                             void *addr, uint64_t len, int access );
+void mr_cache_put( struct rb_root *root, struct ibv_mr *mr );
+void mr_cache_invalidate( struct rb_root *root, void *addr, uint64_t len );
+void mr_cache_free( struct rb_root *root );
+
+#endif /* DARE_MR_CACHE_H */
@@ -19,6 +19,7 @@
 #include "./dare_log.h"
 #include "./dare.h"
 #include "./timer.h"
+#include "./dare_stage.h"
 
 /* Server types */
 #define SRV_TYPE_START  1
@@ -41,6 +42,24 @@ extern uint64_t elec_timeout_high;
 extern double rc_info_period;
 extern double retransmit_period;
 extern double log_pruning_period;
+extern double catchup_rate;
+extern uint64_t log_size_mb;
+extern int log_hugepages;
+extern int log_window;
+extern double idle_timeout;
+extern double idle_poll_period;
+extern int loggp_tune;
+extern char loggp_profile[128];
+extern double tune_latency_target;
+extern double lease_period;
+extern double lease_drift;
+extern int pipeline_stages;
+extern int cpu_dare;
+extern int cpu_persist;
+extern int cpu_apply;
+extern char transport[16];
+extern char shm_fabric[64];
+extern double shm_latency;
 
 /**
  * The state identifier (SID)
@@ -75,23 +94,60 @@ extern double log_pruning_period;
 server as permanently failed */
 #define PERMANENT_FAILURE   2
 
+/* Period (seconds) after which a donor stops reserving its catch-up 
+buffer for a follower that does not come back for the next chunk */
+#define CATCHUP_LEASE   1.
+/* Period (seconds) after which a snapshot transfer without progress 
+is abandoned, by both the donor and the joiner */
+#define SM_LEASE        2.
+
 /* Normal operation (log replication) steps */
 #define LR_GET_WRITE      1
 #define LR_GET_NCE_LEN    2
 #define LR_GET_NCE        3
 #define LR_SET_END        4
 #define LR_UPDATE_LOG     5
-#define LR_UPDATE_END     6
+
+/* Log update window: up to log_window ranges of the log are written 
+to a server without waiting for the previous ones to complete; a range 
+is identified by the WR ID (i.e., the ssn) of its writes. The remote end 
+offset is updated once a range completes, chained with the next range */
+#define LR_WINDOW_MAX   32
+struct lr_window_t {
+    uint64_t wr_id[LR_WINDOW_MAX];  // WR ID of each outstanding range
+    uint64_t end[LR_WINDOW_MAX];    // end offset after each range
+    uint8_t  parts[LR_WINDOW_MAX];  // writes to complete (2 if wrapped)
+    uint8_t  head;          // oldest outstanding range
+    uint8_t  count;         // number of outstanding ranges
+    uint8_t  failed;        // a write failed; wait for the window to drain
+    uint64_t sent_end;      // end offset after the last range posted
+    uint64_t acked_end;     // end offset after the last range completed
+    uint64_t remote_end;    // end offset set on the remote server
+    uint64_t end_wr_id;     // WR ID of the end offset update; 0 if none
+};
+typedef struct lr_window_t lr_window_t;
 
 struct server_t {
     uint64_t next_wr_id;    // next WR ID to wait for
-    uint64_t cached_end_offset; // the new end offset if the log update succeeds
-    uint64_t last_get_read_ssn; // ssn of the last get read operation
+    uint64_t status_hb;     // HB counter of the last status record used
+    uint64_t hb_ack_idx;    // ack at the last HB (see rc_send_hb)
     void *ep;               // endpoint data (network related)
     uint8_t fail_count;     // number of failures detected
     uint8_t next_lr_step;   // next log replication step 
     uint8_t send_flag;      // flag set for posting send for this EP
-    uint8_t send_count;     // number of sends poster for current step
+    lr_window_t win;        // outstanding log updates (LR_UPDATE_LOG)
+    uint64_t cu_seq;        // seq of the last catch-up request served
+    uint64_t cu_head_idx;   // head idx of the last catch-up notice sent
+    uint64_t nc_read;       // NC-Buffer determinants read (log adjustment)
+    uint64_t nc_checked;    // NC-Buffer determinants compared
+    uint64_t nc_end;        // remote end offset found by the comparison
+    uint8_t  nc_done;       // nc_end is set
+    double   lease_ts;      // the server promised not to vote until 
+                            // lease_ts + lease_period (leader's clock)
+    uint64_t lease_ssn;     // ssn of the HB that renews the lease
+    double   lease_hb_ts;   // when that HB was posted
+    uint64_t lease_idx;     // idx of the entry that renews the lease
+    double   lease_idx_ts;  // when that entry was posted
 };
 
 //typedef struct server_t server_t;
@@ -112,14 +168,73 @@ struct prv_data_t {
 };
 typedef struct prv_data_t prv_data_t;
 
+/* SM reply: the snapshot is sent in chunks; the reply describes the 
+chunk seq, which is acknowledged through sm_ack before the next one is 
+published (see poll_sm_requests)
+Note: seq is the last field, so that it is placed last */
 struct sm_rep_t {
     uint64_t sid;
     uint64_t raddr;
     uint32_t rkey;
-    uint32_t len;
+    uint32_t len;       // length of the chunk (with the header)
+    uint64_t offset;    // offset of the chunk data in the snapshot
+    uint64_t total;     // upper bound of the snapshot length
+    uint64_t last;      // 1 for the last chunk
+    uint64_t seq;       // chunk number, from 1
 };
 typedef struct sm_rep_t sm_rep_t;
 
+/* Catch-up notice: the leader advanced the head offset past the 
+apply offset of a follower; the entries before head_idx must be 
+fetched from the stable storage of the donor */
+struct cu_notice_t {
+    uint64_t sid;       // SID of the leader
+    uint64_t head;      // head offset; the log is valid from here
+    uint64_t head_idx;  // index of the entry at the head offset
+    uint64_t donor;     // server that serves the missing records
+};
+typedef struct cu_notice_t cu_notice_t;
+
+/* Catch-up request: get the records in [from_idx, to_idx)
+Note: seq is the last field, so that it is placed last */
+struct cu_req_t {
+    uint64_t from_idx;
+    uint64_t to_idx;
+    uint64_t seq;
+};
+typedef struct cu_req_t cu_req_t;
+
+/* Catch-up reply: a chunk with the records in [from_idx, last_idx];
+last_idx == 0 means the donor cannot serve the request */
+struct cu_rep_t {
+    uint64_t raddr;
+    uint32_t rkey;
+    uint32_t len;
+    uint64_t last_idx;
+    uint64_t seq;
+};
+typedef struct cu_rep_t cu_rep_t;
+
+/* Status record of a server: each server writes its own record into 
+status[own idx] of the others, in one RDMA write (a cache line); the 
+HB counter tells a new record. Followers send it with the acks (see 
+rc_send_entries_reply); thus, an ack is a HB and carries the apply 
+offset, which the leader needs for pruning the log; the HBs carry 
+only the SID and the HB counter (see send_status) */
+struct status_t {
+    uint64_t sid;       // SID of the sender
+    uint64_t hb;        // HB counter, incremented for every record
+    uint64_t ack_idx;   // last persisted entry
+    uint64_t apply;     // apply offset
+    uint64_t ack_term;  // term of the leader that got ack_idx
+    uint64_t pad[3];
+} __attribute__((aligned(64)));
+typedef struct status_t status_t;
+
+/* Scratch area for the start-up tuning (see rc_tune); large enough 
+for the biggest measured write */
+#define TUNE_BUF_SIZE   4096
+
 struct ctrl_data_t {
     /* State identified (SID) */
     uint64_t    sid;
@@ -129,16 +244,37 @@ struct ctrl_data_t {
     log_offsets_t log_offsets[MAX_SERVER_COUNT];	/* log offsets */
     sm_rep_t      sm_rep[MAX_SERVER_COUNT];
     uint64_t      sm_req[MAX_SERVER_COUNT];
-    uint64_t 	  hb[MAX_SERVER_COUNT];             /* heartbeat array */ 
+    uint64_t      sm_ack[MAX_SERVER_COUNT];     /* SM chunks received */
+    status_t      status[MAX_SERVER_COUNT];     /* HBs & acks */
     uint64_t      vote_ack[MAX_SERVER_COUNT];
     uint64_t      rsid[MAX_SERVER_COUNT];   /* for remote terms & indexes */
     uint64_t      apply_offsets[MAX_SERVER_COUNT];   /* apply offsets */
+    cu_notice_t   cu_notice[MAX_SERVER_COUNT];  /* catch-up notices */
+    cu_req_t      cu_req[MAX_SERVER_COUNT];     /* catch-up requests */
+    cu_rep_t      cu_rep[MAX_SERVER_COUNT];     /* catch-up replies */
     
     /* Remote private data */
     prv_data_t  prv_data[MAX_SERVER_COUNT];    // private data
+    
+    /* Scratch area written by the other servers while tuning */
+    uint8_t     tune_buf[TUNE_BUF_SIZE];
 };
 typedef struct ctrl_data_t ctrl_data_t;
 
+/* Log region: the control data and the log can be backed by a file, 
+so that a restarted server recovers from its own log; the file holds 
+[log_region_hdr_t][ctrl_data_t][dare_log_t], each part page aligned */
+#define LOG_REGION_MAGIC    0x4745524552414400ULL
+#define LOG_REGION_VERSION  8
+struct log_region_hdr_t {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t ctrl_size;     // sizeof(ctrl_data_t)
+    uint64_t log_size;      // sizeof(dare_log_t) + log->len
+    uint64_t cu_min_idx;    // first idx the stable storage can serve
+};
+typedef struct log_region_hdr_t log_region_hdr_t;
+
 struct dare_server_input_t {
     FILE* log;
     char* name;
@@ -150,11 +286,16 @@ struct dare_server_input_t {
     
     proxy_do_action_cb_t do_action;
     proxy_store_cmd_cb_t store_cmd;
-    proxy_create_db_snapshot_cb_t create_db_snapshot;
+    proxy_get_db_chunk_cb_t get_db_chunk;
     proxy_get_db_size_cb_t get_db_size;
     proxy_apply_db_snapshot_cb_t apply_db_snapshot;
     proxy_update_state_cb_t update_state;
+    proxy_get_db_records_cb_t get_db_records;
+    proxy_apply_db_records_cb_t apply_db_records;
+    proxy_get_db_last_idx_cb_t get_db_last_idx;
+    proxy_replay_db_cb_t replay_db;
     char config_path[128];
+    char log_region[128];   // file backing the log region; "" for none
     void* up_para;
 };
 typedef struct dare_server_input_t dare_server_input_t;
@@ -177,8 +318,68 @@ struct dare_server_data_t {
     ctrl_data_t *ctrl_data;  // control data (state & private data)
     dare_log_t  *log;       // local log (remotely accessible)
     dare_sm_t   *sm;        // local state machine
-    snapshot_t  *prereg_snapshot;
-    snapshot_t  *snapshot;
+    snapshot_t  *sm_chunk[2];   // snapshot chunks (remotely accessible)
+    snapshot_t  *snapshot;      // snapshot being received
+    uint64_t    snapshot_size;  // size of the snapshot buffer
+    
+    /* Snapshot transfer (joiner side) */
+    uint8_t     sm_donor;       // server sending the snapshot
+    uint64_t    sm_seq;         // last chunk received
+    ev_tstamp   sm_ts;          // time of the last chunk
+    ev_tstamp   sm_req_ts;      // time of the first SM request
+    void        *cu_buf;    // catch-up chunk (remotely accessible)
+    
+    /* NC-Buffers: own buffer (remotely accessible), followed by 
+    two chunks per server, where the leader reads the remote ones */
+    dare_nc_buf_t *nc_buf;
+    dare_log_entry_det_t *nc_chunks;
+    uint64_t    nc_len;         // length of the NC region
+    ev_tstamp   lead_ts;        // time the election was won
+    uint64_t    lead_nc;        // own not committed entries at that time
+    
+    /* In-band entries (see append_inband_entries) */
+    uint64_t    band_term;      // term of the last log adjustment
+    uint64_t    band_sync;      // idx set by the last log adjustment
+    uint64_t    band_idx;       // idx of the next entry
+    
+    /* Catch-up from stable storage */
+    uint64_t    cu_min_idx;     // first idx this server can serve
+    uint64_t    cu_from_idx;    // first idx still missing
+    uint64_t    cu_to_idx;      // idx of the entry at cu_head
+    uint64_t    cu_head;        // offset from where the log is valid
+    uint64_t    cu_seq;         // seq of the last catch-up request
+    uint8_t     cu_donor;       // server serving the missing records
+    uint8_t     cu_owner;       // follower that holds our cu_buf
+    ev_tstamp   cu_owner_ts;    // time cu_buf was handed to cu_owner
+    ev_tstamp   cu_req_ts;      // time of the last catch-up request
+    ev_tstamp   cu_next_ts;     // throttling: time of the next chunk
+    
+    /* Log region backed by a file (see init_log_region) */
+    log_region_hdr_t *region;   // mapped file; NULL if on the heap
+    uint64_t    region_len;
+    int         region_fd;
+    uint64_t    log_map_len;    // mapped length of the log (not in a region)
+    uint64_t    log_page_size;  // page size backing the log
+    uint64_t    forced_prunings;
+    uint64_t    rst_head;       // head offset of the restored log
+    uint64_t    rst_end;        // offset after the last restored entry;
+                                // log->len if nothing was restored
+    
+    /* Pipeline: the persist and apply stages run in their own threads; 
+    the DARE thread ingests and replicates (see store_entry) */
+    stage_t     persist_stage;  // stores the commands in stable storage
+    stage_t     apply_stage;    // replays the commands (followers)
+    uint64_t    persist_idx;    // idx of the last stored or queued entry
+    uint64_t    persist_ack;    // idx of the last acknowledged entry
+    uint8_t     persist_sender; // leader that sent the last entry
+    
+    /* Idle mode: without activity for idle_timeout, the server stops 
+    busy-polling and sleeps in the EV loop (see enter_idle_mode) */
+    int         kick_fd;        // eventfd kicked by the proxy threads
+    volatile int sleeping;      // the proxy threads must kick the server
+    uint64_t    activity;       // progress at the last activity
+    ev_tstamp   active_ts;      // time of the last activity
+    uint64_t    idle_count;     // times the server went to sleep
     
     struct rb_root endpoints;   // RB-tree with remote endpoints
     uint64_t last_write_csm_idx;
@@ -201,5 +402,10 @@ void server_to_follower();
 int server_update_sid( uint64_t new_sid, uint64_t old_sid );
 int is_leader();
 uint8_t get_node_id();
+dare_log_entry_t* dare_reserve_request( uint64_t req_id, uint16_t clt_id, 
+                    uint8_t type, uint16_t len, uint64_t *prev_end );
+void dare_publish_request( dare_log_entry_t* entry, void *buf, 
+                    uint64_t prev_end );
+void dare_kick();
 
 #endif /* DARE_SERVER_H */
@@ -39,12 +39,16 @@ typedef void (*destroy_cb_t)(dare_sm_t *sm);
 /* Apply a command to the state machine */
 typedef int (*apply_cmd_cb_t)(dare_sm_t *sm, sm_cmd_t *cmd, sm_data_t *data);
 
-typedef void (*proxy_store_cmd_cb_t)(void* data,void *arg);
+typedef void (*proxy_store_cmd_cb_t)(uint64_t idx,void* data,void *arg);
 typedef void (*proxy_do_action_cb_t)(uint16_t clt_id,uint8_t type,size_t data_size,void* data,void *arg);
-typedef void (*proxy_create_db_snapshot_cb_t)(void *snapshot,void *arg);
-typedef uint32_t (*proxy_get_db_size_cb_t)(void *arg);
-typedef int (*proxy_apply_db_snapshot_cb_t)(void *snapshot,uint32_t size,void *arg);
+typedef int (*proxy_get_db_chunk_cb_t)(uint64_t to_idx,uint64_t *pos,void *buf,uint32_t max_len,uint32_t *len,void *arg);
+typedef uint64_t (*proxy_get_db_size_cb_t)(void *arg);
+typedef int (*proxy_apply_db_snapshot_cb_t)(void *snapshot,uint64_t size,void *arg);
 typedef void (*proxy_update_state_cb_t)(void *arg);
+typedef uint32_t (*proxy_get_db_records_cb_t)(uint64_t from_idx,uint64_t to_idx,void *buf,uint32_t max_len,uint64_t *last_idx,void *arg);
+typedef int (*proxy_apply_db_records_cb_t)(void *buf,uint32_t size,void *arg);
+typedef uint64_t (*proxy_get_db_last_idx_cb_t)(void *arg);
+typedef int (*proxy_replay_db_cb_t)(uint64_t to_idx,void *arg);
 
 struct dare_sm_t {
     destroy_cb_t   destroy;
@@ -53,9 +57,13 @@ struct dare_sm_t {
     proxy_store_cmd_cb_t proxy_store_cmd;
     proxy_do_action_cb_t proxy_do_action;
     proxy_get_db_size_cb_t proxy_get_db_size;
-    proxy_create_db_snapshot_cb_t proxy_create_db_snapshot;
+    proxy_get_db_chunk_cb_t proxy_get_db_chunk;
     proxy_apply_db_snapshot_cb_t proxy_apply_db_snapshot;
     proxy_update_state_cb_t proxy_update_state;
+    proxy_get_db_records_cb_t proxy_get_db_records;
+    proxy_apply_db_records_cb_t proxy_apply_db_records;
+    proxy_get_db_last_idx_cb_t proxy_get_db_last_idx;
+    proxy_replay_db_cb_t proxy_replay_db;
     void* up_para;
 };
 
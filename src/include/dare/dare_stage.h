@@ -0,0 +1,93 @@
+/**
+ * DARE (Direct Access REplication)
+ *
+ * Pipeline stages: helper threads fed by the DARE thread through
+ * single-producer single-consumer rings
+ *
+ * Copyright (c) 2014-2015 ETH-Zurich. All rights reserved.
+ *
+ * Author(s): Marius Poke <marius.poke@inf.ethz.ch>
+ *
+ */
+
+#ifndef DARE_STAGE_H
+#define DARE_STAGE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* Size of the ring of a stage; a record larger than half of it is
+not queued (see stage_push) */
+#define STAGE_RING_SIZE (8 << 20)
+/* Empty polls before a stage thread sleeps */
+#define STAGE_SPIN 100000
+
+/* Record: a copy of a log entry, from clt_id on (as the SM callbacks
+get it); the log may be overwritten before the stage gets to it */
+struct stage_rec_t {
+    uint64_t idx;           // idx of the log entry
+    uint32_t len;           // length of data; STAGE_PAD: skip to the start
+    uint16_t clt_id;
+    uint8_t  type;
+    uint8_t  sender;
+    char     data[0];
+};
+typedef struct stage_rec_t stage_rec_t;
+#define STAGE_PAD ((uint32_t)-1)
+
+typedef void (*stage_handler_t)(stage_rec_t *rec, void *arg);
+
+/* Stage: the DARE thread is the only producer and the stage thread
+the only consumer; head and tail count bytes and never wrap */
+struct stage_t {
+    /* Written by the DARE thread */
+    volatile uint64_t head __attribute__((aligned(64)));
+    /* Written by the stage thread */
+    volatile uint64_t tail __attribute__((aligned(64)));
+    volatile uint64_t done;         // idx of the last handled record
+                                    // (0 after a drain)
+    volatile int sleeping;          // the producer must signal cond
+
+    char *ring __attribute__((aligned(64)));
+    const char *name;
+    stage_handler_t handler;
+    void *arg;
+    int cpu;                        // CPU to pin to; -1: no pinning
+    int active;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+typedef struct stage_t stage_t;
+
+/* ================================================================== */
+
+int stage_start( stage_t *stage, const char *name, int cpu,
+                 stage_handler_t handler, void *arg );
+void stage_stop( stage_t *stage );
+int stage_push( stage_t *stage, uint64_t idx, uint16_t clt_id,
+                uint8_t type, uint8_t sender, void *data, uint32_t len );
+void stage_drain( stage_t *stage );
+int stage_pin( pthread_t thread, int cpu );
+
+/**
+ * idx of the last record handled by the stage; 0 if none since the 
+ * last drain
+ */
+static inline uint64_t
+stage_done( stage_t *stage )
+{
+    return stage->done;
+}
+
+/**
+ * Check if the stage handled all the queued records
+ */
+static inline int
+stage_empty( stage_t *stage )
+{
+    return (stage->tail == stage->head);
+}
+
+#endif /* DARE_STAGE_H */
@@ -0,0 +1,103 @@
+/**
+ * DARE (Direct Access REplication)
+ *
+ * Transport: the verbs used by the IB modules, provided either by
+ * libibverbs or by a shared-memory emulation of the fabric (all the
+ * servers on one host)
+ *
+ * Copyright (c) 2014-2015 ETH-Zurich. All rights reserved.
+ *
+ * Author(s): Marius Poke <marius.poke@inf.ethz.ch>
+ *
+ */
+
+#ifndef DARE_TP_H
+#define DARE_TP_H
+
+#include <infiniband/verbs.h> /* OFED IB verbs */
+
+/* The verbs have the signatures of libibverbs, so that the IB modules
+call dare_tp->X where they would call ibv_X */
+struct dare_tp_ops_t {
+    const char *name;
+
+    /* Device */
+    struct ibv_device** (*get_device_list)(int *num_devices);
+    void (*free_device_list)(struct ibv_device **list);
+    const char* (*get_device_name)(struct ibv_device *device);
+    struct ibv_context* (*open_device)(struct ibv_device *device);
+    int (*close_device)(struct ibv_context *context);
+    int (*query_device)(struct ibv_context *context,
+                        struct ibv_device_attr *attr);
+    int (*query_device_ex)(struct ibv_context *context,
+                           const struct ibv_query_device_ex_input *input,
+                           struct ibv_device_attr_ex *attr);
+    int (*query_port)(struct ibv_context *context, uint8_t port_num,
+                      struct ibv_port_attr *attr);
+    int (*query_gid)(struct ibv_context *context, uint8_t port_num,
+                     int index, union ibv_gid *gid);
+    int (*query_pkey)(struct ibv_context *context, uint8_t port_num,
+                      int index, uint16_t *pkey);
+
+    /* Protection domains and memory regions */
+    struct ibv_pd* (*alloc_pd)(struct ibv_context *context);
+    int (*dealloc_pd)(struct ibv_pd *pd);
+    struct ibv_mr* (*reg_mr)(struct ibv_pd *pd, void *addr,
+                             size_t length, int access);
+    int (*dereg_mr)(struct ibv_mr *mr);
+    /* Memory that the peers access (registered with remote access)
+    comes from here: page aligned, zero filled and prefaulted; the shm
+    backend backs it by a file that the peers map. Not a verb, so it
+    can be used before the device is opened */
+    void* (*alloc_buf)(size_t length);
+    void (*free_buf)(void *addr, size_t length);
+
+    /* Completion queues and events */
+    struct ibv_comp_channel* (*create_comp_channel)(struct ibv_context *context);
+    int (*destroy_comp_channel)(struct ibv_comp_channel *channel);
+    struct ibv_cq* (*create_cq)(struct ibv_context *context, int cqe,
+                                void *cq_context,
+                                struct ibv_comp_channel *channel,
+                                int comp_vector);
+    int (*destroy_cq)(struct ibv_cq *cq);
+    int (*req_notify_cq)(struct ibv_cq *cq, int solicited_only);
+    int (*get_cq_event)(struct ibv_comp_channel *channel,
+                        struct ibv_cq **cq, void **cq_context);
+    void (*ack_cq_events)(struct ibv_cq *cq, unsigned int nevents);
+    int (*poll_cq)(struct ibv_cq *cq, int num_entries, struct ibv_wc *wc);
+
+    /* Queue pairs */
+    struct ibv_qp* (*create_qp)(struct ibv_pd *pd,
+                                struct ibv_qp_init_attr *attr);
+    int (*modify_qp)(struct ibv_qp *qp, struct ibv_qp_attr *attr,
+                     int attr_mask);
+    int (*query_qp)(struct ibv_qp *qp, struct ibv_qp_attr *attr,
+                    int attr_mask, struct ibv_qp_init_attr *init_attr);
+    int (*destroy_qp)(struct ibv_qp *qp);
+    int (*post_send)(struct ibv_qp *qp, struct ibv_send_wr *wr,
+                     struct ibv_send_wr **bad_wr);
+    int (*post_recv)(struct ibv_qp *qp, struct ibv_recv_wr *wr,
+                     struct ibv_recv_wr **bad_wr);
+
+    /* UD: address handles and multicast */
+    struct ibv_ah* (*create_ah)(struct ibv_pd *pd, struct ibv_ah_attr *attr);
+    int (*destroy_ah)(struct ibv_ah *ah);
+    int (*attach_mcast)(struct ibv_qp *qp, const union ibv_gid *gid,
+                        uint16_t lid);
+    int (*detach_mcast)(struct ibv_qp *qp, const union ibv_gid *gid,
+                        uint16_t lid);
+};
+typedef struct dare_tp_ops_t dare_tp_ops_t;
+
+extern const dare_tp_ops_t dare_tp_ibv_ops;
+extern const dare_tp_ops_t dare_tp_shm_ops;
+
+/* The selected transport (libibverbs unless selected otherwise) */
+extern const dare_tp_ops_t *dare_tp;
+
+/* ================================================================== */
+
+int dare_tp_select( const char *name );
+void dare_tp_shm_config( const char *fabric, double latency );
+
+#endif /* DARE_TP_H */
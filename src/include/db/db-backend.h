@@ -0,0 +1,42 @@
+#ifndef DB_BACKEND_H
+#define DB_BACKEND_H
+#include <pthread.h>
+#include "db-interface.h"
+
+// called for every record during a scan; return non-zero to stop
+typedef int (*db_record_cb)(uint64_t idx,const void* data,uint32_t size,uint32_t crc,void* arg);
+
+typedef struct db_ops_t{
+    const char* name;
+    int (*open)(db*,const char* db_name,uint32_t flag);
+    void (*close)(db*,uint32_t mode);
+    int (*append)(db*,uint64_t idx,const void* data,uint32_t size,uint32_t crc);
+    // optional; the records are not indexed; *stored is the number of 
+    // records written (the first ones), also on error
+    int (*append_batch)(db*,uint32_t count,void** data,uint32_t* sizes,uint32_t* crcs,uint32_t* stored);
+    // walk the records in append order, starting at the position *pos 
+    // (0 is the first record); *pos is advanced past every record the 
+    // callback accepts; returns -1 if the position is no longer available
+    int (*walk)(db*,uint64_t* pos,db_record_cb cb,void* arg);
+    // walk the indexed records with idx >= from_idx (from_idx > 0); 
+    // returns -1 if some of them are no longer available
+    int (*scan)(db*,uint64_t from_idx,db_record_cb cb,void* arg);
+    // optional; compact the stored records (called under the lock)
+    int (*compact)(db*);
+}db_ops;
+
+struct db_t{
+    const db_ops* ops;
+    void* priv;             // backend state
+    db_config cfg;
+    uint64_t last_idx;      // highest indexed log idx
+    uint64_t record_count;  // number of records
+    uint64_t records_len;   // length of the records (without CRCs)
+    pthread_mutex_t lock;   // the snapshot thread reads while the proxy appends
+};
+
+extern const db_ops db_bdb_ops;
+extern const db_ops db_file_ops;
+extern const db_ops db_mem_ops;
+
+#endif
@@ -5,14 +5,56 @@
 
 typedef struct db_t db;
 
-db* initialize_db(const char* db_name,uint32_t flag);
+// stable storage options (see nodes.local.cfg)
+typedef struct db_config_t{
+    char backend[16];       // "bdb", "file" or "mem"
+    uint32_t page_size;     // bdb page size
+    uint32_t cache_size;    // bdb cache size
+    uint64_t mem_size;      // size of the in-memory ring
+    int sync;               // flush every store to disk
+    uint64_t segment_size;  // file: segment size; sealed segments are 
+                            // compressed; 0 for one segment
+}db_config;
+
+// set the default options (bdb, 32 KB pages, 32 MB cache)
+void db_config_default(db_config*);
+
+// cfg may be NULL for the default options
+db* initialize_db(const char* db_name,db_config* cfg,uint32_t flag);
 
 void close_db(db*,uint32_t);
 
-int store_record(db*,size_t,void*);
+// idx is the log idx of the record; 0 means the record is not indexed
+int store_record(db*,uint64_t,size_t,void*);
+
+// store count records with one batch write; the records are not indexed;
+// if stored is not NULL, it is set to the number of records stored (the 
+// first ones), also on error, so that only the rest is retried
+int store_records(db*,uint32_t,void**,uint32_t*,uint32_t*);
 
 // the caller is responsible to release the memory
 
 void dump_records(db*,void*);
-uint32_t get_records_len();
+// copy the records with idx in [from_idx, to_idx) as [idx][size][data];
+// returns the length copied; last_idx is the idx up to which the range
+// is covered, or 0 if the records cannot be served
+uint32_t dump_records_from(db*,uint64_t,uint64_t,void*,uint32_t,uint64_t*);
+// like dump_records, but stop after the record with idx to_idx;
+// returns the length copied
+uint64_t dump_records_to(db*,uint64_t,void*);
+// copy the records from the position *pos up to the record with idx 
+// to_idx, at most max_len bytes; *pos is advanced and len is the length 
+// copied; returns 1 if more records follow, 0 when done, -1 on error
+int dump_records_chunk(db*,uint64_t,uint64_t*,void*,uint32_t,uint32_t*);
+
+// compact the stored records (file: compress all the segments);
+// returns 1 if the backend does not support it
+int compact_db(db*);
+
+// length of all the records, i.e., the size of a dump
+uint64_t get_records_len(db*);
+uint64_t get_records_count(db*);
+// idx of the last indexed record; 0 if none
+uint64_t get_last_idx(db*);
+const char* get_db_backend(db*);
 #endif
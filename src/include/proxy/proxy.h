@@ -48,12 +48,37 @@ typedef struct proxy_node_t{
 	
     // log option
     int req_log;
+    // number of threads replaying a snapshot
+    int recovery_threads;
 
 	FILE* req_log_file;
 	char* db_name;
+	db_config db_cfg;
 	db* db_ptr;
 }proxy_node;
 
+#define REPLAY_MAX_THREADS 16
+#define REPLAY_IOV_MAX 64
+#define REPLAY_PROGRESS_PERIOD 100000 /* us */
+
+struct proxy_msg_header_t;
+typedef struct replay_wait_t{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;            // workers not done yet
+}replay_wait;
+
+typedef struct replay_shard_t{
+    proxy_node* proxy;
+    replay_wait* wait;
+    struct proxy_msg_header_t** records; // records of this shard, in log order
+    uint32_t count;
+    uint32_t cap;
+    socket_pair* hash_map;  // connections opened while replaying
+    uint64_t done;          // records replayed so far
+    pthread_t tid;
+}replay_shard;
+
 typedef struct proxy_msg_header_t{
     uint16_t connection_id;
     uint8_t action;
@@ -69,8 +94,8 @@ struct fake_dare_cid_t {
     uint64_t epoch;
     uint8_t size[2];
     uint8_t state;
-    uint8_t pad[1];
-    uint32_t bitmask;
+    uint8_t pad[5];
+    uint64_t bitmask;
 };
 typedef struct fake_dare_cid_t fake_dare_cid_t;
 
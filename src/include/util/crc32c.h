@@ -0,0 +1,15 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC32C (Castagnoli); uses the SSE4.2 crc32 instruction when available
+
+// extend crc (a previous result, or 0) with len bytes of buf
+uint32_t crc32c_extend(uint32_t crc,const void* buf,size_t len);
+
+#define crc32c(buf,len) crc32c_extend(0,(buf),(len))
+
+// 1 if the hardware instruction is used
+int crc32c_hw_enabled();
+#endif
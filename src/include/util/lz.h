@@ -0,0 +1,15 @@
+#ifndef LZ_H
+#define LZ_H
+#include <stdint.h>
+
+// LZ block codec (LZ4 block format); used for the sealed segments of
+// the stable storage
+
+// compress len bytes of src into dst (at most cap bytes); returns the
+// compressed length, or 0 if it does not fit
+uint32_t lz_compress(const void* src,uint32_t len,void* dst,uint32_t cap);
+
+// decompress len bytes of src into exactly dst_len bytes of dst;
+// returns 0 on success, 1 if the input is malformed
+int lz_decompress(const void* src,uint32_t len,void* dst,uint32_t dst_len);
+#endif
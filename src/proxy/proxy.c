@@ -1,20 +1,33 @@
 #include "../include/proxy/proxy.h"
 #include "../include/config-comp/config-proxy.h"
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include "../include/dare/dare_server.h"
 #include "../include/dare/message.h"
 #define __STDC_FORMAT_MACROS
 
-static void stablestorage_save_request(void* data,void*arg);
-static void stablestorage_dump_records(void*buf,void*arg);
-static uint32_t stablestorage_get_records_len(void*arg);
-static int stablestorage_load_records(void*buf,uint32_t size,void*arg);
+static void stablestorage_save_request(uint64_t idx,void* data,void*arg);
+static int stablestorage_dump_chunk(uint64_t to_idx,uint64_t*pos,void*buf,uint32_t max_len,uint32_t*len,void*arg);
+static uint64_t stablestorage_get_records_len(void*arg);
+static int stablestorage_load_records(void*buf,uint64_t size,void*arg);
+static uint64_t stablestorage_get_last_idx(void*arg);
+static int stablestorage_replay_local(uint64_t to_idx,void*arg);
+static int parse_records(void*buf,uint64_t size,void***records,uint32_t**sizes,uint32_t*count);
+static int replay_records(proxy_node* proxy,void** records,uint32_t count,uint64_t size);
+static uint32_t stablestorage_get_records(uint64_t from_idx,uint64_t to_idx,void*buf,uint32_t max_len,uint64_t*last_idx,void*arg);
+static int stablestorage_apply_records(void*buf,uint32_t size,void*arg);
+static uint32_t apply_record(uint64_t idx,proxy_msg_header* header,void*arg);
 static void update_highest_rec(void*arg);
 static void do_action_to_server(uint16_t clt_id,uint8_t type,size_t data_size,void* data,void *arg);
 static void do_action_send(uint16_t clt_id,size_t data_size,void* data,void* arg);
 static void do_action_connect(uint16_t clt_id,void* arg);
 static void do_action_close(uint16_t clt_id,void* arg);
+static void open_connection(proxy_node* proxy,socket_pair** hash_map,uint16_t clt_id);
+static void close_connection(socket_pair** hash_map,uint16_t clt_id);
+static void* replay_shard_worker(void* arg);
+static void replay_send(socket_pair* hash_map,uint16_t clt_id,struct iovec* iov,int iovcnt);
 static int set_socket_blocking(int fd, int blocking);
 
 FILE *log_fp;
@@ -41,9 +54,13 @@ int dare_main(proxy_node* proxy, const char* config_path)
     input->do_action = do_action_to_server;
     input->store_cmd = stablestorage_save_request;
     input->get_db_size = stablestorage_get_records_len;
-    input->create_db_snapshot = stablestorage_dump_records;
+    input->get_db_chunk = stablestorage_dump_chunk;
     input->apply_db_snapshot = stablestorage_load_records;
     input->update_state = update_highest_rec;
+    input->get_db_records = stablestorage_get_records;
+    input->apply_db_records = stablestorage_apply_records;
+    input->get_db_last_idx = stablestorage_get_last_idx;
+    input->replay_db = stablestorage_replay_local;
     memcpy(input->config_path, config_path, strlen(config_path));
     input->up_para = proxy;
     static int srv_type = SRV_TYPE_START;
@@ -57,6 +74,11 @@ int dare_main(proxy_node* proxy, const char* config_path)
     char *dare_log_file = getenv("dare_log_file");
     if (dare_log_file == NULL)
         dare_log_file = "";
+    /* File backing the log region; a restarted server recovers 
+    from it locally (see init_log_region) */
+    char *dare_log_region = getenv("dare_log_region");
+    if (dare_log_region != NULL)
+        strncpy(input->log_region, dare_log_region, sizeof(input->log_region) - 1);
 
     input->srv_type = srv_type;
 
@@ -146,17 +168,31 @@ static void leader_handle_submit_req(uint8_t type, ssize_t data_size, void* buf,
             break;
     }
 
-    tailq_entry_t* n2 = (tailq_entry_t*)malloc(sizeof(tailq_entry_t));
-    n2->req_id = req_id;
-    n2->connection_id = connection_id;
-    n2->type = type;
-    n2->cmd.len = data_size;
-    if (data_size)
-        memcpy(n2->cmd.cmd, buf, data_size);
-    TAILQ_INSERT_TAIL(&tailhead, n2, entries);
+    /* Append the request directly into the log; the tailq keeps the 
+    requests that do not fit (or that come while not leader) and the 
+    requests after them, so that the order is kept */
+    dare_log_entry_t* entry = NULL;
+    uint64_t prev_end;
+    if (TAILQ_EMPTY(&tailhead))
+        entry = dare_reserve_request(req_id, connection_id, type, data_size, &prev_end);
+    if (NULL == entry) {
+        tailq_entry_t* n2 = (tailq_entry_t*)malloc(sizeof(tailq_entry_t));
+        n2->req_id = req_id;
+        n2->connection_id = connection_id;
+        n2->type = type;
+        n2->cmd.len = data_size;
+        if (data_size)
+            memcpy(n2->cmd.cmd, buf, data_size);
+        TAILQ_INSERT_TAIL(&tailhead, n2, entries);
+    }
 
     pthread_spin_unlock(&tailq_lock);
 
+    if (NULL != entry)
+        dare_publish_request(entry, buf, prev_end);
+    /* The DARE thread may sleep (idle mode) */
+    dare_kick();
+
     while (cur_rec > proxy->highest_rec);
 }
 
@@ -266,78 +302,417 @@ static void update_highest_rec(void*arg)
     proxy->highest_rec++;   
 }
 
-static void stablestorage_save_request(void* data,void*arg)
+static void stablestorage_save_request(uint64_t idx,void* data,void*arg)
 {
     proxy_node* proxy = arg;
     proxy_msg_header* header = (proxy_msg_header*)data;
     switch(header->action){
         case CONNECT:
         {
-            store_record(proxy->db_ptr,PROXY_CONNECT_MSG_SIZE,data);
+            store_record(proxy->db_ptr,idx,PROXY_CONNECT_MSG_SIZE,data);
             break;
         }
         case SEND:
         {
             proxy_send_msg* send_msg = (proxy_send_msg*)data;
-            store_record(proxy->db_ptr,PROXY_SEND_MSG_SIZE(send_msg),data);
+            store_record(proxy->db_ptr,idx,PROXY_SEND_MSG_SIZE(send_msg),data);
             break;
         }
         case CLOSE:
         {
-            store_record(proxy->db_ptr,PROXY_CLOSE_MSG_SIZE,data);
+            store_record(proxy->db_ptr,idx,PROXY_CLOSE_MSG_SIZE,data);
             break;
         }
     }
 }
 
-static uint32_t stablestorage_get_records_len(void*arg)
+static uint64_t stablestorage_get_records_len(void*arg)
 {
     proxy_node* proxy = arg;
-    uint32_t records_len = get_records_len(proxy->db_ptr);
+    uint64_t records_len = get_records_len(proxy->db_ptr);
     return records_len;
 }
 
-static void stablestorage_dump_records(void*buf,void*arg)
+/* called by the snapshot thread of DARE */
+static int stablestorage_dump_chunk(uint64_t to_idx,uint64_t*pos,void*buf,uint32_t max_len,uint32_t*len,void*arg)
 {
     proxy_node* proxy = arg;
-    dump_records(proxy->db_ptr,buf);
+    return dump_records_chunk(proxy->db_ptr,to_idx,pos,buf,max_len,len);
 }
 
-static int stablestorage_load_records(void*buf,uint32_t size,void*arg)
+static uint32_t record_size(proxy_msg_header* header)
+{
+    switch(header->action){
+        case SEND:
+            return PROXY_SEND_MSG_SIZE(((proxy_send_msg*)header));
+        case CONNECT:
+            return PROXY_CONNECT_MSG_SIZE;
+        case CLOSE:
+            return PROXY_CLOSE_MSG_SIZE;
+    }
+    return 0;
+}
+
+/**
+ * Find the records in a dump
+ */
+static int parse_records(void*buf,uint64_t size,void***records,uint32_t**sizes,uint32_t*count)
 {
-    proxy_node* proxy = arg;
     proxy_msg_header* header;
-    uint32_t len = 0;
+    uint32_t cap = 0,rec_size;
+    uint64_t len = 0;
+
+    *records = NULL;
+    *sizes = NULL;
+    *count = 0;
     while(len < size) {
         header = (proxy_msg_header*)((char*)buf + len);
+        rec_size = record_size(header);
+        if(0 == rec_size){
+            err_log("PROXY : unknown record action %"PRIu8" in snapshot.\n",header->action);
+            return 1;
+        }
+        if(*count == cap){
+            cap = cap ? 2*cap : 1024;
+            *records = realloc(*records,cap*sizeof(void*));
+            *sizes = realloc(*sizes,cap*sizeof(uint32_t));
+            if(NULL == *records || NULL == *sizes){
+                err_log("PROXY : Cannot Malloc Memory For The Snapshot Records.\n");
+                return 1;
+            }
+        }
+        (*records)[*count] = header;
+        (*sizes)[*count] = rec_size;
+        (*count)++;
+        len += rec_size;
+    }
+    return 0;
+}
+
+/**
+ * Replay records in parallel, sharded by connection; the records of a 
+ * connection are replayed in order by a single thread
+ */
+static int replay_records(proxy_node* proxy,void** records,uint32_t count,uint64_t size)
+{
+    replay_shard shards[REPLAY_MAX_THREADS];
+    replay_wait wait;
+    uint32_t i;
+    int nthreads,ret = 0;
+    uint64_t done;
+    struct timeval start,now;
+    struct timespec deadline;
+
+    gettimeofday(&start,0);
+
+    /* Shard the records by connection */
+    nthreads = proxy->recovery_threads;
+    if(nthreads < 1) nthreads = 1;
+    if(nthreads > REPLAY_MAX_THREADS) nthreads = REPLAY_MAX_THREADS;
+    memset(shards,0,sizeof(shards));
+    for(i = 0; i < count; i++){
+        replay_shard* shard = &shards[((proxy_msg_header*)records[i])->connection_id % nthreads];
+        if(shard->count == shard->cap){
+            shard->cap = shard->cap ? 2*shard->cap : 1024;
+            shard->records = realloc(shard->records,shard->cap*sizeof(proxy_msg_header*));
+            if(NULL == shard->records){
+                err_log("PROXY : Cannot Malloc Memory For The Replay Shards.\n");
+                ret = 1;
+                goto replay_records_exit;
+            }
+        }
+        shard->records[shard->count++] = records[i];
+    }
+
+    /* Replay; the workers signal when they are done, and the progress 
+    is reported every REPLAY_PROGRESS_PERIOD meanwhile */
+    pthread_mutex_init(&wait.lock,NULL);
+    pthread_cond_init(&wait.cond,NULL);
+    wait.running = 0;
+    for(i = 0; i < (uint32_t)nthreads; i++){
+        shards[i].proxy = proxy;
+        shards[i].wait = &wait;
+        pthread_mutex_lock(&wait.lock);
+        wait.running++;
+        pthread_mutex_unlock(&wait.lock);
+        if(pthread_create(&shards[i].tid,NULL,replay_shard_worker,&shards[i]) != 0){
+            /* Replay this shard in the current thread */
+            replay_shard_worker(&shards[i]);
+            shards[i].tid = 0;
+        }
+    }
+    pthread_mutex_lock(&wait.lock);
+    while(wait.running > 0){
+        clock_gettime(CLOCK_REALTIME,&deadline);
+        deadline.tv_nsec += REPLAY_PROGRESS_PERIOD * 1000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        if(pthread_cond_timedwait(&wait.cond,&wait.lock,&deadline) != ETIMEDOUT){
+            continue;
+        }
+        done = 0;
+        for(i = 0; i < (uint32_t)nthreads; i++){
+            done += __sync_fetch_and_add(&shards[i].done,0);
+        }
+        debug_log("PROXY : replayed %"PRIu64"/%"PRIu32" records.\n",done,count);
+    }
+    pthread_mutex_unlock(&wait.lock);
+    pthread_cond_destroy(&wait.cond);
+    pthread_mutex_destroy(&wait.lock);
+    for(i = 0; i < (uint32_t)nthreads; i++){
+        if(shards[i].tid){
+            pthread_join(shards[i].tid,NULL);
+        }
+    }
+
+    /* Hand over the connections */
+    for(i = 0; i < (uint32_t)nthreads; i++){
+        socket_pair *pair,*tmp,*old;
+        HASH_ITER(hh,shards[i].hash_map,pair,tmp){
+            HASH_DEL(shards[i].hash_map,pair);
+            HASH_FIND(hh,proxy->follower_hash_map,&pair->connection_id,sizeof(uint16_t),old);
+            if(NULL != old){
+                close_connection(&proxy->follower_hash_map,pair->connection_id);
+            }
+            HASH_ADD(hh,proxy->follower_hash_map,connection_id,sizeof(uint16_t),pair);
+        }
+    }
+
+    gettimeofday(&now,0);
+    double secs = (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+    debug_log("PROXY : recovered %"PRIu32" records (%"PRIu64" bytes) with %d threads in %.3lf s: %.0lf records/s.\n",
+            count,size,nthreads,secs,secs > 0 ? count / secs : 0.);
+
+replay_records_exit:
+    for(i = 0; i < REPLAY_MAX_THREADS; i++){
+        if(NULL != shards[i].records){
+            free(shards[i].records);
+        }
+    }
+    return ret;
+}
+
+/**
+ * Load a snapshot: the records are stored with one batch write and 
+ * then replayed
+ */
+static int stablestorage_load_records(void*buf,uint64_t size,void*arg)
+{
+    proxy_node* proxy = arg;
+    void** records = NULL;
+    uint32_t* sizes = NULL;
+    uint32_t i,count = 0,stored = 0;
+    int ret = 0;
+
+    if(parse_records(buf,size,&records,&sizes,&count) != 0){
+        ret = 1;
+        goto load_records_exit;
+    }
+
+    /* Bulk import into the store; after a failure, only the records 
+    that were not stored are stored one by one */
+    if(store_records(proxy->db_ptr,count,records,sizes,&stored) != 0){
+        err_log("PROXY : bulk import failed after %"PRIu32"/%"PRIu32" records; storing the rest one by one.\n",stored,count);
+        for(i = stored; i < count; i++){
+            if(store_record(proxy->db_ptr,0,sizes[i],records[i]) != 0){
+                err_log("PROXY : cannot store snapshot record %"PRIu32".\n",i);
+                ret = 1;
+                goto load_records_exit;
+            }
+        }
+    }
+
+    ret = replay_records(proxy,records,count,size);
+
+load_records_exit:
+    if(NULL != records) free(records);
+    if(NULL != sizes) free(sizes);
+    return ret;
+}
+
+static uint64_t stablestorage_get_last_idx(void*arg)
+{
+    proxy_node* proxy = arg;
+    return get_last_idx(proxy->db_ptr);
+}
+
+/**
+ * Restart from the local stable storage: replay the records stored up 
+ * to to_idx; nothing is stored, since the records are already there
+ */
+static int stablestorage_replay_local(uint64_t to_idx,void*arg)
+{
+    proxy_node* proxy = arg;
+    void** records = NULL;
+    uint32_t* sizes = NULL;
+    uint32_t count = 0;
+    uint64_t size;
+    void* buf;
+    int ret = 0;
+
+    buf = malloc(get_records_len(proxy->db_ptr) + 1);
+    if(NULL == buf){
+        err_log("PROXY : Cannot Malloc Memory For The Local Records.\n");
+        return 1;
+    }
+    size = dump_records_to(proxy->db_ptr,to_idx,buf);
+    if(parse_records(buf,size,&records,&sizes,&count) != 0){
+        ret = 1;
+        goto replay_local_exit;
+    }
+    ret = replay_records(proxy,records,count,size);
+
+replay_local_exit:
+    if(NULL != records) free(records);
+    if(NULL != sizes) free(sizes);
+    free(buf);
+    return ret;
+}
+
+static void* replay_shard_worker(void* arg)
+{
+    replay_shard* shard = arg;
+    proxy_msg_header* header;
+    proxy_send_msg* send_msg;
+    struct iovec iov[REPLAY_IOV_MAX];
+    uint32_t i = 0;
+    uint16_t clt_id;
+    int iovcnt;
+
+    while(i < shard->count){
+        header = shard->records[i];
+        clt_id = header->connection_id;
         switch(header->action){
             case SEND:
             {
-                proxy_send_msg* send_msg = (proxy_send_msg*)header;
-                len += PROXY_SEND_MSG_SIZE(send_msg);
-                store_record(proxy->db_ptr,PROXY_SEND_MSG_SIZE(send_msg),header);
-                do_action_send(header->connection_id, send_msg->data.cmd.len, send_msg->data.cmd.cmd, arg);
+                /* Coalesce consecutive records of the same connection */
+                iovcnt = 0;
+                while(i < shard->count && iovcnt < REPLAY_IOV_MAX &&
+                        SEND == shard->records[i]->action &&
+                        clt_id == shard->records[i]->connection_id){
+                    send_msg = (proxy_send_msg*)shard->records[i];
+                    iov[iovcnt].iov_base = send_msg->data.cmd.cmd;
+                    iov[iovcnt].iov_len = send_msg->data.cmd.len;
+                    iovcnt++;
+                    i++;
+                }
+                replay_send(shard->hash_map,clt_id,iov,iovcnt);
                 break;
             }
             case CONNECT:
-            {
-                len += PROXY_CONNECT_MSG_SIZE;
-                store_record(proxy->db_ptr,PROXY_CONNECT_MSG_SIZE,header);
-                do_action_connect(header->connection_id, arg);
+                open_connection(shard->proxy,&shard->hash_map,clt_id);
+                i++;
                 break;
-            }
             case CLOSE:
-            {
-                len += PROXY_CLOSE_MSG_SIZE;
-                store_record(proxy->db_ptr,PROXY_CLOSE_MSG_SIZE,header);
-                do_action_close(header->connection_id, arg);
+                close_connection(&shard->hash_map,clt_id);
+                i++;
                 break;
+        }
+        __sync_lock_test_and_set(&shard->done,i);
+    }
+    pthread_mutex_lock(&shard->wait->lock);
+    shard->wait->running--;
+    pthread_cond_signal(&shard->wait->cond);
+    pthread_mutex_unlock(&shard->wait->lock);
+    return NULL;
+}
+
+static void replay_send(socket_pair* hash_map,uint16_t clt_id,struct iovec* iov,int iovcnt)
+{
+    socket_pair* ret;
+    struct pollfd pfd;
+    char discard[4096];
+    ssize_t n;
+
+    HASH_FIND(hh, hash_map, &clt_id, sizeof(uint16_t), ret);
+    if(NULL==ret){
+        return;
+    }
+    while(iovcnt > 0){
+        n = writev(ret->p_s, iov, iovcnt);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                fprintf(stderr, "ERROR writing to socket!\n");
+                return;
             }
+            /* Nobody reads the replies on a replica; drain them so 
+            that the server keeps reading the requests */
+            pfd.fd = ret->p_s;
+            pfd.events = POLLIN | POLLOUT;
+            if(poll(&pfd, 1, 100) > 0 && (pfd.revents & POLLIN)){
+                while(read(ret->p_s, discard, sizeof(discard)) > 0);
+            }
+            continue;
+        }
+        /* Skip what was written */
+        while(iovcnt > 0 && (size_t)n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static uint32_t stablestorage_get_records(uint64_t from_idx,uint64_t to_idx,void*buf,uint32_t max_len,uint64_t*last_idx,void*arg)
+{
+    proxy_node* proxy = arg;
+    return dump_records_from(proxy->db_ptr,from_idx,to_idx,buf,max_len,last_idx);
+}
+
+static int stablestorage_apply_records(void*buf,uint32_t size,void*arg)
+{
+    uint64_t idx;
+    uint32_t rec_size,len = 0;
+    while(len < size) {
+        memcpy(&idx,(char*)buf + len,sizeof(uint64_t));
+        memcpy(&rec_size,(char*)buf + len + sizeof(uint64_t),sizeof(uint32_t));
+        len += sizeof(uint64_t) + sizeof(uint32_t);
+        if(apply_record(idx,(proxy_msg_header*)((char*)buf + len),arg) != rec_size){
+            err_log("PROXY : malformed catch-up record %"PRIu64".\n",idx);
+            return 1;
         }
+        len += rec_size;
     }
     return 0;
 }
 
+static uint32_t apply_record(uint64_t idx,proxy_msg_header* header,void*arg)
+{
+    proxy_node* proxy = arg;
+    uint32_t len = 0;
+    switch(header->action){
+        case SEND:
+        {
+            proxy_send_msg* send_msg = (proxy_send_msg*)header;
+            len = PROXY_SEND_MSG_SIZE(send_msg);
+            store_record(proxy->db_ptr,idx,len,header);
+            do_action_send(header->connection_id, send_msg->data.cmd.len, send_msg->data.cmd.cmd, arg);
+            break;
+        }
+        case CONNECT:
+        {
+            len = PROXY_CONNECT_MSG_SIZE;
+            store_record(proxy->db_ptr,idx,len,header);
+            do_action_connect(header->connection_id, arg);
+            break;
+        }
+        case CLOSE:
+        {
+            len = PROXY_CLOSE_MSG_SIZE;
+            store_record(proxy->db_ptr,idx,len,header);
+            do_action_close(header->connection_id, arg);
+            break;
+        }
+    }
+    return len;
+}
+
 static void do_action_to_server(uint16_t clt_id,uint8_t type,size_t data_size,void* data,void*arg)
 {
     proxy_node* proxy = arg;
@@ -373,9 +748,13 @@ static void do_action_to_server(uint16_t clt_id,uint8_t type,size_t data_size,vo
 static void do_action_connect(uint16_t clt_id,void* arg)
 {
     proxy_node* proxy = arg;
+    open_connection(proxy,&proxy->follower_hash_map,clt_id);
+}
 
+static void open_connection(proxy_node* proxy,socket_pair** hash_map,uint16_t clt_id)
+{
     socket_pair* ret;
-    HASH_FIND(hh, proxy->follower_hash_map, &clt_id, sizeof(uint16_t), ret);
+    HASH_FIND(hh, *hash_map, &clt_id, sizeof(uint16_t), ret);
     if (NULL == ret)
     {
         ret = malloc(sizeof(socket_pair));
@@ -386,10 +765,11 @@ static void do_action_connect(uint16_t clt_id,void* arg)
         if (sockfd < 0)
         {
             fprintf(stderr, "ERROR opening socket!\n");
-            goto do_action_connect_exit;
+            free(ret);
+            goto open_connection_exit;
         }
         ret->p_s = sockfd;
-        HASH_ADD(hh, proxy->follower_hash_map, connection_id, sizeof(uint16_t), ret);
+        HASH_ADD(hh, *hash_map, connection_id, sizeof(uint16_t), ret);
 
         if (connect(ret->p_s, (struct sockaddr*)&proxy->sys_addr.s_addr, proxy->sys_addr.s_sock_len) < 0)
             fprintf(stderr, "ERROR connecting!\n");
@@ -401,7 +781,7 @@ static void do_action_connect(uint16_t clt_id,void* arg)
             fprintf(stderr, "TCP_NODELAY SETTING ERROR!\n");
     }
 
-do_action_connect_exit:
+open_connection_exit:
 	return;
 }
 
@@ -425,16 +805,22 @@ do_action_send_exit:
 static void do_action_close(uint16_t clt_id,void* arg)
 {
 	proxy_node* proxy = arg;
+	close_connection(&proxy->follower_hash_map,clt_id);
+}
+
+static void close_connection(socket_pair** hash_map,uint16_t clt_id)
+{
 	socket_pair* ret;
-	HASH_FIND(hh, proxy->follower_hash_map, &clt_id, sizeof(uint16_t), ret);
+	HASH_FIND(hh, *hash_map, &clt_id, sizeof(uint16_t), ret);
 	if(NULL==ret){
-		goto do_action_close_exit;
+		goto close_connection_exit;
 	}else{
 		if (close(ret->p_s))
 			fprintf(stderr, "ERROR closing socket!\n");
-		HASH_DEL(proxy->follower_hash_map, ret);
+		HASH_DEL(*hash_map, ret);
+		free(ret);
 	}
-do_action_close_exit:
+close_connection_exit:
 	return;
 }
 
@@ -486,7 +872,7 @@ proxy_node* proxy_init(const char* config_path,const char* proxy_log_path)
     TAILQ_INIT(&tailhead);
     LIST_INIT(&listhead);
 
-    proxy->db_ptr = initialize_db(proxy->db_name,0);
+    proxy->db_ptr = initialize_db(proxy->db_name,&proxy->db_cfg,0);
 
     proxy->follower_hash_map = NULL;
     proxy->leader_hash_map = NULL;
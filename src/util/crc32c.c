@@ -0,0 +1,113 @@
+#include "../include/util/crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78 /* reversed Castagnoli polynomial */
+
+typedef uint32_t (*crc32c_fn_t)(uint32_t,const uint8_t*,size_t);
+
+static uint32_t crc32c_table[8][256];
+static int crc32c_hw = 0;
+static uint32_t crc32c_first(uint32_t crc,const uint8_t* p,size_t len);
+/* the implementation, picked once at load time (see crc32c_init) */
+static crc32c_fn_t crc32c_fn = crc32c_first;
+
+static uint32_t crc32c_sw(uint32_t crc,const uint8_t* p,size_t len);
+#if defined(__x86_64__)
+static uint32_t crc32c_sse42(uint32_t crc,const uint8_t* p,size_t len);
+#endif
+
+__attribute__((constructor))
+static void crc32c_init(){
+    uint32_t i,j,crc;
+    for(i=0;i<256;i++){
+        crc = i;
+        for(j=0;j<8;j++){
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for(i=0;i<256;i++){
+        crc = crc32c_table[0][i];
+        for(j=1;j<8;j++){
+            crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+            crc32c_table[j][i] = crc;
+        }
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    crc32c_hw = (0 != __builtin_cpu_supports("sse4.2"));
+    if(crc32c_hw){
+        crc32c_fn = crc32c_sse42;
+        return;
+    }
+#endif
+    crc32c_fn = crc32c_sw;
+}
+
+/* only for calls from other constructors that run before crc32c_init */
+static uint32_t crc32c_first(uint32_t crc,const uint8_t* p,size_t len){
+    crc32c_init();
+    return crc32c_fn(crc,p,len);
+}
+
+/* Slicing-by-8 fallback */
+static uint32_t crc32c_sw(uint32_t crc,const uint8_t* p,size_t len){
+    uint64_t word;
+    while(len && ((uintptr_t)p & 7)){
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    while(len >= 8){
+        word = *(const uint64_t*)p ^ crc;
+        crc = crc32c_table[7][word & 0xFF] ^
+              crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^
+              crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^
+              crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^
+              crc32c_table[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while(len--){
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc,const uint8_t* p,size_t len){
+    uint64_t crc64;
+    while(len && ((uintptr_t)p & 7)){
+        crc = _mm_crc32_u8(crc,*p++);
+        len--;
+    }
+    crc64 = crc;
+    while(len >= 8){
+        crc64 = _mm_crc32_u64(crc64,*(const uint64_t*)p);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while(len--){
+        crc = _mm_crc32_u8(crc,*p++);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c_extend(uint32_t crc,const void* buf,size_t len){
+    return ~crc32c_fn(~crc,(const uint8_t*)buf,len);
+}
+
+int crc32c_hw_enabled(){
+    if(crc32c_fn == crc32c_first){
+        crc32c_init();
+    }
+    return crc32c_hw;
+}
@@ -0,0 +1,178 @@
+#include <string.h>
+#include "../include/util/lz.h"
+
+/* A sequence is [token][literal length][literals][offset][match length]:
+the token holds 4 bits of each length (15 means more bytes follow, each
+255 means more again), the offset is 16 bits little-endian and the
+match length is stored minus LZ_MIN_MATCH. The last sequence only has
+literals; a match cannot start in the last LZ_MFLIMIT bytes, nor end in
+the last LZ_LAST_LITERALS bytes */
+
+#define LZ_HASH_LOG 12
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MFLIMIT 12
+#define LZ_MAX_DIST 65535
+
+static inline uint32_t lz_read32(const uint8_t* p){
+    uint32_t v;
+    memcpy(&v,p,sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v){
+    return (v * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+/* Write a length that does not fit in the token */
+static inline uint8_t* lz_write_len(uint8_t* op,uint32_t len){
+    while(len >= 255){
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+uint32_t lz_compress(const void* src,uint32_t len,void* dst,uint32_t cap){
+    const uint8_t* base = src;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    const uint8_t* iend = base + len;
+    const uint8_t* mflimit = iend - LZ_MFLIMIT;
+    const uint8_t* matchlimit = iend - LZ_LAST_LITERALS;
+    uint8_t* op = dst;
+    uint8_t* oend = op + cap;
+    uint8_t* token;
+    uint32_t table[1<<LZ_HASH_LOG];
+    uint32_t lit,mlen,h,seq;
+    const uint8_t *ref,*m,*r;
+
+    memset(table,0,sizeof(table));
+    if(len > LZ_MFLIMIT){
+        ip++;
+        while(ip < mflimit){
+            seq = lz_read32(ip);
+            h = lz_hash(seq);
+            ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+            if((ip - ref > LZ_MAX_DIST) || (lz_read32(ref) != seq)){
+                ip++;
+                continue;
+            }
+            /* Extend the match backwards and forwards */
+            while((ip > anchor) && (ref > base) && (ip[-1] == ref[-1])){
+                ip--;
+                ref--;
+            }
+            m = ip + LZ_MIN_MATCH;
+            r = ref + LZ_MIN_MATCH;
+            while((m < matchlimit) && (*m == *r)){
+                m++;
+                r++;
+            }
+            lit = (uint32_t)(ip - anchor);
+            mlen = (uint32_t)(m - ip) - LZ_MIN_MATCH;
+            if(op + 1 + lit/255 + 1 + lit + 2 + mlen/255 + 1 > oend){
+                return 0;
+            }
+            token = op++;
+            if(lit >= 15){
+                *token = 15 << 4;
+                op = lz_write_len(op,lit - 15);
+            }else{
+                *token = (uint8_t)(lit << 4);
+            }
+            memcpy(op,anchor,lit);
+            op += lit;
+            *op++ = (uint8_t)(ip - ref);
+            *op++ = (uint8_t)((ip - ref) >> 8);
+            if(mlen >= 15){
+                *token |= 15;
+                op = lz_write_len(op,mlen - 15);
+            }else{
+                *token |= (uint8_t)mlen;
+            }
+            ip = m;
+            anchor = ip;
+        }
+    }
+
+    /* Last literals */
+    lit = (uint32_t)(iend - anchor);
+    if(op + 1 + lit/255 + 1 + lit > oend){
+        return 0;
+    }
+    token = op++;
+    if(lit >= 15){
+        *token = 15 << 4;
+        op = lz_write_len(op,lit - 15);
+    }else{
+        *token = (uint8_t)(lit << 4);
+    }
+    memcpy(op,anchor,lit);
+    op += lit;
+    return (uint32_t)(op - (uint8_t*)dst);
+}
+
+int lz_decompress(const void* src,uint32_t len,void* dst,uint32_t dst_len){
+    const uint8_t* ip = src;
+    const uint8_t* iend = ip + len;
+    uint8_t* op = dst;
+    uint8_t* oend = op + dst_len;
+    const uint8_t* ref;
+    uint32_t lit,mlen,off;
+    uint8_t token,b;
+
+    while(ip < iend){
+        token = *ip++;
+        lit = token >> 4;
+        if(15 == lit){
+            do{
+                if(ip >= iend) return 1;
+                b = *ip++;
+                lit += b;
+            }while(255 == b);
+        }
+        if((lit > (uint32_t)(iend - ip)) || (lit > (uint32_t)(oend - op))){
+            return 1;
+        }
+        memcpy(op,ip,lit);
+        op += lit;
+        ip += lit;
+        if(ip == iend){
+            /* The last sequence */
+            break;
+        }
+
+        if(iend - ip < 2) return 1;
+        off = ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        if((0 == off) || (off > (uint32_t)(op - (uint8_t*)dst))){
+            return 1;
+        }
+        mlen = token & 15;
+        if(15 == mlen){
+            do{
+                if(ip >= iend) return 1;
+                b = *ip++;
+                mlen += b;
+            }while(255 == b);
+        }
+        mlen += LZ_MIN_MATCH;
+        if(mlen > (uint32_t)(oend - op)){
+            return 1;
+        }
+        ref = op - off;
+        if(off >= mlen){
+            memcpy(op,ref,mlen);
+            op += mlen;
+        }else{
+            /* Overlapping match */
+            while(mlen--){
+                *op++ = *ref++;
+            }
+        }
+    }
+    return (op == oend) ? 0 : 1;
+}
@@ -1,9 +1,15 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
-../src/db/db-interface.c
+../src/db/db-interface.c \
+../src/db/db-bdb.c \
+../src/db/db-file.c \
+../src/db/db-mem.c
 
 OBJS += \
-./src/db/db-interface.o
+./src/db/db-interface.o \
+./src/db/db-bdb.o \
+./src/db/db-file.o \
+./src/db/db-mem.o
 
 
 # Each subdirectory must supply rules for building sources it contributes
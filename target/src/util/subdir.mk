@@ -0,0 +1,19 @@
+# Add inputs and outputs from these tool invocations to the build variables 
+C_SRCS += \
+../src/util/crc32c.c \
+../src/util/lz.c
+
+OBJS += \
+./src/util/crc32c.o \
+./src/util/lz.o
+
+
+# Each subdirectory must supply rules for building sources it contributes
+src/util/%.o: ../src/util/%.c
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C Compiler'
+	gcc -fPIC -rdynamic -std=gnu99 -DDEBUG=$(DEBUGOPT) -O2 -g3 -Wall -c -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+